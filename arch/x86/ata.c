@@ -0,0 +1,266 @@
+// arch/x86/ata.c
+//
+// Polled PIO driver for the drives on the primary ATA channel (LBA28).
+// Device interrupts are masked with nIEN and every command busy-waits on
+// the status register, so it can be used from the page fault handler.
+// The master is also a block device, /dev/hda. The slave is the swap
+// area, which kernel/core/swap.c reads and writes directly; it is not a
+// block device, so nothing can overwrite swap slots through it or keep
+// stale copies of them in the page cache.
+
+#include "kernel/ata.h"
+#include "kernel/blk.h"
+#include "kernel/console.h"
+#include "include/io.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* ------------------------------------------------------------------
+ * I/O ports / registers
+ * ------------------------------------------------------------------ */
+#define ATA_IO_BASE         0x1F0
+#define ATA_REG_DATA        (ATA_IO_BASE + 0)
+#define ATA_REG_SECCOUNT    (ATA_IO_BASE + 2)
+#define ATA_REG_LBA_LO      (ATA_IO_BASE + 3)
+#define ATA_REG_LBA_MID     (ATA_IO_BASE + 4)
+#define ATA_REG_LBA_HI      (ATA_IO_BASE + 5)
+#define ATA_REG_DRIVE       (ATA_IO_BASE + 6)
+#define ATA_REG_STATUS      (ATA_IO_BASE + 7)
+#define ATA_REG_COMMAND     (ATA_IO_BASE + 7)
+#define ATA_REG_CONTROL     0x3F6   /* reads return the alternate status */
+
+#define ATA_SR_BSY          0x80
+#define ATA_SR_DF           0x20
+#define ATA_SR_DRQ          0x08
+#define ATA_SR_ERR          0x01
+
+#define ATA_CTRL_NIEN       0x02
+
+#define ATA_CMD_READ        0x20
+#define ATA_CMD_WRITE       0x30
+#define ATA_CMD_FLUSH       0xE7
+#define ATA_CMD_IDENTIFY    0xEC
+
+/* IDENTIFY words 60-61: number of LBA28 sectors */
+#define ATA_ID_LBA28_SECTORS 60
+
+#define ATA_WORDS_PER_SECTOR (ATA_SECTOR_SIZE / 2)
+#define ATA_SECTORS_PER_PAGE (4096 / ATA_SECTOR_SIZE)
+
+/* A sector count of 0 means 256 */
+#define ATA_MAX_SECTORS     256
+#define ATA_MAX_PAGES       (ATA_MAX_SECTORS / ATA_SECTORS_PER_PAGE)
+
+#define ATA_POLL_LIMIT      10000000
+
+static uint32_t ata_sectors[ATA_DRIVE_CNT];
+
+/* ------------------------------------------------------------------
+ * Helpers
+ * ------------------------------------------------------------------ */
+
+/* Each read of the alternate status takes ~100ns; the drive needs 400ns */
+static void ata_delay(void)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        (void) inb(ATA_REG_CONTROL);
+    }
+}
+
+/* Wait until BSY is clear and (status & mask) == mask; -1 on error or timeout */
+static int ata_wait(uint8_t mask)
+{
+    for (uint32_t i = 0; i < ATA_POLL_LIMIT; i++)
+    {
+        uint8_t status = inb(ATA_REG_STATUS);
+        if (status & ATA_SR_BSY)
+        {
+            continue;
+        }
+        if (status & (ATA_SR_ERR | ATA_SR_DF))
+        {
+            return -1;
+        }
+        if ((status & mask) == mask)
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void ata_select(uint32_t drive, uint32_t lba)
+{
+    outb(ATA_REG_DRIVE, (uint8_t) (0xE0 | (drive << 4) | ((lba >> 24) & 0x0F)));
+    ata_delay();
+}
+
+static uint32_t ata_identify(uint32_t drive)
+{
+    outb(ATA_REG_DRIVE, (uint8_t) (0xA0 | (drive << 4)));
+    ata_delay();
+
+    outb(ATA_REG_SECCOUNT, 0);
+    outb(ATA_REG_LBA_LO, 0);
+    outb(ATA_REG_LBA_MID, 0);
+    outb(ATA_REG_LBA_HI, 0);
+    outb(ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+    ata_delay();
+
+    uint8_t status = inb(ATA_REG_STATUS);
+    if (status == 0 || status == 0xFF)
+    {
+        /* No drive / floating bus */
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < ATA_POLL_LIMIT && (inb(ATA_REG_STATUS) & ATA_SR_BSY); i++)
+    {
+    }
+
+    /* ATAPI and SATA devices identify themselves through the LBA registers */
+    if (inb(ATA_REG_LBA_MID) != 0 || inb(ATA_REG_LBA_HI) != 0)
+    {
+        return 0;
+    }
+
+    if (ata_wait(ATA_SR_DRQ) < 0)
+    {
+        return 0;
+    }
+
+    uint16_t id[ATA_WORDS_PER_SECTOR];
+    insw(ATA_REG_DATA, id, ATA_WORDS_PER_SECTOR);
+
+    return (uint32_t) id[ATA_ID_LBA28_SECTORS] |
+           ((uint32_t) id[ATA_ID_LBA28_SECTORS + 1] << 16);
+}
+
+/* One command for at most ATA_MAX_PAGES pages */
+static int ata_transfer(uint32_t drive, uint32_t lba, void *const *pages, uint32_t page_cnt, bool write)
+{
+    uint32_t sector_cnt = page_cnt * ATA_SECTORS_PER_PAGE;
+
+    if (ata_wait(0) < 0)
+    {
+        return -1;
+    }
+
+    ata_select(drive, lba);
+    outb(ATA_REG_SECCOUNT, (uint8_t) (sector_cnt & 0xFF));
+    outb(ATA_REG_LBA_LO, (uint8_t) lba);
+    outb(ATA_REG_LBA_MID, (uint8_t) (lba >> 8));
+    outb(ATA_REG_LBA_HI, (uint8_t) (lba >> 16));
+    outb(ATA_REG_COMMAND, write ? ATA_CMD_WRITE : ATA_CMD_READ);
+    ata_delay();
+
+    for (uint32_t s = 0; s < sector_cnt; s++)
+    {
+        if (ata_wait(ATA_SR_DRQ) < 0)
+        {
+            return -1;
+        }
+
+        uint8_t *buf = (uint8_t *) pages[s / ATA_SECTORS_PER_PAGE] +
+                       (s % ATA_SECTORS_PER_PAGE) * ATA_SECTOR_SIZE;
+        if (write)
+        {
+            outsw(ATA_REG_DATA, buf, ATA_WORDS_PER_SECTOR);
+        }
+        else
+        {
+            insw(ATA_REG_DATA, buf, ATA_WORDS_PER_SECTOR);
+        }
+        ata_delay();
+    }
+
+    return ata_wait(0);
+}
+
+static int ata_rw_pages(uint32_t drive, uint32_t lba, void *const *pages, uint32_t page_cnt, bool write)
+{
+    if (drive >= ATA_DRIVE_CNT ||
+        lba + page_cnt * ATA_SECTORS_PER_PAGE > ata_sectors[drive])
+    {
+        return -1;
+    }
+
+    while (page_cnt > 0)
+    {
+        uint32_t cnt = page_cnt < ATA_MAX_PAGES ? page_cnt : ATA_MAX_PAGES;
+        if (ata_transfer(drive, lba, pages, cnt, write) < 0)
+        {
+            return -1;
+        }
+
+        lba += cnt * ATA_SECTORS_PER_PAGE;
+        pages += cnt;
+        page_cnt -= cnt;
+    }
+
+    if (write)
+    {
+        ata_select(drive, 0);
+        outb(ATA_REG_COMMAND, ATA_CMD_FLUSH);
+        ata_delay();
+        return ata_wait(0);
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------
+ * Block device
+ * ------------------------------------------------------------------ */
+
+static int ata_blk_transfer(struct blk_dev *dev, uint32_t block, void *const *pages, uint32_t cnt, bool write)
+{
+    uint32_t drive = (uint32_t) (uintptr_t) blk_driver_data(dev);
+    return ata_rw_pages(drive, block * ATA_SECTORS_PER_PAGE, pages, cnt, write);
+}
+
+static const struct blk_ops ata_blk_ops = {
+        .transfer = ata_blk_transfer,
+};
+
+/* ------------------------------------------------------------------
+ * Public API
+ * ------------------------------------------------------------------ */
+
+void ata_init(void)
+{
+    outb(ATA_REG_CONTROL, ATA_CTRL_NIEN);
+
+    for (uint32_t drive = 0; drive < ATA_DRIVE_CNT; drive++)
+    {
+        ata_sectors[drive] = ata_identify(drive);
+        if (ata_sectors[drive] != 0)
+        {
+            kprintf("ATA: drive %u, %u sectors\n", drive, ata_sectors[drive]);
+        }
+    }
+
+    /* The slave belongs to swap */
+    if (ata_sectors[ATA_DRIVE_MASTER] != 0)
+    {
+        blk_register("hda", ata_sectors[ATA_DRIVE_MASTER] / ATA_SECTORS_PER_PAGE, &ata_blk_ops,
+                     (void *) (uintptr_t) ATA_DRIVE_MASTER);
+    }
+}
+
+uint32_t ata_sector_count(uint32_t drive)
+{
+    return drive < ATA_DRIVE_CNT ? ata_sectors[drive] : 0;
+}
+
+int ata_read_pages(uint32_t drive, uint32_t lba, void *const *pages, uint32_t page_cnt)
+{
+    return ata_rw_pages(drive, lba, pages, page_cnt, false);
+}
+
+int ata_write_pages(uint32_t drive, uint32_t lba, void *const *pages, uint32_t page_cnt)
+{
+    return ata_rw_pages(drive, lba, pages, page_cnt, true);
+}
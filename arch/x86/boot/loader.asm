@@ -11,12 +11,10 @@ org 0x7E00
 %define KB(x) (x * 1024)
 %define MB(x) (x * 1024 * 1024)
 
-; THe size of the image.
-%define IMAGE_SIZE           MB(4)
+; The size of kernel.bin (KERNEL_BIN_SIZE), generated by the build
+%include "kernel_size.inc"
 ; Size of a single sector
 %define SECTOR_SIZE          512
-; The number of sectors required to hold the image
-%define IMAGE_SECTORS        (IMAGE_SIZE / SECTOR_SIZE)
 ; final run address (1 MiB)
 %define KERNEL_LOAD_ADDR      MB(1)
 ; temporary load address (64KB)
@@ -25,8 +23,8 @@ org 0x7E00
 %define LOADER_SECTORS        2
 ; kernel starts at LBA 3
 %define KERNEL_START_LBA      (1 + LOADER_SECTORS)
-; The number of kernel sectors. We don't need to copy the bootsector/loader sectors
-%define KERNEL_SECTORS        (IMAGE_SECTORS - KERNEL_START_LBA)
+; The number of kernel sectors; only what kernel.bin occupies is read
+%define KERNEL_SECTORS        ((KERNEL_BIN_SIZE + SECTOR_SIZE - 1) / SECTOR_SIZE)
 ; The of the intermediate buffer
 %define CHUNK_SIZE            KB(64)
 ; sectors per chunk
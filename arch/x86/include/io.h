@@ -17,6 +17,48 @@ static inline uint8_t inb(uint16_t port)
     return v;
 }
 
+static inline void outw(uint16_t port, uint16_t val)
+{
+    __asm__ volatile ("outw %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint16_t inw(uint16_t port)
+{
+    uint16_t v;
+    __asm__ volatile ("inw %1, %0" : "=a"(v) : "Nd"(port));
+    return v;
+}
+
+static inline void outl(uint16_t port, uint32_t val)
+{
+    __asm__ volatile ("outl %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint32_t inl(uint16_t port)
+{
+    uint32_t v;
+    __asm__ volatile ("inl %1, %0" : "=a"(v) : "Nd"(port));
+    return v;
+}
+
+/* Read cnt 16-bit words from port into buf */
+static inline void insw(uint16_t port, void *buf, uint32_t cnt)
+{
+    __asm__ volatile ("rep insw"
+            : "+D"(buf), "+c"(cnt)
+            : "d"(port)
+            : "memory");
+}
+
+/* Write cnt 16-bit words from buf to port */
+static inline void outsw(uint16_t port, const void *buf, uint32_t cnt)
+{
+    __asm__ volatile ("rep outsw"
+            : "+S"(buf), "+c"(cnt)
+            : "d"(port)
+            : "memory");
+}
+
 static inline uint8_t cmos(uint8_t reg)
 {
     outb(0x70, 0x80 | reg);
@@ -0,0 +1,40 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include <stdint.h>
+
+/*
+ * Multiboot (version 1) boot information, as far as the kernel uses it.
+ * The header that asks for it is in kpremain.asm.
+ */
+
+/* In eax on entry from a Multiboot loader */
+#define MULTIBOOT_BOOTLOADER_MAGIC  0x2BADB002u
+
+/* multiboot_info.flags: which fields are valid */
+#define MULTIBOOT_INFO_MEMORY       0x00000001u
+#define MULTIBOOT_INFO_MODS         0x00000008u
+
+struct multiboot_info
+{
+    uint32_t flags;
+    /* KiB below 1 MiB and above 1 MiB */
+    uint32_t mem_lower;
+    uint32_t mem_upper;
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    /* Physical address of mods_count struct multiboot_module */
+    uint32_t mods_addr;
+};
+
+struct multiboot_module
+{
+    /* Physical range [mod_start, mod_end) */
+    uint32_t mod_start;
+    uint32_t mod_end;
+    uint32_t string;
+    uint32_t reserved;
+};
+
+#endif //MULTIBOOT_H
@@ -100,23 +100,47 @@ extern __kernel_page_directory_va
                                                   ((((limit) >> 16) & 0x0F) << 16) | (((flags) & 0xF0) << 16) | \
                                                   (((base) >> 24) << 24) )
 
+; ------------------------------------------------------------
+; Multiboot (version 1)
+; ------------------------------------------------------------
+%define MULTIBOOT_MAGIC         0x1BADB002
+%define MULTIBOOT_PAGE_ALIGN    (1 << 0)        ; modules on page boundaries
+%define MULTIBOOT_MEMORY_INFO   (1 << 1)
+%define MULTIBOOT_FLAGS         (MULTIBOOT_PAGE_ALIGN | MULTIBOOT_MEMORY_INFO)
+
 ; ============================================================
-; Entry
+; Multiboot header
+;
+; Lets a Multiboot loader (qemu -kernel, GRUB) load kernel.elf by its
+; program headers and enter _kpremain with eax = 0x2BADB002 and ebx =
+; the physical address of the boot info. It must be in the first 8 KiB
+; of the file, so it sits in the premain page, after the code: the disk
+; loader jumps to the start of that page.
 ; ============================================================
-section .text.premain
+section .multiboot
+align 4
+    dd MULTIBOOT_MAGIC
+    dd MULTIBOOT_FLAGS
+    dd -(MULTIBOOT_MAGIC + MULTIBOOT_FLAGS)
+
+; What the loader passed; handed to kmain once paging is on
+section .data.premain
+align 4
+boot_magic:     dd 0
+boot_info_pa:   dd 0
 
+; ============================================================
+; Entry
+; ============================================================
 section .text.premain
 
 _kpremain:
     cli
 
-    ; Flat segments
-    mov ax, KERNEL_DS
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
-    mov ss, ax
+    ; The segments of the loader are flat; a Multiboot loader leaves GDTR
+    ; undefined, so no selector is loaded until our own GDT is in place.
+    mov [boot_magic], eax
+    mov [boot_info_pa], ebx
 
     ; Temporary stack in identity-mapped low memory
     mov esp, 589824
@@ -178,6 +202,11 @@ _kpremain:
 
     ; Switch to high virtual stack
     mov esp, KERNEL_VA_STACK_TOP
+
+    ; kmain(boot_magic, boot_info_pa), with a null return address
+    push dword [boot_info_pa]
+    push dword [boot_magic]
+    push dword 0
     jmp kmain
 
 ; ============================================================
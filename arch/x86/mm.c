@@ -5,8 +5,11 @@
 #include "kernel/panic.h"
 #include "kernel/irq.h"
 #include "kernel/kutils.h"
+#include "kernel/boot.h"
 #include "include/gdt.h"
 #include "include/exc_stub.h"
+#include "include/io.h"
+#include "kernel/sched.h"
 #include <stdint.h>
 #include <stddef.h>
 
@@ -36,6 +39,13 @@ extern uint32_t __premain_pa_end;
 #define PTE_W 0x002
 #define PTE_U 0x004
 
+#define PDE_PS_SIZE        (4u * 1024u * 1024u)
+
+#define CR0_WP  (1u << 16)
+#define CR4_PSE (1u << 4)
+
+#define CPUID_EDX_SSE2 (1u << 26)
+
 #define PTE_INDEX(va)      (((va) >> PAGE_SHIFT) & 0x3FF)
 #define PDE_INDEX(va)      ((va) >> 22)
 #define FRAME_TO_PA(frame) ((uintptr_t)(frame) << PAGE_SHIFT)
@@ -48,25 +58,8 @@ extern uint32_t __premain_pa_end;
 #define VGA_TEXT_BUFFER_VA   0xB8000
 #define VGA_TEXT_BUFFER_SIZE 0x1000
 
-/* Static sizing (up-front) */
-#define VM_PT_COVERS_BYTES (4u * 1024u * 1024u)  /* 1 PT covers 4MB */
-
-#define DIV_ROUND_UP(x, y) (((x) + (y) - 1) / (y))
-#define VM_USER_PTS_PER_PROC  (DIV_ROUND_UP(PROCESS_VA_SIZE, VM_PT_COVERS_BYTES))
-#define MM_PAGING_PAGES_TOTAL (MAX_PROCESS_CNT * (1u + VM_USER_PTS_PER_PROC)) /* PD + PTs */
-
-/* VMA pool sizing */
-#define MAX_VMAS_PER_PROCESS 16
-#define MAX_VMAS_TOTAL (MAX_PROCESS_CNT * MAX_VMAS_PER_PROCESS)
-
-/* ------------------------------------------------------------
- * Copy window (ONE page table max; 4MB hard cap)
- * ------------------------------------------------------------ */
-#define COPY_WINDOW_MAX_BYTES   VM_PT_COVERS_BYTES
-
-/* Put both src+dst in the SAME PT (same PDE), different PTEs */
-#define COPY_SRC_VA   0xFF000000u
-#define COPY_DST_VA   0xFF001000u
+/* Page directories; page tables come from the frame allocator */
+#define MM_PAGING_PAGES_TOTAL MAX_PROCESS_CNT
 
 /* ------------------------------------------------------------
  * Paging structures (x86 32-bit non-PAE)
@@ -83,7 +76,9 @@ struct pte
     uint32_t dirty: 1;
     uint32_t pat: 1;
     uint32_t global: 1;
-    uint32_t ignored: 3;
+    uint32_t owned: 1;      /* frame belongs to the mapping (anon memory) */
+    uint32_t swapped: 1;    /* not present; frame holds the swap slot */
+    uint32_t cow: 1;        /* frame is shared; writes fault and copy it */
     uint32_t frame: 20;
 };
 
@@ -134,9 +129,14 @@ static struct mm_impl kernel_impl;
 static struct mm_impl mm_impl_pool[MAX_PROCESS_CNT];
 static uint32_t mm_impl_next = 0;
 
-/* VMA pool */
-static struct vma vma_pool[MAX_VMAS_TOTAL];
-static uint32_t vma_next = 0;
+/* Size of the physmap: all RAM is mapped at KERNEL_PHYSMAP_VA */
+static uintptr_t physmap_size = 0;
+
+/* movnti is available (SSE2) */
+static bool has_movnti = false;
+
+/* Page tables taken from the frame allocator */
+static uint32_t page_table_cnt = 0;
 
 /* ------------------------------------------------------------
  * Kernel-owned paging-structure pool (PD/PT pages)
@@ -147,41 +147,56 @@ static uint8_t mm_paging_pool[MM_PAGING_PAGES_TOTAL * PAGE_SIZE]
 
 static uint32_t mm_paging_next = 0;
 
-/* ------------------------------------------------------------
- * Permanent copy-window PT (inherited by all processes)
- * ------------------------------------------------------------ */
-static struct page_table *copy_pt = NULL;
-
 /* ------------------------------------------------------------
  * Page fault debug handler (exception #14 with error code)
  * ------------------------------------------------------------ */
 
-__attribute__((used))
 __attribute__((used))
 void page_fault_handler(uint32_t err)
 {
     uint32_t cr2, eip;
     __asm__ volatile("mov %%cr2, %0" : "=r"(cr2));
 
-    // Stack layout when handler is called:
-    // [esp+0]  = return address (to stub)
-    // [esp+4]  = error code (passed as parameter)
-    // [esp+8]  = EIP (CPU pushed)
-    // [esp+12] = CS  (CPU pushed)
-    // [esp+16] = EFLAGS (CPU pushed)
-
-    uint32_t *stack;
-    __asm__ volatile("mov %%esp, %0" : "=r"(stack));
+    // Stack layout relative to this function's frame pointer:
+    // [0]      = saved EBP
+    // [1]      = return address (to stub)
+    // [2]      = error code (pushed by the stub)
+    // [3..10]  = pushal
+    // [11]     = error code (CPU pushed)
+    // [12]     = EIP (CPU pushed)
+    // [13]     = CS  (CPU pushed)
+    // [14]     = EFLAGS (CPU pushed)
+    uint32_t *stack = (uint32_t *) __builtin_frame_address(0);
+
+    /* Demand paging of user memory */
+    if (mm_handle_fault(mm_active(), cr2, (err & 0x02) != 0))
+    {
+        return;
+    }
 
-    eip = stack[2];  // EIP at esp+8
-    uint32_t cs = stack[3];
-    uint32_t eflags = stack[4];
+    eip = stack[12];
+    uint32_t cs = stack[13];
+    uint32_t eflags = stack[14];
     uint32_t cr3;
     __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
 
     /* classify based on instruction pointer: below kernel base == "user" */
     bool user_mode = (eip < (uintptr_t)&__kernel_va_base);
 
+    struct task *current = sched_current();
+    if (user_mode && current)
+    {
+        kprintf("%s: segmentation fault at 0x%08x (eip=0x%08x, err=0x%x)\n",
+                current->name, cr2, eip, err);
+
+        /* We run on the user stack that sched_exit is about to free */
+        __asm__ volatile("mov %0, %%esp\n\t"
+                         "push $-1\n\t"
+                         "call sched_exit"
+                         : : "r"(current->cpu_ctx.k_sp) : "memory");
+        __builtin_unreachable();
+    }
+
     kprintf("\033[1;37;41m\n=== PAGE FAULT ===\033[0m\n");
     kprintf("Address: 0x%08x ", cr2);
     kprintf("Error:   0x%08x ", err);
@@ -240,9 +255,28 @@ static inline struct page_directory *kernel_pd(void)
     return (struct page_directory *) &__kernel_page_directory_va;
 }
 
-static inline struct page_table *pde_to_pt(struct pde *pde)
+void *mm_pa_to_kva(uintptr_t pa)
 {
-    return (struct page_table *) kernel_pa_to_va(FRAME_TO_PA(pde->frame));
+    if (pa >= physmap_size)
+    {
+        panic("mm_pa_to_kva: address outside of physmap");
+    }
+    return (void *) (KERNEL_PHYSMAP_VA + pa);
+}
+
+uintptr_t mm_kva_to_pa(const void *kva)
+{
+    uintptr_t va = (uintptr_t) kva;
+    if (va < KERNEL_PHYSMAP_VA || va - KERNEL_PHYSMAP_VA >= physmap_size)
+    {
+        panic("mm_kva_to_pa: address outside of physmap");
+    }
+    return va - KERNEL_PHYSMAP_VA;
+}
+
+static inline struct page_table *pde_to_pt(const struct pde *pde)
+{
+    return (struct page_table *) mm_pa_to_kva(FRAME_TO_PA(pde->frame));
 }
 
 static inline void pte_set(struct pte *p, uintptr_t pa, uint32_t flags)
@@ -258,17 +292,6 @@ static inline void pte_clear(struct pte *p)
     p->present = 0;
 }
 
-static void pt_clear(struct page_table *pt)
-{
-    for (uint32_t i = 0; i < PAGE_TABLE_ENTRIES; i++)
-    {
-        pt->e[i].present = 0;
-        pt->e[i].writable = 0;
-        pt->e[i].user = 0;
-        pt->e[i].frame = 0;
-    }
-}
-
 static uintptr_t mm_alloc_page_pa(void)
 {
     if (mm_paging_next >= MM_PAGING_PAGES_TOTAL)
@@ -300,13 +323,33 @@ static struct mm_impl *mm_alloc_impl(void)
     return &mm_impl_pool[mm_impl_next++];
 }
 
-static struct vma *vma_alloc(void)
+/* Page table for va, allocating a zeroed one when create is set */
+static struct pte *pte_lookup(struct mm_impl *impl, uintptr_t va, bool create)
 {
-    if (vma_next >= MAX_VMAS_TOTAL)
+    struct pde *pde = &impl->pd_va->e[PDE_INDEX(va)];
+
+    if (!pde->present)
     {
-        return NULL;
+        if (!create)
+        {
+            return NULL;
+        }
+
+        uintptr_t pt_pa = mm_frame_alloc_zeroed();
+        if (!pt_pa)
+        {
+            return NULL;
+        }
+        page_table_cnt++;
+
+        pde->frame = (uint32_t) (pt_pa >> 12);
+        pde->present = 1;
+        pde->writable = 1;
+        pde->user = va < kernel_va_base();
+        pde->ps = 0;
     }
-    return &vma_pool[vma_next++];
+
+    return &pde_to_pt(pde)->e[PTE_INDEX(va)];
 }
 
 /* ------------------------------------------------------------
@@ -317,32 +360,13 @@ static void vm_map_impl(struct mm_impl *impl, uintptr_t va, uintptr_t pa, size_t
 {
     while (size)
     {
-        uint32_t pde_idx = PDE_INDEX(va);
-        uint32_t pte_idx = PTE_INDEX(va);
-
-        struct pde *pde = &impl->pd_va->e[pde_idx];
-
-        if (!pde->present)
+        struct pde *pde = &impl->pd_va->e[PDE_INDEX(va)];
+        struct pte *pte = pte_lookup(impl, va, true);
+        if (!pte)
         {
-            uintptr_t pt_pa = mm_alloc_page_pa();
-            if (!pt_pa)
-            {
-                return;
-            }
-
-            struct page_table *new_pt = (struct page_table *) kernel_pa_to_va(pt_pa);
-            pt_clear(new_pt);
-
-            pde->frame = (uint32_t) (pt_pa >> 12);
-            pde->present = 1;
-            pde->writable = 1;
-            pde->user = 0;
-            pde->ps = 0;
+            return;
         }
 
-        struct page_table *pt = pde_to_pt(pde);
-        struct pte *pte = &pt->e[pte_idx];
-
         uint32_t flags = PTE_P | PTE_W;
         if (va < kernel_va_base())
         {
@@ -397,6 +421,56 @@ static void vm_unmap_premain(void)
                   premain_va_page_end - premain_va_page_start);
 }
 
+/* Installed RAM according to the CMOS (extended memory registers) */
+static uintptr_t detect_ram_size(void)
+{
+    /* 64 KiB blocks above 16 MiB */
+    uint32_t above_16m = (uint32_t) cmos(0x34) | ((uint32_t) cmos(0x35) << 8);
+    if (above_16m != 0)
+    {
+        return MB(16) + above_16m * KB(64);
+    }
+
+    /* KiB above 1 MiB (caps at 64 MiB) */
+    uint32_t above_1m = (uint32_t) cmos(0x30) | ((uint32_t) cmos(0x31) << 8);
+    return MB(1) + above_1m * KB(1);
+}
+
+/*
+ * Map all RAM at KERNEL_PHYSMAP_VA using 4 MiB pages so the kernel can reach
+ * any frame (page tables, anonymous pages) without temporary mappings.
+ * Must run before the first fork so every PD inherits these PDEs.
+ */
+static void physmap_init(void)
+{
+    uintptr_t ram = detect_ram_size();
+    if (ram > KERNEL_PHYSMAP_SIZE)
+    {
+        ram = KERNEL_PHYSMAP_SIZE;
+    }
+    physmap_size = ram & ~(PDE_PS_SIZE - 1);
+
+    uint32_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    __asm__ volatile("mov %0, %%cr4"::"r"(cr4 | CR4_PSE));
+
+    for (uintptr_t pa = 0; pa < physmap_size; pa += PDE_PS_SIZE)
+    {
+        struct pde *pde = &kernel_impl.pd_va->e[PDE_INDEX(KERNEL_PHYSMAP_VA + pa)];
+        pde->frame = (uint32_t) (pa >> 12);
+        pde->present = 1;
+        pde->writable = 1;
+        pde->user = 0;
+        pde->ps = 1;
+        invlpg(KERNEL_PHYSMAP_VA + pa);
+    }
+
+    /* Honour read-only PTEs in ring 0 as well (mprotect) */
+    uint32_t cr0;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile("mov %0, %%cr0"::"r"(cr0 | CR0_WP));
+}
+
 /* ------------------------------------------------------------
  * Public API
  * ------------------------------------------------------------ */
@@ -406,43 +480,43 @@ void mm_init(void)
     idt_set_gate(14, (uint32_t) isr_page_fault, (uint16_t) GDT_KERNEL_CS, (uint8_t) 0x8E);
 
     kernel_mm.impl = &kernel_impl;
-    kernel_mm.vmas = NULL;
+    kernel_mm.vma_cnt = 0;
 
     kernel_impl.pd_va = kernel_pd();
     kernel_impl.pd_pa = kernel_va_to_pa((uintptr_t) kernel_impl.pd_va);
     kernel_impl.kernel_pde_start = PDE_INDEX(kernel_va_base());
 
-    vm_unmap_premain();
+    physmap_init();
 
-    mm_add_vma(&kernel_mm, VMA_TYPE_VGA, VGA_TEXT_BUFFER_VA, VGA_TEXT_BUFFER_SIZE, VMA_READ | VMA_WRITE,
-               VGA_TEXT_BUFFER_VA);
+    uint32_t eax = 1, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    has_movnti = (edx & CPUID_EDX_SSE2) != 0;
 
-    /* ------------------------------------------------------------
-     * Permanent copy window (one PT, PTEs non-present by default)
-     * ------------------------------------------------------------ */
+    /*
+     * Everything above the kernel window is managed by the frame allocator,
+     * except up to the end of an initrd the boot loader put there. One that
+     * follows the kernel inside the window must stay clear of the boot stack.
+     */
+    uintptr_t frames_start = kernel_pa_base() + KERNEL_VA_SIZE;
+    uintptr_t initrd_start, initrd_end;
+    if (boot_initrd_range(&initrd_start, &initrd_end))
     {
-        uint32_t pde_idx = PDE_INDEX(COPY_SRC_VA);
-
-        uintptr_t pt_pa = mm_alloc_page_pa();
-        if (!pt_pa)
+        uintptr_t stack_pa = kernel_va_to_pa(KERNEL_STACK_TOP_VA - KERNEL_STACK_SIZE);
+        if (initrd_start < frames_start && initrd_end > stack_pa)
         {
-            panic("mm_init: copy PT alloc failed");
+            panic("mm_init: initrd overlaps the boot stack");
         }
+        if (initrd_end > frames_start)
+        {
+            frames_start = PAGE_ALIGN_UP(initrd_end);
+        }
+    }
+    mm_frames_init(frames_start, physmap_size);
 
-        copy_pt = (struct page_table *) kernel_pa_to_va(pt_pa);
-        pt_clear(copy_pt);
-
-        struct pde *pde = &kernel_impl.pd_va->e[pde_idx];
-        pde->frame = (uint32_t) (pt_pa >> 12);
-        pde->present = 1;
-        pde->writable = 1;
-        pde->user = 0;
-        pde->ps = 0;
+    vm_unmap_premain();
 
-        /* Ensure no stale TLB (mostly irrelevant this early, but deterministic) */
-        invlpg(COPY_SRC_VA);
-        invlpg(COPY_DST_VA);
-    }
+    mm_add_vma(&kernel_mm, VMA_TYPE_VGA, VGA_TEXT_BUFFER_VA, VGA_TEXT_BUFFER_SIZE, VMA_READ | VMA_WRITE,
+               VGA_TEXT_BUFFER_VA);
 
     mm_activate(&kernel_mm);
 }
@@ -452,6 +526,17 @@ struct mm *mm_kernel(void)
     return &kernel_mm;
 }
 
+void mm_kernel_reserve(uintptr_t va, size_t size)
+{
+    for (uintptr_t cur = va & ~(PDE_PS_SIZE - 1); cur < va + size; cur += PDE_PS_SIZE)
+    {
+        if (!pte_lookup(&kernel_impl, cur, true))
+        {
+            panic("mm_kernel_reserve: out of memory");
+        }
+    }
+}
+
 struct mm *mm_fork_kernel(void)
 {
     struct mm *mm = mm_alloc();
@@ -467,7 +552,7 @@ struct mm *mm_fork_kernel(void)
     }
 
     mm->impl = impl;
-    mm->vmas = NULL;
+    mm->vma_cnt = 0;
 
     uintptr_t pd_pa = mm_alloc_page_pa();
     if (!pd_pa)
@@ -490,7 +575,7 @@ struct mm *mm_fork_kernel(void)
 
     impl->kernel_pde_start = kernel_impl.kernel_pde_start;
 
-    /* Copy all present kernel PDEs (includes the copy-window PDE) */
+    /* Copy all present kernel PDEs (includes the physmap) */
     for (uint32_t i = 0; i < PAGE_DIR_ENTRIES; i++)
     {
         if (kernel_impl.pd_va->e[i].present)
@@ -500,20 +585,19 @@ struct mm *mm_fork_kernel(void)
     }
 
     /* Copy kernel VMAs */
-    for (struct vma *kv = kernel_mm.vmas; kv; kv = kv->next)
+    for (uint32_t i = 0; i < kernel_mm.vma_cnt; i++)
     {
-        struct vma *v = vma_alloc();
+        struct vma *v = mm_vma_alloc();
         if (!v)
         {
             return NULL;
         }
-        v->base_va = kv->base_va;
-        v->base_pa = kv->base_pa;
-        v->length = kv->length;
-        v->flags = kv->flags;
-        v->type = kv->type;
-        v->next = mm->vmas;
-        mm->vmas = v;
+        *v = *kernel_mm.vmas[i];
+        if (mm_vma_insert(mm, v) < 0)
+        {
+            mm_vma_free(v);
+            return NULL;
+        }
     }
 
     return mm;
@@ -521,7 +605,7 @@ struct mm *mm_fork_kernel(void)
 
 struct vma *mm_add_vma(struct mm *mm, uint32_t type, uintptr_t va, size_t size, uint32_t flags, uintptr_t pa)
 {
-    struct vma *v = vma_alloc();
+    struct vma *v = mm_vma_alloc();
     if (!v)
     {
         return NULL;
@@ -532,8 +616,11 @@ struct vma *mm_add_vma(struct mm *mm, uint32_t type, uintptr_t va, size_t size,
     v->length = size;
     v->flags = flags;
     v->type = type;
-    v->next = mm->vmas;
-    mm->vmas = v;
+    if (mm_vma_insert(mm, v) < 0)
+    {
+        mm_vma_free(v);
+        return NULL;
+    }
 
     /* Map the pages */
     struct mm_impl *impl = mm->impl;
@@ -542,18 +629,6 @@ struct vma *mm_add_vma(struct mm *mm, uint32_t type, uintptr_t va, size_t size,
     return v;
 }
 
-struct vma *mm_find_vma_by_type(struct mm *mm, uint32_t type)
-{
-    for (struct vma *v = mm->vmas; v; v = v->next)
-    {
-        if (v->type == type)
-        {
-            return v;
-        }
-    }
-    return NULL;
-}
-
 void mm_activate(struct mm *mm)
 {
     struct mm_impl *impl = (struct mm_impl *) mm->impl;
@@ -615,8 +690,7 @@ bool mm_va_to_pa(const struct mm *mm, uint32_t va, uint32_t *out_pa)
         return false;
     }
 
-    struct page_table *pt =
-            (struct page_table *) kernel_pa_to_va(FRAME_TO_PA(pde->frame));
+    struct page_table *pt = pde_to_pt(pde);
 
     struct pte *pte = &pt->e[pte_idx];
 
@@ -629,82 +703,240 @@ bool mm_va_to_pa(const struct mm *mm, uint32_t va, uint32_t *out_pa)
     return true;
 }
 
-void mm_copy_vma(struct mm *dest_mm, struct vma *dest_vma,
-                 const struct mm *src_mm, const struct vma *src_vma,
-                 size_t length)
+/* ------------------------------------------------------------
+ * Page-level mapping
+ * ------------------------------------------------------------ */
+
+static inline void pte_set_prot(struct pte *pte, uint32_t flags)
+{
+    /* x86 has no write-only or exec-only pages; anything but PROT_NONE is readable */
+    pte->present = (flags & (VMA_READ | VMA_WRITE | VMA_EXEC)) != 0;
+    pte->writable = (flags & VMA_WRITE) != 0 && !pte->cow;
+    pte->user = 1;
+}
+
+static bool map_page(struct mm *mm, uintptr_t va, uintptr_t pa, uint32_t flags, bool cow)
 {
-    if (!copy_pt)
+    struct pte *pte = pte_lookup(mm->impl, va, true);
+    if (!pte)
     {
-        panic("mm_copy_vma: copy window not initialized");
+        return false;
     }
 
-    /* Hard cap: one PT window max (4MB) */
-    if (length > COPY_WINDOW_MAX_BYTES)
+    *(uint32_t *) pte = 0;
+    pte->frame = (uint32_t) (pa >> 12);
+    pte->owned = 1;
+    pte->cow = cow;
+    pte_set_prot(pte, flags);
+    invlpg(va);
+    return true;
+}
+
+bool mm_map_page(struct mm *mm, uintptr_t va, uintptr_t pa, uint32_t flags)
+{
+    return map_page(mm, va, pa, flags, false);
+}
+
+bool mm_map_page_cow(struct mm *mm, uintptr_t va, uintptr_t pa, uint32_t flags)
+{
+    return map_page(mm, va, pa, flags, true);
+}
+
+uintptr_t mm_unmap_page(struct mm *mm, uintptr_t va)
+{
+    struct pte *pte = pte_lookup(mm->impl, va, false);
+    if (!pte || !(pte->owned || pte->swapped))
     {
-        panic("mm_copy_vma: length exceeds 1-PT copy window");
+        return 0;
     }
 
-    /* Validate length fits in both VMAs */
-    if (length > src_vma->length || length > dest_vma->length)
+    uintptr_t pa = pte->owned ? FRAME_TO_PA(pte->frame) : 0;
+    *(uint32_t *) pte = 0;
+    invlpg(va);
+    return pa;
+}
+
+bool mm_get_page(const struct mm *mm, uintptr_t va, uintptr_t *out_pa)
+{
+    struct pte *pte = pte_lookup(mm->impl, va, false);
+    if (!pte || !pte->owned)
     {
-        panic("mm_copy_vma: length exceeds VMA bounds");
+        return false;
     }
 
-    size_t offset = 0;
+    *out_pa = FRAME_TO_PA(pte->frame);
+    return true;
+}
 
-    while (offset < length)
+void mm_protect_page(struct mm *mm, uintptr_t va, uint32_t flags)
+{
+    struct pte *pte = pte_lookup(mm->impl, va, false);
+    if (!pte || !pte->owned)
     {
-        uintptr_t src_va = src_vma->base_va + offset;
-        uintptr_t dst_va = dest_vma->base_va + offset;
+        return;
+    }
 
-        uintptr_t src_page_va = PAGE_ALIGN_DOWN(src_va);
-        uintptr_t dst_page_va = PAGE_ALIGN_DOWN(dst_va);
+    pte_set_prot(pte, flags);
+    invlpg(va);
+}
 
-        uint32_t src_pa, dst_pa;
+uint32_t mm_page_state(const struct mm *mm, uintptr_t va)
+{
+    struct pte *pte = pte_lookup(mm->impl, va, false);
+    if (!pte)
+    {
+        return 0;
+    }
+    if (pte->swapped)
+    {
+        return MM_PAGE_SWAPPED;
+    }
+    if (!pte->owned)
+    {
+        return 0;
+    }
 
-        /* Translate to PA (source PD is assumed active, but this works regardless) */
-        if (!mm_va_to_pa(src_mm, (uint32_t)src_page_va, &src_pa))
-        {
-            panic("mm_copy_vma: source VA not mapped");
-        }
+    uint32_t state = MM_PAGE_PRESENT;
+    if (pte->accessed)
+    {
+        state |= MM_PAGE_ACCESSED;
+    }
+    if (pte->dirty)
+    {
+        state |= MM_PAGE_DIRTY;
+    }
+    if (pte->cow)
+    {
+        state |= MM_PAGE_COW;
+    }
+    return state;
+}
 
-        if (!mm_va_to_pa(dest_mm, (uint32_t)dst_page_va, &dst_pa))
-        {
-            panic("mm_copy_vma: dest VA not mapped");
-        }
+bool mm_clear_accessed(struct mm *mm, uintptr_t va)
+{
+    struct pte *pte = pte_lookup(mm->impl, va, false);
+    if (!pte || !pte->owned || !pte->accessed)
+    {
+        return false;
+    }
 
-        struct pte *src_pte = &copy_pt->e[PTE_INDEX(COPY_SRC_VA)];
-        struct pte *dst_pte = &copy_pt->e[PTE_INDEX(COPY_DST_VA)];
+    pte->accessed = 0;
+    invlpg(va);
+    return true;
+}
 
-        /* Arm mappings (PTEs normally non-present) */
-        pte_set(src_pte, (uintptr_t)(src_pa & PAGE_MASK), PTE_P);
-        pte_set(dst_pte, (uintptr_t)(dst_pa & PAGE_MASK), PTE_P | PTE_W);
+uintptr_t mm_swap_out_page(struct mm *mm, uintptr_t va, uint32_t slot)
+{
+    struct pte *pte = pte_lookup(mm->impl, va, false);
+    if (!pte || !pte->owned)
+    {
+        return 0;
+    }
 
-        invlpg(COPY_SRC_VA);
-        invlpg(COPY_DST_VA);
+    uintptr_t pa = FRAME_TO_PA(pte->frame);
+    *(uint32_t *) pte = 0;
+    pte->swapped = 1;
+    pte->frame = slot;
+    invlpg(va);
+    return pa;
+}
 
-        size_t src_off = (size_t)(src_va - src_page_va);
-        size_t dst_off = (size_t)(dst_va - dst_page_va);
+bool mm_get_swap_slot(const struct mm *mm, uintptr_t va, uint32_t *out_slot)
+{
+    struct pte *pte = pte_lookup(mm->impl, va, false);
+    if (!pte || !pte->swapped)
+    {
+        return false;
+    }
 
-        size_t chunk = PAGE_SIZE - src_off;
-        size_t tmp = PAGE_SIZE - dst_off;
-        if (tmp < chunk) chunk = tmp;
+    *out_slot = pte->frame;
+    return true;
+}
 
-        size_t remain = length - offset;
-        if (remain < chunk) chunk = remain;
+void mm_paging_stat(struct mm_stat *stat)
+{
+    stat->total_pages = physmap_size / PAGE_SIZE;
+    stat->page_table_pages = mm_paging_next + page_table_cnt;
+}
 
-        k_memcpy((void *)(COPY_DST_VA + dst_off),
-                 (void *)(COPY_SRC_VA + src_off),
-                 chunk);
+void mm_clear_page(void *page)
+{
+    uint32_t cnt = PAGE_SIZE / 4;
+    __asm__ volatile("rep stosl"
+                     : "+D"(page), "+c"(cnt)
+                     : "a"(0)
+                     : "memory");
+}
 
-        /* Disarm immediately */
-        pte_clear(src_pte);
-        pte_clear(dst_pte);
+void mm_clear_page_nt(void *page)
+{
+    if (!has_movnti)
+    {
+        mm_clear_page(page);
+        return;
+    }
 
-        invlpg(COPY_SRC_VA);
-        invlpg(COPY_DST_VA);
+    uint32_t *p = page;
+    for (uint32_t i = 0; i < PAGE_SIZE / 4; i += 4)
+    {
+        __asm__ volatile("movnti %1, 0(%0)\n\t"
+                         "movnti %1, 4(%0)\n\t"
+                         "movnti %1, 8(%0)\n\t"
+                         "movnti %1, 12(%0)"
+                         : : "r"(p + i), "r"(0) : "memory");
+    }
 
-        offset += chunk;
+    /* Make the streaming stores globally visible before the frame is handed out */
+    __asm__ volatile("sfence" ::: "memory");
+}
+
+struct mm *mm_active(void)
+{
+    uint32_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+
+    struct task *current = sched_current();
+    if (current && ((struct mm_impl *) current->mm->impl)->pd_pa == cr3)
+    {
+        return current->mm;
+    }
+
+    /* e.g. while the kernel sets up a task that isn't running yet */
+    for (uint32_t i = 0; i < proc_mm_next; i++)
+    {
+        if (((struct mm_impl *) proc_mms[i].impl)->pd_pa == cr3)
+        {
+            return &proc_mms[i];
+        }
+    }
+
+    return NULL;
+}
+
+void mm_free_user_page_tables(struct mm *mm)
+{
+    struct mm_impl *impl = mm->impl;
+
+    for (uint32_t i = 0; i < kernel_impl.kernel_pde_start; i++)
+    {
+        struct pde *pde = &impl->pd_va->e[i];
+
+        /* PDEs inherited from the kernel (low identity PT) are shared */
+        if (!pde->present || kernel_impl.pd_va->e[i].present)
+        {
+            continue;
+        }
+
+        uintptr_t pt_pa = FRAME_TO_PA(pde->frame);
+        *(uint32_t *) pde = 0;
+        mm_frame_free(pt_pa);
+        page_table_cnt--;
+    }
+
+    if (mm_active() == mm)
+    {
+        uint32_t cr3;
+        __asm__ volatile("mov %%cr3, %0; mov %0, %%cr3" : "=r"(cr3) : : "memory");
     }
 }
 
@@ -0,0 +1,85 @@
+// multiboot.c
+//
+// The boot information of a Multiboot loader (see include/kernel/boot.h).
+// Only the first module is used: the initrd with the /bin image.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "kernel/boot.h"
+#include "kernel/mm.h"
+#include "kernel/console.h"
+#include "include/multiboot.h"
+
+static struct
+{
+    uint32_t magic;
+    uint32_t info_pa;
+    bool parsed;
+    bool has_initrd;
+    uintptr_t initrd_start;
+    uintptr_t initrd_end;
+} boot;
+
+void boot_init(uint32_t magic, uint32_t info_pa)
+{
+    boot.magic = magic;
+    boot.info_pa = info_pa;
+}
+
+static void boot_parse(void)
+{
+    if (boot.parsed)
+    {
+        return;
+    }
+    boot.parsed = true;
+
+    if (boot.magic != MULTIBOOT_BOOTLOADER_MAGIC)
+    {
+        return;
+    }
+
+    const struct multiboot_info *info = mm_pa_to_kva(boot.info_pa);
+    if (!(info->flags & MULTIBOOT_INFO_MODS) || info->mods_count == 0)
+    {
+        kprintf("Multiboot: no initrd.\n");
+        return;
+    }
+
+    const struct multiboot_module *mod = mm_pa_to_kva(info->mods_addr);
+    if (mod->mod_end <= mod->mod_start)
+    {
+        kprintf("Multiboot: empty initrd.\n");
+        return;
+    }
+
+    boot.has_initrd = true;
+    boot.initrd_start = mod->mod_start;
+    boot.initrd_end = mod->mod_end;
+    kprintf("Multiboot: initrd at %x, %u KB.\n", mod->mod_start, (mod->mod_end - mod->mod_start) / 1024);
+}
+
+bool boot_initrd_range(uintptr_t *start_pa, uintptr_t *end_pa)
+{
+    boot_parse();
+    if (!boot.has_initrd)
+    {
+        return false;
+    }
+
+    *start_pa = boot.initrd_start;
+    *end_pa = boot.initrd_end;
+    return true;
+}
+
+const void *boot_initrd(size_t *size)
+{
+    boot_parse();
+    if (!boot.has_initrd)
+    {
+        return NULL;
+    }
+
+    *size = boot.initrd_end - boot.initrd_start;
+    return mm_pa_to_kva(boot.initrd_start);
+}
@@ -0,0 +1,143 @@
+// arch/x86/pci.c
+//
+// PCI bus enumeration through configuration mechanism #1 (ports 0xCF8 and
+// 0xCFC). Every bus is scanned once at boot and the functions found are
+// kept in a small table that drivers search by vendor and device id.
+
+#include "kernel/pci.h"
+#include "kernel/console.h"
+#include "include/io.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PCI_CONFIG_ADDRESS  0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+
+#define PCI_VENDOR_NONE     0xFFFF
+#define PCI_HEADER_TYPE     0x0E
+#define PCI_HEADER_MULTI    0x80
+#define PCI_CLASS_REV       0x08
+
+#define PCI_BUS_CNT         256
+#define PCI_SLOT_CNT        32
+#define PCI_FUNC_CNT        8
+
+static struct
+{
+    struct pci_dev devs[PCI_MAX_DEVICES];
+    uint32_t cnt;
+} pci;
+
+/* ------------------------------------------------------------------
+ * Configuration space
+ * ------------------------------------------------------------------ */
+
+static uint32_t pci_config_read(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+{
+    outl(PCI_CONFIG_ADDRESS, 0x80000000u | ((uint32_t) bus << 16) | ((uint32_t) slot << 11) |
+                             ((uint32_t) func << 8) | (offset & 0xFCu));
+    return inl(PCI_CONFIG_DATA);
+}
+
+uint32_t pci_read32(const struct pci_dev *dev, uint8_t offset)
+{
+    return pci_config_read(dev->bus, dev->slot, dev->func, offset);
+}
+
+uint16_t pci_read16(const struct pci_dev *dev, uint8_t offset)
+{
+    return (uint16_t) (pci_read32(dev, offset) >> ((offset & 2) * 8));
+}
+
+void pci_write16(const struct pci_dev *dev, uint8_t offset, uint16_t value)
+{
+    outl(PCI_CONFIG_ADDRESS, 0x80000000u | ((uint32_t) dev->bus << 16) | ((uint32_t) dev->slot << 11) |
+                             ((uint32_t) dev->func << 8) | (offset & 0xFCu));
+    outw((uint16_t) (PCI_CONFIG_DATA + (offset & 2)), value);
+}
+
+void pci_enable(const struct pci_dev *dev)
+{
+    uint16_t cmd = pci_read16(dev, PCI_COMMAND);
+    pci_write16(dev, PCI_COMMAND, (uint16_t) (cmd | PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER));
+}
+
+/* ------------------------------------------------------------------
+ * Enumeration
+ * ------------------------------------------------------------------ */
+
+static void pci_add(uint8_t bus, uint8_t slot, uint8_t func, uint32_t id)
+{
+    if (pci.cnt == PCI_MAX_DEVICES)
+    {
+        return;
+    }
+
+    struct pci_dev *dev = &pci.devs[pci.cnt++];
+    dev->bus = bus;
+    dev->slot = slot;
+    dev->func = func;
+    dev->vendor = (uint16_t) id;
+    dev->device = (uint16_t) (id >> 16);
+
+    uint32_t class_rev = pci_read32(dev, PCI_CLASS_REV);
+    dev->class = (uint8_t) (class_rev >> 24);
+    dev->subclass = (uint8_t) (class_rev >> 16);
+    dev->irq = (uint8_t) pci_read32(dev, PCI_INTERRUPT_LINE);
+    for (uint8_t i = 0; i < 6; i++)
+    {
+        dev->bar[i] = pci_read32(dev, (uint8_t) (PCI_BAR0 + i * 4));
+    }
+
+    kprintf("PCI: %u:%u.%u %x:%x class %x.%x irq %u\n", bus, slot, func,
+            dev->vendor, dev->device, dev->class, dev->subclass, dev->irq);
+}
+
+void pci_init(void)
+{
+    for (uint32_t bus = 0; bus < PCI_BUS_CNT; bus++)
+    {
+        for (uint8_t slot = 0; slot < PCI_SLOT_CNT; slot++)
+        {
+            uint32_t id = pci_config_read((uint8_t) bus, slot, 0, 0);
+            if ((id & 0xFFFF) == PCI_VENDOR_NONE)
+            {
+                continue;
+            }
+            pci_add((uint8_t) bus, slot, 0, id);
+
+            uint8_t header = (uint8_t) (pci_config_read((uint8_t) bus, slot, 0, PCI_HEADER_TYPE & 0xFC) >> 16);
+            if (!(header & PCI_HEADER_MULTI))
+            {
+                continue;
+            }
+
+            for (uint8_t func = 1; func < PCI_FUNC_CNT; func++)
+            {
+                id = pci_config_read((uint8_t) bus, slot, func, 0);
+                if ((id & 0xFFFF) != PCI_VENDOR_NONE)
+                {
+                    pci_add((uint8_t) bus, slot, func, id);
+                }
+            }
+        }
+    }
+}
+
+struct pci_dev *pci_find(uint16_t vendor, uint16_t device_lo, uint16_t device_hi, uint32_t index)
+{
+    for (uint32_t i = 0; i < pci.cnt; i++)
+    {
+        struct pci_dev *dev = &pci.devs[i];
+        if (dev->vendor == vendor && dev->device >= device_lo && dev->device <= device_hi)
+        {
+            if (index == 0)
+            {
+                return dev;
+            }
+            index--;
+        }
+    }
+    return NULL;
+}
@@ -10,15 +10,12 @@ global ctx_setup_fork_return
 extern sys_return
 
 extern sched_current
-extern vfs_open
+extern task_init_stdio
 extern sched_exit
 
 %define OFF_U_ESP  0
 %define OFF_K_ESP  4
 
-%define O_RDONLY   0
-%define O_WRONLY   1
-
 ; Linux i386 auxv types we provide minimally
 %define AT_NULL    0
 %define AT_PAGESZ  6
@@ -136,33 +133,10 @@ task_trampoline:
     call sched_current
     mov [ebp - 20], eax           ; current
 
-    ; --- open stdin/stdout/stderr on kernel stack ---
-    mov eax, [ebp - 20]
-
-    push dword 0
-    push dword O_RDONLY
-    push stdin_str
-    push eax
-    call vfs_open
-    add esp, 16
-
-    mov eax, [ebp - 20]
-
-    push dword 0
-    push dword O_WRONLY
-    push stdout_str
-    push eax
-    call vfs_open
-    add esp, 16
-
-    mov eax, [ebp - 20]
-
-    push dword 0
-    push dword O_WRONLY
-    push stderr_str
-    push eax
-    call vfs_open
-    add esp, 16
+    ; --- open stdin/stdout/stderr unless inherited ---
+    push dword [ebp - 20]
+    call task_init_stdio
+    add esp, 4
 
     ; --- switch to user stack ---
     mov edi, [ebp - 20]           ; current
@@ -245,13 +219,6 @@ task_trampoline:
     ; Jump to entry (_start)
     jmp eax
 
-section .rodata
-stdin_str:  db "/dev/stdin", 0
-stdout_str: db "/dev/stdout", 0
-stderr_str: db "/dev/stderr", 0
-
-section .text
-
 ; ============================================================
 ; void ctx_switch(struct cpu_ctx *prev,
 ;                 struct cpu_ctx *next,
@@ -0,0 +1,481 @@
+// arch/x86/virtio_blk.c
+//
+// Legacy (virtio 0.9.5) virtio-blk driver over PCI port I/O. Every
+// device found is registered with the block layer, as /dev/vda, /dev/vdb
+// and so on.
+//
+// The device reads requests from a single virtqueue. Each request is a
+// chain of descriptors: a header with the direction and the sector, one
+// descriptor per data page and a status byte the device writes. The block
+// layer starts every request of a dispatch before it waits, so the device
+// has them all in flight at once, and it is notified once per dispatch
+// instead of once per request.
+//
+// Waiting halts the CPU until the device interrupts. When the device
+// offers VIRTIO_RING_F_EVENT_IDX, the driver asks for a single interrupt
+// once the last request in flight completes instead of one per request.
+// Devices whose interrupt can't be routed (or is on the master PIC, whose
+// vectors overlap the CPU exceptions) are polled.
+
+#include "kernel/virtio_blk.h"
+#include "kernel/blk.h"
+#include "kernel/pci.h"
+#include "kernel/mm.h"
+#include "kernel/irq.h"
+#include "kernel/kutils.h"
+#include "kernel/console.h"
+#include "include/io.h"
+#include "include/irq_stub.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define VIRTIO_VENDOR               0x1AF4
+/* Transitional device ids: 0x1000 + the virtio device type */
+#define VIRTIO_BLK_LEGACY_ID        0x1001
+
+/* ------------------------------------------------------------------
+ * Legacy register layout (I/O BAR 0, without MSI-X)
+ * ------------------------------------------------------------------ */
+#define VIRTIO_REG_DEVICE_FEATURES  0x00
+#define VIRTIO_REG_GUEST_FEATURES   0x04
+#define VIRTIO_REG_QUEUE_PFN        0x08
+#define VIRTIO_REG_QUEUE_SIZE       0x0C
+#define VIRTIO_REG_QUEUE_SELECT     0x0E
+#define VIRTIO_REG_QUEUE_NOTIFY     0x10
+#define VIRTIO_REG_STATUS           0x12
+#define VIRTIO_REG_ISR              0x13
+#define VIRTIO_REG_BLK_CAPACITY     0x14
+
+#define VIRTIO_STATUS_ACK           0x01
+#define VIRTIO_STATUS_DRIVER        0x02
+#define VIRTIO_STATUS_DRIVER_OK     0x04
+#define VIRTIO_STATUS_FAILED        0x80
+
+#define VIRTIO_RING_F_EVENT_IDX     (1u << 29)
+
+#define VRING_DESC_F_NEXT           0x1
+#define VRING_DESC_F_WRITE          0x2
+#define VRING_USED_F_NO_NOTIFY      0x1
+#define VRING_ALIGN                 4096u
+
+#define VIRTIO_BLK_T_IN             0
+#define VIRTIO_BLK_T_OUT            1
+#define VIRTIO_BLK_S_OK             0
+
+/* The largest legacy queue QEMU offers */
+#define VBLK_MAX_QUEUE              256
+#define VBLK_RING_PAGES             3
+#define VBLK_MAX_INFLIGHT           32
+#define VBLK_MAX_DEVS               2
+
+/* Slave PIC lines in the BIOS mapping */
+#define PIC2_VECTOR_BASE            0x70
+#define PIC2_DATA_PORT              0xA1
+#define PIC1_DATA_PORT              0x21
+#define PIC_CASCADE_MASK            0x04
+
+#define PAGE_SIZE                   4096u
+
+struct vring_desc
+{
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed));
+
+struct vring_used_elem
+{
+    uint32_t id;
+    uint32_t len;
+} __attribute__((packed));
+
+struct virtio_blk_req_hdr
+{
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__((packed));
+
+/* A request the device has */
+struct vblk_slot
+{
+    bool active;
+    void *tag;
+    uint16_t head;
+    uint16_t desc_cnt;
+};
+
+struct vblk
+{
+    uint16_t io;
+    uint8_t vector;
+    bool event_idx;
+    struct blk_dev *blk;
+
+    uint16_t qsize;
+    volatile struct vring_desc *desc;
+    volatile uint16_t *avail_flags;
+    volatile uint16_t *avail_idx;
+    volatile uint16_t *avail_ring;
+    volatile uint16_t *used_event;
+    volatile uint16_t *used_flags;
+    volatile uint16_t *used_idx;
+    volatile struct vring_used_elem *used_ring;
+    volatile uint16_t *avail_event;
+
+    /* Free descriptors, chained through next */
+    uint16_t free_head;
+    uint16_t free_cnt;
+    /* avail index at the last notification */
+    uint16_t kicked_idx;
+    uint16_t last_used;
+
+    /* Headers and status bytes of the slots, one frame */
+    struct virtio_blk_req_hdr *hdrs;
+    volatile uint8_t *status;
+    uintptr_t hdr_pa;
+    struct vblk_slot slots[VBLK_MAX_INFLIGHT];
+    /* Slot of the request whose chain starts at a descriptor */
+    uint8_t slot_of[VBLK_MAX_QUEUE];
+    uint32_t inflight;
+};
+
+static struct vblk vblks[VBLK_MAX_DEVS];
+static uint32_t vblk_cnt;
+
+static inline void vblk_barrier(void)
+{
+    __asm__ volatile("" ::: "memory");
+}
+
+/* ------------------------------------------------------------------
+ * Interrupt
+ * ------------------------------------------------------------------ */
+
+/*
+ * Reading the ISR acknowledges the interrupt and lowers the line. Devices
+ * can share a line, and reading the ISR of one that didn't interrupt is
+ * harmless, so every device is acknowledged.
+ */
+void virtio_blk_interrupt(void)
+{
+    for (uint32_t i = 0; i < vblk_cnt; i++)
+    {
+        (void) inb((uint16_t) (vblks[i].io + VIRTIO_REG_ISR));
+    }
+}
+
+MAKE_IRQ_STUB(virtio_blk_irq_stub, virtio_blk_interrupt, 1)
+
+static void vblk_irq_init(struct vblk *vb, uint8_t line)
+{
+    if (line < 8 || line > 15)
+    {
+        return;
+    }
+
+    vb->vector = (uint8_t) (PIC2_VECTOR_BASE + line - 8);
+    idt_set_gate(vb->vector, (uint32_t) virtio_blk_irq_stub, 0x08, 0x8E);
+    outb(PIC2_DATA_PORT, (uint8_t) (inb(PIC2_DATA_PORT) & ~(1u << (line - 8))));
+    outb(PIC1_DATA_PORT, (uint8_t) (inb(PIC1_DATA_PORT) & ~PIC_CASCADE_MASK));
+}
+
+/* ------------------------------------------------------------------
+ * Virtqueue
+ * ------------------------------------------------------------------ */
+
+static void vblk_kick(struct vblk *vb)
+{
+    uint16_t idx = *vb->avail_idx;
+    if (idx == vb->kicked_idx)
+    {
+        return;
+    }
+
+    vblk_barrier();
+    bool notify;
+    if (vb->event_idx)
+    {
+        /* The device asked to be notified once avail passes avail_event */
+        notify = (uint16_t) (idx - *vb->avail_event - 1) < (uint16_t) (idx - vb->kicked_idx);
+    }
+    else
+    {
+        notify = !(*vb->used_flags & VRING_USED_F_NO_NOTIFY);
+    }
+
+    vb->kicked_idx = idx;
+    if (notify)
+    {
+        outw((uint16_t) (vb->io + VIRTIO_REG_QUEUE_NOTIFY), 0);
+    }
+}
+
+/* Complete the requests the device is done with */
+static void vblk_reap(struct vblk *vb)
+{
+    while (vb->last_used != *vb->used_idx)
+    {
+        vblk_barrier();
+        uint16_t head = (uint16_t) vb->used_ring[vb->last_used % vb->qsize].id;
+        vb->last_used++;
+
+        uint8_t s = vb->slot_of[head];
+        struct vblk_slot *slot = &vb->slots[s];
+
+        /* Give the chain back */
+        uint16_t tail = head;
+        for (uint16_t i = 1; i < slot->desc_cnt; i++)
+        {
+            tail = vb->desc[tail].next;
+        }
+        vb->desc[tail].next = vb->free_head;
+        vb->free_head = head;
+        vb->free_cnt = (uint16_t) (vb->free_cnt + slot->desc_cnt);
+
+        slot->active = false;
+        vb->inflight--;
+        blk_complete(vb->blk, slot->tag, vb->status[s] == VIRTIO_BLK_S_OK ? 0 : -1);
+    }
+}
+
+static int vblk_start(struct blk_dev *dev, uint32_t block, void *const *pages, uint32_t cnt, bool write, void *tag)
+{
+    struct vblk *vb = blk_driver_data(dev);
+
+    uint16_t need = (uint16_t) (cnt + 2);
+    if (vb->free_cnt < need)
+    {
+        return -1;
+    }
+
+    uint32_t s = 0;
+    while (s < VBLK_MAX_INFLIGHT && vb->slots[s].active)
+    {
+        s++;
+    }
+    if (s == VBLK_MAX_INFLIGHT)
+    {
+        return -1;
+    }
+
+    struct vblk_slot *slot = &vb->slots[s];
+    slot->active = true;
+    slot->tag = tag;
+    slot->desc_cnt = need;
+    slot->head = vb->free_head;
+
+    vb->hdrs[s].type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    vb->hdrs[s].reserved = 0;
+    vb->hdrs[s].sector = (uint64_t) block * BLK_SECTORS;
+    vb->status[s] = 0xFF;
+
+    /* Header, the pages, then the status byte */
+    uint16_t d = slot->head;
+    for (uint16_t i = 0; i < need; i++)
+    {
+        volatile struct vring_desc *desc = &vb->desc[d];
+        if (i == 0)
+        {
+            desc->addr = vb->hdr_pa + s * sizeof(struct virtio_blk_req_hdr);
+            desc->len = sizeof(struct virtio_blk_req_hdr);
+            desc->flags = VRING_DESC_F_NEXT;
+        }
+        else if (i < need - 1)
+        {
+            desc->addr = mm_kva_to_pa(pages[i - 1]);
+            desc->len = PAGE_SIZE;
+            desc->flags = (uint16_t) (VRING_DESC_F_NEXT | (write ? 0 : VRING_DESC_F_WRITE));
+        }
+        else
+        {
+            desc->addr = mm_kva_to_pa((const void *) &vb->status[s]);
+            desc->len = 1;
+            desc->flags = VRING_DESC_F_WRITE;
+        }
+        if (i < need - 1)
+        {
+            d = desc->next;
+        }
+    }
+    vb->free_head = vb->desc[d].next;
+    vb->free_cnt = (uint16_t) (vb->free_cnt - need);
+    vb->slot_of[slot->head] = (uint8_t) s;
+
+    vb->avail_ring[*vb->avail_idx % vb->qsize] = slot->head;
+    vblk_barrier();
+    *vb->avail_idx = (uint16_t) (*vb->avail_idx + 1);
+    vb->inflight++;
+    return 0;
+}
+
+static void vblk_wait(struct blk_dev *dev)
+{
+    struct vblk *vb = blk_driver_data(dev);
+
+    vblk_kick(vb);
+
+    irq_state_t state = irq_disable();
+    while (vb->inflight > 0)
+    {
+        /* One interrupt when the last request in flight is done */
+        *vb->used_event = (uint16_t) (vb->last_used + vb->inflight - 1);
+        vblk_barrier();
+
+        vblk_reap(vb);
+        if (vb->inflight == 0)
+        {
+            break;
+        }
+
+        if (vb->vector)
+        {
+            /* sti takes effect after hlt starts, so the interrupt can't slip in between */
+            __asm__ volatile("sti\n\thlt\n\tcli" ::: "memory");
+        }
+        else
+        {
+            __asm__ volatile("pause" ::: "memory");
+        }
+    }
+    irq_restore(state);
+}
+
+static const struct blk_ops vblk_ops = {
+        .start = vblk_start,
+        .wait  = vblk_wait,
+};
+
+/* ------------------------------------------------------------------
+ * Setup
+ * ------------------------------------------------------------------ */
+
+/*
+ * The legacy interface wants the whole virtqueue physically contiguous. At
+ * boot the frame allocator still hands out frames in address order, so
+ * consecutive allocations are.
+ */
+static uintptr_t vblk_ring_alloc(void)
+{
+    uintptr_t base = mm_frame_alloc();
+    if (!base)
+    {
+        return 0;
+    }
+    for (uint32_t i = 1; i < VBLK_RING_PAGES; i++)
+    {
+        if (mm_frame_alloc() != base + i * PAGE_SIZE)
+        {
+            return 0;
+        }
+    }
+    k_memset(mm_pa_to_kva(base), 0, VBLK_RING_PAGES * PAGE_SIZE);
+    return base;
+}
+
+static bool vblk_queue_init(struct vblk *vb)
+{
+    outw((uint16_t) (vb->io + VIRTIO_REG_QUEUE_SELECT), 0);
+    vb->qsize = inw((uint16_t) (vb->io + VIRTIO_REG_QUEUE_SIZE));
+    if (vb->qsize == 0 || vb->qsize > VBLK_MAX_QUEUE)
+    {
+        kprintf("virtio-blk: unsupported queue size %u\n", vb->qsize);
+        return false;
+    }
+
+    uintptr_t ring_pa = vblk_ring_alloc();
+    uintptr_t hdr_pa = mm_frame_alloc_zeroed();
+    if (!ring_pa || !hdr_pa)
+    {
+        kprintf("virtio-blk: can't allocate the virtqueue\n");
+        return false;
+    }
+
+    /* desc[qsize], avail {flags, idx, ring[qsize], used_event}, aligned used {flags, idx, ring[qsize], avail_event} */
+    uint8_t *ring = mm_pa_to_kva(ring_pa);
+    size_t avail_off = 16u * vb->qsize;
+    size_t used_off = (avail_off + 2u * (3u + vb->qsize) + VRING_ALIGN - 1) & ~(VRING_ALIGN - 1);
+
+    vb->desc = (volatile struct vring_desc *) ring;
+    vb->avail_flags = (volatile uint16_t *) (ring + avail_off);
+    vb->avail_idx = vb->avail_flags + 1;
+    vb->avail_ring = vb->avail_flags + 2;
+    vb->used_event = vb->avail_ring + vb->qsize;
+    vb->used_flags = (volatile uint16_t *) (ring + used_off);
+    vb->used_idx = vb->used_flags + 1;
+    vb->used_ring = (volatile struct vring_used_elem *) (vb->used_idx + 1);
+    vb->avail_event = (volatile uint16_t *) (vb->used_ring + vb->qsize);
+
+    for (uint16_t i = 0; i < vb->qsize; i++)
+    {
+        vb->desc[i].next = (uint16_t) (i + 1);
+    }
+    vb->free_head = 0;
+    vb->free_cnt = vb->qsize;
+
+    vb->hdr_pa = hdr_pa;
+    vb->hdrs = mm_pa_to_kva(hdr_pa);
+    vb->status = (volatile uint8_t *) (vb->hdrs + VBLK_MAX_INFLIGHT);
+
+    outl((uint16_t) (vb->io + VIRTIO_REG_QUEUE_PFN), (uint32_t) (ring_pa / PAGE_SIZE));
+    return true;
+}
+
+static void vblk_probe(struct pci_dev *pci)
+{
+    if (!(pci->bar[0] & PCI_BAR_IO))
+    {
+        kprintf("virtio-blk: BAR0 is not an I/O BAR\n");
+        return;
+    }
+
+    struct vblk *vb = &vblks[vblk_cnt];
+    pci_enable(pci);
+    vb->io = (uint16_t) (pci->bar[0] & PCI_BAR_IO_MASK);
+
+    outb((uint16_t) (vb->io + VIRTIO_REG_STATUS), 0);
+    outb((uint16_t) (vb->io + VIRTIO_REG_STATUS), VIRTIO_STATUS_ACK);
+    outb((uint16_t) (vb->io + VIRTIO_REG_STATUS), VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+
+    uint32_t features = inl((uint16_t) (vb->io + VIRTIO_REG_DEVICE_FEATURES));
+    vb->event_idx = (features & VIRTIO_RING_F_EVENT_IDX) != 0;
+    outl((uint16_t) (vb->io + VIRTIO_REG_GUEST_FEATURES), features & VIRTIO_RING_F_EVENT_IDX);
+
+    if (!vblk_queue_init(vb))
+    {
+        outb((uint16_t) (vb->io + VIRTIO_REG_STATUS), VIRTIO_STATUS_FAILED);
+        return;
+    }
+
+    uint32_t sectors = inl((uint16_t) (vb->io + VIRTIO_REG_BLK_CAPACITY));
+    if (inl((uint16_t) (vb->io + VIRTIO_REG_BLK_CAPACITY + 4)) != 0)
+    {
+        /* LBA beyond 32 bits; use what a block number can address */
+        sectors = UINT32_MAX;
+    }
+
+    /* Counted before it can interrupt, so the handler acknowledges it */
+    vblk_cnt++;
+    vblk_irq_init(vb, pci->irq);
+    outb((uint16_t) (vb->io + VIRTIO_REG_STATUS),
+         VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+    kprintf("virtio-blk: %u sectors, queue %u, irq %u%s\n", sectors, vb->qsize, pci->irq,
+            vb->event_idx ? ", event idx" : "");
+    char name[] = "vda";
+    name[2] = (char) ('a' + vblk_cnt - 1);
+    vb->blk = blk_register(name, sectors / BLK_SECTORS, &vblk_ops, vb);
+}
+
+void virtio_blk_init(void)
+{
+    struct pci_dev *pci;
+    for (uint32_t i = 0; vblk_cnt < VBLK_MAX_DEVS &&
+                         (pci = pci_find(VIRTIO_VENDOR, VIRTIO_BLK_LEGACY_ID, VIRTIO_BLK_LEGACY_ID, i)) != NULL; i++)
+    {
+        vblk_probe(pci);
+    }
+}
@@ -0,0 +1,188 @@
+// blk_bench.c
+//
+// Block device throughput and IOPS: sequential reads in small and large
+// chunks and random 4 KiB reads over the first part of each disk. Large
+// reads show what merging the blocks of one call into a single disk
+// command buys, and on virtio-blk what having several commands in flight
+// buys. Without device arguments the ATA disk and the virtio disk (when
+// there is one) are compared.
+//
+// The device is opened with O_DIRECT, so every read goes to the disk.
+// With -b it is read through the page cache instead: the sequential runs
+// then show what read-ahead buys, and later runs hit the cache.
+//
+// With -w every chunk that was read is written back unchanged, so the
+// disk keeps its contents.
+//
+// usage: blk_bench [-b] [-w] [-m MiB] [device...]
+#include "fcntl.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+#include "unistd.h"
+#include "stat.h"
+
+#define DEFAULT_MIB     2
+#define RANDOM_IOS      256
+#define MAX_CHUNK       (512 * 1024)
+
+static const size_t chunk_sizes[] = {4096, 65536, MAX_CHUNK};
+
+static const char *const default_devices[] = {"/dev/hda", "/dev/vda"};
+
+static char buf[MAX_CHUNK];
+static int fd;
+static int write_back;
+static int buffered;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void report(const char *name, size_t chunk, uint32_t ios, uint64_t ns)
+{
+    if (ns == 0)
+    {
+        ns = 1;
+    }
+    uint64_t bytes = (uint64_t) chunk * ios;
+    printf("blk_bench: %s %u x %u bytes: %llu ms, %llu KB/s, %llu IOPS\n",
+           name, ios, (unsigned) chunk,
+           (unsigned long long) (ns / 1000000ULL),
+           (unsigned long long) (bytes * 1000000ULL / ns),
+           (unsigned long long) ((uint64_t) ios * 1000000000ULL / ns));
+}
+
+static void io(size_t chunk, off_t offset)
+{
+    if (pread(fd, buf, chunk, offset) != (ssize_t) chunk)
+    {
+        printf("blk_bench: read at %d failed\n", (int) offset);
+        exit(1);
+    }
+    if (write_back && pwrite(fd, buf, chunk, offset) != (ssize_t) chunk)
+    {
+        printf("blk_bench: write at %d failed\n", (int) offset);
+        exit(1);
+    }
+}
+
+static void sequential(size_t chunk, off_t size)
+{
+    uint32_t ios = (uint32_t) (size / (off_t) chunk);
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < ios; i++)
+    {
+        io(chunk, (off_t) (i * chunk));
+    }
+    report("seq", chunk, ios, now_ns() - start);
+}
+
+static void random_4k(off_t size)
+{
+    uint32_t blocks = (uint32_t) (size / 4096);
+    uint32_t seed = 12345;
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < RANDOM_IOS; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        io(4096, (off_t) ((seed >> 8) % blocks) * 4096);
+    }
+    report("rand", 4096, RANDOM_IOS, now_ns() - start);
+}
+
+/* Returns 0 when device can't be benchmarked */
+static int bench(const char *device, int mib)
+{
+    fd = open(device, (write_back ? O_RDWR : O_RDONLY) | (buffered ? 0 : O_DIRECT), 0);
+    if (fd < 0)
+    {
+        printf("blk_bench: can't open %s\n", device);
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (st.st_mode & S_IFMT) != S_IFBLK)
+    {
+        printf("blk_bench: %s is not a block device\n", device);
+        close(fd);
+        return 0;
+    }
+
+    off_t size = (off_t) mib * 1024 * 1024;
+    if (size > st.st_size)
+    {
+        size = st.st_size;
+    }
+    printf("blk_bench: %s, %d KiB%s%s\n", device, (int) (size / 1024), buffered ? ", buffered" : "",
+           write_back ? ", reads written back" : "");
+
+    for (size_t i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); i++)
+    {
+        if ((off_t) chunk_sizes[i] <= size)
+        {
+            sequential(chunk_sizes[i], size);
+        }
+    }
+    random_4k(size);
+
+    close(fd);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    int mib = DEFAULT_MIB;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++)
+    {
+        if (strcmp(argv[arg], "-b") == 0)
+        {
+            buffered = 1;
+        }
+        else if (strcmp(argv[arg], "-w") == 0)
+        {
+            write_back = 1;
+        }
+        else if (strcmp(argv[arg], "-m") == 0 && arg + 1 < argc)
+        {
+            mib = atoi(argv[++arg]);
+        }
+        else
+        {
+            mib = 0;
+            break;
+        }
+    }
+    if (mib <= 0)
+    {
+        printf("usage: blk_bench [-b] [-w] [-m MiB] [device...]\n");
+        return 1;
+    }
+
+    if (arg < argc)
+    {
+        int ok = 1;
+        for (; arg < argc; arg++)
+        {
+            ok &= bench(argv[arg], mib);
+        }
+        return ok ? 0 : 1;
+    }
+
+    /* The ATA disk has to be there; the virtio disk is optional */
+    if (!bench(default_devices[0], mib))
+    {
+        return 1;
+    }
+    struct stat st;
+    if (stat(default_devices[1], &st) == 0)
+    {
+        bench(default_devices[1], mib);
+    }
+    return 0;
+}
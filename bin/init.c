@@ -1,6 +1,7 @@
 #include <stdint.h>
 #include "stdio.h"
 #include "unistd.h"
+#include "fcntl.h"
 #include "kernel/constants.h"
 
 static pid_t tty_pids[TTY_COUNT];
@@ -24,6 +25,14 @@ static pid_t spawn_shell(int tty_id)
             exit(1);
         }
 
+        /* stdio is inherited from init; reopen it on the new tty */
+        close(STDIN_FILENO);
+        close(STDOUT_FILENO);
+        close(STDERR_FILENO);
+        open("/dev/stdin", O_RDONLY, 0);
+        open("/dev/stdout", O_WRONLY, 0);
+        open("/dev/stderr", O_WRONLY, 0);
+
         char *sh_argv[] = {"/bin/sh", NULL};
         char *sh_envp[] = {NULL};
 
@@ -0,0 +1,97 @@
+// launch_bench.c
+//
+// Command launch latency: fork + execve + exit + waitpid, like the shell
+// runs a command. The first launch of a binary loads its ELF image, later
+// ones are served from its process template (see zygote_hit/zygote_miss in
+// /proc/vmstat), so the first launch is reported on its own.
+//
+// usage: launch_bench [count] [command]
+// Without a command the benchmark launches itself with -x, which exits
+// right away.
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+#include "unistd.h"
+
+#define DEFAULT_LAUNCHES    200
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* Returns the latency of one launch in ns */
+static uint64_t launch(char **argv, char **envp)
+{
+    uint64_t start = now_ns();
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        printf("launch_bench: fork failed\n");
+        exit(1);
+    }
+    if (pid == 0)
+    {
+        execve(argv[0], argv, envp);
+        printf("launch_bench: execve failed for '%s'\n", argv[0]);
+        exit(1);
+    }
+
+    int status = 0;
+    if (waitpid(pid, &status, 0) < 0)
+    {
+        printf("launch_bench: waitpid failed for pid %d\n", (int) pid);
+        exit(1);
+    }
+    return now_ns() - start;
+}
+
+int main(int argc, char **argv, char **envp)
+{
+    if (argc > 1 && strcmp(argv[1], "-x") == 0)
+    {
+        return 0;
+    }
+
+    int launches = DEFAULT_LAUNCHES;
+    if (argc > 1)
+    {
+        launches = atoi(argv[1]);
+    }
+    if (launches < 2)
+    {
+        printf("usage: launch_bench [count >= 2] [command]\n");
+        return 1;
+    }
+
+    char *self_argv[] = {"/bin/launch_bench", "-x", NULL};
+    char *cmd_argv[] = {argc > 2 ? argv[2] : NULL, NULL};
+    char **child_argv = argc > 2 ? cmd_argv : self_argv;
+
+    uint64_t first = launch(child_argv, envp);
+
+    uint64_t total = 0;
+    uint64_t min = (uint64_t) -1;
+    uint64_t max = 0;
+    for (int i = 1; i < launches; i++)
+    {
+        uint64_t ns = launch(child_argv, envp);
+        total += ns;
+        min = ns < min ? ns : min;
+        max = ns > max ? ns : max;
+    }
+
+    uint64_t avg = total / (uint64_t) (launches - 1);
+    printf("launch_bench: %s first %llu us, then %d launches avg %llu us min %llu us max %llu us\n",
+           child_argv[0],
+           (unsigned long long) (first / 1000ULL),
+           launches - 1,
+           (unsigned long long) (avg / 1000ULL),
+           (unsigned long long) (min / 1000ULL),
+           (unsigned long long) (max / 1000ULL));
+    return 0;
+}
@@ -95,6 +95,45 @@ static void print_size_human(long size)
     printf("%4.1f%c", s, units[u]);
 }
 
+static void print_entry(const struct dirent *de, const char *path, int long_format, int show_all, int human)
+{
+    if (!show_all && is_dot_entry(de))
+    {
+        return;
+    }
+
+    if (!long_format)
+    {
+        printf("%s\n", de->d_name);
+        return;
+    }
+
+    struct stat st;
+    char full_path[256];
+
+    build_path(full_path, sizeof(full_path), path, de->d_name);
+
+    if (stat(full_path, &st) == 0)
+    {
+        printf("%c ", type_char(de));
+        if (human)
+        {
+            print_size_human(st.st_size);
+        }
+        else
+        {
+            printf("%10ld", (long)st.st_size);
+        }
+        printf(" %s\n", de->d_name);
+    }
+    else
+    {
+        printf("%c          ? %s\n",
+               type_char(de),
+               de->d_name);
+    }
+}
+
 int main(int argc, char **argv)
 {
     const char *path = ".";
@@ -157,57 +196,25 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    struct dirent entries[256];
-    int nbytes = getdents(fd, entries, sizeof(entries));
-    if (nbytes < 0)
-    {
-        printf("ls: getdents failed\n");
-        close(fd);
-        return 1;
-    }
+    /* A few entries per call; getdents resumes where the last call stopped */
+    struct dirent entries[16];
+    int nbytes;
 
-    int n = nbytes / (int)sizeof(struct dirent);
-
-    for (int i = 0; i < n; i++)
+    while ((nbytes = getdents(fd, entries, sizeof(entries))) > 0)
     {
-        struct dirent *de = &entries[i];
+        int n = nbytes / (int)sizeof(struct dirent);
 
-        if (!show_all && is_dot_entry(de))
+        for (int i = 0; i < n; i++)
         {
-            continue;
+            print_entry(&entries[i], path, long_format, show_all, human);
         }
+    }
 
-        if (long_format)
-        {
-            struct stat st;
-            char full_path[256];
-
-            build_path(full_path, sizeof(full_path), path, de->d_name);
-
-            if (stat(full_path, &st) == 0)
-            {
-                printf("%c ", type_char(de));
-                if (human)
-                {
-                    print_size_human(st.st_size);
-                }
-                else
-                {
-                    printf("%10ld", (long)st.st_size);
-                }
-                printf(" %s\n", de->d_name);
-            }
-            else
-            {
-                printf("%c          ? %s\n",
-                       type_char(de),
-                       de->d_name);
-            }
-        }
-        else
-        {
-            printf("%s\n", de->d_name);
-        }
+    if (nbytes < 0)
+    {
+        printf("ls: getdents failed\n");
+        close(fd);
+        return 1;
     }
 
     close(fd);
@@ -0,0 +1,153 @@
+// malloc_bench.c
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "malloc.h"
+#include "time.h"
+#include "unistd.h"
+
+#define DEFAULT_OPS     200000
+#define LIVE_SLOTS      1024
+
+static uint32_t rng_state = 12345;
+
+static uint32_t rng_next(void)
+{
+    rng_state = rng_state * 1103515245u + 12345u;
+    return rng_state >> 8;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void report(const char *name, uint32_t ops, uint64_t elapsed_ns)
+{
+    uint64_t us = elapsed_ns / 1000ULL;
+    if (us == 0)
+    {
+        us = 1;
+    }
+
+    uint64_t ops_per_sec = (uint64_t) ops * 1000000ULL / us;
+    printf("%s: %u ops %llu us %llu ops/s\n",
+           name, ops, (unsigned long long) us, (unsigned long long) ops_per_sec);
+}
+
+/* malloc immediately followed by free; measures the free-list fast path */
+static void bench_fixed(size_t size, uint32_t ops)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "fixed %u", (unsigned) size);
+
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        void *p = malloc(size);
+        if (!p)
+        {
+            printf("malloc_bench: out of memory\n");
+            exit(1);
+        }
+        *(volatile char *) p = (char) i;
+        free(p);
+    }
+    report(name, ops * 2, now_ns() - start);
+}
+
+/*
+ * Keep a set of live blocks with random sizes and keep replacing random
+ * ones; this is where size classes fragment.
+ */
+static void bench_mixed(uint32_t ops, size_t max_size)
+{
+    static void *slots[LIVE_SLOTS];
+    static size_t sizes[LIVE_SLOTS];
+    size_t live_bytes = 0;
+
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        uint32_t idx = rng_next() % LIVE_SLOTS;
+        if (slots[idx])
+        {
+            free(slots[idx]);
+            live_bytes -= sizes[idx];
+        }
+
+        size_t size = 1 + rng_next() % max_size;
+        slots[idx] = malloc(size);
+        if (!slots[idx])
+        {
+            printf("malloc_bench: out of memory\n");
+            exit(1);
+        }
+        sizes[idx] = size;
+        live_bytes += size;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "mixed 1-%u", (unsigned) max_size);
+    report(name, ops * 2, now_ns() - start);
+
+    struct mallinfo mi = mallinfo();
+    size_t footprint = (size_t) mi.arena + (size_t) mi.hblkhd;
+    uint32_t frag_pct = footprint ? (uint32_t) (100 - (live_bytes * 100) / footprint) : 0;
+
+    printf("  live=%u bytes footprint=%u bytes (arena=%u large=%u) fragmentation=%u%%\n",
+           (unsigned) live_bytes, (unsigned) footprint, (unsigned) mi.arena,
+           (unsigned) mi.hblkhd, frag_pct);
+    printf("  in-use=%u free-chunks=%d free=%u uncarved=%u\n",
+           (unsigned) mi.uordblks, mi.ordblks, (unsigned) mi.fordblks, (unsigned) mi.keepcost);
+
+    for (uint32_t i = 0; i < LIVE_SLOTS; i++)
+    {
+        free(slots[i]);
+        slots[i] = NULL;
+    }
+}
+
+static void bench_realloc(uint32_t ops)
+{
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        char *p = NULL;
+        for (size_t size = 8; size <= 8192; size *= 2)
+        {
+            p = realloc(p, size);
+            if (!p)
+            {
+                printf("malloc_bench: out of memory\n");
+                exit(1);
+            }
+            p[size - 1] = 0;
+        }
+        free(p);
+    }
+    report("realloc 8-8192", ops * 12, now_ns() - start);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t ops = DEFAULT_OPS;
+    if (argc > 1)
+    {
+        ops = (uint32_t) atoi(argv[1]);
+    }
+
+    printf("malloc_bench: %u iterations per test\n", ops);
+
+    bench_fixed(16, ops);
+    bench_fixed(256, ops);
+    bench_fixed(4000, ops);
+    bench_fixed(64 * 1024, ops / 100 ? ops / 100 : 1);
+    bench_mixed(ops, 256);
+    bench_mixed(ops, 4096);
+    bench_realloc(ops / 100 ? ops / 100 : 1);
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+// pipe_bench.c
+//
+// Pipe throughput: a child drains a pipe to EOF while the parent writes
+// a fixed amount through it, once for each write size. Writes up to
+// PIPE_BUF (4096) bytes go into the pipe whole; larger ones are split
+// over several wakeups of the reader.
+//
+// usage: pipe_bench [MiB per write size]
+#include "fcntl.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "time.h"
+#include "unistd.h"
+
+#define DEFAULT_MIB     8
+#define MAX_WRITE_SIZE  16384
+
+static const size_t write_sizes[] = {64, 512, 4096, 16384};
+
+static char buf[MAX_WRITE_SIZE];
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* Returns the ns it took to push total bytes through a pipe */
+static uint64_t run(size_t write_size, uint64_t total)
+{
+    int fds[2];
+    if (pipe(fds) < 0)
+    {
+        printf("pipe_bench: pipe failed\n");
+        exit(1);
+    }
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        printf("pipe_bench: fork failed\n");
+        exit(1);
+    }
+    if (pid == 0)
+    {
+        close(fds[1]);
+        while (read(fds[0], buf, sizeof(buf)) > 0)
+        {
+        }
+        exit(0);
+    }
+
+    close(fds[0]);
+    uint64_t start = now_ns();
+    for (uint64_t done = 0; done < total; done += write_size)
+    {
+        if (write(fds[1], buf, write_size) != (ssize_t) write_size)
+        {
+            printf("pipe_bench: short write\n");
+            exit(1);
+        }
+    }
+    close(fds[1]);
+
+    /* Done when the reader has seen EOF */
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return now_ns() - start;
+}
+
+int main(int argc, char **argv)
+{
+    int mib = DEFAULT_MIB;
+    if (argc > 1)
+    {
+        mib = atoi(argv[1]);
+    }
+    if (mib <= 0)
+    {
+        printf("usage: pipe_bench [MiB per write size]\n");
+        return 1;
+    }
+
+    uint64_t total = (uint64_t) mib * 1024 * 1024;
+    for (size_t i = 0; i < sizeof(write_sizes) / sizeof(write_sizes[0]); i++)
+    {
+        uint64_t ns = run(write_sizes[i], total);
+        if (ns == 0)
+        {
+            ns = 1;
+        }
+        /* bytes per us is MB/s */
+        uint64_t mb_s = total * 1000ULL / ns;
+        printf("pipe_bench: %d MiB in %u byte writes: %llu ms, %llu MB/s\n",
+               mib, (unsigned) write_sizes[i],
+               (unsigned long long) (ns / 1000000ULL),
+               (unsigned long long) mb_s);
+    }
+    return 0;
+}
@@ -49,7 +49,7 @@ int main(int argc, char **argv)
 
     printf("PID   COMMAND\n");
 
-    struct dirent buf[32];
+    struct dirent buf[8];
 
     for (;;) {
         int nbytes = getdents(fd, buf, sizeof(buf));
@@ -5,6 +5,7 @@
 #include "stdio.h"
 #include "unistd.h"
 #include "stdlib.h"
+#include "sys/uio.h"
 
 extern char **environ;
 
@@ -167,7 +168,7 @@ static int find_in_bin(const char *name, char *fullpath, size_t fullpath_size)
     if (fd < 0)
         return 0;
 
-    char buf[4096];
+    char buf[8 * sizeof(struct dirent)];
     ssize_t nread;
     int found = 0;
 
@@ -240,22 +241,31 @@ static void history_add(const char *line)
 
 static void load_history_entry(char *line, size_t *len, int new_index)
 {
-    while (*len > 0)
+    /* erase the current line and draw the entry in one writev */
+    static char erase[LINE_MAX * 3];
+    for (size_t i = 0; i < *len; i++)
     {
-        write(FD_STDOUT, "\b \b", 3);
-        (*len)--;
+        memcpy(erase + i * 3, "\b \b", 3);
     }
 
+    struct iovec iov[2];
+    iov[0].iov_base = erase;
+    iov[0].iov_len = *len * 3;
+
     if (new_index == history_size)
     {
         line[0] = '\0';
         *len = 0;
-        return;
+    }
+    else
+    {
+        strcpy(line, history[new_index]);
+        *len = strlen(line);
     }
 
-    strcpy(line, history[new_index]);
-    *len = strlen(line);
-    write(STDOUT_FILENO, line, *len);
+    iov[1].iov_base = line;
+    iov[1].iov_len = *len;
+    writev(STDOUT_FILENO, iov, 2);
 }
 
 /* handle arrow key escape sequences */
@@ -809,6 +819,8 @@ static int builtin_help(int argc, char **argv)
         printf("  printenv [VAR]        Display exported variable(s)\n");
         printf("  repeat N CMD [args]   Execute command N times\n");
         printf("  help [command]        Show help for builtin commands\n");
+        printf("\nPipelines:\n");
+        printf("  CMD1 | CMD2 | ...     Connect stdout of each command to stdin of the next\n");
         printf("\nSpecial variables:\n");
         printf("  $?                    Exit status of last command\n");
         printf("  $$                    Shell process ID\n");
@@ -887,36 +899,202 @@ static int builtin_help(int argc, char **argv)
 /* ------------------------------------------------------------------
  * Built-in dispatch
  * ------------------------------------------------------------------ */
+struct builtin
+{
+    const char *name;
+    int (*fn)(int argc, char **argv);
+};
+
+static const struct builtin builtins[] = {
+    {"exit",     builtin_exit},
+    {"cd",       builtin_cd},
+    {"set",      builtin_set},
+    {"env",      builtin_env_like},
+    {"printenv", builtin_env_like},
+    {"export",   builtin_export},
+    {"unset",    builtin_unset},
+    {"repeat",   builtin_repeat},
+    {"help",     builtin_help},
+};
+
+static const struct builtin *find_builtin(const char *name)
+{
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+    {
+        if (strcmp(name, builtins[i].name) == 0)
+            return &builtins[i];
+    }
+    return NULL;
+}
+
 static int handle_builtin(int argc, char **argv)
 {
     if (argc <= 0 || argv == NULL || argv[0] == NULL)
         return 0;
 
-    if (strcmp(argv[0], "exit") == 0)
-        return builtin_exit(argc, argv);
+    const struct builtin *builtin = find_builtin(argv[0]);
+    if (builtin == NULL)
+        return 0; /* not a builtin */
+
+    return builtin->fn(argc, argv);
+}
+
+/* ------------------------------------------------------------------
+ * Pipelines: cmd1 | cmd2 | ... | cmdN
+ *
+ * Every stage runs in its own child with stdin and stdout wired to the
+ * pipes between the stages. The shell creates the pipes close-on-exec,
+ * so a stage only keeps the two ends it dup2'ed onto fds 0 and 1 and a
+ * reader sees EOF as soon as the stage before it exits.
+ * ------------------------------------------------------------------ */
+#define PIPELINE_MAX    8
+
+/*
+ * Cut line at every '|' outside quotes. Returns the number of stages, or
+ * -1 when there are more than max.
+ */
+static int split_pipeline(char *line, char **stages, int max)
+{
+    int count = 0;
+    int in_quotes = 0;
+
+    stages[count++] = line;
+    for (char *p = line; *p; p++)
+    {
+        if (*p == '"')
+        {
+            in_quotes = !in_quotes;
+        }
+        else if (*p == '|' && !in_quotes)
+        {
+            if (count == max)
+                return -1;
+            *p = '\0';
+            stages[count++] = p + 1;
+        }
+    }
+    return count;
+}
+
+static void run_pipeline(char **stages, int stage_cnt)
+{
+    pid_t pids[PIPELINE_MAX];
+    int started = 0;
+    int background = 0;
+    /* read end of the pipe from the previous stage */
+    int in_fd = -1;
+    char **child_envp = build_environment();
+
+    for (int i = 0; i < stage_cnt; i++)
+    {
+        char *cmd_argv[16];
+        int cmd_argc = parse_arguments(stages[i], cmd_argv, 15);
+        cmd_argv[cmd_argc] = NULL;
+
+        /* a trailing & puts the whole pipeline in the background */
+        if (i == stage_cnt - 1 && cmd_argc > 0 && strcmp(cmd_argv[cmd_argc - 1], "&") == 0)
+        {
+            background = 1;
+            cmd_argv[--cmd_argc] = NULL;
+        }
+
+        if (cmd_argc == 0)
+        {
+            printf("syntax error near '|'\n");
+            last_exit_status = 2;
+            break;
+        }
+
+        for (int j = 0; j < cmd_argc; j++)
+        {
+            expand_variables(cmd_argv[j]);
+        }
+
+        if (find_builtin(cmd_argv[0]))
+        {
+            printf("%s: builtins can't be used in a pipeline\n", cmd_argv[0]);
+            last_exit_status = 1;
+            break;
+        }
 
-    if (strcmp(argv[0], "cd") == 0)
-        return builtin_cd(argc, argv);
+        static char fullpath[LINE_MAX];
+        if (!resolve_full_path(fullpath, sizeof(fullpath), cmd_argv[0]))
+        {
+            printf("%s: command not found\n", cmd_argv[0]);
+            last_exit_status = 127;
+            break;
+        }
 
-    if (strcmp(argv[0], "set") == 0)
-        return builtin_set(argc, argv);
+        int fds[2] = {-1, -1};
+        if (i < stage_cnt - 1 && pipe2(fds, O_CLOEXEC) < 0)
+        {
+            printf("Failed to create pipe\n");
+            last_exit_status = 1;
+            break;
+        }
 
-    if (strcmp(argv[0], "env") == 0 || strcmp(argv[0], "printenv") == 0)
-        return builtin_env_like(argc, argv);
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            printf("Failed to fork\n");
+            last_exit_status = 1;
+            if (fds[0] >= 0)
+            {
+                close(fds[0]);
+                close(fds[1]);
+            }
+            break;
+        }
+
+        if (pid == 0)
+        {
+            /* Child process */
+            if (in_fd >= 0)
+                dup2(in_fd, STDIN_FILENO);
+            if (fds[1] >= 0)
+                dup2(fds[1], STDOUT_FILENO);
+            execve(fullpath, cmd_argv, child_envp);
+            printf("execve failed for '%s'\n", fullpath);
+            exit(1);
+        }
 
-    if (strcmp(argv[0], "export") == 0)
-        return builtin_export(argc, argv);
+        /* Parent: the stages hold the pipe ends from here on */
+        pids[started++] = pid;
+        if (in_fd >= 0)
+            close(in_fd);
+        if (fds[1] >= 0)
+            close(fds[1]);
+        in_fd = fds[0];
+    }
 
-    if (strcmp(argv[0], "unset") == 0)
-        return builtin_unset(argc, argv);
+    /* set when a stage failed to start */
+    if (in_fd >= 0)
+        close(in_fd);
 
-    if (strcmp(argv[0], "repeat") == 0)
-        return builtin_repeat(argc, argv);
+    if (started == 0)
+        return;
 
-    if (strcmp(argv[0], "help") == 0)
-        return builtin_help(argc, argv);
+    if (background && started == stage_cnt)
+    {
+        last_bg_pid = pids[started - 1];
+        return;
+    }
 
-    return 0; /* not a builtin */
+    /* the exit status of a pipeline is that of its last stage */
+    for (int i = 0; i < started; i++)
+    {
+        int status = 0;
+        pid_t res = waitpid(pids[i], &status, 0);
+        if (res < 0)
+        {
+            printf("waitpid failed for pid %d\n", (int)pids[i]);
+            last_exit_status = 1;
+        }
+        else if (started == stage_cnt && i == started - 1)
+        {
+            last_exit_status = (status >> 8) & 0xff;
+        }
+    }
 }
 
 /* ------------------------------------------------------------------
@@ -927,6 +1105,20 @@ static void process_command(char *line)
     char *cmd_argv[16];
     int cmd_argc;
 
+    char *stages[PIPELINE_MAX];
+    int stage_cnt = split_pipeline(line, stages, PIPELINE_MAX);
+    if (stage_cnt < 0)
+    {
+        printf("pipeline too long (max %d commands)\n", PIPELINE_MAX);
+        last_exit_status = 1;
+        return;
+    }
+    if (stage_cnt > 1)
+    {
+        run_pipeline(stages, stage_cnt);
+        return;
+    }
+
     /* parse with quote support */
     cmd_argc = parse_arguments(line, cmd_argv, 15);
     cmd_argv[cmd_argc] = NULL;
@@ -0,0 +1,162 @@
+// shm_ring.c
+//
+// Producer/consumer over a ring buffer in POSIX shared memory. The parent
+// creates /dev/shm/ring and forks; the child opens the object by name, maps
+// it and consumes what the parent produces, checking every message.
+#include "stdio.h"
+#include "stdlib.h"
+#include "unistd.h"
+#include "fcntl.h"
+#include "time.h"
+#include "sys/mman.h"
+
+#define SHM_NAME        "/ring"
+#define RING_SLOTS      1024    /* power of 2 */
+#define DEFAULT_MSGS    1000000
+
+struct ring
+{
+    /* Next slot the producer fills / the consumer takes; both only grow */
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    /* Written by the consumer when it is done */
+    volatile uint32_t received;
+    volatile uint32_t errors;
+    uint32_t slots[RING_SLOTS];
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static struct ring *ring_map(int fd)
+{
+    struct ring *ring = mmap(NULL, sizeof(struct ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED)
+    {
+        printf("shm_ring: mmap failed\n");
+        exit(1);
+    }
+    return ring;
+}
+
+/* Scheduling is cooperative, so an empty or full ring yields to the other side */
+static void consume(uint32_t msgs)
+{
+    int fd = shm_open(SHM_NAME, O_RDWR, 0);
+    if (fd < 0)
+    {
+        printf("shm_ring: consumer can't open %s\n", SHM_NAME);
+        exit(1);
+    }
+    struct ring *ring = ring_map(fd);
+    close(fd);
+
+    uint32_t errors = 0;
+    uint32_t tail = ring->tail;
+    while (tail < msgs)
+    {
+        uint32_t head = ring->head;
+        if (head == tail)
+        {
+            sched_yield();
+            continue;
+        }
+
+        for (; tail != head; tail++)
+        {
+            if (ring->slots[tail & (RING_SLOTS - 1)] != tail * 2654435761u)
+            {
+                errors++;
+            }
+        }
+        ring->tail = tail;
+    }
+
+    ring->errors = errors;
+    ring->received = tail;
+    munmap(ring, sizeof(struct ring));
+    exit(0);
+}
+
+static void produce(struct ring *ring, uint32_t msgs)
+{
+    uint32_t head = ring->head;
+    while (head < msgs)
+    {
+        uint32_t room = RING_SLOTS - (head - ring->tail);
+        if (room == 0)
+        {
+            sched_yield();
+            continue;
+        }
+
+        for (; room > 0 && head < msgs; room--, head++)
+        {
+            ring->slots[head & (RING_SLOTS - 1)] = head * 2654435761u;
+        }
+        ring->head = head;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t msgs = DEFAULT_MSGS;
+    if (argc > 1)
+    {
+        msgs = (uint32_t) atoi(argv[1]);
+    }
+
+    /* A previous run may have been killed before cleaning up */
+    shm_unlink(SHM_NAME);
+
+    int fd = shm_open(SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        printf("shm_ring: can't create %s\n", SHM_NAME);
+        return 1;
+    }
+    if (ftruncate(fd, sizeof(struct ring)) < 0)
+    {
+        printf("shm_ring: ftruncate failed\n");
+        return 1;
+    }
+
+    /* The mapping keeps the object alive once the descriptor is gone */
+    struct ring *ring = ring_map(fd);
+    close(fd);
+
+    uint64_t start = now_ns();
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        printf("shm_ring: fork failed\n");
+        return 1;
+    }
+    if (pid == 0)
+    {
+        consume(msgs);
+    }
+
+    produce(ring, msgs);
+    waitpid(pid, NULL, 0);
+
+    uint64_t us = (now_ns() - start) / 1000ULL;
+    if (us == 0)
+    {
+        us = 1;
+    }
+
+    printf("shm_ring: %u messages, %u received, %u errors, %llu us, %llu msgs/s\n",
+           msgs, ring->received, ring->errors, (unsigned long long) us,
+           (unsigned long long) ((uint64_t) msgs * 1000000ULL / us));
+
+    int failed = ring->received != msgs || ring->errors != 0;
+    munmap(ring, sizeof(struct ring));
+    shm_unlink(SHM_NAME);
+    return failed;
+}
@@ -0,0 +1,128 @@
+// tmpfs_bench.c
+//
+// tmpfs file life cycle: creates and writes a number of files under /tmp,
+// reads them all back and unlinks them, timing each phase separately.
+//
+// usage: tmpfs_bench [files] [KiB per file]
+#include "fcntl.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "time.h"
+#include "unistd.h"
+
+#define DEFAULT_FILES   128
+#define DEFAULT_KIB     16
+#define IO_SIZE         4096
+
+static char buf[IO_SIZE];
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void file_path(char *path, size_t size, int i)
+{
+    snprintf(path, size, "/tmp/bench.%d", i);
+}
+
+static void report(const char *phase, int files, uint64_t bytes, uint64_t ns)
+{
+    if (ns == 0)
+    {
+        ns = 1;
+    }
+    printf("tmpfs_bench: %s %d files: %llu ms, %llu us/file",
+           phase, files,
+           (unsigned long long) (ns / 1000000ULL),
+           (unsigned long long) (ns / 1000ULL / (uint64_t) files));
+    if (bytes > 0)
+    {
+        /* bytes per us is MB/s */
+        printf(", %llu MB/s", (unsigned long long) (bytes * 1000ULL / ns));
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    int files = argc > 1 ? atoi(argv[1]) : DEFAULT_FILES;
+    int kib = argc > 2 ? atoi(argv[2]) : DEFAULT_KIB;
+    if (files <= 0 || kib < 0)
+    {
+        printf("usage: tmpfs_bench [files] [KiB per file]\n");
+        return 1;
+    }
+
+    size_t file_size = (size_t) kib * 1024;
+    uint64_t total = (uint64_t) files * file_size;
+    char path[32];
+
+    for (size_t i = 0; i < sizeof(buf); i++)
+    {
+        buf[i] = (char) i;
+    }
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < files; i++)
+    {
+        file_path(path, sizeof(path), i);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            printf("tmpfs_bench: can't create %s\n", path);
+            return 1;
+        }
+        for (size_t done = 0; done < file_size; done += IO_SIZE)
+        {
+            size_t n = file_size - done < IO_SIZE ? file_size - done : IO_SIZE;
+            if (write(fd, buf, n) != (ssize_t) n)
+            {
+                printf("tmpfs_bench: short write to %s\n", path);
+                return 1;
+            }
+        }
+        close(fd);
+    }
+    report("create", files, total, now_ns() - start);
+
+    start = now_ns();
+    for (int i = 0; i < files; i++)
+    {
+        file_path(path, sizeof(path), i);
+        int fd = open(path, O_RDONLY, 0);
+        if (fd < 0)
+        {
+            printf("tmpfs_bench: can't open %s\n", path);
+            return 1;
+        }
+        uint64_t got = 0;
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+        {
+            got += (uint64_t) n;
+        }
+        close(fd);
+        if (got != file_size)
+        {
+            printf("tmpfs_bench: %s has %llu bytes\n", path, (unsigned long long) got);
+            return 1;
+        }
+    }
+    report("read", files, total, now_ns() - start);
+
+    start = now_ns();
+    for (int i = 0; i < files; i++)
+    {
+        file_path(path, sizeof(path), i);
+        if (unlink(path) < 0)
+        {
+            printf("tmpfs_bench: can't unlink %s\n", path);
+            return 1;
+        }
+    }
+    report("unlink", files, 0, now_ns() - start);
+    return 0;
+}
@@ -1,90 +1,219 @@
 // bin_fs.c
-
+//
+// /bin, served from the packed binary image that tools/mkbinfs.c builds
+// (see kernel/binfs.h). A Multiboot boot passes it as the initrd, so the
+// binaries change without relinking the kernel; the disk image boot has it
+// embedded in the kernel. Only the compressed image is kept in memory;
+// blocks are decompressed on demand into a small cache, so
+// memory holds just the parts of binaries that are actually read or
+// executed. The cache is direct mapped on the block number, which keeps the
+// blocks of one file in different slots.
+
+#include "errno.h"
 #include "kernel/files.h"
 #include "kernel/fs_util.h"
 #include "kernel/elf_loader.h"
+#include "kernel/binfs.h"
+#include "kernel/lz4.h"
+#include "kernel/mm.h"
+#include "kernel/console.h"
 #include "kernel/kutils.h"
+#include "kernel/vfs.h"
+#include "kernel/boot.h"
+
+#define BIN_MAX_FILES       64
+#define BIN_CACHE_BLOCKS    64
+
+/* Only linked into the kernel of the disk image */
+extern const uint8_t _binary_binfs_img_start[] __attribute__((weak));
+extern const uint8_t _binary_binfs_img_end[] __attribute__((weak));
 
-/* find_bin is provided by the ELF / embedded app layer. */
-/* const struct embedded_bin *find_bin(const char *name); */
+struct bin_cache_slot
+{
+    uint32_t block;
+    /* Frame holding the decompressed block; 0 = empty */
+    uintptr_t pa;
+};
+
+static struct
+{
+    const uint8_t *image;
+    struct embedded_bin files[BIN_MAX_FILES];
+    uint32_t file_cnt;
+    const uint32_t *block_off;
+
+    struct bin_cache_slot cache[BIN_CACHE_BLOCKS];
+    uint64_t hits;
+    uint64_t misses;
+} bins;
 
 /* ------------------------------------------------------------
- * Helper to lookup bin by pathname
+ * Image
  * ------------------------------------------------------------ */
 
-static int bin_lookup(const char *pathname, const struct embedded_bin **out_bin)
+void bin_fs_init(void)
 {
-    if (!pathname || *pathname == '\0')
+    size_t image_size = 0;
+    const uint8_t *image = boot_initrd(&image_size);
+    if (!image && _binary_binfs_img_start)
     {
-        return -1;
+        image = _binary_binfs_img_start;
+        image_size = (size_t) (_binary_binfs_img_end - _binary_binfs_img_start);
+    }
+    if (!image)
+    {
+        kprintf("Bin fs: no image; boot with the initrd.\n");
+        return;
     }
 
-    const struct embedded_bin *bin = find_bin(pathname);
-    if (!bin)
+    const struct binfs_super *super = (const struct binfs_super *) image;
+
+    if (image_size < sizeof(*super) || super->magic != BINFS_MAGIC || super->version != BINFS_VERSION ||
+        super->file_cnt > BIN_MAX_FILES)
     {
-        return -1;
+        kprintf("Bin fs: bad image.\n");
+        return;
     }
 
-    *out_bin = bin;
-    return 0;
+    const struct binfs_entry *entries = (const struct binfs_entry *) (super + 1);
+    for (uint32_t i = 0; i < super->file_cnt; i++)
+    {
+        struct embedded_bin *bin = &bins.files[i];
+        bin->name = entries[i].name;
+        bin->base = entries[i].name + entries[i].base_off;
+        bin->size = entries[i].size;
+        bin->first_block = entries[i].first_block;
+    }
+    bins.file_cnt = super->file_cnt;
+    bins.block_off = (const uint32_t *) (entries + super->file_cnt);
+    bins.image = image;
+
+    kprintf("Bin fs: %u binaries, %u KB packed into %u KB.\n",
+            super->file_cnt, super->raw_size / 1024, (uint32_t) image_size / 1024);
 }
 
-/* ------------------------------------------------------------
- * Fill dirent entries for /bin from embedded_bins
- * ------------------------------------------------------------ */
+const struct embedded_bin *find_bin(const char *name)
+{
+    uint32_t lo = 0;
+    uint32_t hi = bins.file_cnt;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = k_strcmp(name, bins.files[mid].name);
+        if (cmp == 0)
+        {
+            return &bins.files[mid];
+        }
+        if (cmp < 0)
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
 
-static void fill_dirent_from_bin(struct dirent *de,
-                                 const struct embedded_bin *bin,
-                                 uint32_t ino)
+/* Kernel address of block idx of bin, decompressed; NULL when out of memory or corrupt */
+static const uint8_t *bin_block(const struct embedded_bin *bin, uint32_t idx)
 {
-    de->d_ino = ino;
-    de->d_reclen = (uint16_t) sizeof(struct dirent);
-    de->d_type = DT_REG;
+    uint32_t block = bin->first_block + idx;
+    struct bin_cache_slot *slot = &bins.cache[block % BIN_CACHE_BLOCKS];
+    if (slot->pa && slot->block == block)
+    {
+        bins.hits++;
+        return mm_pa_to_kva(slot->pa);
+    }
+    bins.misses++;
 
-    /* Strip any leading path: "/bin/ls" -> "ls" */
-    const char *name = bin->name;
-    const char *base = name;
+    if (!slot->pa)
+    {
+        slot->pa = mm_frame_alloc();
+        if (!slot->pa)
+        {
+            return NULL;
+        }
+    }
+    /* Invalid until the block is in */
+    slot->block = UINT32_MAX;
 
-    const char *p = k_strrchr(name, '/');
-    if (p && p[1] != '\0')
+    size_t raw_len = bin->size - idx * BINFS_BLOCK_SIZE;
+    if (raw_len > BINFS_BLOCK_SIZE)
     {
-        base = p + 1;
+        raw_len = BINFS_BLOCK_SIZE;
     }
 
-    size_t len = k_strlen(base);
-    if (len >= sizeof(de->d_name))
+    const uint8_t *src = bins.image + bins.block_off[block];
+    size_t src_len = bins.block_off[block + 1] - bins.block_off[block];
+    uint8_t *dst = mm_pa_to_kva(slot->pa);
+
+    if (src_len == raw_len)
+    {
+        k_memcpy(dst, src, raw_len);
+    }
+    else if (lz4_decompress(src, src_len, dst, BINFS_BLOCK_SIZE) != (int) raw_len)
     {
-        len = sizeof(de->d_name) - 1;
+        kprintf("bin_block: corrupt block %u of %s\n", idx, bin->name);
+        return NULL;
     }
 
-    k_memcpy(de->d_name, base, len);
-    de->d_name[len] = '\0';
+    slot->block = block;
+    return dst;
 }
 
-int elf_fill_bin_dirents(struct dirent *buf, unsigned int max_entries)
+ssize_t bin_pread(const struct embedded_bin *bin, void *buf, size_t count, size_t pos)
 {
-    unsigned int idx = 0;
-
-    if (!buf || max_entries == 0)
+    if (pos >= bin->size)
     {
         return 0;
     }
+    if (count > bin->size - pos)
+    {
+        count = bin->size - pos;
+    }
 
-    for (size_t i = 0; i < embedded_bin_count && idx < max_entries; ++i)
+    uint8_t *dst = buf;
+    size_t done = 0;
+    while (done < count)
     {
-        fill_dirent_from_bin(&buf[idx], &embedded_bins[i],
-                             (uint32_t) (i + 1));  // fake inode
-        idx++;
+        size_t off = pos + done;
+        size_t in_block = off % BINFS_BLOCK_SIZE;
+        size_t chunk = BINFS_BLOCK_SIZE - in_block;
+        if (chunk > count - done)
+        {
+            chunk = count - done;
+        }
+
+        const uint8_t *block = bin_block(bin, (uint32_t) (off / BINFS_BLOCK_SIZE));
+        if (!block)
+        {
+            return -EIO;
+        }
+        k_memcpy(dst + done, block + in_block, chunk);
+        done += chunk;
     }
 
-    return (int) idx;
+    return (ssize_t) done;
+}
+
+void bin_cache_stat(struct bin_cache_stat *stat)
+{
+    k_memset(stat, 0, sizeof(*stat));
+    for (uint32_t i = 0; i < BIN_CACHE_BLOCKS; i++)
+    {
+        stat->pages += bins.cache[i].pa != 0;
+    }
+    stat->hits = bins.hits;
+    stat->misses = bins.misses;
 }
 
 /* ------------------------------------------------------------------
  * /bin file operations
  * ------------------------------------------------------------------ */
 
-static ssize_t bin_read(struct file *file, void *buf, size_t count)
+static ssize_t bin_file_pread(struct file *file, void *buf, size_t count, off_t offset)
 {
     if (!file || !buf)
     {
@@ -98,23 +227,17 @@ static ssize_t bin_read(struct file *file, void *buf, size_t count)
         return -1;
     }
 
-    size_t size = (size_t) (bin->end - bin->start);
+    return bin_pread(bin, buf, count, (size_t) offset);
+}
 
-    /* Check if we're at or past EOF */
-    if (file->pos >= size)
+static ssize_t bin_read(struct file *file, void *buf, size_t count)
+{
+    ssize_t n = bin_file_pread(file, buf, count, (off_t) file->pos);
+    if (n > 0)
     {
-        return 0;  /* EOF */
+        file->pos += n;
     }
-
-    /* Calculate how much to read */
-    size_t remaining = size - file->pos;
-    size_t to_read = (count < remaining) ? count : remaining;
-
-    /* Copy data */
-    k_memcpy(buf, bin->start + file->pos, to_read);
-    file->pos += to_read;
-
-    return (ssize_t) to_read;
+    return n;
 }
 
 static int bin_getdents(struct file *file, struct dirent *buf, unsigned int count)
@@ -124,31 +247,22 @@ static int bin_getdents(struct file *file, struct dirent *buf, unsigned int coun
         return 0;
     }
 
-    /* Only one page of entries; subsequent calls return 0. */
-    if (file->pos > 0)
-    {
-        return 0;
-    }
-
     unsigned int max_entries = count / sizeof(struct dirent);
     unsigned int idx = 0;
 
-    fs_add_entry(buf, max_entries, &idx, 1, DT_DIR, ".");
-    fs_add_entry(buf, max_entries, &idx, 1, DT_DIR, "..");
+    fs_dir_emit(file, buf, max_entries, &idx, 0, 1, DT_DIR, ".");
+    fs_dir_emit(file, buf, max_entries, &idx, 1, 1, DT_DIR, "..");
 
-    if (idx < max_entries)
+    /* Binary i of the image is at position 2 + i, with a fake inode */
+    for (uint32_t i = 0; i < bins.file_cnt; i++)
     {
-        unsigned int remaining = max_entries - idx;
-        int written = elf_fill_bin_dirents(&buf[idx], remaining);
-        if (written > 0)
+        if (!fs_dir_emit(file, buf, max_entries, &idx, 2 + i, i + 1, DT_REG, bins.files[i].base))
         {
-            idx += (unsigned int) written;
+            break;
         }
     }
 
-    int size = (int) (idx * sizeof(struct dirent));
-    file->pos += size;
-    return size;
+    return (int) (idx * sizeof(struct dirent));
 }
 
 int bin_fstat(struct file *file, struct stat *stat){
@@ -164,36 +278,49 @@ int bin_fstat(struct file *file, struct stat *stat){
     }
 
     /* Regular embedded binary */
-    size_t size = (size_t)(bin->end - bin->start);
-
     stat->st_mode  = S_IFREG | 0555;
     stat->st_nlink = 1;
-    stat->st_size  = (off_t)size;
+    stat->st_size  = (off_t)bin->size;
 
     return 0;
 }
 
-int bin_open(struct file *file)
+/* The image holds full paths, which is what the dentry spells out */
+static int bin_lookup(struct inode *dir, struct dentry *dentry)
 {
-    file->file_ops.read = bin_read;
-    file->file_ops.getdents = bin_getdents;
-    file->file_ops.fstat = bin_fstat;
+    (void) dir;
 
-    /* Opening the /bin directory itself is allowed. */
-    if ((k_strcmp(file->pathname, "/bin") == 0) ||
-        (k_strcmp(file->pathname, "/bin/") == 0))
+    char path[BINFS_NAME_MAX];
+    if (d_path(dentry, path, sizeof(path)) < 0)
     {
         return 0;
     }
 
-    const struct embedded_bin *bin = NULL;
-    if (bin_lookup(file->pathname, &bin) < 0)
+    const struct embedded_bin *bin = find_bin(path);
+    if (!bin)
     {
-        /* No such program -> open() should fail. */
-        return -1;
+        return 0;
+    }
+
+    struct inode *inode = inode_alloc(&bin_fs, (uint32_t) (bin - bins.files) + 1, S_IFREG | 0555, (void *) bin);
+    if (!inode)
+    {
+        return -ENOMEM;
     }
 
-    file->driver_data = (void *) bin;
+    d_instantiate(dentry, inode);
+    return 0;
+}
+
+int bin_open(struct file *file)
+{
+    file->file_ops.read = bin_read;
+    file->file_ops.pread = bin_file_pread;
+    file->file_ops.getdents = bin_getdents;
+    file->file_ops.fstat = bin_fstat;
+
+    /* NULL for the /bin directory itself */
+    file->driver_data = file->inode->private;
     return 0;
 }
 
@@ -203,5 +330,6 @@ int bin_open(struct file *file)
  * ------------------------------------------------------------------ */
 
 struct fs bin_fs = {
+        .lookup   = bin_lookup,
         .open     = bin_open,
 };
\ No newline at end of file
@@ -0,0 +1,435 @@
+// dcache.c
+//
+// Inode pool and dentry cache (see include/kernel/dcache.h).
+//
+// Every dentry holds a reference to its parent, so a directory stays cached
+// as long as anything below it does and eviction always starts at the
+// leaves. Unused dentries stay hashed on the LRU list until their slot is
+// needed; a dentry that is dropped while still in use (stale, or shadowed by
+// a mount) is unhashed and freed by its last dput.
+
+#include "errno.h"
+#include "kernel/dcache.h"
+#include "kernel/files.h"
+#include "kernel/kutils.h"
+
+#define DCACHE_SIZE         512
+#define DCACHE_HASH_SIZE    256
+#define DCACHE_HASH_MASK    (DCACHE_HASH_SIZE - 1)
+#define MAX_INODES          512
+
+static struct
+{
+    struct dentry dentries[DCACHE_SIZE];
+    /* Free dentries, chained through hash_next */
+    struct dentry *free;
+    struct dentry *hash[DCACHE_HASH_SIZE];
+    dlist_t lru;
+    struct dentry *root;
+    uint32_t dentries_used;
+
+    struct inode inodes[MAX_INODES];
+    struct inode *free_inodes;
+    uint32_t inodes_used;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} dcache;
+
+void dcache_init(void)
+{
+    k_memset(&dcache, 0, sizeof(dcache));
+    dlist_init(&dcache.lru);
+
+    for (int i = DCACHE_SIZE - 1; i >= 0; i--)
+    {
+        dcache.dentries[i].hash_next = dcache.free;
+        dcache.free = &dcache.dentries[i];
+    }
+
+    for (int i = MAX_INODES - 1; i >= 0; i--)
+    {
+        dcache.inodes[i].next_free = dcache.free_inodes;
+        dcache.free_inodes = &dcache.inodes[i];
+    }
+}
+
+/* ------------------------------------------------------------
+ * Hash table
+ * ------------------------------------------------------------ */
+
+/* FNV-1a over the name, seeded with the parent */
+static uint32_t d_hash(const struct dentry *parent, const char *name, size_t len)
+{
+    uint32_t h = 2166136261u ^ (uint32_t) (uintptr_t) parent;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (uint8_t) name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static struct dentry *d_hash_find(const struct dentry *parent, const char *name, size_t len, uint32_t hash)
+{
+    for (struct dentry *d = dcache.hash[hash & DCACHE_HASH_MASK]; d; d = d->hash_next)
+    {
+        if (d->hash == hash && d->parent == parent && d->name_len == len &&
+            k_memcmp(d->name, name, len) == 0)
+        {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+static void d_unhash(struct dentry *dentry)
+{
+    struct dentry **link = &dcache.hash[dentry->hash & DCACHE_HASH_MASK];
+    while (*link != dentry)
+    {
+        link = &(*link)->hash_next;
+    }
+    *link = dentry->hash_next;
+    dentry->hash_next = NULL;
+    dentry->flags &= (uint8_t) ~DENTRY_HASHED;
+}
+
+/* ------------------------------------------------------------
+ * Dentries
+ * ------------------------------------------------------------ */
+
+static void d_free(struct dentry *dentry)
+{
+    struct dentry *parent = dentry->parent;
+    if (dentry->inode)
+    {
+        inode_put(dentry->inode);
+    }
+
+    dentry->inode = NULL;
+    dentry->parent = NULL;
+    dentry->flags = 0;
+    dentry->hash_next = dcache.free;
+    dcache.free = dentry;
+    dcache.dentries_used--;
+
+    if (parent)
+    {
+        dput(parent);
+    }
+}
+
+/* Free the least recently used unused dentry; false if there is none */
+static bool d_evict_one(void)
+{
+    if (dlist_empty(&dcache.lru))
+    {
+        return false;
+    }
+
+    struct dentry *dentry = dlist_entry(dcache.lru.head.next, struct dentry, lru);
+    dlist_remove(&dentry->lru);
+    d_unhash(dentry);
+    dcache.evictions++;
+    d_free(dentry);
+    return true;
+}
+
+/* Unhash dentry; it is freed right away when nobody uses it */
+void d_drop(struct dentry *dentry)
+{
+    if (!(dentry->flags & DENTRY_HASHED))
+    {
+        return;
+    }
+
+    d_unhash(dentry);
+    if (dentry->refs == 0)
+    {
+        dlist_remove(&dentry->lru);
+        d_free(dentry);
+    }
+}
+
+/* A new negative, hashed dentry with one reference */
+static struct dentry *d_alloc(struct dentry *parent, const char *name, size_t len, uint32_t hash)
+{
+    if (!dcache.free && !d_evict_one())
+    {
+        return NULL;
+    }
+
+    struct dentry *dentry = dcache.free;
+    dcache.free = dentry->hash_next;
+    dcache.dentries_used++;
+
+    k_memset(dentry, 0, sizeof(*dentry));
+    dlist_node_init(&dentry->lru);
+    dentry->parent = parent ? dget(parent) : NULL;
+    dentry->refs = 1;
+    dentry->hash = hash;
+    dentry->name_len = (uint8_t) len;
+    k_memcpy(dentry->name, name, len);
+
+    struct dentry **bucket = &dcache.hash[hash & DCACHE_HASH_MASK];
+    dentry->hash_next = *bucket;
+    *bucket = dentry;
+    dentry->flags = DENTRY_HASHED;
+    return dentry;
+}
+
+struct dentry *dget(struct dentry *dentry)
+{
+    if (dentry->refs == 0 && (dentry->flags & DENTRY_HASHED))
+    {
+        dlist_remove(&dentry->lru);
+    }
+    dentry->refs++;
+    return dentry;
+}
+
+void dput(struct dentry *dentry)
+{
+    if (dentry->refs == 0)
+    {
+        panic("dput: no references");
+    }
+
+    dentry->refs--;
+    if (dentry->refs > 0)
+    {
+        return;
+    }
+
+    if (dentry->flags & DENTRY_HASHED)
+    {
+        dlist_push_back(&dcache.lru, &dentry->lru);
+        return;
+    }
+
+    d_free(dentry);
+}
+
+struct dentry *d_root(void)
+{
+    return dcache.root;
+}
+
+int d_set_root(struct inode *root)
+{
+    if (dcache.root)
+    {
+        return -EBUSY;
+    }
+
+    /* Hashed under a NULL parent, which no lookup ever uses */
+    struct dentry *dentry = d_alloc(NULL, "/", 1, d_hash(NULL, "/", 1));
+    if (!dentry)
+    {
+        return -ENOMEM;
+    }
+
+    dentry->inode = root;
+    dentry->flags |= DENTRY_PINNED;
+    dcache.root = dentry;
+    return 0;
+}
+
+int d_lookup(struct dentry *dir, const char *name, size_t len, struct dentry **out)
+{
+    if (len >= DNAME_MAX)
+    {
+        return -ENAMETOOLONG;
+    }
+
+    struct fs *fs = dir->inode->fs;
+    uint32_t hash = d_hash(dir, name, len);
+
+    struct dentry *dentry = d_hash_find(dir, name, len, hash);
+    if (dentry)
+    {
+        if ((dentry->flags & DENTRY_PINNED) || !fs->revalidate || fs->revalidate(dentry))
+        {
+            dcache.hits++;
+            *out = dget(dentry);
+            return 0;
+        }
+
+        /* Stale; whoever still uses it keeps it until their dput */
+        d_drop(dentry);
+    }
+
+    dcache.misses++;
+    dentry = d_alloc(dir, name, len, hash);
+    if (!dentry)
+    {
+        return -ENOMEM;
+    }
+
+    int res = fs->lookup ? fs->lookup(dir->inode, dentry) : 0;
+    if (res < 0)
+    {
+        d_drop(dentry);
+        dput(dentry);
+        return res;
+    }
+
+    *out = dentry;
+    return 0;
+}
+
+int d_mount(struct dentry *dir, const char *name, struct inode *root)
+{
+    size_t len = k_strlen(name);
+    if (len == 0 || len >= DNAME_MAX)
+    {
+        return -EINVAL;
+    }
+
+    uint32_t hash = d_hash(dir, name, len);
+    struct dentry *old = d_hash_find(dir, name, len, hash);
+    if (old)
+    {
+        if (old->flags & DENTRY_PINNED)
+        {
+            return -EBUSY;
+        }
+        d_drop(old);
+    }
+
+    struct dentry *dentry = d_alloc(dir, name, len, hash);
+    if (!dentry)
+    {
+        return -ENOMEM;
+    }
+
+    /* The allocation reference is the pin */
+    dentry->inode = root;
+    dentry->flags |= DENTRY_PINNED;
+    return 0;
+}
+
+void d_instantiate(struct dentry *dentry, struct inode *inode)
+{
+    if (dentry->inode)
+    {
+        panic("d_instantiate: dentry isn't negative");
+    }
+    dentry->inode = inode;
+}
+
+void d_delete(struct dentry *dentry)
+{
+    if (dentry->inode)
+    {
+        inode_put(dentry->inode);
+        dentry->inode = NULL;
+    }
+}
+
+int d_path(const struct dentry *dentry, char *buf, size_t size)
+{
+    if (size < 2)
+    {
+        return -ENAMETOOLONG;
+    }
+
+    /* Build it back to front */
+    size_t pos = size - 1;
+    buf[pos] = '\0';
+    for (const struct dentry *d = dentry; d->parent; d = d->parent)
+    {
+        if (pos < (size_t) d->name_len + 1)
+        {
+            return -ENAMETOOLONG;
+        }
+        pos -= d->name_len;
+        k_memcpy(buf + pos, d->name, d->name_len);
+        buf[--pos] = '/';
+    }
+
+    if (pos == size - 1)
+    {
+        buf[--pos] = '/';
+    }
+
+    size_t len = size - 1 - pos;
+    k_memmove(buf, buf + pos, len + 1);
+    return (int) len;
+}
+
+/* ------------------------------------------------------------
+ * Inodes
+ * ------------------------------------------------------------ */
+
+struct inode *inode_alloc(struct fs *fs, uint32_t ino, mode_t mode, void *private)
+{
+    /* Inodes are mostly held by cached dentries: evict those first */
+    while (!dcache.free_inodes)
+    {
+        if (!d_evict_one())
+        {
+            return NULL;
+        }
+    }
+
+    struct inode *inode = dcache.free_inodes;
+    dcache.free_inodes = inode->next_free;
+    dcache.inodes_used++;
+
+    inode->ino = ino;
+    inode->mode = mode;
+    inode->refs = 1;
+    inode->fs = fs;
+    inode->private = private;
+    inode->next_free = NULL;
+    return inode;
+}
+
+void inode_get(struct inode *inode)
+{
+    inode->refs++;
+}
+
+void inode_put(struct inode *inode)
+{
+    if (inode->refs == 0)
+    {
+        panic("inode_put: no references");
+    }
+
+    inode->refs--;
+    if (inode->refs > 0)
+    {
+        return;
+    }
+
+    if (inode->fs->evict)
+    {
+        inode->fs->evict(inode);
+    }
+
+    inode->private = NULL;
+    inode->next_free = dcache.free_inodes;
+    dcache.free_inodes = inode;
+    dcache.inodes_used--;
+}
+
+void dcache_stat(struct dcache_stat *stat)
+{
+    k_memset(stat, 0, sizeof(*stat));
+
+    for (uint32_t i = 0; i < DCACHE_SIZE; i++)
+    {
+        const struct dentry *d = &dcache.dentries[i];
+        stat->negative += (d->flags & DENTRY_HASHED) && !d->inode;
+    }
+
+    stat->dentries = dcache.dentries_used;
+    stat->inodes = dcache.inodes_used;
+    stat->hits = dcache.hits;
+    stat->misses = dcache.misses;
+    stat->evictions = dcache.evictions;
+}
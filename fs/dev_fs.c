@@ -1,9 +1,11 @@
 // dev_fs.c
 
+#include "errno.h"
 #include "kernel/files.h"
 #include "kernel/fs_util.h"
 #include "kernel/kutils.h"
 #include "kernel/dev.h"
+#include "kernel/vfs.h"
 
 #define MAX_DEVICES 32
 
@@ -90,79 +92,76 @@ static int dev_getdents(struct file *file, struct dirent *buf, unsigned int coun
         return 0;
     }
 
-    if (file->pos > 0)
-    {
-        return 0;
-    }
-
     unsigned int max_entries = count / sizeof(struct dirent);
     unsigned int idx = 0;
 
-    fs_add_entry(buf, max_entries, &idx, 1, DT_DIR, ".");
-    fs_add_entry(buf, max_entries, &idx, 2, DT_DIR, "..");
+    fs_dir_emit(file, buf, max_entries, &idx, 0, 1, DT_DIR, ".");
+    fs_dir_emit(file, buf, max_entries, &idx, 1, 2, DT_DIR, "..");
 
+    /* Device slot i is at position 2 + i */
     for (int i = 0; i < MAX_DEVICES; i++)
     {
-        if (idx >= max_entries)
-        {
-            break;
-        }
-
         if (devices[i].active)
         {
-            fs_add_entry(buf, max_entries, &idx, 100 + i, DT_CHR, devices[i].name);
+            uint8_t type = devices[i].ops->type == S_IFBLK ? DT_BLK : DT_CHR;
+            if (!fs_dir_emit(file, buf, max_entries, &idx, 2 + (uint32_t) i, 100 + i, type, devices[i].name))
+            {
+                break;
+            }
         }
     }
 
-    int size = (int) (idx * sizeof(struct dirent));
-    file->pos += size;
-    return size;
+    return (int) (idx * sizeof(struct dirent));
 }
 
-static int dev_open(struct file *file)
+static int dev_lookup_name(struct inode *dir, struct dentry *dentry)
 {
-    // Must start with /dev
-    if (k_strncmp(file->pathname, "/dev", 4) != 0)
-    {
-        return -1;
-    }
+    (void) dir;
 
-    file->file_ops.getdents = dev_getdents;
-
-    // Opening /dev or /dev/ itself (directory listing)
-    if (file->pathname[4] == '\0' ||
-        (file->pathname[4] == '/' && file->pathname[5] == '\0'))
+    struct dev *dev = dev_lookup(dentry->name);
+    if (!dev)
     {
-        return 0;  // Allow directory operations
+        return 0;
     }
 
-    // Must have /dev/ prefix for devices
-    if (file->pathname[4] != '/')
+    mode_t type = dev->ops->type ? dev->ops->type : S_IFCHR;
+    struct inode *inode = inode_alloc(&dev_fs, (uint32_t) (100 + (dev - devices)), type | 0666, dev);
+    if (!inode)
     {
-        return -1;
+        return -ENOMEM;
     }
 
-    // Get device name after /dev/
-    const char *dev_name = file->pathname + 5;
+    d_instantiate(dentry, inode);
+    return 0;
+}
 
-    // Empty device name is invalid
-    if (dev_name[0] == '\0')
-    {
-        return -1;
-    }
+/* Devices can be registered at any time, so a missing name isn't cached */
+static bool dev_revalidate(struct dentry *dentry)
+{
+    return dentry->inode != NULL;
+}
 
-    struct dev *dev = dev_lookup(dev_name);
+static int dev_open(struct file *file)
+{
+    file->file_ops.getdents = dev_getdents;
 
+    struct dev *dev = file->inode->private;
+
+    // Opening /dev itself (directory listing)
     if (!dev)
     {
-        kprintf("dev_open dev not found %s\n", dev_name);
-        return -1;
+        return 0;  // Allow directory operations
     }
 
     file->driver_data = dev->driver_data;
     file->file_ops.write = dev->ops->write;
     file->file_ops.read = dev->ops->read;
     file->file_ops.close = dev->ops->close;
+    file->file_ops.poll = dev->ops->poll;
+    file->file_ops.pread = dev->ops->pread;
+    file->file_ops.pwrite = dev->ops->pwrite;
+    file->file_ops.fstat = dev->ops->fstat;
+    file->file_ops.fsync = dev->ops->fsync;
 
     if (dev->ops->open)
     {
@@ -174,5 +173,7 @@ static int dev_open(struct file *file)
 
 
 struct fs dev_fs = {
-        .open     = dev_open,
+        .lookup     = dev_lookup_name,
+        .revalidate = dev_revalidate,
+        .open       = dev_open,
 };
\ No newline at end of file
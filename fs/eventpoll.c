@@ -0,0 +1,444 @@
+// eventpoll.c
+//
+// epoll (see include/kernel/eventpoll.h). An epoll instance lives behind
+// an anonymous inode; its items come from a fixed pool. An item sits on
+// the ready list from the first wakeup of its file until epoll_wait finds
+// it no longer ready, so a level triggered item is reported for as long
+// as it stays ready and an edge triggered one once per wakeup.
+
+#include "errno.h"
+#include "time.h"
+#include "kernel/eventpoll.h"
+#include "kernel/poll.h"
+#include "kernel/vfs.h"
+#include "kernel/sched.h"
+#include "kernel/clock.h"
+#include "kernel/kutils.h"
+
+#define MAX_EPOLLS      16
+#define MAX_EPITEMS     128
+/* Wait queues one file registers at most */
+#define EP_MAX_WAITS    2
+
+/* Item flags that aren't events */
+#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET)
+
+struct eventpoll
+{
+    bool active;
+    dlist_t items;
+    dlist_t ready;
+    /* epoll_wait sleepers, and epoll instances watching this one */
+    struct wait_queue wait;
+};
+
+struct epitem
+{
+    bool active;
+    /* In ep->items */
+    dlist_node_t ep_link;
+    /* In ep->ready; points to itself when not ready */
+    dlist_node_t ready_link;
+    struct epitem *file_next;
+    struct eventpoll *ep;
+    struct file *file;
+    int fd;
+    uint32_t events;
+    uint64_t data;
+    uint32_t wait_cnt;
+    struct wait_queue_entry waits[EP_MAX_WAITS];
+};
+
+/* Registers the item being added on the queues of its file */
+struct ep_pqueue
+{
+    /* Must stay first, the queue proc casts back */
+    struct poll_table pt;
+    struct epitem *item;
+};
+
+static struct eventpoll eventpolls[MAX_EPOLLS];
+static struct epitem epitems[MAX_EPITEMS];
+
+static struct fs eventpoll_fs;
+
+static bool ep_item_ready(const struct epitem *item)
+{
+    return item->ready_link.next != &item->ready_link;
+}
+
+/* ------------------------------------------------------------
+ * Wakeups
+ * ------------------------------------------------------------ */
+
+static void ep_poll_callback(struct wait_queue_entry *entry)
+{
+    struct epitem *item = entry->private;
+
+    /* Disabled by EPOLLONESHOT, or already waiting to be looked at */
+    if ((item->events & ~EP_PRIVATE_BITS) == 0 || ep_item_ready(item))
+    {
+        return;
+    }
+
+    dlist_push_back(&item->ep->ready, &item->ready_link);
+    wakeup(&item->ep->wait);
+}
+
+static void ep_queue_proc(struct wait_queue *queue, struct poll_table *pt)
+{
+    struct epitem *item = ((struct ep_pqueue *) pt)->item;
+    if (item->wait_cnt == EP_MAX_WAITS)
+    {
+        panic("epoll: too many wait queues");
+    }
+
+    struct wait_queue_entry *entry = &item->waits[item->wait_cnt++];
+    wait_queue_entry_init_func(entry, ep_poll_callback, item);
+    wait_queue_add(queue, entry);
+}
+
+/* ------------------------------------------------------------
+ * Items
+ * ------------------------------------------------------------ */
+
+static struct epitem *ep_find(struct eventpoll *ep, const struct file *file, int fd)
+{
+    dlist_node_t *node;
+    dlist_for_each(node, &ep->items)
+    {
+        struct epitem *item = dlist_entry(node, struct epitem, ep_link);
+        if (item->file == file && item->fd == fd)
+        {
+            return item;
+        }
+    }
+    return NULL;
+}
+
+static void ep_remove(struct epitem *item)
+{
+    for (uint32_t i = 0; i < item->wait_cnt; i++)
+    {
+        wait_queue_remove(&item->waits[i]);
+    }
+
+    dlist_remove(&item->ep_link);
+    dlist_remove(&item->ready_link);
+
+    struct epitem **link = &item->file->ep_items;
+    while (*link != item)
+    {
+        link = &(*link)->file_next;
+    }
+    *link = item->file_next;
+
+    item->active = false;
+}
+
+static int ep_insert(struct eventpoll *ep, struct file *file, int fd, const struct epoll_event *event)
+{
+    struct epitem *item = NULL;
+    for (uint32_t i = 0; i < MAX_EPITEMS; i++)
+    {
+        if (!epitems[i].active)
+        {
+            item = &epitems[i];
+            break;
+        }
+    }
+    if (item == NULL)
+    {
+        return -ENOSPC;
+    }
+
+    k_memset(item, 0, sizeof(*item));
+    item->active = true;
+    item->ep = ep;
+    item->file = file;
+    item->fd = fd;
+    item->events = event->events;
+    item->data = event->data.u64;
+    dlist_node_init(&item->ready_link);
+    dlist_push_back(&ep->items, &item->ep_link);
+    item->file_next = file->ep_items;
+    file->ep_items = item;
+
+    struct ep_pqueue epq = {.pt = {.queue_proc = ep_queue_proc}, .item = item};
+    uint32_t mask = vfs_file_poll(file, &epq.pt);
+    if (mask & (item->events | EPOLLERR | EPOLLHUP))
+    {
+        dlist_push_back(&ep->ready, &item->ready_link);
+        wakeup(&ep->wait);
+    }
+    return 0;
+}
+
+static void ep_modify(struct epitem *item, const struct epoll_event *event)
+{
+    item->events = event->events;
+    item->data = event->data.u64;
+
+    uint32_t mask = vfs_file_poll(item->file, NULL);
+    if ((mask & (item->events | EPOLLERR | EPOLLHUP)) && !ep_item_ready(item))
+    {
+        dlist_push_back(&item->ep->ready, &item->ready_link);
+        wakeup(&item->ep->wait);
+    }
+}
+
+void eventpoll_release(struct file *file)
+{
+    while (file->ep_items != NULL)
+    {
+        ep_remove(file->ep_items);
+    }
+}
+
+/*
+ * Report the ready items, up to maxevents. Items that turn out not to be
+ * ready leave the ready list; level triggered items that are go back on
+ * it for the next call.
+ */
+static int ep_send_events(struct eventpoll *ep, struct epoll_event *events, int maxevents)
+{
+    dlist_t again;
+    dlist_init(&again);
+    int count = 0;
+
+    while (count < maxevents && !dlist_empty(&ep->ready))
+    {
+        struct epitem *item = dlist_entry(ep->ready.head.next, struct epitem, ready_link);
+        dlist_remove(&item->ready_link);
+
+        uint32_t want = item->events & ~EP_PRIVATE_BITS;
+        if (want == 0)
+        {
+            continue;
+        }
+
+        uint32_t mask = vfs_file_poll(item->file, NULL) & (want | EPOLLERR | EPOLLHUP);
+        if (mask == 0)
+        {
+            continue;
+        }
+
+        events[count].events = mask;
+        events[count].data.u64 = item->data;
+        count++;
+
+        if (item->events & EPOLLONESHOT)
+        {
+            item->events &= EP_PRIVATE_BITS;
+        }
+        else if (!(item->events & EPOLLET))
+        {
+            dlist_push_back(&again, &item->ready_link);
+        }
+    }
+
+    while (!dlist_empty(&again))
+    {
+        dlist_node_t *node = again.head.next;
+        dlist_remove(node);
+        dlist_push_back(&ep->ready, node);
+    }
+    return count;
+}
+
+/* ------------------------------------------------------------
+ * The epoll file
+ * ------------------------------------------------------------ */
+
+static uint32_t ep_file_poll(struct file *file, struct poll_table *pt)
+{
+    struct eventpoll *ep = file->inode->private;
+    poll_wait(&ep->wait, pt);
+    return dlist_empty(&ep->ready) ? 0 : POLLIN | POLLRDNORM;
+}
+
+static off_t ep_llseek(struct file *file, off_t offset, int whence)
+{
+    (void) file;
+    (void) offset;
+    (void) whence;
+    return -ESPIPE;
+}
+
+static int ep_close(struct file *file)
+{
+    struct eventpoll *ep = file->inode->private;
+    while (!dlist_empty(&ep->items))
+    {
+        ep_remove(dlist_entry(ep->items.head.next, struct epitem, ep_link));
+    }
+    return 0;
+}
+
+static int ep_open(struct file *file)
+{
+    file->file_ops.poll = ep_file_poll;
+    file->file_ops.llseek = ep_llseek;
+    file->file_ops.close = ep_close;
+    return 0;
+}
+
+static void ep_evict(struct inode *inode)
+{
+    struct eventpoll *ep = inode->private;
+    ep->active = false;
+}
+
+static struct fs eventpoll_fs = {
+        .open     = ep_open,
+        .evict    = ep_evict,
+};
+
+/* The epoll instance behind epfd, or NULL */
+static struct eventpoll *ep_from_fd(struct task *task, int epfd)
+{
+    struct file *file = files_find_by_fd(&task->files, epfd);
+    if (file == NULL || file->inode->fs != &eventpoll_fs)
+    {
+        return NULL;
+    }
+    return file->inode->private;
+}
+
+/* ------------------------------------------------------------
+ * System calls
+ * ------------------------------------------------------------ */
+
+int eventpoll_create(struct task *task, int flags)
+{
+    if (flags & ~EPOLL_CLOEXEC)
+    {
+        return -EINVAL;
+    }
+
+    for (uint32_t i = 0; i < MAX_EPOLLS; i++)
+    {
+        struct eventpoll *ep = &eventpolls[i];
+        if (ep->active)
+        {
+            continue;
+        }
+
+        struct inode *inode = inode_alloc(&eventpoll_fs, i + 1, 0600, ep);
+        if (inode == NULL)
+        {
+            return -ENFILE;
+        }
+
+        ep->active = true;
+        dlist_init(&ep->items);
+        dlist_init(&ep->ready);
+        wait_queue_init(&ep->wait);
+
+        int fd = vfs_open_anon(task, inode, O_RDONLY | (flags & O_CLOEXEC));
+        inode_put(inode);
+        return fd;
+    }
+    return -ENFILE;
+}
+
+int eventpoll_ctl(struct task *task, int epfd, int op, int fd, struct epoll_event *event)
+{
+    struct file *ep_file = files_find_by_fd(&task->files, epfd);
+    struct file *file = files_find_by_fd(&task->files, fd);
+    if (ep_file == NULL || file == NULL)
+    {
+        return -EBADF;
+    }
+
+    struct eventpoll *ep = ep_from_fd(task, epfd);
+    if (ep == NULL || file == ep_file)
+    {
+        return -EINVAL;
+    }
+    if (file->file_ops.poll == NULL)
+    {
+        return -EPERM;
+    }
+    if (op != EPOLL_CTL_DEL && event == NULL)
+    {
+        return -EFAULT;
+    }
+
+    struct epitem *item = ep_find(ep, file, fd);
+    switch (op)
+    {
+        case EPOLL_CTL_ADD:
+            return item ? -EEXIST : ep_insert(ep, file, fd, event);
+        case EPOLL_CTL_MOD:
+            if (!item)
+            {
+                return -ENOENT;
+            }
+            ep_modify(item, event);
+            return 0;
+        case EPOLL_CTL_DEL:
+            if (!item)
+            {
+                return -ENOENT;
+            }
+            ep_remove(item);
+            return 0;
+        default:
+            return -EINVAL;
+    }
+}
+
+static bool ep_has_ready(void *obj)
+{
+    struct eventpoll *ep = obj;
+    return !dlist_empty(&ep->ready);
+}
+
+static uint64_t ep_now_ms(void)
+{
+    struct timespec ts;
+    kclock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000ULL + (uint64_t) ts.tv_nsec / 1000000ULL;
+}
+
+int eventpoll_wait(struct task *task, int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+    if (maxevents <= 0 || events == NULL)
+    {
+        return -EINVAL;
+    }
+
+    struct eventpoll *ep = ep_from_fd(task, epfd);
+    if (ep == NULL)
+    {
+        return files_find_by_fd(&task->files, epfd) ? -EINVAL : -EBADF;
+    }
+
+    uint64_t deadline = timeout > 0 ? ep_now_ms() + (uint64_t) timeout : 0;
+    for (;;)
+    {
+        int count = ep_send_events(ep, events, maxevents);
+        if (count > 0 || timeout == 0)
+        {
+            return count;
+        }
+
+        if (timeout < 0)
+        {
+            wait_event(&ep->wait, ep_has_ready, ep, WAIT_INTERRUPTIBLE);
+            continue;
+        }
+
+        /* No kernel timers: yield until the deadline, like poll */
+        if (ep_now_ms() >= deadline)
+        {
+            return 0;
+        }
+        if (task->signal.pending != 0u)
+        {
+            sched_exit(-1);
+        }
+        sched_schedule();
+    }
+}
@@ -0,0 +1,1285 @@
+// ext2_fs.c
+//
+// ext2 on a block device, mounted at /mnt (see include/kernel/ext2.h for
+// the disk layout).
+//
+// Everything on disk goes through the page cache: file data and
+// directory entries through a mapping per file, and the superblock, group
+// descriptors, bitmaps, inode table and indirect blocks through the
+// mapping of the whole device. The group descriptors are also kept in
+// memory, so picking a group never reads the disk.
+//
+// New inodes go to the parent directory's group, and new directories to
+// a group with many free inodes and blocks. A file's blocks are taken
+// right after its previous block when possible, else from its inode's
+// group, so files stay close to their inodes and directories.
+//
+// Lookups are only asked for names the dentry cache doesn't know yet;
+// names found (or found missing) stay cached there.
+//
+// A node lives while it has inodes; an unlinked file is freed on disk
+// with its last inode.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "errno.h"
+#include "kernel/vfs.h"
+#include "kernel/ext2.h"
+#include "kernel/blk.h"
+#include "kernel/pcache.h"
+#include "kernel/clock.h"
+#include "kernel/console.h"
+#include "kernel/fs_util.h"
+#include "kernel/kutils.h"
+
+#define EXT2_BLOCK_SIZE     4096u
+#define EXT2_LOG_BLOCK_SIZE 2
+#define EXT2_SECTORS        (EXT2_BLOCK_SIZE / 512u)
+/* Block numbers in an indirect block */
+#define EXT2_PTRS           (EXT2_BLOCK_SIZE / sizeof(uint32_t))
+
+#define EXT2_MAX_NODES      256
+#define EXT2_MAX_GROUPS     128
+/* off_t is 32 bits */
+#define EXT2_MAX_FILE_SIZE  0x7fffffffu
+#define EXT2_MAX_BLOCKS     (EXT2_MAX_FILE_SIZE / EXT2_BLOCK_SIZE)
+#define EXT2_NAME_MAX       255
+
+struct ext2_node
+{
+    bool active;
+    uint32_t ino;
+    /* Inodes of the node */
+    uint32_t refs;
+    struct ext2_inode raw;
+    /* File data, or the entries of a directory */
+    struct pcache_mapping mapping;
+};
+
+static struct
+{
+    struct blk_dev *dev;
+    /* The whole device, for everything but file data */
+    struct pcache_mapping *disk;
+    struct ext2_super_block sb;
+    uint32_t group_cnt;
+    uint32_t inode_size;
+    uint32_t first_ino;
+    bool filetype;
+    struct ext2_group_desc groups[EXT2_MAX_GROUPS];
+    struct ext2_node nodes[EXT2_MAX_NODES];
+    struct ext2_node *root;
+    /* A block of directory entries */
+    uint8_t dir_buf[EXT2_BLOCK_SIZE];
+    /* A block of a bitmap; allocating can happen while dir_buf is in use */
+    uint8_t bitmap_buf[EXT2_BLOCK_SIZE];
+} ext2;
+
+static const uint8_t ext2_zero[EXT2_BLOCK_SIZE];
+
+static const struct pcache_ops ext2_pcache_ops;
+
+static uint32_t ext2_now(void)
+{
+    struct timespec ts;
+    kclock_gettime(CLOCK_REALTIME, &ts);
+    return (uint32_t) ts.tv_sec;
+}
+
+static bool ext2_is_dir(const struct ext2_node *node)
+{
+    return (node->raw.i_mode & S_IFMT) == S_IFDIR;
+}
+
+/* The mount root has no private data */
+static struct ext2_node *ext2_node_of(const struct inode *inode)
+{
+    return inode->private ? inode->private : ext2.root;
+}
+
+/* ------------------------------------------------------------
+ * Metadata
+ * ------------------------------------------------------------ */
+
+static int ext2_read(void *buf, size_t len, uint64_t pos)
+{
+    return pcache_read(ext2.disk, buf, len, (off_t) pos) == (ssize_t) len ? 0 : -EIO;
+}
+
+static int ext2_write(const void *buf, size_t len, uint64_t pos)
+{
+    return pcache_write(ext2.disk, buf, len, (off_t) pos) == (ssize_t) len ? 0 : -EIO;
+}
+
+static uint64_t ext2_block_pos(uint32_t block)
+{
+    return (uint64_t) block * EXT2_BLOCK_SIZE;
+}
+
+static void ext2_super_write(void)
+{
+    ext2.sb.s_wtime = ext2_now();
+    ext2_write(&ext2.sb, sizeof(ext2.sb), EXT2_SUPER_OFFSET);
+}
+
+static void ext2_group_write(uint32_t group)
+{
+    uint64_t pos = ext2_block_pos(ext2.sb.s_first_data_block + 1) + group * sizeof(struct ext2_group_desc);
+    ext2_write(&ext2.groups[group], sizeof(struct ext2_group_desc), pos);
+}
+
+static uint64_t ext2_inode_pos(uint32_t ino)
+{
+    uint32_t group = (ino - 1) / ext2.sb.s_inodes_per_group;
+    uint32_t index = (ino - 1) % ext2.sb.s_inodes_per_group;
+    return ext2_block_pos(ext2.groups[group].bg_inode_table) + (uint64_t) index * ext2.inode_size;
+}
+
+static int ext2_node_write(struct ext2_node *node)
+{
+    return ext2_write(&node->raw, sizeof(node->raw), ext2_inode_pos(node->ino));
+}
+
+/* ------------------------------------------------------------
+ * Bitmaps
+ * ------------------------------------------------------------ */
+
+/*
+ * Set the first clear bit at or after start of a bitmap of nbits, wrapping
+ * around to first; bits below first are never looked at. -1 if all are set.
+ */
+static int32_t ext2_bitmap_alloc(uint32_t bitmap_block, uint32_t first, uint32_t start, uint32_t nbits)
+{
+    if (ext2_read(ext2.bitmap_buf, EXT2_BLOCK_SIZE, ext2_block_pos(bitmap_block)) < 0)
+    {
+        return -1;
+    }
+
+    if (first >= nbits)
+    {
+        return -1;
+    }
+    if (start < first || start >= nbits)
+    {
+        start = first;
+    }
+
+    uint32_t range = nbits - first;
+    for (uint32_t i = 0; i < range; i++)
+    {
+        uint32_t bit = first + (start - first + i) % range;
+        uint8_t *byte = &ext2.bitmap_buf[bit / 8];
+        if (*byte == 0xFF)
+        {
+            /* Jump to the last bit of a full byte */
+            i += 7 - bit % 8;
+            continue;
+        }
+        if (!(*byte & (1u << (bit % 8))))
+        {
+            *byte = (uint8_t) (*byte | (1u << (bit % 8)));
+            ext2_write(byte, 1, ext2_block_pos(bitmap_block) + bit / 8);
+            return (int32_t) bit;
+        }
+    }
+    return -1;
+}
+
+static void ext2_bitmap_clear(uint32_t bitmap_block, uint32_t bit)
+{
+    uint64_t pos = ext2_block_pos(bitmap_block) + bit / 8;
+    uint8_t byte;
+    if (ext2_read(&byte, 1, pos) == 0)
+    {
+        byte = (uint8_t) (byte & ~(1u << (bit % 8)));
+        ext2_write(&byte, 1, pos);
+    }
+}
+
+static uint32_t ext2_group_blocks(uint32_t group)
+{
+    uint32_t first = ext2.sb.s_first_data_block + group * ext2.sb.s_blocks_per_group;
+    uint32_t left = ext2.sb.s_blocks_count - first;
+    return left < ext2.sb.s_blocks_per_group ? left : ext2.sb.s_blocks_per_group;
+}
+
+/* A free block, looked for from goal on */
+static int ext2_block_alloc(uint32_t goal, uint32_t *block)
+{
+    uint32_t first = ext2.sb.s_first_data_block;
+    if (goal < first || goal >= ext2.sb.s_blocks_count)
+    {
+        goal = first;
+    }
+    uint32_t goal_group = (goal - first) / ext2.sb.s_blocks_per_group;
+
+    for (uint32_t i = 0; i < ext2.group_cnt; i++)
+    {
+        uint32_t group = (goal_group + i) % ext2.group_cnt;
+        struct ext2_group_desc *gd = &ext2.groups[group];
+        if (gd->bg_free_blocks_count == 0)
+        {
+            continue;
+        }
+
+        uint32_t start = i == 0 ? (goal - first) % ext2.sb.s_blocks_per_group : 0;
+        int32_t bit = ext2_bitmap_alloc(gd->bg_block_bitmap, 0, start, ext2_group_blocks(group));
+        if (bit < 0)
+        {
+            continue;
+        }
+
+        gd->bg_free_blocks_count--;
+        ext2.sb.s_free_blocks_count--;
+        ext2_group_write(group);
+        ext2_super_write();
+        *block = first + group * ext2.sb.s_blocks_per_group + (uint32_t) bit;
+        return 0;
+    }
+    return -ENOSPC;
+}
+
+static void ext2_block_free(uint32_t block)
+{
+    uint32_t rel = block - ext2.sb.s_first_data_block;
+    uint32_t group = rel / ext2.sb.s_blocks_per_group;
+
+    /* The block may be reused for something else; a cached copy must not be written over it */
+    pcache_discard(ext2.disk, block);
+    ext2_bitmap_clear(ext2.groups[group].bg_block_bitmap, rel % ext2.sb.s_blocks_per_group);
+    ext2.groups[group].bg_free_blocks_count++;
+    ext2.sb.s_free_blocks_count++;
+    ext2_group_write(group);
+    ext2_super_write();
+}
+
+/*
+ * A free inode. A file goes into the group of its directory; a directory
+ * into a group with at least the average number of free inodes, picking
+ * the one with the most free blocks, so directories spread out and their
+ * files have room nearby.
+ */
+static int ext2_inode_alloc(const struct ext2_node *parent, bool dir, uint32_t *ino)
+{
+    uint32_t ipg = ext2.sb.s_inodes_per_group;
+    uint32_t goal = (parent->ino - 1) / ipg;
+
+    if (dir)
+    {
+        uint32_t avg = ext2.sb.s_free_inodes_count / ext2.group_cnt;
+        int32_t best = -1;
+        for (uint32_t group = 0; group < ext2.group_cnt; group++)
+        {
+            const struct ext2_group_desc *gd = &ext2.groups[group];
+            if (gd->bg_free_inodes_count == 0 || gd->bg_free_inodes_count < avg)
+            {
+                continue;
+            }
+            if (best < 0 || gd->bg_free_blocks_count > ext2.groups[best].bg_free_blocks_count)
+            {
+                best = (int32_t) group;
+            }
+        }
+        if (best >= 0)
+        {
+            goal = (uint32_t) best;
+        }
+    }
+
+    for (uint32_t i = 0; i < ext2.group_cnt; i++)
+    {
+        uint32_t group = (goal + i) % ext2.group_cnt;
+        struct ext2_group_desc *gd = &ext2.groups[group];
+        if (gd->bg_free_inodes_count == 0)
+        {
+            continue;
+        }
+
+        /* Group 0 starts with the reserved inodes, which the search must not take */
+        uint32_t first = group == 0 ? ext2.first_ino - 1 : 0;
+        int32_t bit = ext2_bitmap_alloc(gd->bg_inode_bitmap, first, first, ipg);
+        if (bit < 0)
+        {
+            continue;
+        }
+
+        gd->bg_free_inodes_count--;
+        if (dir)
+        {
+            gd->bg_used_dirs_count++;
+        }
+        ext2.sb.s_free_inodes_count--;
+        ext2_group_write(group);
+        ext2_super_write();
+        *ino = group * ipg + (uint32_t) bit + 1;
+        return 0;
+    }
+    return -ENOSPC;
+}
+
+static void ext2_inode_free(uint32_t ino, bool dir)
+{
+    uint32_t group = (ino - 1) / ext2.sb.s_inodes_per_group;
+    struct ext2_group_desc *gd = &ext2.groups[group];
+
+    ext2_bitmap_clear(gd->bg_inode_bitmap, (ino - 1) % ext2.sb.s_inodes_per_group);
+    gd->bg_free_inodes_count++;
+    if (dir)
+    {
+        gd->bg_used_dirs_count--;
+    }
+    ext2.sb.s_free_inodes_count++;
+    ext2_group_write(group);
+    ext2_super_write();
+}
+
+/* ------------------------------------------------------------
+ * Block map
+ * ------------------------------------------------------------ */
+
+/* Allocate a block for node; an indirect block starts out all zeros */
+static int ext2_alloc_for(struct ext2_node *node, uint32_t goal, bool indirect, uint32_t *block)
+{
+    int res = ext2_block_alloc(goal, block);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    node->raw.i_blocks += EXT2_SECTORS;
+    if (indirect)
+    {
+        ext2_write(ext2_zero, EXT2_BLOCK_SIZE, ext2_block_pos(*block));
+    }
+    return 0;
+}
+
+static int ext2_bmap(struct pcache_mapping *mapping, uint32_t index, bool create, uint32_t *block);
+
+/* Where a new block for page index should go: after the page before it, else near the inode */
+static uint32_t ext2_goal(struct ext2_node *node, uint32_t index)
+{
+    uint32_t prev;
+    if (index > 0 && ext2_bmap(&node->mapping, index - 1, false, &prev) == 0 && prev != PCACHE_HOLE)
+    {
+        return prev + 1;
+    }
+
+    uint32_t group = (node->ino - 1) / ext2.sb.s_inodes_per_group;
+    return ext2.sb.s_first_data_block + group * ext2.sb.s_blocks_per_group;
+}
+
+static int ext2_bmap(struct pcache_mapping *mapping, uint32_t index, bool create, uint32_t *block)
+{
+    struct ext2_node *node = mapping->private;
+
+    uint32_t offsets[2];
+    uint32_t depth;
+    uint32_t *top;
+    if (index < EXT2_NDIR_BLOCKS)
+    {
+        depth = 0;
+        top = &node->raw.i_block[index];
+    }
+    else if (index - EXT2_NDIR_BLOCKS < EXT2_PTRS)
+    {
+        depth = 1;
+        top = &node->raw.i_block[EXT2_IND_BLOCK];
+        offsets[0] = index - EXT2_NDIR_BLOCKS;
+    }
+    else if (index - EXT2_NDIR_BLOCKS - EXT2_PTRS < EXT2_PTRS * EXT2_PTRS)
+    {
+        uint32_t rel = index - EXT2_NDIR_BLOCKS - EXT2_PTRS;
+        depth = 2;
+        top = &node->raw.i_block[EXT2_DIND_BLOCK];
+        offsets[0] = rel / EXT2_PTRS;
+        offsets[1] = rel % EXT2_PTRS;
+    }
+    else
+    {
+        return -EFBIG;
+    }
+
+    /* Only looked up once a block has to be allocated */
+    uint32_t goal = 0;
+    bool changed = false;
+    int res = 0;
+
+    uint32_t cur = *top;
+    if (cur == 0)
+    {
+        if (!create)
+        {
+            *block = PCACHE_HOLE;
+            return 0;
+        }
+        goal = ext2_goal(node, index);
+        res = ext2_alloc_for(node, goal, depth > 0, &cur);
+        if (res < 0)
+        {
+            return res;
+        }
+        *top = cur;
+        changed = true;
+    }
+
+    for (uint32_t level = 0; level < depth && res == 0; level++)
+    {
+        uint64_t pos = ext2_block_pos(cur) + offsets[level] * sizeof(uint32_t);
+        uint32_t next;
+        res = ext2_read(&next, sizeof(next), pos);
+        if (res == 0 && next == 0)
+        {
+            if (!create)
+            {
+                *block = PCACHE_HOLE;
+                return 0;
+            }
+            if (goal == 0)
+            {
+                goal = ext2_goal(node, index);
+            }
+            res = ext2_alloc_for(node, goal, level + 1 < depth, &next);
+            if (res == 0)
+            {
+                res = ext2_write(&next, sizeof(next), pos);
+                changed = true;
+            }
+        }
+        cur = next;
+    }
+
+    if (changed)
+    {
+        ext2_node_write(node);
+    }
+    if (res == 0)
+    {
+        *block = cur;
+    }
+    return res;
+}
+
+static const struct pcache_ops ext2_pcache_ops = {
+        .bmap = ext2_bmap,
+};
+
+/*
+ * Free the blocks under *slot, a tree of depth levels of indirect blocks,
+ * that map pages from on (counted from the tree's first page). Indirect
+ * blocks are freed once nothing below them is left.
+ */
+static void ext2_free_tree(struct ext2_node *node, uint32_t *slot, uint32_t depth, uint32_t from)
+{
+    if (*slot == 0)
+    {
+        return;
+    }
+
+    if (depth > 0)
+    {
+        uint32_t span = depth == 1 ? 1 : EXT2_PTRS;
+        for (uint32_t i = from / span; i < EXT2_PTRS; i++)
+        {
+            uint64_t pos = ext2_block_pos(*slot) + i * sizeof(uint32_t);
+            uint32_t child;
+            if (ext2_read(&child, sizeof(child), pos) < 0 || child == 0)
+            {
+                continue;
+            }
+
+            ext2_free_tree(node, &child, depth - 1, i == from / span ? from % span : 0);
+            if (from != 0)
+            {
+                ext2_write(&child, sizeof(child), pos);
+            }
+        }
+        if (from != 0)
+        {
+            return;
+        }
+    }
+
+    ext2_block_free(*slot);
+    node->raw.i_blocks -= EXT2_SECTORS;
+    *slot = 0;
+}
+
+static int ext2_resize(struct ext2_node *node, uint64_t size)
+{
+    if (size > EXT2_MAX_FILE_SIZE)
+    {
+        return -EFBIG;
+    }
+
+    if (size < node->mapping.size)
+    {
+        pcache_truncate(&node->mapping, size);
+
+        uint32_t from = (uint32_t) ((size + EXT2_BLOCK_SIZE - 1) / EXT2_BLOCK_SIZE);
+        for (uint32_t i = from; i < EXT2_NDIR_BLOCKS; i++)
+        {
+            ext2_free_tree(node, &node->raw.i_block[i], 0, 0);
+        }
+        ext2_free_tree(node, &node->raw.i_block[EXT2_IND_BLOCK], 1,
+                       from > EXT2_NDIR_BLOCKS ? from - EXT2_NDIR_BLOCKS : 0);
+        ext2_free_tree(node, &node->raw.i_block[EXT2_DIND_BLOCK], 2,
+                       from > EXT2_NDIR_BLOCKS + EXT2_PTRS ? from - EXT2_NDIR_BLOCKS - EXT2_PTRS : 0);
+    }
+    else
+    {
+        node->mapping.size = size;
+    }
+
+    node->raw.i_size = (uint32_t) size;
+    node->raw.i_mtime = node->raw.i_ctime = ext2_now();
+    return ext2_node_write(node);
+}
+
+/* ------------------------------------------------------------
+ * Nodes
+ * ------------------------------------------------------------ */
+
+/* The node of ino, read from disk unless it is in use */
+static struct ext2_node *ext2_node_get(uint32_t ino)
+{
+    struct ext2_node *free = NULL;
+    for (uint32_t i = 0; i < EXT2_MAX_NODES; i++)
+    {
+        struct ext2_node *node = &ext2.nodes[i];
+        if (node->active && node->ino == ino)
+        {
+            return node;
+        }
+        if (!node->active && !free)
+        {
+            free = node;
+        }
+    }
+
+    if (!free || ino == 0 || ino > ext2.sb.s_inodes_count)
+    {
+        return NULL;
+    }
+
+    k_memset(free, 0, sizeof(*free));
+    free->ino = ino;
+    if (ext2_read(&free->raw, sizeof(free->raw), ext2_inode_pos(ino)) < 0)
+    {
+        return NULL;
+    }
+    free->active = true;
+    pcache_mapping_init(&free->mapping, ext2.dev, &ext2_pcache_ops, free, free->raw.i_size);
+    return free;
+}
+
+/* Free node on disk */
+static void ext2_node_delete(struct ext2_node *node)
+{
+    ext2_resize(node, 0);
+    node->raw.i_dtime = ext2_now();
+    ext2_node_write(node);
+    ext2_inode_free(node->ino, ext2_is_dir(node));
+}
+
+static void ext2_node_put(struct ext2_node *node)
+{
+    if (node->refs > 0 || node == ext2.root)
+    {
+        return;
+    }
+
+    if (node->raw.i_links_count == 0)
+    {
+        ext2_node_delete(node);
+    }
+    pcache_release(&node->mapping);
+    node->active = false;
+}
+
+static int ext2_instantiate(struct dentry *dentry, struct ext2_node *node)
+{
+    struct inode *inode = inode_alloc(&ext2_fs, node->ino, node->raw.i_mode, node);
+    if (!inode)
+    {
+        ext2_node_put(node);
+        return -ENOMEM;
+    }
+
+    node->refs++;
+    d_instantiate(dentry, inode);
+    return 0;
+}
+
+/* ------------------------------------------------------------
+ * Directory entries
+ * ------------------------------------------------------------ */
+
+static int ext2_dir_read(struct ext2_node *dir, uint32_t block_idx)
+{
+    ssize_t n = pcache_read(&dir->mapping, ext2.dir_buf, EXT2_BLOCK_SIZE, (off_t) (block_idx * EXT2_BLOCK_SIZE));
+    return n == (ssize_t) EXT2_BLOCK_SIZE ? 0 : -EIO;
+}
+
+static int ext2_dir_write(struct ext2_node *dir, uint32_t block_idx)
+{
+    /* A hashed index would no longer match the entries */
+    if (dir->raw.i_flags & EXT2_INDEX_FL)
+    {
+        dir->raw.i_flags &= ~EXT2_INDEX_FL;
+        ext2_node_write(dir);
+    }
+
+    ssize_t n = pcache_write(&dir->mapping, ext2.dir_buf, EXT2_BLOCK_SIZE, (off_t) (block_idx * EXT2_BLOCK_SIZE));
+    return n == (ssize_t) EXT2_BLOCK_SIZE ? 0 : -EIO;
+}
+
+static uint32_t ext2_dir_blocks(const struct ext2_node *dir)
+{
+    return (uint32_t) (dir->mapping.size / EXT2_BLOCK_SIZE);
+}
+
+/* The entry at off of dir_buf, or NULL if it doesn't fit the block */
+static struct ext2_dir_entry *ext2_dirent_at(uint32_t off)
+{
+    if (off + 8 > EXT2_BLOCK_SIZE)
+    {
+        return NULL;
+    }
+
+    struct ext2_dir_entry *de = (struct ext2_dir_entry *) &ext2.dir_buf[off];
+    if (de->rec_len < 8 || de->rec_len % 4 != 0 || off + de->rec_len > EXT2_BLOCK_SIZE ||
+        EXT2_DIR_REC_LEN(de->name_len) > de->rec_len)
+    {
+        return NULL;
+    }
+    return de;
+}
+
+/*
+ * Find name in dir. On success dir_buf holds its block, and *block_idx,
+ * *off and *prev_off (UINT32_MAX for the first entry) say where it is.
+ */
+static int ext2_dir_find(struct ext2_node *dir, const char *name, size_t len,
+                         uint32_t *block_idx, uint32_t *off, uint32_t *prev_off)
+{
+    for (uint32_t b = 0; b < ext2_dir_blocks(dir); b++)
+    {
+        if (ext2_dir_read(dir, b) < 0)
+        {
+            return -EIO;
+        }
+
+        uint32_t prev = UINT32_MAX;
+        for (uint32_t o = 0; o < EXT2_BLOCK_SIZE;)
+        {
+            struct ext2_dir_entry *de = ext2_dirent_at(o);
+            if (!de)
+            {
+                return -EIO;
+            }
+            if (de->inode && de->name_len == len && k_memcmp(de->name, name, len) == 0)
+            {
+                *block_idx = b;
+                *off = o;
+                *prev_off = prev;
+                return 0;
+            }
+            prev = o;
+            o += de->rec_len;
+        }
+    }
+    return -ENOENT;
+}
+
+static uint8_t ext2_file_type(const struct ext2_node *node)
+{
+    if (!ext2.filetype)
+    {
+        return EXT2_FT_UNKNOWN;
+    }
+    return ext2_is_dir(node) ? EXT2_FT_DIR : EXT2_FT_REG_FILE;
+}
+
+static void ext2_dirent_fill(struct ext2_dir_entry *de, uint16_t rec_len, const char *name, size_t len,
+                             const struct ext2_node *node)
+{
+    de->inode = node->ino;
+    de->rec_len = rec_len;
+    de->name_len = (uint8_t) len;
+    de->file_type = ext2_file_type(node);
+    k_memcpy(de->name, name, len);
+}
+
+/* Add an entry for node: in the slack of an entry, or in a new block */
+static int ext2_dir_add(struct ext2_node *dir, const char *name, size_t len, const struct ext2_node *node)
+{
+    uint32_t need = EXT2_DIR_REC_LEN(len);
+    uint32_t blocks = ext2_dir_blocks(dir);
+
+    for (uint32_t b = 0; b < blocks; b++)
+    {
+        if (ext2_dir_read(dir, b) < 0)
+        {
+            return -EIO;
+        }
+
+        for (uint32_t o = 0; o < EXT2_BLOCK_SIZE;)
+        {
+            struct ext2_dir_entry *de = ext2_dirent_at(o);
+            if (!de)
+            {
+                return -EIO;
+            }
+
+            uint32_t used = de->inode ? EXT2_DIR_REC_LEN(de->name_len) : 0;
+            if (de->rec_len - used >= need)
+            {
+                if (used)
+                {
+                    uint16_t rest = (uint16_t) (de->rec_len - used);
+                    de->rec_len = (uint16_t) used;
+                    de = (struct ext2_dir_entry *) &ext2.dir_buf[o + used];
+                    de->rec_len = rest;
+                }
+                ext2_dirent_fill(de, de->rec_len, name, len, node);
+                return ext2_dir_write(dir, b);
+            }
+            o += de->rec_len;
+        }
+    }
+
+    k_memset(ext2.dir_buf, 0, EXT2_BLOCK_SIZE);
+    ext2_dirent_fill((struct ext2_dir_entry *) ext2.dir_buf, EXT2_BLOCK_SIZE, name, len, node);
+    int res = ext2_dir_write(dir, blocks);
+    if (res == 0)
+    {
+        dir->raw.i_size = (uint32_t) dir->mapping.size;
+        res = ext2_node_write(dir);
+    }
+    return res;
+}
+
+static int ext2_dir_remove(struct ext2_node *dir, const char *name, size_t len)
+{
+    uint32_t b, off, prev;
+    int res = ext2_dir_find(dir, name, len, &b, &off, &prev);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    struct ext2_dir_entry *de = (struct ext2_dir_entry *) &ext2.dir_buf[off];
+    if (prev != UINT32_MAX)
+    {
+        struct ext2_dir_entry *before = (struct ext2_dir_entry *) &ext2.dir_buf[prev];
+        before->rec_len = (uint16_t) (before->rec_len + de->rec_len);
+    }
+    else
+    {
+        de->inode = 0;
+    }
+    return ext2_dir_write(dir, b);
+}
+
+/* Point the entry name of dir at node instead */
+static int ext2_dir_set(struct ext2_node *dir, const char *name, size_t len, const struct ext2_node *node)
+{
+    uint32_t b, off, prev;
+    int res = ext2_dir_find(dir, name, len, &b, &off, &prev);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    struct ext2_dir_entry *de = (struct ext2_dir_entry *) &ext2.dir_buf[off];
+    de->inode = node->ino;
+    de->file_type = ext2_file_type(node);
+    return ext2_dir_write(dir, b);
+}
+
+/* Nothing but "." and ".." */
+static bool ext2_dir_empty(struct ext2_node *dir)
+{
+    for (uint32_t b = 0; b < ext2_dir_blocks(dir); b++)
+    {
+        if (ext2_dir_read(dir, b) < 0)
+        {
+            return false;
+        }
+
+        for (uint32_t o = 0; o < EXT2_BLOCK_SIZE;)
+        {
+            struct ext2_dir_entry *de = ext2_dirent_at(o);
+            if (!de)
+            {
+                return false;
+            }
+            bool dot = de->name_len <= 2 && de->name[0] == '.' && (de->name_len == 1 || de->name[1] == '.');
+            if (de->inode && !dot)
+            {
+                return false;
+            }
+            o += de->rec_len;
+        }
+    }
+    return true;
+}
+
+/* ------------------------------------------------------------
+ * File operations
+ * ------------------------------------------------------------ */
+
+static ssize_t ext2_pread(struct file *file, void *buf, size_t count, off_t offset)
+{
+    struct ext2_node *node = file->driver_data;
+    return pcache_read(&node->mapping, buf, count, offset);
+}
+
+static ssize_t ext2_pwrite(struct file *file, const void *buf, size_t count, off_t offset)
+{
+    struct ext2_node *node = file->driver_data;
+
+    uint64_t end = (uint64_t) offset + count;
+    if (end > EXT2_MAX_FILE_SIZE)
+    {
+        return -EFBIG;
+    }
+
+    ssize_t n = pcache_write(&node->mapping, buf, count, offset);
+    if (n > 0)
+    {
+        node->raw.i_size = (uint32_t) node->mapping.size;
+        node->raw.i_mtime = node->raw.i_ctime = ext2_now();
+        ext2_node_write(node);
+    }
+    return n;
+}
+
+static ssize_t ext2_read_op(struct file *file, void *buf, size_t count)
+{
+    ssize_t n = ext2_pread(file, buf, count, (off_t) file->pos);
+    if (n > 0)
+    {
+        file->pos += (uint64_t) n;
+    }
+    return n;
+}
+
+static ssize_t ext2_write_op(struct file *file, const void *buf, size_t count)
+{
+    ssize_t n = ext2_pwrite(file, buf, count, (off_t) file->pos);
+    if (n > 0)
+    {
+        file->pos += (uint64_t) n;
+    }
+    return n;
+}
+
+static int ext2_truncate(struct file *file, off_t length)
+{
+    return ext2_resize(file->driver_data, (uint64_t) length);
+}
+
+/* The file's data, then the metadata that finds it */
+static int ext2_fsync(struct file *file)
+{
+    struct ext2_node *node = file->driver_data;
+    int res = pcache_writeback(&node->mapping);
+    int meta = pcache_writeback(ext2.disk);
+    return res < 0 ? res : meta;
+}
+
+static int ext2_fstat(struct file *file, struct stat *stat)
+{
+    const struct ext2_node *node = file->driver_data;
+    stat->st_ino = node->ino;
+    stat->st_mode = node->raw.i_mode;
+    stat->st_nlink = node->raw.i_links_count;
+    stat->st_uid = node->raw.i_uid;
+    stat->st_gid = node->raw.i_gid;
+    stat->st_size = (off_t) node->mapping.size;
+    stat->st_blksize = EXT2_BLOCK_SIZE;
+    stat->st_blocks = (blkcnt_t) node->raw.i_blocks;
+    stat->st_atim.tv_sec = node->raw.i_atime;
+    stat->st_mtim.tv_sec = node->raw.i_mtime;
+    stat->st_ctim.tv_sec = node->raw.i_ctime;
+    return 0;
+}
+
+/* pos is the byte offset of the next entry in the directory */
+static int ext2_getdents(struct file *file, struct dirent *buf, unsigned int count)
+{
+    struct ext2_node *dir = file->driver_data;
+    unsigned int max_entries = count / sizeof(struct dirent);
+    unsigned int idx = 0;
+
+    while (idx < max_entries && file->pos < dir->mapping.size)
+    {
+        uint32_t b = (uint32_t) (file->pos / EXT2_BLOCK_SIZE);
+        if (ext2_dir_read(dir, b) < 0)
+        {
+            return idx > 0 ? (int) (idx * sizeof(struct dirent)) : -EIO;
+        }
+
+        uint32_t o = 0;
+        while (o < EXT2_BLOCK_SIZE && idx < max_entries)
+        {
+            struct ext2_dir_entry *de = ext2_dirent_at(o);
+            if (!de)
+            {
+                return idx > 0 ? (int) (idx * sizeof(struct dirent)) : -EIO;
+            }
+
+            uint64_t pos = (uint64_t) b * EXT2_BLOCK_SIZE + o;
+            o += de->rec_len;
+            if (pos < file->pos)
+            {
+                continue;
+            }
+
+            if (de->inode)
+            {
+                char name[EXT2_NAME_MAX + 1];
+                k_memcpy(name, de->name, de->name_len);
+                name[de->name_len] = '\0';
+                uint8_t type = de->file_type == EXT2_FT_DIR ? DT_DIR :
+                               de->file_type == EXT2_FT_REG_FILE ? DT_REG : DT_UNKNOWN;
+                fs_add_entry(buf, max_entries, &idx, de->inode, type, name);
+            }
+            file->pos = (uint64_t) b * EXT2_BLOCK_SIZE + o;
+        }
+    }
+
+    return (int) (idx * sizeof(struct dirent));
+}
+
+/* ------------------------------------------------------------
+ * Filesystem operations
+ * ------------------------------------------------------------ */
+
+static int ext2_lookup(struct inode *dir, struct dentry *dentry)
+{
+    uint32_t b, off, prev;
+    int res = ext2_dir_find(ext2_node_of(dir), dentry->name, dentry->name_len, &b, &off, &prev);
+    if (res == -ENOENT)
+    {
+        return 0;
+    }
+    if (res < 0)
+    {
+        return res;
+    }
+
+    struct ext2_node *node = ext2_node_get(((struct ext2_dir_entry *) &ext2.dir_buf[off])->inode);
+    return node ? ext2_instantiate(dentry, node) : -ENFILE;
+}
+
+/* A new inode of mode, linked under the name of dentry in dir */
+static int ext2_mknod(struct inode *dir_inode, struct dentry *dentry, mode_t mode)
+{
+    struct ext2_node *dir = ext2_node_of(dir_inode);
+    bool is_dir = (mode & S_IFMT) == S_IFDIR;
+
+    uint32_t ino;
+    int res = ext2_inode_alloc(dir, is_dir, &ino);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    struct ext2_node *node = ext2_node_get(ino);
+    if (!node)
+    {
+        ext2_inode_free(ino, is_dir);
+        return -ENFILE;
+    }
+
+    uint32_t now = ext2_now();
+    k_memset(&node->raw, 0, sizeof(node->raw));
+    node->raw.i_mode = (uint16_t) mode;
+    node->raw.i_links_count = 1;
+    node->raw.i_atime = node->raw.i_ctime = node->raw.i_mtime = now;
+    pcache_mapping_init(&node->mapping, ext2.dev, &ext2_pcache_ops, node, 0);
+    res = ext2_node_write(node);
+
+    if (res == 0 && is_dir)
+    {
+        /* "." and "..", the second taking the rest of the block */
+        k_memset(ext2.dir_buf, 0, EXT2_BLOCK_SIZE);
+        struct ext2_dir_entry *dot = (struct ext2_dir_entry *) ext2.dir_buf;
+        ext2_dirent_fill(dot, (uint16_t) EXT2_DIR_REC_LEN(1), ".", 1, node);
+        struct ext2_dir_entry *dotdot = (struct ext2_dir_entry *) &ext2.dir_buf[dot->rec_len];
+        ext2_dirent_fill(dotdot, (uint16_t) (EXT2_BLOCK_SIZE - dot->rec_len), "..", 2, dir);
+
+        res = ext2_dir_write(node, 0);
+        if (res == 0)
+        {
+            node->raw.i_links_count = 2;
+            node->raw.i_size = EXT2_BLOCK_SIZE;
+            res = ext2_node_write(node);
+        }
+    }
+
+    if (res == 0)
+    {
+        res = ext2_dir_add(dir, dentry->name, dentry->name_len, node);
+    }
+    if (res < 0)
+    {
+        node->raw.i_links_count = 0;
+        ext2_node_put(node);
+        return res;
+    }
+
+    if (is_dir)
+    {
+        dir->raw.i_links_count++;
+    }
+    dir->raw.i_mtime = dir->raw.i_ctime = now;
+    ext2_node_write(dir);
+    return ext2_instantiate(dentry, node);
+}
+
+static int ext2_create(struct inode *dir, struct dentry *dentry, int mode)
+{
+    return ext2_mknod(dir, dentry, S_IFREG | (mode & 0777));
+}
+
+static int ext2_mkdir(struct inode *dir, struct dentry *dentry, int mode)
+{
+    return ext2_mknod(dir, dentry, S_IFDIR | (mode & 0777));
+}
+
+/* One name less for node; the last one frees it once its inodes are gone */
+static void ext2_drop_link(struct ext2_node *dir, struct ext2_node *node)
+{
+    if (ext2_is_dir(node))
+    {
+        /* Its "." and the parent's ".." go with it */
+        node->raw.i_links_count = 0;
+        dir->raw.i_links_count--;
+    }
+    else
+    {
+        node->raw.i_links_count--;
+    }
+
+    uint32_t now = ext2_now();
+    node->raw.i_ctime = now;
+    dir->raw.i_mtime = dir->raw.i_ctime = now;
+    ext2_node_write(node);
+    ext2_node_write(dir);
+}
+
+static int ext2_unlink(struct inode *dir_inode, struct dentry *dentry)
+{
+    struct ext2_node *dir = ext2_node_of(dir_inode);
+    int res = ext2_dir_remove(dir, dentry->name, dentry->name_len);
+    if (res == 0)
+    {
+        ext2_drop_link(dir, ext2_node_of(dentry->inode));
+    }
+    return res;
+}
+
+static int ext2_rmdir(struct inode *dir, struct dentry *dentry)
+{
+    if (!ext2_dir_empty(ext2_node_of(dentry->inode)))
+    {
+        return -ENOTEMPTY;
+    }
+    return ext2_unlink(dir, dentry);
+}
+
+static int ext2_rename(struct inode *old_dir_inode, struct dentry *old_dentry,
+                       struct inode *new_dir_inode, struct dentry *new_dentry)
+{
+    struct ext2_node *old_dir = ext2_node_of(old_dir_inode);
+    struct ext2_node *new_dir = ext2_node_of(new_dir_inode);
+    struct ext2_node *node = ext2_node_of(old_dentry->inode);
+
+    /* Replace the target, which the vfs checked to be of the same kind, in place */
+    int res;
+    if (new_dentry->inode)
+    {
+        struct ext2_node *target = ext2_node_of(new_dentry->inode);
+        if (target == node)
+        {
+            return 0;
+        }
+        if (ext2_is_dir(target) && !ext2_dir_empty(target))
+        {
+            return -ENOTEMPTY;
+        }
+
+        res = ext2_dir_set(new_dir, new_dentry->name, new_dentry->name_len, node);
+        if (res == 0)
+        {
+            ext2_drop_link(new_dir, target);
+        }
+    }
+    else
+    {
+        res = ext2_dir_add(new_dir, new_dentry->name, new_dentry->name_len, node);
+    }
+    if (res < 0)
+    {
+        return res;
+    }
+
+    res = ext2_dir_remove(old_dir, old_dentry->name, old_dentry->name_len);
+    if (res == 0 && ext2_is_dir(node) && old_dir != new_dir)
+    {
+        res = ext2_dir_set(node, "..", 2, new_dir);
+        old_dir->raw.i_links_count--;
+        new_dir->raw.i_links_count++;
+    }
+
+    uint32_t now = ext2_now();
+    node->raw.i_ctime = now;
+    old_dir->raw.i_mtime = old_dir->raw.i_ctime = now;
+    new_dir->raw.i_mtime = new_dir->raw.i_ctime = now;
+    ext2_node_write(node);
+    ext2_node_write(old_dir);
+    ext2_node_write(new_dir);
+    return res;
+}
+
+static int ext2_open(struct file *file)
+{
+    struct ext2_node *node = ext2_node_of(file->inode);
+    file->driver_data = node;
+    file->file_ops.fstat = ext2_fstat;
+    file->file_ops.fsync = ext2_fsync;
+
+    if (ext2_is_dir(node))
+    {
+        file->file_ops.getdents = ext2_getdents;
+        return 0;
+    }
+    if ((node->raw.i_mode & S_IFMT) != S_IFREG)
+    {
+        return 0;
+    }
+
+    int access = file->flags & 3;
+    if (access != O_WRONLY)
+    {
+        file->file_ops.read = ext2_read_op;
+        file->file_ops.pread = ext2_pread;
+    }
+    if (access != O_RDONLY)
+    {
+        file->file_ops.write = ext2_write_op;
+        file->file_ops.pwrite = ext2_pwrite;
+        file->file_ops.truncate = ext2_truncate;
+
+        if (file->flags & O_TRUNC)
+        {
+            return ext2_resize(node, 0);
+        }
+    }
+    return 0;
+}
+
+static void ext2_evict(struct inode *inode)
+{
+    struct ext2_node *node = inode->private;
+    if (node)
+    {
+        node->refs--;
+        ext2_node_put(node);
+    }
+}
+
+struct fs ext2_fs = {
+        .lookup   = ext2_lookup,
+        .create   = ext2_create,
+        .open     = ext2_open,
+        .unlink   = ext2_unlink,
+        .mkdir    = ext2_mkdir,
+        .rmdir    = ext2_rmdir,
+        .rename   = ext2_rename,
+        .evict    = ext2_evict,
+};
+
+/* ------------------------------------------------------------
+ * Mounting
+ * ------------------------------------------------------------ */
+
+int ext2_fs_init(const char *device)
+{
+    k_memset(&ext2, 0, sizeof(ext2));
+
+    ext2.dev = blk_find(device);
+    if (!ext2.dev)
+    {
+        return -ENODEV;
+    }
+    ext2.disk = blk_mapping(ext2.dev);
+
+    struct ext2_super_block *sb = &ext2.sb;
+    if (ext2_read(sb, sizeof(*sb), EXT2_SUPER_OFFSET) < 0 || sb->s_magic != EXT2_MAGIC)
+    {
+        kprintf("ext2: no filesystem on %s\n", device);
+        return -EINVAL;
+    }
+
+    if (sb->s_rev_level == EXT2_GOOD_OLD_REV)
+    {
+        ext2.inode_size = EXT2_GOOD_OLD_INODE_SIZE;
+        ext2.first_ino = EXT2_GOOD_OLD_FIRST_INO;
+    }
+    else
+    {
+        ext2.inode_size = sb->s_inode_size;
+        ext2.first_ino = sb->s_first_ino;
+        ext2.filetype = (sb->s_feature_incompat & EXT2_FEATURE_INCOMPAT_FILETYPE) != 0;
+
+        uint32_t ro_known = EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER | EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
+        if ((sb->s_feature_incompat & ~EXT2_FEATURE_INCOMPAT_FILETYPE) || (sb->s_feature_ro_compat & ~ro_known))
+        {
+            kprintf("ext2: %s has unsupported features %x/%x\n", device,
+                    sb->s_feature_incompat, sb->s_feature_ro_compat);
+            return -EINVAL;
+        }
+    }
+
+    if (sb->s_log_block_size != EXT2_LOG_BLOCK_SIZE)
+    {
+        kprintf("ext2: %s has %u byte blocks, only %u is supported\n", device,
+                1024u << sb->s_log_block_size, EXT2_BLOCK_SIZE);
+        return -EINVAL;
+    }
+
+    ext2.group_cnt = (sb->s_blocks_count - sb->s_first_data_block + sb->s_blocks_per_group - 1) /
+                     sb->s_blocks_per_group;
+    if (ext2.group_cnt == 0 || ext2.group_cnt > EXT2_MAX_GROUPS || sb->s_blocks_count > EXT2_MAX_BLOCKS ||
+        sb->s_inodes_per_group == 0 || ext2.inode_size < EXT2_GOOD_OLD_INODE_SIZE)
+    {
+        kprintf("ext2: %s: unsupported geometry\n", device);
+        return -EINVAL;
+    }
+
+    if (ext2_read(ext2.groups, ext2.group_cnt * sizeof(struct ext2_group_desc),
+                  ext2_block_pos(sb->s_first_data_block + 1)) < 0)
+    {
+        return -EIO;
+    }
+
+    ext2.root = ext2_node_get(EXT2_ROOT_INO);
+    if (!ext2.root || !ext2_is_dir(ext2.root))
+    {
+        kprintf("ext2: %s: bad root directory\n", device);
+        return -EINVAL;
+    }
+
+    sb->s_mnt_count++;
+    sb->s_mtime = ext2_now();
+    ext2_super_write();
+
+    kprintf("ext2: %s, %u blocks, %u free, %u groups\n", device,
+            sb->s_blocks_count, sb->s_free_blocks_count, ext2.group_cnt);
+    return 0;
+}
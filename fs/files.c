@@ -6,6 +6,7 @@ void files_init(struct files *files)
     for (int i = 0; i < RLIMIT_NOFILE; i++)
     {
         files->slots[i].file = NULL;
+        files->slots[i].flags = 0;
     }
 }
 
@@ -20,6 +21,11 @@ struct file *files_find_by_fd(const struct files *files, int fd)
 }
 
 int files_alloc_fd(struct files *files, struct file *file)
+{
+    return files_alloc_fd_from(files, file, 0);
+}
+
+int files_alloc_fd_from(struct files *files, struct file *file, int min_fd)
 {
     if (file == NULL)
     {
@@ -27,11 +33,12 @@ int files_alloc_fd(struct files *files, struct file *file)
     }
 
     // Find lowest available fd (POSIX requirement)
-    for (int fd = 0; fd < RLIMIT_NOFILE; fd++)
+    for (int fd = min_fd < 0 ? 0 : min_fd; fd < RLIMIT_NOFILE; fd++)
     {
         if (files->slots[fd].file == NULL)
         {
             files->slots[fd].file = file;
+            files->slots[fd].flags = 0;
             return fd;
         }
     }
@@ -39,6 +46,18 @@ int files_alloc_fd(struct files *files, struct file *file)
     return -1;  // No free slots
 }
 
+void files_dup(struct files *dst, const struct files *src)
+{
+    for (int fd = 0; fd < RLIMIT_NOFILE; fd++)
+    {
+        dst->slots[fd] = src->slots[fd];
+        if (dst->slots[fd].file)
+        {
+            dst->slots[fd].file->refs++;
+        }
+    }
+}
+
 struct file *files_free_fd(struct files *files, int fd)
 {
     if (fd < 0 || fd >= RLIMIT_NOFILE)
@@ -53,5 +72,6 @@ struct file *files_free_fd(struct files *files, int fd)
     }
 
     files->slots[fd].file = NULL;
+    files->slots[fd].flags = 0;
     return file;
 }
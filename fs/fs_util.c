@@ -32,4 +32,28 @@ int fs_add_entry(
 
     (*idx)++;
     return 1;
+}
+
+bool fs_dir_emit(
+        struct file *file,
+        struct dirent *buf_entries,
+        unsigned int max_entries,
+        unsigned int *idx,
+        uint32_t pos,
+        uint32_t ino,
+        uint8_t d_type,
+        const char *name)
+{
+    if (pos < file->pos)
+    {
+        return true;
+    }
+    if (*idx >= max_entries)
+    {
+        return false;
+    }
+
+    fs_add_entry(buf_entries, max_entries, idx, ino, d_type, name);
+    file->pos = (uint64_t) pos + 1;
+    return true;
 }
\ No newline at end of file
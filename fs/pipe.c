@@ -0,0 +1,283 @@
+// pipe.c
+//
+// Pipes. The buffer is a single frame used as a ring with free running
+// head and tail counters. Readers and writers sleep on their own wait
+// queue, so a write only wakes up readers and a read only writers.
+//
+// A pipe lives as long as its inode, which is anonymous: pipe(2) opens a
+// read file and a write file on it, and the pipe counts the open files of
+// each kind. Reading from a pipe without writers gives EOF, writing to one
+// without readers fails with EPIPE. On an O_NONBLOCK file, a read or
+// write that would have to wait fails with EAGAIN instead.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "errno.h"
+#include "kernel/pipe.h"
+#include "kernel/wait.h"
+#include "kernel/poll.h"
+#include "kernel/mm.h"
+#include "kernel/kutils.h"
+
+#define PIPE_SIZE       4096u
+#define PIPE_MASK       (PIPE_SIZE - 1)
+#define MAX_PIPES       32
+
+struct pipe
+{
+    bool active;
+    /* Ring buffer; head is where the next write goes, tail the next read */
+    uintptr_t buf_pa;
+    uint8_t *buf;
+    uint32_t head;
+    uint32_t tail;
+    /* Open read and write files */
+    uint32_t readers;
+    uint32_t writers;
+    struct wait_queue read_wait;
+    struct wait_queue write_wait;
+};
+
+static struct pipe pipes[MAX_PIPES];
+
+static uint32_t pipe_used(const struct pipe *pipe)
+{
+    return pipe->head - pipe->tail;
+}
+
+/* ------------------------------------------------------------
+ * Wait conditions
+ * ------------------------------------------------------------ */
+
+static bool pipe_readable(void *obj)
+{
+    const struct pipe *pipe = obj;
+    return pipe_used(pipe) > 0 || pipe->writers == 0;
+}
+
+struct pipe_write_wait
+{
+    const struct pipe *pipe;
+    /* Room the writer waits for */
+    uint32_t need;
+};
+
+static bool pipe_writable(void *obj)
+{
+    const struct pipe_write_wait *w = obj;
+    return PIPE_SIZE - pipe_used(w->pipe) >= w->need || w->pipe->readers == 0;
+}
+
+/* ------------------------------------------------------------
+ * File operations
+ * ------------------------------------------------------------ */
+
+static ssize_t pipe_read(struct file *file, void *buf, size_t count)
+{
+    struct pipe *pipe = file->inode->private;
+
+    if (!pipe_readable(pipe) && (file->flags & O_NONBLOCK))
+    {
+        return -EAGAIN;
+    }
+
+    wait_event(&pipe->read_wait, pipe_readable, pipe, WAIT_INTERRUPTIBLE);
+
+    uint32_t avail = pipe_used(pipe);
+    if (count > avail)
+    {
+        count = avail;
+    }
+
+    /* At most two pieces: up to the end of the buffer and from its start */
+    uint8_t *dst = buf;
+    size_t done = 0;
+    while (done < count)
+    {
+        uint32_t off = pipe->tail & PIPE_MASK;
+        size_t chunk = PIPE_SIZE - off < count - done ? PIPE_SIZE - off : count - done;
+        k_memcpy(dst + done, pipe->buf + off, chunk);
+        pipe->tail += (uint32_t) chunk;
+        done += chunk;
+    }
+
+    if (done > 0)
+    {
+        wakeup(&pipe->write_wait);
+    }
+    return (ssize_t) done;
+}
+
+static ssize_t pipe_write(struct file *file, const void *buf, size_t count)
+{
+    struct pipe *pipe = file->inode->private;
+    const uint8_t *src = buf;
+    size_t done = 0;
+
+    while (done < count)
+    {
+        /* A write that fits in PIPE_BUF waits until it can go in whole */
+        size_t left = count - done;
+        struct pipe_write_wait w = {
+                .pipe = pipe,
+                .need = count <= PIPE_BUF ? (uint32_t) left : 1,
+        };
+        if (!pipe_writable(&w) && (file->flags & O_NONBLOCK))
+        {
+            /* An atomic write goes in whole or not at all */
+            return done > 0 ? (ssize_t) done : -EAGAIN;
+        }
+
+        wait_event(&pipe->write_wait, pipe_writable, &w, WAIT_INTERRUPTIBLE);
+
+        if (pipe->readers == 0)
+        {
+            return done > 0 ? (ssize_t) done : -EPIPE;
+        }
+
+        size_t room = PIPE_SIZE - pipe_used(pipe);
+        size_t n = left < room ? left : room;
+        while (n > 0)
+        {
+            uint32_t off = pipe->head & PIPE_MASK;
+            size_t chunk = PIPE_SIZE - off < n ? PIPE_SIZE - off : n;
+            k_memcpy(pipe->buf + off, src + done, chunk);
+            pipe->head += (uint32_t) chunk;
+            done += chunk;
+            n -= chunk;
+        }
+
+        wakeup(&pipe->read_wait);
+    }
+
+    return (ssize_t) done;
+}
+
+static int pipe_close(struct file *file)
+{
+    struct pipe *pipe = file->inode->private;
+
+    if (file->file_ops.read)
+    {
+        pipe->readers--;
+        wakeup(&pipe->write_wait);
+    }
+    else
+    {
+        pipe->writers--;
+        wakeup(&pipe->read_wait);
+    }
+    return 0;
+}
+
+/* Readable with data or without writers; writable with any room */
+static uint32_t pipe_poll(struct file *file, struct poll_table *pt)
+{
+    struct pipe *pipe = file->inode->private;
+    uint32_t mask = 0;
+
+    if (file->file_ops.read)
+    {
+        poll_wait(&pipe->read_wait, pt);
+        if (pipe_used(pipe) > 0)
+        {
+            mask |= POLLIN | POLLRDNORM;
+        }
+        if (pipe->writers == 0)
+        {
+            mask |= POLLHUP;
+        }
+    }
+    else
+    {
+        poll_wait(&pipe->write_wait, pt);
+        if (pipe_used(pipe) < PIPE_SIZE)
+        {
+            mask |= POLLOUT | POLLWRNORM;
+        }
+        if (pipe->readers == 0)
+        {
+            mask |= POLLERR;
+        }
+    }
+    return mask;
+}
+
+static int pipe_fstat(struct file *file, struct stat *stat)
+{
+    const struct pipe *pipe = file->inode->private;
+    stat->st_size = (off_t) pipe_used(pipe);
+    stat->st_blksize = PIPE_BUF;
+    return 0;
+}
+
+static int pipe_open(struct file *file)
+{
+    struct pipe *pipe = file->inode->private;
+
+    file->file_ops.close = pipe_close;
+    file->file_ops.fstat = pipe_fstat;
+    file->file_ops.poll = pipe_poll;
+
+    if ((file->flags & 3) == O_RDONLY)
+    {
+        file->file_ops.read = pipe_read;
+        pipe->readers++;
+    }
+    else
+    {
+        file->file_ops.write = pipe_write;
+        pipe->writers++;
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------
+ * Pipes
+ * ------------------------------------------------------------ */
+
+static void pipe_evict(struct inode *inode)
+{
+    struct pipe *pipe = inode->private;
+    mm_frame_free(pipe->buf_pa);
+    pipe->active = false;
+}
+
+struct inode *pipe_inode_alloc(void)
+{
+    for (uint32_t i = 0; i < MAX_PIPES; i++)
+    {
+        struct pipe *pipe = &pipes[i];
+        if (pipe->active)
+        {
+            continue;
+        }
+
+        uintptr_t pa = mm_frame_alloc();
+        if (!pa)
+        {
+            return NULL;
+        }
+
+        struct inode *inode = inode_alloc(&pipe_fs, i + 1, S_IFIFO | 0600, pipe);
+        if (!inode)
+        {
+            mm_frame_free(pa);
+            return NULL;
+        }
+
+        k_memset(pipe, 0, sizeof(*pipe));
+        pipe->active = true;
+        pipe->buf_pa = pa;
+        pipe->buf = mm_pa_to_kva(pa);
+        wait_queue_init(&pipe->read_wait);
+        wait_queue_init(&pipe->write_wait);
+        return inode;
+    }
+    return NULL;
+}
+
+struct fs pipe_fs = {
+        .open     = pipe_open,
+        .evict    = pipe_evict,
+};
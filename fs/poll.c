@@ -0,0 +1,188 @@
+// poll.c
+//
+// poll(2). The first pass over the fds registers a callback entry on
+// every wait queue the files report; the entries stay queued until poll
+// returns, so later passes only re-read the ready masks. The callback
+// enqueues the polling task at most once per sleep, however many of the
+// queues are woken up.
+//
+// There are no kernel timers, so a poll with a finite timeout doesn't
+// sleep: it yields and checks the clock between passes.
+
+#include "errno.h"
+#include "time.h"
+#include "kernel/poll.h"
+#include "kernel/files.h"
+#include "kernel/sched.h"
+#include "kernel/clock.h"
+#include "kernel/kutils.h"
+
+/* Queues one poll can sleep on; files register at most two each */
+#define POLL_MAX_ENTRIES    (2 * RLIMIT_NOFILE)
+
+struct poll_wqueues
+{
+    /* Must stay first, the queue proc casts back */
+    struct poll_table pt;
+    struct task *task;
+    /* Set by a wakeup since the last pass */
+    bool triggered;
+    uint32_t count;
+    struct wait_queue_entry entries[POLL_MAX_ENTRIES];
+};
+
+uint32_t vfs_file_poll(struct file *file, struct poll_table *pt)
+{
+    if (file->file_ops.poll != NULL)
+    {
+        return file->file_ops.poll(file, pt);
+    }
+
+    uint32_t mask = 0;
+    if (file->file_ops.read != NULL)
+    {
+        mask |= POLLIN | POLLRDNORM;
+    }
+    if (file->file_ops.write != NULL)
+    {
+        mask |= POLLOUT | POLLWRNORM;
+    }
+    return mask;
+}
+
+static void poll_wake(struct wait_queue_entry *entry)
+{
+    struct poll_wqueues *pwq = entry->private;
+    if (pwq->triggered)
+    {
+        return;
+    }
+
+    pwq->triggered = true;
+    struct task *task = pwq->task;
+    if (task->state == TASK_INTERRUPTIBLE)
+    {
+        sched_enqueue(task);
+    }
+}
+
+static void poll_queue_proc(struct wait_queue *queue, struct poll_table *pt)
+{
+    struct poll_wqueues *pwq = (struct poll_wqueues *) pt;
+    if (pwq->count == POLL_MAX_ENTRIES)
+    {
+        panic("poll: too many wait queues");
+    }
+
+    struct wait_queue_entry *entry = &pwq->entries[pwq->count++];
+    wait_queue_entry_init_func(entry, poll_wake, pwq);
+    wait_queue_add(queue, entry);
+}
+
+static void poll_free(struct poll_wqueues *pwq)
+{
+    for (uint32_t i = 0; i < pwq->count; i++)
+    {
+        wait_queue_remove(&pwq->entries[i]);
+    }
+    pwq->count = 0;
+}
+
+static uint64_t poll_now_ms(void)
+{
+    struct timespec ts;
+    kclock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000ULL + (uint64_t) ts.tv_nsec / 1000000ULL;
+}
+
+/* One pass over the fds; returns how many have events */
+static int poll_pass(struct task *task, struct pollfd *fds, nfds_t nfds, struct poll_table *pt)
+{
+    int ready = 0;
+    for (nfds_t i = 0; i < nfds; i++)
+    {
+        fds[i].revents = 0;
+        if (fds[i].fd < 0)
+        {
+            continue;
+        }
+
+        struct file *file = files_find_by_fd(&task->files, fds[i].fd);
+        if (file == NULL)
+        {
+            fds[i].revents = POLLNVAL;
+            ready++;
+            continue;
+        }
+
+        /* Errors and hangups are reported whether asked for or not */
+        uint32_t want = (uint16_t) fds[i].events | POLLERR | POLLHUP;
+        uint32_t mask = vfs_file_poll(file, pt) & want;
+        fds[i].revents = (short) mask;
+        if (mask != 0)
+        {
+            ready++;
+        }
+    }
+    return ready;
+}
+
+int vfs_poll(struct task *task, struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    if (nfds > RLIMIT_NOFILE)
+    {
+        return -EINVAL;
+    }
+    if (fds == NULL && nfds > 0)
+    {
+        return -EFAULT;
+    }
+
+    struct poll_wqueues pwq;
+    pwq.pt.queue_proc = poll_queue_proc;
+    pwq.task = task;
+    pwq.count = 0;
+
+    uint64_t deadline = timeout > 0 ? poll_now_ms() + (uint64_t) timeout : 0;
+    struct poll_table *pt = timeout != 0 ? &pwq.pt : NULL;
+    int ready;
+
+    for (;;)
+    {
+        pwq.triggered = false;
+        ready = poll_pass(task, fds, nfds, pt);
+        pt = NULL;
+
+        if (ready > 0 || timeout == 0)
+        {
+            break;
+        }
+        if (timeout > 0 && poll_now_ms() >= deadline)
+        {
+            break;
+        }
+        if (task->signal.pending != 0u)
+        {
+            poll_free(&pwq);
+            sched_exit(-1);
+        }
+
+        if (timeout > 0)
+        {
+            sched_schedule();
+            continue;
+        }
+
+        task->state = TASK_INTERRUPTIBLE;
+        if (pwq.triggered)
+        {
+            /* Woken up during the pass */
+            task->state = TASK_RUNNING;
+            continue;
+        }
+        sched_schedule();
+    }
+
+    poll_free(&pwq);
+    return ready;
+}
@@ -6,172 +6,226 @@
 #include "kernel/sched.h"
 #include "kernel/kutils.h"
 #include "kernel/constants.h"
+#include "kernel/mm.h"
+#include "kernel/swap.h"
+#include "kernel/ksm.h"
+#include "kernel/zygote.h"
+#include "kernel/elf_loader.h"
+#include "kernel/shm.h"
+#include "kernel/kstack.h"
+#include "kernel/blk.h"
+#include "kernel/pcache.h"
+#include "kernel/vfs.h"
 
 /* ------------------------------------------------------------
- * Helper: fill one dirent entry from a task
+ * Inodes
+ *
+ * A /proc file gets its inode when it is first looked up. The low bits of
+ * the inode number say which file it is (and which fd for
+ * /proc/<pid>/fd/<n>) and private holds the pid, so read and getdents
+ * dispatch on the inode instead of parsing the path again.
  * ------------------------------------------------------------ */
-static void fill_dirent_from_task(struct dirent *de, const struct task *task)
-{
-    de->d_ino = (uint32_t) task->pid;
-    de->d_reclen = (uint16_t) sizeof(struct dirent);
-    de->d_type = DT_DIR;
-
-    char namebuf[MAX_FILENAME_LEN];
-    k_itoa(task->pid, namebuf);
 
-    size_t nlen = k_strlen(namebuf);
-    if (nlen >= sizeof(de->d_name))
-    {
-        nlen = sizeof(de->d_name) - 1;
-    }
+enum proc_kind
+{
+    /* The root inode the VFS allocates at mount has ino 1 */
+    PROC_ROOT = 1,
+    PROC_DISKSTATS,
+    PROC_MEMINFO,
+    PROC_STAT,
+    PROC_VMSTAT,
+    /* Everything from here on belongs to a process */
+    PROC_PID_DIR,
+    PROC_PID_CMDLINE,
+    PROC_PID_COMM,
+    PROC_PID_CWD,
+    PROC_PID_EXE,
+    PROC_PID_FD_DIR,
+    PROC_PID_MAPS,
+    PROC_PID_SMAPS,
+    PROC_PID_STAT,
+    PROC_PID_STATM,
+    PROC_PID_STATUS,
+    PROC_PID_FD_LINK,
+};
+
+#define PROC_KIND_BITS  6
+#define PROC_FD_BITS    5
+#define PROC_INO(pid, fd, kind) \
+    (((uint32_t) (pid) << (PROC_KIND_BITS + PROC_FD_BITS)) | ((uint32_t) (fd) << PROC_KIND_BITS) | (uint32_t) (kind))
+
+struct proc_entry
+{
+    const char *name;
+    enum proc_kind kind;
+    uint8_t d_type;
+};
+
+static const struct proc_entry proc_root_entries[] = {
+        {"diskstats", PROC_DISKSTATS, DT_REG},
+        {"meminfo",   PROC_MEMINFO,   DT_REG},
+        {"stat",      PROC_STAT,      DT_REG},
+        {"vmstat",    PROC_VMSTAT,    DT_REG},
+};
+
+static const struct proc_entry proc_pid_entries[] = {
+        {"cmdline", PROC_PID_CMDLINE, DT_REG},
+        {"comm",    PROC_PID_COMM,    DT_REG},
+        {"cwd",     PROC_PID_CWD,     DT_REG},
+        {"exe",     PROC_PID_EXE,     DT_REG},
+        {"fd",      PROC_PID_FD_DIR,  DT_DIR},
+        {"maps",    PROC_PID_MAPS,    DT_REG},
+        {"smaps",   PROC_PID_SMAPS,   DT_REG},
+        {"stat",    PROC_PID_STAT,    DT_REG},
+        {"statm",   PROC_PID_STATM,   DT_REG},
+        {"status",  PROC_PID_STATUS,  DT_REG},
+};
+
+#define PROC_ROOT_ENTRY_CNT (sizeof(proc_root_entries) / sizeof(proc_root_entries[0]))
+#define PROC_PID_ENTRY_CNT  (sizeof(proc_pid_entries) / sizeof(proc_pid_entries[0]))
+
+static enum proc_kind proc_kind(const struct inode *inode)
+{
+    return (enum proc_kind) (inode->ino & ((1u << PROC_KIND_BITS) - 1));
+}
 
-    k_memcpy(de->d_name, namebuf, nlen);
-    de->d_name[nlen] = '\0';
+static int proc_fd(const struct inode *inode)
+{
+    return (int) ((inode->ino >> PROC_KIND_BITS) & ((1u << PROC_FD_BITS) - 1));
 }
 
-/* ------------------------------------------------------------
- * Fill struct dirent entries for /proc
- * ------------------------------------------------------------ */
-int sched_fill_proc_dirents(struct dirent *buf, unsigned int max_entries)
+static pid_t proc_pid(const struct inode *inode)
 {
-    unsigned int idx = 0;
+    return (pid_t) (uintptr_t) inode->private;
+}
 
-    if (!buf || max_entries == 0)
-    {
-        return 0;
-    }
+/* Task the inode belongs to; NULL once it is gone */
+static struct task *proc_task(const struct inode *inode)
+{
+    return proc_kind(inode) < PROC_PID_DIR
+           ? NULL
+           : task_table_find_task_by_pid(&sched.task_table, proc_pid(inode));
+}
 
-    for (int k = 0; k < MAX_PROCESS_CNT; k++)
+static const struct proc_entry *proc_find_entry(const struct proc_entry *entries, size_t cnt, const char *name)
+{
+    for (size_t i = 0; i < cnt; i++)
     {
-        struct task *task = &sched.task_table.slots[k].task;
-        if (task->state != TASK_POOLED)
+        if (k_strcmp(entries[i].name, name) == 0)
         {
-            fill_dirent_from_task(&buf[idx], task);
-            idx++;
+            return &entries[i];
         }
     }
-
-    return (int) idx;
+    return NULL;
 }
 
-/* ------------------------------------------------------------
- * Extract PID from /proc/<pid>[/...]
- * ------------------------------------------------------------ */
-static pid_t proc_path_to_pid(const char *pathname)
+/* Parse a non-negative decimal number; false if name isn't one */
+static bool proc_parse_num(const char *name, int *out)
 {
-    if (!pathname || pathname[0] != '/')
+    if (*name == '\0')
     {
-        return PID_NONE;
-    }
-
-    if (k_strncmp(pathname, "/proc/", 6) != 0)
-    {
-        return PID_NONE;
+        return false;
     }
 
-    const char *p = pathname + 6;
-
-    if (*p < '0' || *p > '9')
+    int n = 0;
+    for (const char *p = name; *p; p++)
     {
-        return PID_NONE;
+        if (*p < '0' || *p > '9' || n > 100000000)
+        {
+            return false;
+        }
+        n = n * 10 + (*p - '0');
     }
 
-    pid_t pid = 0;
-    while (*p >= '0' && *p <= '9')
-    {
-        pid = pid * 10 + (*p - '0');
-        p++;
-    }
+    *out = n;
+    return true;
+}
 
-    if (*p != '\0' && *p != '/')
+static int proc_instantiate(struct dentry *dentry, enum proc_kind kind, pid_t pid, int fd)
+{
+    bool dir = kind == PROC_PID_DIR || kind == PROC_PID_FD_DIR;
+    struct inode *inode = inode_alloc(&proc_fs,
+                                      PROC_INO(pid, fd, kind),
+                                      dir ? S_IFDIR | 0555 : S_IFREG | 0444,
+                                      (void *) (uintptr_t) pid);
+    if (!inode)
     {
-        return PID_NONE;
+        return -ENOMEM;
     }
 
-    return pid;
+    d_instantiate(dentry, inode);
+    return 0;
 }
 
-/* ------------------------------------------------------------
- * Helper: is pathname exactly /proc or /proc/
- * ------------------------------------------------------------ */
-static bool proc_is_root(const char *pathname)
+static int proc_lookup(struct inode *dir, struct dentry *dentry)
 {
-    return pathname &&
-           (k_strcmp(pathname, "/proc") == 0 ||
-            k_strcmp(pathname, "/proc/") == 0);
-}
+    const struct proc_entry *entry;
+    struct task *task;
+    int num;
 
-/* ------------------------------------------------------------
- * Helper: is pathname exactly /proc/<pid> or /proc/<pid>/
- * ------------------------------------------------------------ */
-static bool proc_is_pid_dir(const char *pathname, pid_t *pid_out)
-{
-    pid_t pid = proc_path_to_pid(pathname);
-    if (pid == PID_NONE)
+    switch (proc_kind(dir))
     {
-        return false;
-    }
+        case PROC_ROOT:
+            entry = proc_find_entry(proc_root_entries, PROC_ROOT_ENTRY_CNT, dentry->name);
+            if (entry)
+            {
+                return proc_instantiate(dentry, entry->kind, 0, 0);
+            }
 
-    const char *p = pathname + 6;
-    while (*p >= '0' && *p <= '9')
-    {
-        p++;
-    }
+            if (proc_parse_num(dentry->name, &num) &&
+                task_table_find_task_by_pid(&sched.task_table, num))
+            {
+                return proc_instantiate(dentry, PROC_PID_DIR, num, 0);
+            }
+            return 0;
 
-    if (*p == '\0' || (*p == '/' && p[1] == '\0'))
-    {
-        if (pid_out)
-        {
-            *pid_out = pid;
-        }
-        return true;
-    }
+        case PROC_PID_DIR:
+            entry = proc_find_entry(proc_pid_entries, PROC_PID_ENTRY_CNT, dentry->name);
+            return entry ? proc_instantiate(dentry, entry->kind, proc_pid(dir), 0) : 0;
 
-    return false;
+        case PROC_PID_FD_DIR:
+            task = proc_task(dir);
+            if (task && proc_parse_num(dentry->name, &num) &&
+                num < RLIMIT_NOFILE && task->files.slots[num].file)
+            {
+                return proc_instantiate(dentry, PROC_PID_FD_LINK, proc_pid(dir), num);
+            }
+            return 0;
+
+        default:
+            return 0;
+    }
 }
 
-/* ------------------------------------------------------------
- * Helper: is pathname /proc/<pid>/fd or /proc/<pid>/fd/
- * ------------------------------------------------------------ */
-static bool proc_is_fd_dir(const char *pathname, pid_t *pid_out)
+/*
+ * Processes and their fds come and go behind the back of the dentry cache:
+ * a cached entry only stands while what it names still exists, and a
+ * missing name is looked up again every time.
+ */
+static bool proc_revalidate(struct dentry *dentry)
 {
-    pid_t pid = proc_path_to_pid(pathname);
-    if (pid == PID_NONE)
+    const struct inode *inode = dentry->inode;
+    if (!inode)
     {
         return false;
     }
 
-    const char *p = pathname + 6;
-    while (*p >= '0' && *p <= '9')
+    if (proc_kind(inode) < PROC_PID_DIR)
     {
-        p++;
+        return true;
     }
 
-    if (*p != '/')
+    struct task *task = proc_task(inode);
+    if (!task)
     {
         return false;
     }
-    p++;
 
-    if (k_strcmp(p, "fd") == 0 || k_strcmp(p, "fd/") == 0)
+    if (proc_kind(inode) == PROC_PID_FD_LINK)
     {
-        if (pid_out)
-        {
-            *pid_out = pid;
-        }
-        return true;
+        return task->files.slots[proc_fd(inode)].file != NULL;
     }
-
-    return false;
-}
-
-/* ------------------------------------------------------------
- * Helper: extract fd number from /proc/<pid>/fd/<num>
- * ------------------------------------------------------------ */
-int proc_extract_fd_num(const char *pathname)
-{
-    const char *fd = k_strstr(pathname, "/fd/");
-    return fd ? k_atoi(fd + 4) : -1;
+    return true;
 }
 
 /* ------------------------------------------------------------
@@ -347,6 +401,14 @@ static ssize_t read_proc_pid_status(struct file *file, void *buf, size_t count,
     k_strcat(output, temp);
     k_strcat(output, "\n");
 
+    if (task->kstack)
+    {
+        k_strcat(output, "KStackUsed:\t");
+        k_itoa((int) kstack_used(task->kstack), temp);
+        k_strcat(output, temp);
+        k_strcat(output, " bytes\n");
+    }
+
     k_strcat(output, "Brk:\t0x");
     k_itoa_hex(task->brk, temp);
     k_strcat(output, temp);
@@ -413,8 +475,22 @@ static ssize_t read_proc_pid_fd_link(struct file *file, void *buf, size_t count,
         return -1;
     }
 
-    const char *path = target->pathname;
-    size_t len = k_strlen(path);
+    char path[MAX_FILENAME_LEN];
+    int path_len;
+    if (target->dentry)
+    {
+        path_len = d_path(target->dentry, path, sizeof(path));
+    }
+    else
+    {
+        /* Anonymous, like a pipe */
+        path_len = k_snprintf(path, sizeof(path), "pipe:[%u]", target->inode->ino);
+    }
+    if (path_len < 0)
+    {
+        return path_len;
+    }
+    size_t len = (size_t) path_len;
 
     if (len + 1 > count)
     {
@@ -457,251 +533,505 @@ static ssize_t read_proc_stat(struct file *file, void *buf, size_t count)
 }
 
 /* ------------------------------------------------------------
- * proc_read
+ * Rendered files
+ *
+ * Files that can outgrow a single read are rendered in full on every
+ * read and served from file->pos onwards, so cat can page through them.
  * ------------------------------------------------------------ */
-static ssize_t proc_read(struct file *file, void *buf, size_t count)
-{
-    if (file->pos > 0 || !buf || count == 0)
-    {
-        return 0;
-    }
 
-    if (k_strcmp(file->pathname, "/proc/stat") == 0)
-    {
-        return read_proc_stat(file, buf, count);
-    }
+/*
+ * The largest file is smaps of a task with MM_MAX_VMAS VMAs: a maps line
+ * of at most ~120 bytes plus nine counter lines of ~28 bytes per VMA
+ */
+#define PROC_VMA_RECORD_MAX 512
+#define PROC_BUF_SIZE (MM_MAX_VMAS * PROC_VMA_RECORD_MAX)
 
-    pid_t pid = proc_path_to_pid(file->pathname);
-    if (pid == PID_NONE)
-    {
-        return -1;
-    }
+struct proc_buf
+{
+    char data[PROC_BUF_SIZE];
+    size_t len;
+    /* Output was cut off; the read fails instead of returning part of it */
+    bool overflow;
+};
 
-    struct task *task =
-            task_table_find_task_by_pid(&sched.task_table, pid);
-    if (!task)
-    {
-        return -1;
-    }
+static struct proc_buf proc_buf;
 
-    int fd = proc_extract_fd_num(file->pathname);
-    if (fd >= 0)
+static void proc_printf(struct proc_buf *out, const char *fmt, ...)
+{
+    size_t avail = PROC_BUF_SIZE - out->len;
+    if (avail <= 1)
     {
-        return read_proc_pid_fd_link(file, buf, count, task, fd);
+        out->overflow = true;
+        return;
     }
 
-    const char *leaf = k_strrchr(file->pathname, '/');
-    if (!leaf)
-    {
-        return -1;
-    }
-    leaf++;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = k_vsnprintf(out->data + out->len, avail, fmt, ap);
+    va_end(ap);
 
-    if (k_strcmp(leaf, "comm") == 0)
-    {
-        return read_proc_pid_comm(file, buf, count, task);
-    }
-    else if (k_strcmp(leaf, "cmdline") == 0)
+    if (n < 0)
     {
-        return read_proc_pid_cmdline(file, buf, count, task);
+        return;
     }
-    else if (k_strcmp(leaf, "stat") == 0)
+    /* k_vsnprintf stops at the last byte, so a full buffer may have lost the rest */
+    if ((size_t) n >= avail - 1)
     {
-        return read_proc_pid_stat(file, buf, count, task);
+        out->overflow = true;
     }
-    else if (k_strcmp(leaf, "status") == 0)
-    {
-        return read_proc_pid_status(file, buf, count, task);
-    }
-    else if (k_strcmp(leaf, "cwd") == 0)
+    out->len += (size_t) n < avail ? (size_t) n : avail - 1;
+}
+
+/* 4 KiB pages */
+#define KB_PER_PAGE 4u
+
+static void render_meminfo(struct proc_buf *out)
+{
+    struct mm_stat st;
+    mm_stat(&st);
+    struct swap_stat sw;
+    swap_stat(&sw);
+    struct kstack_stat kst;
+    kstack_stat(&kst);
+    struct pcache_stat ps;
+    pcache_stat(&ps);
+    struct bin_cache_stat bc;
+    bin_cache_stat(&bc);
+
+    proc_printf(out, "MemTotal:    %8u kB\n", st.total_pages * KB_PER_PAGE);
+    proc_printf(out, "MemFree:     %8u kB\n", st.free_pages * KB_PER_PAGE);
+    /* Page cache plus the decompressed /bin blocks */
+    proc_printf(out, "Cached:      %8u kB\n", (ps.pages + bc.pages) * KB_PER_PAGE);
+    proc_printf(out, "Slab:        %8u kB\n",
+                (uint32_t) (st.vmas_used * sizeof(struct vma) + 1023) / 1024);
+    proc_printf(out, "KernelStack: %8u kB\n", kst.stacks * (uint32_t) (KERNEL_STACK_SIZE / 1024));
+    proc_printf(out, "PageTables:  %8u kB\n", st.page_table_pages * KB_PER_PAGE);
+    proc_printf(out, "ZeroPool:    %8u kB\n", st.zero_pool_pages * KB_PER_PAGE);
+    proc_printf(out, "SwapTotal:   %8u kB\n", sw.total_slots * KB_PER_PAGE);
+    proc_printf(out, "SwapFree:    %8u kB\n", sw.free_slots * KB_PER_PAGE);
+}
+
+/*
+ * One line per block device: blocks read and written, merges, driver
+ * requests, errors and the most requests in flight at once
+ */
+static void render_diskstats(struct proc_buf *out)
+{
+    struct blk_stat st;
+    for (uint32_t i = 0; blk_stat(i, &st); i++)
     {
-        return read_proc_pid_cwd(file, buf, count, task);
+        proc_printf(out, "%s %llu %llu %llu %llu %llu %u\n", st.name,
+                    (unsigned long long) st.reads,
+                    (unsigned long long) st.writes,
+                    (unsigned long long) st.merges,
+                    (unsigned long long) st.requests,
+                    (unsigned long long) st.errors,
+                    st.max_inflight);
     }
-    else if (k_strcmp(leaf, "exe") == 0)
+}
+
+static void render_vmstat(struct proc_buf *out)
+{
+    struct mm_stat st;
+    mm_stat(&st);
+    struct swap_stat sw;
+    swap_stat(&sw);
+    struct ksm_stat ks;
+    ksm_stat(&ks);
+    struct kstack_stat kst;
+    kstack_stat(&kst);
+    struct zygote_stat zs;
+    zygote_stat(&zs);
+    struct bin_cache_stat bc;
+    bin_cache_stat(&bc);
+    struct dcache_stat ds;
+    dcache_stat(&ds);
+    struct pcache_stat ps;
+    pcache_stat(&ps);
+
+    proc_printf(out, "nr_free_pages %u\n", st.free_pages);
+    proc_printf(out, "nr_page_table_pages %u\n", st.page_table_pages);
+    proc_printf(out, "nr_vma %u\n", st.vmas_used);
+    proc_printf(out, "nr_vma_total %u\n", st.vmas_total);
+    proc_printf(out, "zero_pool_pages %u\n", st.zero_pool_pages);
+    proc_printf(out, "zero_pool_hit %llu\n", (unsigned long long) st.zero_pool_hits);
+    proc_printf(out, "zero_pool_miss %llu\n", (unsigned long long) st.zero_pool_misses);
+    proc_printf(out, "nr_swap_slots %u\n", sw.total_slots);
+    proc_printf(out, "nr_swap_slots_free %u\n", sw.free_slots);
+    proc_printf(out, "pswpin %llu\n", (unsigned long long) sw.pswpin);
+    proc_printf(out, "pswpout %llu\n", (unsigned long long) sw.pswpout);
+    proc_printf(out, "pgscan_kswapd %llu\n", (unsigned long long) sw.pgscan_kswapd);
+    proc_printf(out, "pgscan_direct %llu\n", (unsigned long long) sw.pgscan_direct);
+    proc_printf(out, "pgsteal_kswapd %llu\n", (unsigned long long) sw.pgsteal_kswapd);
+    proc_printf(out, "pgsteal_direct %llu\n", (unsigned long long) sw.pgsteal_direct);
+    proc_printf(out, "ksm_pages_shared %u\n", ks.pages_shared);
+    proc_printf(out, "ksm_pages_sharing %u\n", ks.pages_sharing);
+    proc_printf(out, "ksm_pages_unshared %u\n", ks.pages_unshared);
+    proc_printf(out, "ksm_pages_scanned %llu\n", (unsigned long long) ks.pages_scanned);
+    proc_printf(out, "ksm_full_scans %llu\n", (unsigned long long) ks.full_scans);
+    proc_printf(out, "nr_kernel_stacks %u\n", kst.stacks);
+    proc_printf(out, "kernel_stack_max_used %u\n", kst.max_used);
+    proc_printf(out, "nr_zygote_templates %u\n", zs.templates);
+    proc_printf(out, "nr_zygote_pages %u\n", zs.pages);
+    proc_printf(out, "zygote_hit %llu\n", (unsigned long long) zs.hits);
+    proc_printf(out, "zygote_miss %llu\n", (unsigned long long) zs.misses);
+    proc_printf(out, "zygote_evict %llu\n", (unsigned long long) zs.evictions);
+    proc_printf(out, "nr_bin_cache_pages %u\n", bc.pages);
+    proc_printf(out, "bin_cache_hit %llu\n", (unsigned long long) bc.hits);
+    proc_printf(out, "bin_cache_miss %llu\n", (unsigned long long) bc.misses);
+    proc_printf(out, "nr_dentry %u\n", ds.dentries);
+    proc_printf(out, "nr_dentry_negative %u\n", ds.negative);
+    proc_printf(out, "nr_inode %u\n", ds.inodes);
+    proc_printf(out, "dcache_hit %llu\n", (unsigned long long) ds.hits);
+    proc_printf(out, "dcache_miss %llu\n", (unsigned long long) ds.misses);
+    proc_printf(out, "dcache_evict %llu\n", (unsigned long long) ds.evictions);
+    proc_printf(out, "nr_file_pages %u\n", ps.pages);
+    proc_printf(out, "nr_dirty %u\n", ps.dirty);
+    proc_printf(out, "pgcache_hit %llu\n", (unsigned long long) ps.hits);
+    proc_printf(out, "pgcache_miss %llu\n", (unsigned long long) ps.misses);
+    proc_printf(out, "pgreadahead %llu\n", (unsigned long long) ps.readahead);
+    proc_printf(out, "pgwriteback %llu\n", (unsigned long long) ps.writeback);
+    proc_printf(out, "pgcache_evict %llu\n", (unsigned long long) ps.evictions);
+}
+
+static const char *vma_name(const struct vma *vma, const struct task *task)
+{
+    switch (vma->type)
     {
-        return read_proc_pid_exe(file, buf, count, task);
+        case VMA_TYPE_KERNEL:
+            return "[kernel]";
+        case VMA_TYPE_VGA:
+            return "[vga]";
+        case VMA_TYPE_IMAGE:
+            return task->name;
+        case VMA_TYPE_HEAP:
+            return "[heap]";
+        case VMA_TYPE_STACK:
+            return "[stack]";
+        case VMA_TYPE_SHARED:
+            return shm_object_name(vma->shm)[0] ? shm_object_name(vma->shm) : "/dev/zero (deleted)";
+        default:
+            return "";
     }
+}
 
-    return -1;
+/* One /proc/<pid>/maps line: start-end perms offset dev inode name */
+static void render_vma_line(struct proc_buf *out, const struct vma *vma, const struct task *task)
+{
+    bool shared = vma->type == VMA_TYPE_SHARED;
+    bool named = shared && shm_object_name(vma->shm)[0] != '\0';
+
+    proc_printf(out, "%08x-%08x %c%c%c%c %08x 00:00 0 %s%s\n",
+                (uint32_t) vma->base_va,
+                (uint32_t) (vma->base_va + vma->length),
+                (vma->flags & VMA_READ) ? 'r' : '-',
+                (vma->flags & VMA_WRITE) ? 'w' : '-',
+                (vma->flags & VMA_EXEC) ? 'x' : '-',
+                shared ? 's' : 'p',
+                shared ? vma->pgoff * KB_PER_PAGE * 1024 : 0,
+                named ? "/dev/shm/" : "",
+                vma_name(vma, task));
 }
 
-/* ------------------------------------------------------------
- * proc_getdents
- * ------------------------------------------------------------ */
-static int proc_getdents(struct file *file, struct dirent *buf, unsigned int count)
+static void render_pid_maps(struct proc_buf *out, const struct task *task)
 {
-    if (!buf || count < sizeof(struct dirent))
+    const struct mm *mm = task->mm;
+    for (uint32_t i = 0; i < mm->vma_cnt; i++)
     {
-        return 0;
+        render_vma_line(out, mm->vmas[i], task);
     }
+}
 
-    if (file->pos > 0)
+static void render_pid_smaps(struct proc_buf *out, const struct task *task)
+{
+    const struct mm *mm = task->mm;
+    for (uint32_t i = 0; i < mm->vma_cnt; i++)
     {
-        return 0;
+        const struct vma *vma = mm->vmas[i];
+        struct vma_usage usage;
+        mm_vma_usage(mm, vma, &usage);
+
+        render_vma_line(out, vma, task);
+        proc_printf(out, "Size:           %8u kB\n", usage.size * KB_PER_PAGE);
+        proc_printf(out, "Rss:            %8u kB\n", usage.rss * KB_PER_PAGE);
+        uint32_t private_dirty = usage.dirty - usage.shared_dirty;
+        proc_printf(out, "Shared_Clean:   %8u kB\n", (usage.shared - usage.shared_dirty) * KB_PER_PAGE);
+        proc_printf(out, "Shared_Dirty:   %8u kB\n", usage.shared_dirty * KB_PER_PAGE);
+        proc_printf(out, "Private_Clean:  %8u kB\n",
+                    (usage.rss - usage.shared - private_dirty) * KB_PER_PAGE);
+        proc_printf(out, "Private_Dirty:  %8u kB\n", private_dirty * KB_PER_PAGE);
+        proc_printf(out, "Referenced:     %8u kB\n", usage.referenced * KB_PER_PAGE);
+        proc_printf(out, "Anonymous:      %8u kB\n",
+                    vma->type == VMA_TYPE_IMAGE || vma->type == VMA_TYPE_SHARED ? 0 : usage.rss * KB_PER_PAGE);
+        proc_printf(out, "Swap:           %8u kB\n", usage.swap * KB_PER_PAGE);
     }
+}
 
-    unsigned int max_entries = count / sizeof(struct dirent);
-    unsigned int idx = 0;
-
-    if (proc_is_root(file->pathname))
+/* /proc/<pid>/statm: size resident shared text lib data dt, in pages */
+static void render_pid_statm(struct proc_buf *out, const struct task *task)
+{
+    const struct mm *mm = task->mm;
+    uint32_t size = 0;
+    uint32_t resident = 0;
+    uint32_t shared = 0;
+    uint32_t text = 0;
+    uint32_t data = 0;
+
+    for (uint32_t i = 0; i < mm->vma_cnt; i++)
     {
-        fs_add_entry(buf, max_entries, &idx, 1, DT_DIR, ".");
-        fs_add_entry(buf, max_entries, &idx, 1, DT_DIR, "..");
-        fs_add_entry(buf, max_entries, &idx, 1, DT_REG, "stat");
-
-        if (idx < max_entries)
+        const struct vma *vma = mm->vmas[i];
+        if (!(vma->flags & VMA_USER))
         {
-            unsigned int remaining = max_entries - idx;
-            int written = sched_fill_proc_dirents(&buf[idx], remaining);
-            if (written > 0)
-            {
-                idx += (unsigned int) written;
-            }
+            continue;
         }
 
-        int size = (int) (idx * sizeof(struct dirent));
-        file->pos += size;
-        return size;
-    }
+        struct vma_usage usage;
+        mm_vma_usage(mm, vma, &usage);
+        size += usage.size;
+        resident += usage.rss;
+        shared += usage.shared;
 
-    pid_t fd_pid;
-    if (proc_is_fd_dir(file->pathname, &fd_pid))
-    {
-        struct task *task = task_table_find_task_by_pid(&sched.task_table, fd_pid);
-        if (!task)
+        if (vma->type == VMA_TYPE_IMAGE && (vma->flags & VMA_EXEC))
         {
-            return -1;
+            text += usage.size;
         }
-
-        fs_add_entry(buf, max_entries, &idx, 1, DT_DIR, ".");
-        fs_add_entry(buf, max_entries, &idx, 1, DT_DIR, "..");
-
-        for (int i = 0; i < RLIMIT_NOFILE && idx < max_entries; i++)
+        else if (vma->flags & VMA_WRITE)
         {
-            if (task->files.slots[i].file)
-            {
-                char fd_name[16];
-                k_itoa(i, fd_name);
-                fs_add_entry(buf, max_entries, &idx, i + 10, DT_LNK, fd_name);
-            }
+            data += usage.size;
         }
+    }
 
-        int size = (int) (idx * sizeof(struct dirent));
-        file->pos += size;
-        return size;
+    proc_printf(out, "%u %u %u %u 0 %u 0\n", size, resident, shared, text, data);
+}
+
+/* Render the file behind inode into out; false if it isn't a rendered file */
+static bool proc_render(const struct inode *inode, struct proc_buf *out)
+{
+    out->len = 0;
+    out->overflow = false;
+
+    switch (proc_kind(inode))
+    {
+        case PROC_MEMINFO:
+            render_meminfo(out);
+            return true;
+        case PROC_VMSTAT:
+            render_vmstat(out);
+            return true;
+        case PROC_DISKSTATS:
+            render_diskstats(out);
+            return true;
+        case PROC_PID_MAPS:
+        case PROC_PID_SMAPS:
+        case PROC_PID_STATM:
+            break;
+        default:
+            return false;
     }
 
-    pid_t pid;
-    if (proc_is_pid_dir(file->pathname, &pid))
+    struct task *task = proc_task(inode);
+    if (!task)
     {
-        struct task *task = task_table_find_task_by_pid(&sched.task_table, pid);
-        if (!task)
-        {
-            return -1;
-        }
+        return false;
+    }
+
+    switch (proc_kind(inode))
+    {
+        case PROC_PID_MAPS:
+            render_pid_maps(out, task);
+            break;
+        case PROC_PID_SMAPS:
+            render_pid_smaps(out, task);
+            break;
+        default:
+            render_pid_statm(out, task);
+            break;
+    }
+    return true;
+}
 
-        fs_add_entry(buf, max_entries, &idx, 1, DT_DIR, ".");
-        fs_add_entry(buf, max_entries, &idx, 1, DT_DIR, "..");
-        fs_add_entry(buf, max_entries, &idx, 1, DT_REG, "cmdline");
-        fs_add_entry(buf, max_entries, &idx, 1, DT_REG, "comm");
-        fs_add_entry(buf, max_entries, &idx, 1, DT_REG, "cwd");
-        fs_add_entry(buf, max_entries, &idx, 1, DT_REG, "exe");
-        fs_add_entry(buf, max_entries, &idx, 1, DT_DIR, "fd");
-        fs_add_entry(buf, max_entries, &idx, 1, DT_REG, "stat");
-        fs_add_entry(buf, max_entries, &idx, 1, DT_REG, "status");
+static ssize_t proc_copy_out(struct file *file, void *buf, size_t count, const struct proc_buf *out)
+{
+    if ((size_t) file->pos >= out->len)
+    {
+        return 0;
+    }
 
-        int size = (int) (idx * sizeof(struct dirent));
-        file->pos += size;
-        return size;
+    size_t len = out->len - (size_t) file->pos;
+    if (len > count)
+    {
+        len = count;
     }
 
-    /* Not a directory */
-    return -ENOTDIR;
+    k_memcpy(buf, out->data + file->pos, len);
+    file->pos += len;
+    return (ssize_t) len;
 }
 
 /* ------------------------------------------------------------
- * proc_open
+ * proc_read
  * ------------------------------------------------------------ */
-static int proc_open(struct file *file)
+static ssize_t proc_read(struct file *file, void *buf, size_t count)
 {
-    const char *pathname = file->pathname;
-
-    file->file_ops.read = proc_read;
-    file->file_ops.getdents = proc_getdents;
-
-    if (proc_is_root(pathname))
+    if (!buf || count == 0)
     {
         return 0;
     }
 
-    if (k_strcmp(pathname, "/proc/stat") == 0)
+    if (proc_render(file->inode, &proc_buf))
+    {
+        return proc_buf.overflow ? -EOVERFLOW : proc_copy_out(file, buf, count, &proc_buf);
+    }
+
+    if (file->pos > 0)
     {
         return 0;
     }
 
-    pid_t pid = proc_path_to_pid(pathname);
-    if (pid == PID_NONE)
+    if (proc_kind(file->inode) == PROC_STAT)
     {
-        return -1;
+        return read_proc_stat(file, buf, count);
     }
 
-    struct task *task = task_table_find_task_by_pid(&sched.task_table, pid);
+    struct task *task = proc_task(file->inode);
     if (!task)
     {
         return -1;
     }
 
-    const char *p = pathname + 6;
-    while (*p >= '0' && *p <= '9')
+    switch (proc_kind(file->inode))
     {
-        p++;
+        case PROC_PID_FD_LINK:
+            return read_proc_pid_fd_link(file, buf, count, task, proc_fd(file->inode));
+        case PROC_PID_COMM:
+            return read_proc_pid_comm(file, buf, count, task);
+        case PROC_PID_CMDLINE:
+            return read_proc_pid_cmdline(file, buf, count, task);
+        case PROC_PID_STAT:
+            return read_proc_pid_stat(file, buf, count, task);
+        case PROC_PID_STATUS:
+            return read_proc_pid_status(file, buf, count, task);
+        case PROC_PID_CWD:
+            return read_proc_pid_cwd(file, buf, count, task);
+        case PROC_PID_EXE:
+            return read_proc_pid_exe(file, buf, count, task);
+        default:
+            return -1;
     }
+}
 
-    if (*p == '\0')
+/* Entry i of entries is at position base + i; false once buf is full */
+static bool proc_add_entries(struct file *file, struct dirent *buf, unsigned int max_entries, unsigned int *idx,
+                             uint32_t base, const struct proc_entry *entries, size_t cnt, pid_t pid)
+{
+    for (size_t i = 0; i < cnt; i++)
     {
-        return 0;
+        if (!fs_dir_emit(file, buf, max_entries, idx, base + (uint32_t) i, PROC_INO(pid, 0, entries[i].kind),
+                         entries[i].d_type, entries[i].name))
+        {
+            return false;
+        }
     }
+    return true;
+}
 
-    if (*p == '/' && p[1] == '\0')
+/* ------------------------------------------------------------
+ * proc_getdents
+ *
+ * Positions: "." 0, ".." 1, then the fixed entries. In /proc the tasks
+ * follow at the position of their task table slot, in /proc/<pid>/fd
+ * fd n is at 2 + n, so a task or fd that comes or goes between two calls
+ * doesn't shift the others.
+ * ------------------------------------------------------------ */
+static int proc_getdents(struct file *file, struct dirent *buf, unsigned int count)
+{
+    if (!buf || count < sizeof(struct dirent))
     {
         return 0;
     }
 
-    if (*p == '/')
-    {
-        const char *leaf = p + 1;
+    unsigned int max_entries = count / sizeof(struct dirent);
+    unsigned int idx = 0;
+    enum proc_kind kind = proc_kind(file->inode);
 
-        if (k_strcmp(leaf, "comm") == 0 ||
-            k_strcmp(leaf, "cmdline") == 0 ||
-            k_strcmp(leaf, "stat") == 0 ||
-            k_strcmp(leaf, "status") == 0 ||
-            k_strcmp(leaf, "cwd") == 0 ||
-            k_strcmp(leaf, "exe") == 0)
+    if (kind == PROC_ROOT)
+    {
+        fs_dir_emit(file, buf, max_entries, &idx, 0, 1, DT_DIR, ".");
+        fs_dir_emit(file, buf, max_entries, &idx, 1, 1, DT_DIR, "..");
+        if (!proc_add_entries(file, buf, max_entries, &idx, 2, proc_root_entries, PROC_ROOT_ENTRY_CNT, 0))
         {
-            return 0;
+            return (int) (idx * sizeof(struct dirent));
         }
 
-        if (k_strcmp(leaf, "fd") == 0 || k_strcmp(leaf, "fd/") == 0)
+        uint32_t base = 2 + (uint32_t) PROC_ROOT_ENTRY_CNT;
+        for (int k = 0; k < MAX_PROCESS_CNT; k++)
         {
-            return 0;
+            struct task *task = &sched.task_table.slots[k].task;
+            if (task->state == TASK_POOLED)
+            {
+                continue;
+            }
+
+            char name[16];
+            k_itoa(task->pid, name);
+            if (!fs_dir_emit(file, buf, max_entries, &idx, base + (uint32_t) k, (uint32_t) task->pid, DT_DIR, name))
+            {
+                break;
+            }
         }
 
-        if (k_strncmp(leaf, "fd/", 3) == 0)
+        return (int) (idx * sizeof(struct dirent));
+    }
+
+    if (kind != PROC_PID_DIR && kind != PROC_PID_FD_DIR)
+    {
+        /* Not a directory */
+        return -ENOTDIR;
+    }
+
+    struct task *task = proc_task(file->inode);
+    if (!task)
+    {
+        return -1;
+    }
+
+    fs_dir_emit(file, buf, max_entries, &idx, 0, 1, DT_DIR, ".");
+    fs_dir_emit(file, buf, max_entries, &idx, 1, 1, DT_DIR, "..");
+
+    if (kind == PROC_PID_FD_DIR)
+    {
+        for (int i = 0; i < RLIMIT_NOFILE; i++)
         {
-            int fd = proc_extract_fd_num(pathname);
-            if (fd >= 0 && fd < RLIMIT_NOFILE)
+            if (!task->files.slots[i].file)
             {
-                if (task->files.slots[fd].file)
-                {
-                    file->pos = 0;
-                    return 0;
-                }
+                continue;
+            }
+
+            char fd_name[16];
+            k_itoa(i, fd_name);
+            if (!fs_dir_emit(file, buf, max_entries, &idx, 2 + (uint32_t) i, PROC_INO(task->pid, i, PROC_PID_FD_LINK),
+                             DT_LNK, fd_name))
+            {
+                break;
             }
-            return -1;
         }
     }
+    else
+    {
+        proc_add_entries(file, buf, max_entries, &idx, 2, proc_pid_entries, PROC_PID_ENTRY_CNT, task->pid);
+    }
+
+    return (int) (idx * sizeof(struct dirent));
+}
 
-    return -1;
+/* ------------------------------------------------------------
+ * proc_open
+ * ------------------------------------------------------------ */
+static int proc_open(struct file *file)
+{
+    file->file_ops.read = proc_read;
+    file->file_ops.getdents = proc_getdents;
+    return 0;
 }
 
 
@@ -709,5 +1039,7 @@ static int proc_open(struct file *file)
  * Filesystem descriptor
  * ------------------------------------------------------------ */
 struct fs proc_fs = {
-        .open     = proc_open,
+        .lookup     = proc_lookup,
+        .revalidate = proc_revalidate,
+        .open       = proc_open,
 };
\ No newline at end of file
@@ -13,22 +13,23 @@ static int root_getdents(struct file *file, struct dirent *buf, unsigned int cou
         return 0;
     }
 
-    if (file->pos > 0)
-    {
-        return 0;
-    }
-
     unsigned int max_entries = count / sizeof(struct dirent);
     unsigned int idx = 0;
 
-    fs_add_entry(buf, max_entries, &idx, 1, DT_DIR, ".");
-    fs_add_entry(buf, max_entries, &idx, 1, DT_DIR, "..");
+    fs_dir_emit(file, buf, max_entries, &idx, 0, 1, DT_DIR, ".");
+    fs_dir_emit(file, buf, max_entries, &idx, 1, 1, DT_DIR, "..");
 
-    vfs_get_root_mounts(buf, max_entries, &idx);
+    vfs_get_root_mounts(file, buf, max_entries, &idx, 2);
 
-    int size = (int)(idx * sizeof(struct dirent));
-    file->pos += size;
-    return size;
+    return (int)(idx * sizeof(struct dirent));
+}
+
+/* Everything below / is a mount point, and those are found in the dentry cache */
+static int root_lookup(struct inode *dir, struct dentry *dentry)
+{
+    (void) dir;
+    (void) dentry;
+    return 0;
 }
 
 int root_open(struct file *file)
@@ -38,5 +39,6 @@ int root_open(struct file *file)
 }
 
 struct fs root_fs = {
+        .lookup = root_lookup,
         .open = root_open,
 };
\ No newline at end of file
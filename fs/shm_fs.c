@@ -0,0 +1,483 @@
+// shm_fs.c
+//
+// POSIX shared memory, mounted at /dev/shm. Every file is a shared memory
+// object: a size plus an index of frames that are allocated zeroed when a
+// page is first touched. An object holds a reference to each of its
+// frames and every mapping of a page takes one more, so a frame stays
+// alive as long as the object or any mapping still uses it.
+//
+// The same objects back MAP_SHARED | MAP_ANONYMOUS mappings; those are
+// never linked under /dev/shm and disappear with their last mapping.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "errno.h"
+#include "kernel/shm.h"
+#include "kernel/mm.h"
+#include "kernel/fs_util.h"
+#include "kernel/kutils.h"
+#include "kernel/vfs.h"
+
+#define PAGE_SIZE        4096u
+#define PAGE_CNT(size)   (((size) + PAGE_SIZE - 1) / PAGE_SIZE)
+
+#define SHM_MAX_OBJECTS  32
+#define SHM_NAME_MAX     32
+
+struct shm_object
+{
+    char name[SHM_NAME_MAX];
+    bool active;
+    /* Reachable by name under /dev/shm */
+    bool linked;
+    /* Open files and VMAs */
+    uint32_t refs;
+    size_t size;
+    /* Page index (one frame of SHM_MAX_PAGES entries, 0 = not committed) */
+    uintptr_t index_pa;
+    uintptr_t *pages;
+};
+
+static struct shm_object objects[SHM_MAX_OBJECTS];
+
+/* ------------------------------------------------------------
+ * Objects
+ * ------------------------------------------------------------ */
+
+static struct shm_object *obj_alloc(void)
+{
+    for (uint32_t i = 0; i < SHM_MAX_OBJECTS; i++)
+    {
+        struct shm_object *obj = &objects[i];
+        if (!obj->active)
+        {
+            k_memset(obj, 0, sizeof(*obj));
+            obj->active = true;
+            return obj;
+        }
+    }
+    return NULL;
+}
+
+static struct shm_object *obj_lookup(const char *name)
+{
+    for (uint32_t i = 0; i < SHM_MAX_OBJECTS; i++)
+    {
+        struct shm_object *obj = &objects[i];
+        if (obj->active && obj->linked && k_strcmp(obj->name, name) == 0)
+        {
+            return obj;
+        }
+    }
+    return NULL;
+}
+
+/* Committed frame of page pgoff or 0 */
+static uintptr_t obj_page_lookup(const struct shm_object *obj, uint32_t pgoff)
+{
+    return obj->pages && pgoff < PAGE_CNT(obj->size) ? obj->pages[pgoff] : 0;
+}
+
+/*
+ * Change the size. Pages past the new end are dropped by the object;
+ * mappings that still reference them keep their frames until unmapped.
+ */
+static int obj_resize(struct shm_object *obj, size_t size)
+{
+    if (size > SHM_MAX_PAGES * PAGE_SIZE)
+    {
+        return -EFBIG;
+    }
+
+    if (obj->pages)
+    {
+        for (uint32_t pgoff = PAGE_CNT(size); pgoff < PAGE_CNT(obj->size); pgoff++)
+        {
+            if (obj->pages[pgoff])
+            {
+                mm_frame_free(obj->pages[pgoff]);
+                obj->pages[pgoff] = 0;
+            }
+        }
+
+        /* Growing again must not bring the cut off bytes back */
+        uintptr_t tail = obj_page_lookup(obj, (uint32_t) (size / PAGE_SIZE));
+        if (size < obj->size && tail && size % PAGE_SIZE != 0)
+        {
+            k_memset((uint8_t *) mm_pa_to_kva(tail) + size % PAGE_SIZE, 0, PAGE_SIZE - size % PAGE_SIZE);
+        }
+    }
+
+    obj->size = size;
+    return 0;
+}
+
+static void obj_destroy(struct shm_object *obj)
+{
+    obj_resize(obj, 0);
+    if (obj->index_pa)
+    {
+        mm_frame_free(obj->index_pa);
+    }
+    obj->active = false;
+}
+
+struct shm_object *shm_anon_create(size_t size)
+{
+    struct shm_object *obj = obj_alloc();
+    if (!obj)
+    {
+        return NULL;
+    }
+
+    if (obj_resize(obj, size) < 0)
+    {
+        obj->active = false;
+        return NULL;
+    }
+
+    obj->refs = 1;
+    return obj;
+}
+
+void shm_object_get(struct shm_object *obj)
+{
+    obj->refs++;
+}
+
+void shm_object_put(struct shm_object *obj)
+{
+    if (obj->refs == 0)
+    {
+        panic("shm_object_put: no references");
+    }
+
+    obj->refs--;
+    if (obj->refs == 0 && !obj->linked)
+    {
+        obj_destroy(obj);
+    }
+}
+
+uintptr_t shm_object_page(struct shm_object *obj, uint32_t pgoff)
+{
+    if (pgoff >= PAGE_CNT(obj->size))
+    {
+        return 0;
+    }
+
+    if (!obj->pages)
+    {
+        obj->index_pa = mm_frame_alloc_zeroed();
+        if (!obj->index_pa)
+        {
+            return 0;
+        }
+        obj->pages = mm_pa_to_kva(obj->index_pa);
+    }
+
+    if (!obj->pages[pgoff])
+    {
+        obj->pages[pgoff] = mm_frame_alloc_zeroed();
+    }
+    return obj->pages[pgoff];
+}
+
+size_t shm_object_size(const struct shm_object *obj)
+{
+    return obj->size;
+}
+
+const char *shm_object_name(const struct shm_object *obj)
+{
+    return obj->name;
+}
+
+/* ------------------------------------------------------------
+ * File operations
+ * ------------------------------------------------------------ */
+
+static int shm_close(struct file *file)
+{
+    struct shm_object *obj = file->driver_data;
+    if (obj)
+    {
+        shm_object_put(obj);
+    }
+    return 0;
+}
+
+static ssize_t shm_pread(struct file *file, void *buf, size_t count, off_t offset)
+{
+    const struct shm_object *obj = file->driver_data;
+    if (!obj)
+    {
+        return -EISDIR;
+    }
+
+    if ((size_t) offset >= obj->size)
+    {
+        return 0;
+    }
+    if (count > obj->size - (size_t) offset)
+    {
+        count = obj->size - (size_t) offset;
+    }
+
+    uint8_t *dst = buf;
+    size_t done = 0;
+    while (done < count)
+    {
+        size_t pos = (size_t) offset + done;
+        size_t in_page = pos % PAGE_SIZE;
+        size_t chunk = PAGE_SIZE - in_page < count - done ? PAGE_SIZE - in_page : count - done;
+
+        /* Pages nobody touched read as zero without committing them */
+        uintptr_t pa = obj_page_lookup(obj, (uint32_t) (pos / PAGE_SIZE));
+        if (pa)
+        {
+            k_memcpy(dst + done, (uint8_t *) mm_pa_to_kva(pa) + in_page, chunk);
+        }
+        else
+        {
+            k_memset(dst + done, 0, chunk);
+        }
+        done += chunk;
+    }
+
+    return (ssize_t) done;
+}
+
+static ssize_t shm_read(struct file *file, void *buf, size_t count)
+{
+    ssize_t n = shm_pread(file, buf, count, (off_t) file->pos);
+    if (n > 0)
+    {
+        file->pos += (uint64_t) n;
+    }
+    return n;
+}
+
+static ssize_t shm_pwrite(struct file *file, const void *buf, size_t count, off_t offset)
+{
+    struct shm_object *obj = file->driver_data;
+    if (!obj)
+    {
+        return -EISDIR;
+    }
+
+    size_t end = (size_t) offset + count;
+    if (end < count)
+    {
+        return -EFBIG;
+    }
+    if (end > obj->size)
+    {
+        int res = obj_resize(obj, end);
+        if (res < 0)
+        {
+            return res;
+        }
+    }
+
+    const uint8_t *src = buf;
+    size_t done = 0;
+    while (done < count)
+    {
+        size_t pos = (size_t) offset + done;
+        size_t in_page = pos % PAGE_SIZE;
+        size_t chunk = PAGE_SIZE - in_page < count - done ? PAGE_SIZE - in_page : count - done;
+
+        uintptr_t pa = shm_object_page(obj, (uint32_t) (pos / PAGE_SIZE));
+        if (!pa)
+        {
+            break;
+        }
+        k_memcpy((uint8_t *) mm_pa_to_kva(pa) + in_page, src + done, chunk);
+        done += chunk;
+    }
+
+    if (done == 0)
+    {
+        return -ENOSPC;
+    }
+
+    return (ssize_t) done;
+}
+
+static ssize_t shm_write(struct file *file, const void *buf, size_t count)
+{
+    ssize_t n = shm_pwrite(file, buf, count, (off_t) file->pos);
+    if (n > 0)
+    {
+        file->pos += (uint64_t) n;
+    }
+    return n;
+}
+
+static int shm_truncate(struct file *file, off_t length)
+{
+    struct shm_object *obj = file->driver_data;
+    if (!obj)
+    {
+        return -EISDIR;
+    }
+    return obj_resize(obj, (size_t) length);
+}
+
+static int shm_fstat(struct file *file, struct stat *stat)
+{
+    const struct shm_object *obj = file->driver_data;
+    if (!obj)
+    {
+        stat->st_mode = S_IFDIR | 0777;
+        stat->st_nlink = 1;
+        return 0;
+    }
+
+    stat->st_mode = S_IFREG | 0666;
+    stat->st_nlink = obj->linked ? 1 : 0;
+    stat->st_size = (off_t) obj->size;
+    return 0;
+}
+
+static int shm_getdents(struct file *file, struct dirent *buf, unsigned int count)
+{
+    if (file->driver_data)
+    {
+        return -ENOTDIR;
+    }
+
+    if (!buf || count < sizeof(struct dirent))
+    {
+        return 0;
+    }
+
+    unsigned int max_entries = count / sizeof(struct dirent);
+    unsigned int idx = 0;
+
+    fs_dir_emit(file, buf, max_entries, &idx, 0, 1, DT_DIR, ".");
+    fs_dir_emit(file, buf, max_entries, &idx, 1, 2, DT_DIR, "..");
+
+    /* Object slot i is at position 2 + i */
+    for (uint32_t i = 0; i < SHM_MAX_OBJECTS; i++)
+    {
+        if (objects[i].active && objects[i].linked &&
+            !fs_dir_emit(file, buf, max_entries, &idx, 2 + i, 100 + i, DT_REG, objects[i].name))
+        {
+            break;
+        }
+    }
+
+    return (int) (idx * sizeof(struct dirent));
+}
+
+/* The inode of a named object holds a reference to it */
+static int shm_instantiate(struct dentry *dentry, struct shm_object *obj)
+{
+    struct inode *inode = inode_alloc(&shm_fs, (uint32_t) (100 + (obj - objects)), S_IFREG | 0666, obj);
+    if (!inode)
+    {
+        return -ENOMEM;
+    }
+
+    shm_object_get(obj);
+    d_instantiate(dentry, inode);
+    return 0;
+}
+
+static int shm_fs_lookup(struct inode *dir, struct dentry *dentry)
+{
+    (void) dir;
+
+    struct shm_object *obj = obj_lookup(dentry->name);
+    return obj ? shm_instantiate(dentry, obj) : 0;
+}
+
+static int shm_fs_create(struct inode *dir, struct dentry *dentry, int mode)
+{
+    (void) dir;
+    (void) mode;
+
+    struct shm_object *obj = obj_alloc();
+    if (!obj)
+    {
+        return -ENOSPC;
+    }
+    k_strcpy(obj->name, dentry->name);
+    obj->linked = true;
+
+    int res = shm_instantiate(dentry, obj);
+    if (res < 0)
+    {
+        obj_destroy(obj);
+    }
+    return res;
+}
+
+static int shm_fs_open(struct file *file)
+{
+    file->file_ops.getdents = shm_getdents;
+    file->file_ops.fstat = shm_fstat;
+    file->file_ops.close = shm_close;
+
+    struct shm_object *obj = file->inode->private;
+    if (!obj)
+    {
+        return 0;
+    }
+
+    shm_object_get(obj);
+    file->driver_data = obj;
+
+    int access = file->flags & 3;
+    if (access != O_WRONLY)
+    {
+        file->file_ops.read = shm_read;
+        file->file_ops.pread = shm_pread;
+    }
+    if (access != O_RDONLY)
+    {
+        file->file_ops.write = shm_write;
+        file->file_ops.pwrite = shm_pwrite;
+        file->file_ops.truncate = shm_truncate;
+
+        if (file->flags & O_TRUNC)
+        {
+            obj_resize(obj, 0);
+        }
+    }
+    return 0;
+}
+
+static int shm_fs_unlink(struct inode *dir, struct dentry *dentry)
+{
+    (void) dir;
+
+    /* Open files and mappings keep using it; the name is free right away */
+    struct shm_object *obj = dentry->inode->private;
+    obj->linked = false;
+    return 0;
+}
+
+static void shm_fs_evict(struct inode *inode)
+{
+    /* Destroys an unlinked object once nothing else uses it */
+    if (inode->private)
+    {
+        shm_object_put(inode->private);
+    }
+}
+
+struct shm_object *shm_file_object(struct file *file)
+{
+    return file->file_ops.close == shm_close ? file->driver_data : NULL;
+}
+
+struct fs shm_fs = {
+        .lookup   = shm_fs_lookup,
+        .create   = shm_fs_create,
+        .open     = shm_fs_open,
+        .unlink   = shm_fs_unlink,
+        .evict    = shm_fs_evict,
+};
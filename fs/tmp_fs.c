@@ -0,0 +1,577 @@
+// tmp_fs.c
+//
+// tmpfs, mounted at /tmp: a writable filesystem in memory.
+//
+// Every file and directory is a node. A file keeps its data in pages
+// indexed by a radix tree, allocated zeroed when first written, so a
+// sparse file only uses frames for the pages that hold data. Directory
+// entries are hashed on (directory, name) in one table, and each directory
+// also chains its own entries for getdents, oldest first. An entry gets
+// the next sequence number of its directory when it is linked, and that
+// number is its getdents position, so linking or unlinking between two
+// getdents calls doesn't shift the entries the reader has yet to see.
+//
+// A node lives as long as it has a name or an inode: an unlinked file
+// stays readable through the files that have it open and is freed with
+// its last inode.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "errno.h"
+#include "kernel/vfs.h"
+#include "kernel/radix.h"
+#include "kernel/mm.h"
+#include "kernel/fs_util.h"
+#include "kernel/kutils.h"
+
+#define PAGE_SIZE           4096u
+#define PAGE_CNT(size)      (((size) + PAGE_SIZE - 1) / PAGE_SIZE)
+
+#define TMP_MAX_NODES       256
+#define TMP_HASH_SIZE       128
+#define TMP_HASH_MASK       (TMP_HASH_SIZE - 1)
+/* off_t is 32 bits */
+#define TMP_MAX_FILE_SIZE   0x7fffffffu
+
+struct tmp_dirent;
+
+struct tmp_node
+{
+    bool active;
+    mode_t mode;
+    /* Names of the node: 1 while linked, 0 once removed */
+    uint32_t nlink;
+    /* Inodes of the node */
+    uint32_t refs;
+    /* Files */
+    size_t size;
+    struct radix_tree pages;
+    /* Directories */
+    struct tmp_node *parent;
+    struct tmp_dirent *entries;
+    uint32_t entry_cnt;
+    /* Sequence number of the next entry linked */
+    uint32_t next_seq;
+};
+
+struct tmp_dirent
+{
+    bool active;
+    struct tmp_dirent *hash_next;
+    /* Next entry of the same directory, which was linked later */
+    struct tmp_dirent *next;
+    /* Position in the directory is 2 + seq, after "." and ".." */
+    uint32_t seq;
+    struct tmp_node *dir;
+    struct tmp_node *node;
+    uint32_t hash;
+    uint8_t name_len;
+    char name[DNAME_MAX];
+};
+
+static struct
+{
+    /* nodes[0] is the root */
+    struct tmp_node nodes[TMP_MAX_NODES];
+    /* Without hard links every node but the root has exactly one entry */
+    struct tmp_dirent dirents[TMP_MAX_NODES];
+    struct tmp_dirent *hash[TMP_HASH_SIZE];
+} tmp;
+
+void tmp_fs_init(void)
+{
+    k_memset(&tmp, 0, sizeof(tmp));
+
+    struct tmp_node *root = &tmp.nodes[0];
+    root->active = true;
+    root->mode = S_IFDIR | 0777;
+    root->nlink = 1;
+    root->parent = root;
+}
+
+static uint32_t tmp_ino(const struct tmp_node *node)
+{
+    return (uint32_t) (node - tmp.nodes) + 1;
+}
+
+/* The mount root has no private data */
+static struct tmp_node *tmp_node_of(const struct inode *inode)
+{
+    return inode->private ? inode->private : &tmp.nodes[0];
+}
+
+static bool tmp_is_dir(const struct tmp_node *node)
+{
+    return (node->mode & S_IFMT) == S_IFDIR;
+}
+
+/* ------------------------------------------------------------
+ * Pages
+ * ------------------------------------------------------------ */
+
+static int tmp_resize(struct tmp_node *node, size_t size)
+{
+    if (size > TMP_MAX_FILE_SIZE)
+    {
+        return -EFBIG;
+    }
+
+    if (size < node->size)
+    {
+        radix_trim(&node->pages, (uint32_t) PAGE_CNT(size), mm_frame_free);
+
+        /* Growing again must not bring the cut off bytes back */
+        uintptr_t tail = radix_lookup(&node->pages, (uint32_t) (size / PAGE_SIZE));
+        if (tail && size % PAGE_SIZE != 0)
+        {
+            k_memset((uint8_t *) mm_pa_to_kva(tail) + size % PAGE_SIZE, 0, PAGE_SIZE - size % PAGE_SIZE);
+        }
+    }
+
+    node->size = size;
+    return 0;
+}
+
+/* ------------------------------------------------------------
+ * Nodes
+ * ------------------------------------------------------------ */
+
+static struct tmp_node *tmp_node_alloc(mode_t mode)
+{
+    for (uint32_t i = 1; i < TMP_MAX_NODES; i++)
+    {
+        struct tmp_node *node = &tmp.nodes[i];
+        if (!node->active)
+        {
+            k_memset(node, 0, sizeof(*node));
+            node->active = true;
+            node->mode = mode;
+            radix_init(&node->pages);
+            return node;
+        }
+    }
+    return NULL;
+}
+
+static void tmp_node_put(struct tmp_node *node)
+{
+    if (node->refs == 0 && node->nlink == 0)
+    {
+        tmp_resize(node, 0);
+        node->active = false;
+    }
+}
+
+/* Give dentry an inode of node */
+static int tmp_instantiate(struct dentry *dentry, struct tmp_node *node)
+{
+    struct inode *inode = inode_alloc(&tmp_fs, tmp_ino(node), node->mode, node);
+    if (!inode)
+    {
+        return -ENOMEM;
+    }
+
+    node->refs++;
+    d_instantiate(dentry, inode);
+    return 0;
+}
+
+/* ------------------------------------------------------------
+ * Directory entries
+ * ------------------------------------------------------------ */
+
+/* FNV-1a over the name, seeded with the directory */
+static uint32_t tmp_hash(const struct tmp_node *dir, const char *name, size_t len)
+{
+    uint32_t h = 2166136261u ^ (uint32_t) (uintptr_t) dir;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (uint8_t) name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static struct tmp_dirent *tmp_find(const struct tmp_node *dir, const char *name, size_t len)
+{
+    uint32_t hash = tmp_hash(dir, name, len);
+    for (struct tmp_dirent *de = tmp.hash[hash & TMP_HASH_MASK]; de; de = de->hash_next)
+    {
+        if (de->hash == hash && de->dir == dir && de->name_len == len && k_memcmp(de->name, name, len) == 0)
+        {
+            return de;
+        }
+    }
+    return NULL;
+}
+
+static void tmp_dirent_hash(struct tmp_dirent *de)
+{
+    de->hash = tmp_hash(de->dir, de->name, de->name_len);
+    struct tmp_dirent **bucket = &tmp.hash[de->hash & TMP_HASH_MASK];
+    de->hash_next = *bucket;
+    *bucket = de;
+
+    struct tmp_dirent **link = &de->dir->entries;
+    while (*link)
+    {
+        link = &(*link)->next;
+    }
+    de->next = NULL;
+    de->seq = de->dir->next_seq++;
+    *link = de;
+    de->dir->entry_cnt++;
+}
+
+static void tmp_dirent_unhash(struct tmp_dirent *de)
+{
+    struct tmp_dirent **link = &tmp.hash[de->hash & TMP_HASH_MASK];
+    while (*link != de)
+    {
+        link = &(*link)->hash_next;
+    }
+    *link = de->hash_next;
+
+    link = &de->dir->entries;
+    while (*link != de)
+    {
+        link = &(*link)->next;
+    }
+    *link = de->next;
+    de->dir->entry_cnt--;
+}
+
+/* Link node under the name of dentry in dir */
+static int tmp_link(struct tmp_node *dir, const struct dentry *dentry, struct tmp_node *node)
+{
+    struct tmp_dirent *de = NULL;
+    for (uint32_t i = 0; i < TMP_MAX_NODES; i++)
+    {
+        if (!tmp.dirents[i].active)
+        {
+            de = &tmp.dirents[i];
+            break;
+        }
+    }
+    if (!de)
+    {
+        return -ENOSPC;
+    }
+
+    k_memset(de, 0, sizeof(*de));
+    de->active = true;
+    de->dir = dir;
+    de->node = node;
+    de->name_len = dentry->name_len;
+    k_memcpy(de->name, dentry->name, dentry->name_len);
+    tmp_dirent_hash(de);
+
+    node->nlink = 1;
+    if (tmp_is_dir(node))
+    {
+        node->parent = dir;
+    }
+    return 0;
+}
+
+static void tmp_unlink_dirent(struct tmp_dirent *de)
+{
+    struct tmp_node *node = de->node;
+    tmp_dirent_unhash(de);
+    de->active = false;
+
+    node->nlink = 0;
+    tmp_node_put(node);
+}
+
+/* ------------------------------------------------------------
+ * File operations
+ * ------------------------------------------------------------ */
+
+static ssize_t tmp_pread(struct file *file, void *buf, size_t count, off_t offset)
+{
+    const struct tmp_node *node = file->driver_data;
+
+    if ((size_t) offset >= node->size)
+    {
+        return 0;
+    }
+    if (count > node->size - (size_t) offset)
+    {
+        count = node->size - (size_t) offset;
+    }
+
+    uint8_t *dst = buf;
+    size_t done = 0;
+    while (done < count)
+    {
+        size_t pos = (size_t) offset + done;
+        size_t in_page = pos % PAGE_SIZE;
+        size_t chunk = PAGE_SIZE - in_page < count - done ? PAGE_SIZE - in_page : count - done;
+
+        /* Holes read as zero */
+        uintptr_t pa = radix_lookup(&node->pages, (uint32_t) (pos / PAGE_SIZE));
+        if (pa)
+        {
+            k_memcpy(dst + done, (uint8_t *) mm_pa_to_kva(pa) + in_page, chunk);
+        }
+        else
+        {
+            k_memset(dst + done, 0, chunk);
+        }
+        done += chunk;
+    }
+
+    return (ssize_t) done;
+}
+
+static ssize_t tmp_pwrite(struct file *file, const void *buf, size_t count, off_t offset)
+{
+    struct tmp_node *node = file->driver_data;
+
+    size_t end = (size_t) offset + count;
+    if (end < count || end > TMP_MAX_FILE_SIZE)
+    {
+        return -EFBIG;
+    }
+
+    const uint8_t *src = buf;
+    size_t done = 0;
+    while (done < count)
+    {
+        size_t pos = (size_t) offset + done;
+        size_t in_page = pos % PAGE_SIZE;
+        size_t chunk = PAGE_SIZE - in_page < count - done ? PAGE_SIZE - in_page : count - done;
+
+        uintptr_t *slot = radix_slot(&node->pages, (uint32_t) (pos / PAGE_SIZE));
+        if (!slot)
+        {
+            break;
+        }
+        if (*slot == 0)
+        {
+            *slot = mm_frame_alloc_zeroed();
+            if (*slot == 0)
+            {
+                break;
+            }
+        }
+
+        k_memcpy((uint8_t *) mm_pa_to_kva(*slot) + in_page, src + done, chunk);
+        done += chunk;
+    }
+
+    if (done == 0 && count > 0)
+    {
+        return -ENOSPC;
+    }
+
+    if ((size_t) offset + done > node->size)
+    {
+        node->size = (size_t) offset + done;
+    }
+    return (ssize_t) done;
+}
+
+static ssize_t tmp_read(struct file *file, void *buf, size_t count)
+{
+    ssize_t n = tmp_pread(file, buf, count, (off_t) file->pos);
+    if (n > 0)
+    {
+        file->pos += (uint64_t) n;
+    }
+    return n;
+}
+
+static ssize_t tmp_write(struct file *file, const void *buf, size_t count)
+{
+    ssize_t n = tmp_pwrite(file, buf, count, (off_t) file->pos);
+    if (n > 0)
+    {
+        file->pos += (uint64_t) n;
+    }
+    return n;
+}
+
+static int tmp_truncate(struct file *file, off_t length)
+{
+    return tmp_resize(file->driver_data, (size_t) length);
+}
+
+static int tmp_fstat(struct file *file, struct stat *stat)
+{
+    const struct tmp_node *node = file->driver_data;
+    stat->st_mode = node->mode;
+    stat->st_nlink = node->nlink;
+    stat->st_size = tmp_is_dir(node) ? (off_t) node->entry_cnt : (off_t) node->size;
+    stat->st_blksize = PAGE_SIZE;
+    return 0;
+}
+
+/* pos is the position of the next entry, see the sequence numbers above */
+static int tmp_getdents(struct file *file, struct dirent *buf, unsigned int count)
+{
+    const struct tmp_node *dir = file->driver_data;
+    unsigned int max_entries = count / sizeof(struct dirent);
+    unsigned int idx = 0;
+
+    fs_dir_emit(file, buf, max_entries, &idx, 0, tmp_ino(dir), DT_DIR, ".");
+    fs_dir_emit(file, buf, max_entries, &idx, 1, tmp_ino(dir->parent), DT_DIR, "..");
+
+    for (const struct tmp_dirent *de = dir->entries; de; de = de->next)
+    {
+        if (!fs_dir_emit(file, buf, max_entries, &idx, 2 + de->seq, tmp_ino(de->node),
+                         tmp_is_dir(de->node) ? DT_DIR : DT_REG, de->name))
+        {
+            break;
+        }
+    }
+
+    return (int) (idx * sizeof(struct dirent));
+}
+
+/* ------------------------------------------------------------
+ * Filesystem operations
+ * ------------------------------------------------------------ */
+
+static int tmp_lookup(struct inode *dir, struct dentry *dentry)
+{
+    const struct tmp_dirent *de = tmp_find(tmp_node_of(dir), dentry->name, dentry->name_len);
+    return de ? tmp_instantiate(dentry, de->node) : 0;
+}
+
+/* Create a node of the given type under the name of dentry */
+static int tmp_mknod(struct inode *dir, struct dentry *dentry, mode_t mode)
+{
+    struct tmp_node *node = tmp_node_alloc(mode);
+    if (!node)
+    {
+        return -ENOSPC;
+    }
+
+    int res = tmp_link(tmp_node_of(dir), dentry, node);
+    if (res == 0)
+    {
+        res = tmp_instantiate(dentry, node);
+        if (res < 0)
+        {
+            tmp_unlink_dirent(tmp_find(tmp_node_of(dir), dentry->name, dentry->name_len));
+        }
+        return res;
+    }
+
+    node->active = false;
+    return res;
+}
+
+static int tmp_create(struct inode *dir, struct dentry *dentry, int mode)
+{
+    return tmp_mknod(dir, dentry, S_IFREG | (mode & 0777));
+}
+
+static int tmp_mkdir(struct inode *dir, struct dentry *dentry, int mode)
+{
+    return tmp_mknod(dir, dentry, S_IFDIR | (mode & 0777));
+}
+
+static int tmp_unlink(struct inode *dir, struct dentry *dentry)
+{
+    tmp_unlink_dirent(tmp_find(tmp_node_of(dir), dentry->name, dentry->name_len));
+    return 0;
+}
+
+static int tmp_rmdir(struct inode *dir, struct dentry *dentry)
+{
+    if (tmp_node_of(dentry->inode)->entry_cnt > 0)
+    {
+        return -ENOTEMPTY;
+    }
+    return tmp_unlink(dir, dentry);
+}
+
+static int tmp_rename(struct inode *old_dir, struct dentry *old_dentry,
+                      struct inode *new_dir, struct dentry *new_dentry)
+{
+    struct tmp_node *new_parent = tmp_node_of(new_dir);
+    struct tmp_dirent *de = tmp_find(tmp_node_of(old_dir), old_dentry->name, old_dentry->name_len);
+
+    /* Replace the target, which the vfs checked to be of the same kind */
+    struct tmp_dirent *target = tmp_find(new_parent, new_dentry->name, new_dentry->name_len);
+    if (target == de)
+    {
+        return 0;
+    }
+    if (target)
+    {
+        if (tmp_is_dir(target->node) && target->node->entry_cnt > 0)
+        {
+            return -ENOTEMPTY;
+        }
+        tmp_unlink_dirent(target);
+    }
+
+    tmp_dirent_unhash(de);
+    de->dir = new_parent;
+    de->name_len = new_dentry->name_len;
+    k_memcpy(de->name, new_dentry->name, new_dentry->name_len);
+    tmp_dirent_hash(de);
+
+    if (tmp_is_dir(de->node))
+    {
+        de->node->parent = new_parent;
+    }
+    return 0;
+}
+
+static int tmp_open(struct file *file)
+{
+    struct tmp_node *node = tmp_node_of(file->inode);
+    file->driver_data = node;
+    file->file_ops.fstat = tmp_fstat;
+
+    if (tmp_is_dir(node))
+    {
+        file->file_ops.getdents = tmp_getdents;
+        return 0;
+    }
+
+    int access = file->flags & 3;
+    if (access != O_WRONLY)
+    {
+        file->file_ops.read = tmp_read;
+        file->file_ops.pread = tmp_pread;
+    }
+    if (access != O_RDONLY)
+    {
+        file->file_ops.write = tmp_write;
+        file->file_ops.pwrite = tmp_pwrite;
+        file->file_ops.truncate = tmp_truncate;
+
+        if (file->flags & O_TRUNC)
+        {
+            tmp_resize(node, 0);
+        }
+    }
+    return 0;
+}
+
+static void tmp_evict(struct inode *inode)
+{
+    struct tmp_node *node = inode->private;
+    if (node)
+    {
+        node->refs--;
+        tmp_node_put(node);
+    }
+}
+
+struct fs tmp_fs = {
+        .lookup   = tmp_lookup,
+        .create   = tmp_create,
+        .open     = tmp_open,
+        .unlink   = tmp_unlink,
+        .mkdir    = tmp_mkdir,
+        .rmdir    = tmp_rmdir,
+        .rename   = tmp_rename,
+        .evict    = tmp_evict,
+};
@@ -5,9 +5,11 @@
 #include "kernel/fs_util.h"
 #include "kernel/kutils.h"
 #include "kernel/console.h"
+#include "kernel/pipe.h"
+#include "kernel/eventpoll.h"
+#include "kernel/pcache.h"
 
 #define VFS_RING_MASK     (MAX_FILE_CNT - 1)
-#define VFS_MAX_SEGMENTS  64
 #define MAX_MOUNTS        16
 
 
@@ -50,160 +52,110 @@ void vfs_init(struct vfs *vfs)
         vfs->mounts[i].fs = NULL;
         vfs->mounts[i].path[0] = '\0';
     }
+
+    dcache_init();
 }
 
 /* ------------------------------------------------------------
- * Path normalization
+ * Path walk
+ *
+ * Resolves a path one component at a time through the dentry cache.
+ * '.' and '..' are handled on the way, so there is no separate
+ * normalization pass and a component that was looked up before costs a
+ * hash lookup. Mount points are dentries like any other, so crossing
+ * one needs no mount table scan.
  *
- * Input: absolute path or best-effort string in 'path'
- * Output: normalized absolute path in-place:
- *   - ensures leading '/'
- *   - collapses multiple '/'
- *   - resolves '.' and '..'
- *   - strips trailing '/' except for root
+ * On success *out is a referenced dentry; it is negative when only the
+ * last component doesn't exist, so callers can create it.
  * ------------------------------------------------------------ */
-static void vfs_normalize_path(char *path, size_t buf_size)
+static int vfs_walk_from(struct dentry *start, const char *path, struct dentry **out)
 {
-    if (!path || buf_size == 0)
-    {
-        return;
-    }
+    struct dentry *dir = dget(start);
+    const char *p = path;
 
-    if (path[0] == '\0')
+    for (;;)
     {
-        path[0] = '/';
-        if (buf_size > 1)
+        while (*p == '/')
         {
-            path[1] = '\0';
+            p++;
         }
-        return;
-    }
-
-    /* Ensure leading '/' */
-    if (path[0] != '/')
-    {
-        size_t len = k_strlen(path);
-        if (len + 1 >= buf_size)
+        if (*p == '\0')
         {
-            if (buf_size < 2)
-            {
-                return;
-            }
-            len = buf_size - 2;
+            break;
         }
 
-        /* Shift right by one, including '\0' */
-        for (size_t i = len + 1; i > 0; i--)
+        const char *name = p;
+        while (*p != '\0' && *p != '/')
         {
-            path[i] = path[i - 1];
+            p++;
         }
-        path[0] = '/';
-        /* string already null-terminated by the shift */
-    }
-
-    struct segment
-    {
-        int start;
-        int len;
-    };
-
-    struct segment segs[VFS_MAX_SEGMENTS];
-    int seg_count = 0;
+        size_t len = (size_t) (p - name);
 
-    size_t len = k_strlen(path);
-    int i = 0;
-
-    while (i < (int) len)
-    {
-        /* Skip consecutive '/' */
-        while (i < (int) len && path[i] == '/')
+        if (!dir->inode)
         {
-            i++;
+            dput(dir);
+            return -ENOENT;
         }
-
-        int start = i;
-        while (i < (int) len && path[i] != '/')
+        if (!inode_is_dir(dir->inode))
         {
-            i++;
+            dput(dir);
+            return -ENOTDIR;
         }
 
-        int comp_len = i - start;
-        if (comp_len == 0)
+        if (len == 1 && name[0] == '.')
         {
             continue;
         }
 
-        /* Single '.' -> skip */
-        if (comp_len == 1 && path[start] == '.')
+        struct dentry *next;
+        if (len == 2 && name[0] == '.' && name[1] == '.')
         {
-            continue;
+            /* '..' at the root stays at the root */
+            next = dget(dir->parent ? dir->parent : dir);
         }
-
-        /* '..' -> pop previous segment if any */
-        if (comp_len == 2 && path[start] == '.' && path[start + 1] == '.')
+        else
         {
-            if (seg_count > 0)
+            int res = d_lookup(dir, name, len, &next);
+            if (res < 0)
             {
-                seg_count--;
+                dput(dir);
+                return res;
             }
-            /* if at root, stay at root */
-            continue;
         }
 
-        if (seg_count < VFS_MAX_SEGMENTS)
-        {
-            segs[seg_count].start = start;
-            segs[seg_count].len = comp_len;
-            seg_count++;
-        }
+        dput(dir);
+        dir = next;
     }
 
-    /* Rebuild normalized path */
-    int pos = 0;
+    *out = dir;
+    return 0;
+}
 
-    if (seg_count == 0)
+/* Walk pathname from the root when it is absolute and from cwd otherwise */
+static int vfs_walk(const char *cwd, const char *pathname, struct dentry **out)
+{
+    struct dentry *root = d_root();
+    if (!root || !pathname)
     {
-        /* Just root */
-        path[0] = '/';
-        if (buf_size > 1)
-        {
-            path[1] = '\0';
-        }
-        return;
+        return -ENOENT;
     }
 
-    path[pos++] = '/';
-
-    for (int s = 0; s < seg_count; s++)
+    if (pathname[0] == '/' || !cwd || cwd[0] == '\0')
     {
-        if (pos + segs[s].len + 1 >= (int) buf_size)
-        {
-            int allowed = (int) buf_size - pos - 2;
-            if (allowed <= 0)
-            {
-                break;
-            }
-            segs[s].len = allowed;
-        }
-
-        k_memcpy(path + pos, path + segs[s].start, (size_t) segs[s].len);
-        pos += segs[s].len;
-
-        if (s != seg_count - 1)
-        {
-            if (pos + 1 >= (int) buf_size)
-            {
-                break;
-            }
-            path[pos++] = '/';
-        }
+        return vfs_walk_from(root, pathname, out);
     }
 
-    if (pos >= (int) buf_size)
+    /* cwd is absolute, and usually cached all the way down */
+    struct dentry *start;
+    int res = vfs_walk_from(root, cwd, &start);
+    if (res < 0)
     {
-        pos = (int) buf_size - 1;
+        return res;
     }
-    path[pos] = '\0';
+
+    res = vfs_walk_from(start, pathname, out);
+    dput(start);
+    return res;
 }
 
 /* ------------------------------------------------------------
@@ -211,41 +163,70 @@ static void vfs_normalize_path(char *path, size_t buf_size)
  * ------------------------------------------------------------ */
 int vfs_mount(const char *path, struct fs *fs)
 {
-    if (!path || !fs)
+    if (!path || !fs || path[0] != '/')
     {
         return -1;
     }
 
-    // Normalize the mount path
-    char normalized[MAX_FILENAME_LEN];
-    k_strncpy(normalized, path, sizeof(normalized));
-    normalized[sizeof(normalized) - 1] = '\0';
-    vfs_normalize_path(normalized, sizeof(normalized));
-
-    // Find free slot
+    struct mount_point *mp = NULL;
     for (int i = 0; i < MAX_MOUNTS; i++)
     {
         if (!vfs.mounts[i].active)
         {
-            vfs.mounts[i].active = 1;
-            vfs.mounts[i].fs = fs;
-            k_strcpy(vfs.mounts[i].path, normalized);
-            return 0;
+            mp = &vfs.mounts[i];
+            break;
         }
     }
 
-    return -1; // No free slots
-}
+    if (mp == NULL || k_strlen(path) >= sizeof(mp->path))
+    {
+        return -1; // No free slots
+    }
 
-void vfs_get_root_mounts(struct dirent *buf, unsigned int max_entries, unsigned int *idx)
-{
-    for (int i = 0; i < MAX_MOUNTS; i++)
+    struct inode *root = inode_alloc(fs, 1, S_IFDIR | 0555, NULL);
+    if (root == NULL)
+    {
+        return -1;
+    }
+
+    int res;
+    const char *name = k_strrchr(path, '/') + 1;
+    if (name[0] == '\0')
+    {
+        res = d_set_root(root);
+    }
+    else
     {
-        if (*idx >= max_entries)
+        char parent_path[MAX_FILENAME_LEN];
+        k_memcpy(parent_path, path, (size_t) (name - path));
+        parent_path[name - path] = '\0';
+
+        struct dentry *parent;
+        res = vfs_walk(NULL, parent_path, &parent);
+        if (res == 0)
         {
-            break;
+            res = parent->inode && inode_is_dir(parent->inode) ? d_mount(parent, name, root) : -ENOENT;
+            dput(parent);
         }
+    }
+
+    if (res < 0)
+    {
+        inode_put(root);
+        return -1;
+    }
+
+    mp->active = 1;
+    mp->fs = fs;
+    k_strcpy(mp->path, path);
+    return 0;
+}
 
+void vfs_get_root_mounts(struct file *file, struct dirent *buf, unsigned int max_entries, unsigned int *idx,
+                         uint32_t base)
+{
+    for (int i = 0; i < MAX_MOUNTS; i++)
+    {
         if (!vfs.mounts[i].active)
         {
             continue;
@@ -269,54 +250,12 @@ void vfs_get_root_mounts(struct dirent *buf, unsigned int max_entries, unsigned
         const char *name = path + 1;
 
         // Only add if it's a direct child of root (no more slashes)
-        if (k_strchr(name, '/') == NULL && name[0] != '\0')
-        {
-            fs_add_entry(buf, max_entries, idx, 0, DT_DIR, name);
-        }
-    }
-}
-
-/* ------------------------------------------------------------
- * Find filesystem for a path using mount table
- * Returns the filesystem with the longest matching prefix
- * ------------------------------------------------------------ */
-static struct fs *path_to_fs(const char *pathname)
-{
-    if (!pathname || pathname[0] != '/')
-    {
-        return NULL;
-    }
-
-    struct fs *best_fs = NULL;
-    size_t best_len = 0;
-
-    // Find longest matching mount point
-    for (int i = 0; i < MAX_MOUNTS; i++)
-    {
-        if (!vfs.mounts[i].active)
-        {
-            continue;
-        }
-
-        const char *mount_path = vfs.mounts[i].path;
-        size_t mount_len = k_strlen(mount_path);
-
-        // Check if pathname starts with this mount path
-        if (k_strncmp(pathname, mount_path, mount_len) == 0)
+        if (k_strchr(name, '/') == NULL && name[0] != '\0' &&
+            !fs_dir_emit(file, buf, max_entries, idx, base + (uint32_t) i, 0, DT_DIR, name))
         {
-            // Exact match or followed by '/' or end of string
-            if (pathname[mount_len] == '\0' || pathname[mount_len] == '/' || mount_len == 1)
-            {
-                if (mount_len > best_len)
-                {
-                    best_len = mount_len;
-                    best_fs = vfs.mounts[i].fs;
-                }
-            }
+            break;
         }
     }
-
-    return best_fs;
 }
 
 struct file *vfs_alloc_file()
@@ -342,8 +281,6 @@ void vfs_free_file(struct file *file)
         panic("vfs_free_file: too many frees");
     }
 
-    file->fd = -1;
-
     const uint32_t file_idx = file->idx;
     const uint32_t free_ring_idx = vfs.free_tail & VFS_RING_MASK;
 
@@ -351,115 +288,78 @@ void vfs_free_file(struct file *file)
     vfs.free_tail++;
 }
 
-/* ------------------------------------------------------------
- * Path resolution:
- *   - combine task->cwd and pathname
- *   - normalize the resulting absolute path
- * ------------------------------------------------------------ */
-void vfs_resolve_path(const char *cwd, const char *pathname, char *resolved, size_t resolved_size)
+/* Return a file nobody refers to anymore, with what it holds, to the pool */
+static void vfs_release_file(struct file *file)
 {
-    if (!resolved || resolved_size == 0)
+    inode_put(file->inode);
+    if (file->dentry)
     {
-        return;
+        dput(file->dentry);
     }
+    file->inode = NULL;
+    file->dentry = NULL;
+    vfs_free_file(file);
+}
 
-    /* Empty path -> cwd or "/" */
-    if (!pathname || pathname[0] == '\0')
+/* Drop one reference; the last one closes the file */
+static void vfs_put_file(struct file *file)
+{
+    if (file->refs == 0)
     {
-        if (cwd[0] != '\0')
-        {
-            k_strncpy(resolved, cwd, resolved_size);
-            resolved[resolved_size - 1] = '\0';
-        }
-        else
-        {
-            resolved[0] = '/';
-            if (resolved_size > 1)
-            {
-                resolved[1] = '\0';
-            }
-        }
-        vfs_normalize_path(resolved, resolved_size);
-        return;
+        panic("vfs_put_file: no references");
     }
 
-    /* Already absolute */
-    if (pathname[0] == '/')
+    file->refs--;
+    if (file->refs > 0)
     {
-        k_strncpy(resolved, pathname, resolved_size);
-        resolved[resolved_size - 1] = '\0';
-        vfs_normalize_path(resolved, resolved_size);
         return;
     }
 
-    /* Relative: prepend CWD (or "/") */
-    if (cwd[0] != '\0')
-    {
-        k_strncpy(resolved, cwd, resolved_size);
-        resolved[resolved_size - 1] = '\0';
-    }
-    else
+    if (file->ep_items != NULL)
     {
-        resolved[0] = '/';
-        if (resolved_size > 1)
-        {
-            resolved[1] = '\0';
-        }
+        eventpoll_release(file);
     }
 
-    size_t len = k_strlen(resolved);
-
-    if (len == 0)
+    if (file->file_ops.close != NULL)
     {
-        resolved[0] = '/';
-        if (resolved_size > 1)
-        {
-            resolved[1] = '\0';
-        }
-        len = 1;
+        file->file_ops.close(file);
     }
+    vfs_release_file(file);
+}
 
-    /* Add separator if needed */
-    if (len < resolved_size - 1 && resolved[len - 1] != '/')
+/* Create the missing name dentry refers to, for O_CREAT */
+static int vfs_create(struct dentry *dentry, int flags, int mode)
+{
+    if (!(flags & O_CREAT))
     {
-        resolved[len++] = '/';
-        resolved[len] = '\0';
+        return -ENOENT;
     }
 
-    /* Append relative pathname */
-    if (len < resolved_size - 1)
+    struct inode *dir = dentry->parent->inode;
+    if (dir->fs->create == NULL)
     {
-        k_strncpy(resolved + len, pathname, resolved_size - len);
-        resolved[resolved_size - 1] = '\0';
+        return -EROFS;
     }
 
-    /* Normalize final absolute path */
-    vfs_normalize_path(resolved, resolved_size);
+    return dir->fs->create(dir, dentry, mode);
 }
 
-int vfs_open(struct task *task, const char *pathname, int flags, int mode)
+/*
+ * Open inode as a new file at the lowest free fd of task. The file takes
+ * over the dentry reference, NULL for an anonymous inode like a pipe, and
+ * takes its own reference to the inode.
+ */
+static int vfs_open_file(struct task *task, struct dentry *dentry, struct inode *inode, int flags, int mode)
 {
-    char resolved_path[MAX_FILENAME_LEN];
-    vfs_resolve_path(task->cwd, pathname, resolved_path, sizeof(resolved_path));
-
-    struct fs *fs = path_to_fs(resolved_path);
-    if (fs == NULL)
-    {
-        kprintf("vfs_open: no fs found\n");
-        return -1;
-    }
-
-    if (task == NULL)
-    {
-        kprintf("vfs_open: no task found\n");
-        return -1;
-    }
-
     struct file *file = vfs_alloc_file();
     if (file == NULL)
     {
         kprintf("vfs_open: can't allocate file\n");
-        return -1;
+        if (dentry)
+        {
+            dput(dentry);
+        }
+        return -ENFILE;
     }
 
     int fd = files_alloc_fd(&task->files, file);
@@ -467,11 +367,24 @@ int vfs_open(struct task *task, const char *pathname, int flags, int mode)
     {
         kprintf("vfs_open: can't allocate fd\n");
         vfs_free_file(file);
-        return -1;
+        if (dentry)
+        {
+            dput(dentry);
+        }
+        return -EMFILE;
+    }
+
+    if (flags & O_CLOEXEC)
+    {
+        task->files.slots[fd].flags = FD_CLOEXEC;
     }
 
+    file->dentry = dentry;
+    file->inode = inode;
+    inode_get(file->inode);
+
+    file->refs = 1;
     file->driver_data = NULL;
-    file->fd = fd;
     file->pos = 0;
     file->flags = flags;
     file->mode = mode;
@@ -480,22 +393,65 @@ int vfs_open(struct task *task, const char *pathname, int flags, int mode)
     file->file_ops.write = NULL;
     file->file_ops.read = NULL;
     file->file_ops.fstat = NULL;
-
-    k_strcpy(file->pathname, resolved_path);
+    file->file_ops.truncate = NULL;
+    file->file_ops.llseek = NULL;
+    file->file_ops.pread = NULL;
+    file->file_ops.pwrite = NULL;
+    file->file_ops.poll = NULL;
+    file->ep_items = NULL;
 
     // Call filesystem-specific open if it exists
+    struct fs *fs = file->inode->fs;
     if (fs->open != NULL)
     {
         int res = fs->open(file);
         if (res < 0)
         {
             files_free_fd(&task->files, fd);
-            vfs_free_file(file);
-            return -1;
+            vfs_release_file(file);
+            return res;
         }
     }
 
-     return fd;
+    return fd;
+}
+
+int vfs_open_anon(struct task *task, struct inode *inode, int flags)
+{
+    return vfs_open_file(task, NULL, inode, flags, 0);
+}
+
+int vfs_open(struct task *task, const char *pathname, int flags, int mode)
+{
+    if (task == NULL)
+    {
+        kprintf("vfs_open: no task found\n");
+        return -1;
+    }
+
+    struct dentry *dentry;
+    int res = vfs_walk(task->cwd, pathname, &dentry);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    if (dentry->inode == NULL)
+    {
+        res = vfs_create(dentry, flags, mode);
+    }
+    else if ((flags & O_CREAT) && (flags & O_EXCL))
+    {
+        res = -EEXIST;
+    }
+
+    if (res < 0)
+    {
+        dput(dentry);
+        return res;
+    }
+
+    return vfs_open_file(task, dentry, dentry->inode, flags, mode);
 }
 
 int vfs_close(struct task *task, const int fd)
@@ -505,22 +461,140 @@ int vfs_close(struct task *task, const int fd)
         return -1;
     }
 
-    struct file *file = files_find_by_fd(&task->files, fd);
+    struct file *file = files_free_fd(&task->files, fd);
     if (file == NULL)
     {
         return -1;
     }
 
-    if (file->file_ops.close != NULL)
+    vfs_put_file(file);
+    return 0;
+}
+
+int vfs_pipe(struct task *task, int fds[2], int flags)
+{
+    if (flags & ~(O_CLOEXEC | O_NONBLOCK))
     {
-        file->file_ops.close(file);
+        return -EINVAL;
     }
 
-    files_free_fd(&task->files, fd);
-    vfs_free_file(file);
+    struct inode *inode = pipe_inode_alloc();
+    if (inode == NULL)
+    {
+        return -ENFILE;
+    }
+
+    int rfd = vfs_open_anon(task, inode, O_RDONLY | flags);
+    if (rfd < 0)
+    {
+        inode_put(inode);
+        return rfd;
+    }
+
+    int wfd = vfs_open_anon(task, inode, O_WRONLY | flags);
+    if (wfd < 0)
+    {
+        vfs_close(task, rfd);
+        inode_put(inode);
+        return wfd;
+    }
+
+    /* The two files hold the pipe now */
+    inode_put(inode);
+    fds[0] = rfd;
+    fds[1] = wfd;
     return 0;
 }
 
+int vfs_dup(struct task *task, int oldfd)
+{
+    return vfs_fcntl(task, oldfd, F_DUPFD, 0);
+}
+
+int vfs_dup2(struct task *task, int oldfd, int newfd)
+{
+    struct file *file = files_find_by_fd(&task->files, oldfd);
+    if (file == NULL || newfd < 0 || newfd >= RLIMIT_NOFILE)
+    {
+        return -EBADF;
+    }
+
+    if (oldfd == newfd)
+    {
+        return newfd;
+    }
+
+    if (task->files.slots[newfd].file != NULL)
+    {
+        vfs_close(task, newfd);
+    }
+
+    file->refs++;
+    task->files.slots[newfd].file = file;
+    task->files.slots[newfd].flags = 0;
+    return newfd;
+}
+
+int vfs_fcntl(struct task *task, int fd, int cmd, int arg)
+{
+    struct file *file = files_find_by_fd(&task->files, fd);
+    if (file == NULL)
+    {
+        return -EBADF;
+    }
+
+    switch (cmd)
+    {
+        case F_DUPFD:
+        case F_DUPFD_CLOEXEC:
+        {
+            if (arg < 0 || arg >= RLIMIT_NOFILE)
+            {
+                return -EINVAL;
+            }
+
+            int newfd = files_alloc_fd_from(&task->files, file, arg);
+            if (newfd < 0)
+            {
+                return -EMFILE;
+            }
+
+            file->refs++;
+            task->files.slots[newfd].flags = cmd == F_DUPFD_CLOEXEC ? FD_CLOEXEC : 0;
+            return newfd;
+        }
+
+        case F_GETFD:
+            return task->files.slots[fd].flags;
+
+        case F_SETFD:
+            task->files.slots[fd].flags = arg & FD_CLOEXEC;
+            return 0;
+
+        case F_GETFL:
+            return file->flags;
+
+        case F_SETFL:
+            /* Only O_NONBLOCK and O_DIRECT can change; they are shared with every dup */
+            file->flags = (file->flags & ~(O_NONBLOCK | O_DIRECT)) | (arg & (O_NONBLOCK | O_DIRECT));
+            return 0;
+
+        default:
+            return -EINVAL;
+    }
+}
+
+void vfs_close_on_exec(struct task *task)
+{
+    for (int fd = 0; fd < RLIMIT_NOFILE; fd++)
+    {
+        if (task->files.slots[fd].file && (task->files.slots[fd].flags & FD_CLOEXEC))
+        {
+            vfs_close(task, fd);
+        }
+    }
+}
+
 ssize_t vfs_write(int fd, const char *buf, size_t count)
 {
     if (buf == NULL || count == 0)
@@ -567,24 +641,234 @@ ssize_t vfs_read(int fd, void *buf, size_t count)
     return file->file_ops.read(file, buf, count);
 }
 
-int vfs_getdents(int fd, struct dirent *buf, unsigned int count)
+/* ------------------------------------------------------------
+ * Positioned and vectored I/O
+ *
+ * A filesystem can implement llseek, pread and pwrite itself; otherwise
+ * they are built on read, write and fstat. readv and writev always loop
+ * over the read and write ops, so a file gets them for free.
+ * ------------------------------------------------------------ */
+
+/* Pipes and character devices like the ttys have no position */
+static bool vfs_file_seekable(const struct file *file)
 {
-    struct task *current = sched_current();
-    if (current == NULL)
+    mode_t type = file->inode->mode & S_IFMT;
+    return type != S_IFIFO && type != S_IFCHR;
+}
+
+off_t vfs_lseek(struct task *task, int fd, off_t offset, int whence)
+{
+    struct file *file = files_find_by_fd(&task->files, fd);
+    if (file == NULL)
     {
-        return -1;
+        return -EBADF;
     }
 
-    struct file *file = files_find_by_fd(&current->files, fd);
-    if (file == NULL || file->file_ops.getdents == NULL)
+    if (file->file_ops.llseek != NULL)
     {
-        return -1;
+        return file->file_ops.llseek(file, offset, whence);
     }
 
-    return file->file_ops.getdents(file, buf, count);
-}
+    if (!vfs_file_seekable(file))
+    {
+        return -ESPIPE;
+    }
 
-int vfs_fstat(struct task *task, int fd, struct stat *stat)
+    off_t base;
+    switch (whence)
+    {
+        case SEEK_SET:
+            base = 0;
+            break;
+        case SEEK_CUR:
+            base = (off_t) file->pos;
+            break;
+        case SEEK_END:
+        {
+            struct stat stat;
+            int res = vfs_fstat(task, fd, &stat);
+            if (res < 0)
+            {
+                return res;
+            }
+            base = stat.st_size;
+            break;
+        }
+        default:
+            return -EINVAL;
+    }
+
+    if (offset > 0 && base > INT32_MAX - offset)
+    {
+        return -EOVERFLOW;
+    }
+    if (base + offset < 0)
+    {
+        return -EINVAL;
+    }
+
+    file->pos = (uint64_t) (base + offset);
+    return base + offset;
+}
+
+ssize_t vfs_pread(struct task *task, int fd, void *buf, size_t count, off_t offset)
+{
+    struct file *file = files_find_by_fd(&task->files, fd);
+    if (file == NULL || file->file_ops.read == NULL)
+    {
+        return -EBADF;
+    }
+
+    if (offset < 0)
+    {
+        return -EINVAL;
+    }
+
+    if (file->file_ops.pread != NULL)
+    {
+        return file->file_ops.pread(file, buf, count, offset);
+    }
+
+    if (!vfs_file_seekable(file))
+    {
+        return -ESPIPE;
+    }
+
+    /* Read at offset and put the shared position back */
+    uint64_t pos = file->pos;
+    file->pos = (uint64_t) offset;
+    ssize_t n = file->file_ops.read(file, buf, count);
+    file->pos = pos;
+    return n;
+}
+
+ssize_t vfs_pwrite(struct task *task, int fd, const void *buf, size_t count, off_t offset)
+{
+    struct file *file = files_find_by_fd(&task->files, fd);
+    if (file == NULL || file->file_ops.write == NULL)
+    {
+        return -EBADF;
+    }
+
+    if (offset < 0)
+    {
+        return -EINVAL;
+    }
+
+    if (file->file_ops.pwrite != NULL)
+    {
+        return file->file_ops.pwrite(file, buf, count, offset);
+    }
+
+    if (!vfs_file_seekable(file))
+    {
+        return -ESPIPE;
+    }
+
+    uint64_t pos = file->pos;
+    file->pos = (uint64_t) offset;
+    ssize_t n = file->file_ops.write(file, buf, count);
+    file->pos = pos;
+    return n;
+}
+
+ssize_t vfs_readv(struct task *task, int fd, const struct iovec *iov, int iovcnt)
+{
+    struct file *file = files_find_by_fd(&task->files, fd);
+    if (file == NULL || file->file_ops.read == NULL)
+    {
+        return -EBADF;
+    }
+
+    if (iov == NULL || iovcnt < 0 || iovcnt > IOV_MAX)
+    {
+        return -EINVAL;
+    }
+
+    ssize_t total = 0;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        if (iov[i].iov_len == 0)
+        {
+            continue;
+        }
+
+        ssize_t n = file->file_ops.read(file, iov[i].iov_base, iov[i].iov_len);
+        if (n < 0)
+        {
+            return total > 0 ? total : n;
+        }
+        total += n;
+
+        /* A short read means there is nothing more to fill the next buffer */
+        if ((size_t) n < iov[i].iov_len)
+        {
+            break;
+        }
+
+        /* A pipe or tty would sleep for more data although the caller has some already */
+        if (n > 0 && !vfs_file_seekable(file))
+        {
+            break;
+        }
+    }
+    return total;
+}
+
+ssize_t vfs_writev(struct task *task, int fd, const struct iovec *iov, int iovcnt)
+{
+    struct file *file = files_find_by_fd(&task->files, fd);
+    if (file == NULL || file->file_ops.write == NULL)
+    {
+        return -EBADF;
+    }
+
+    if (iov == NULL || iovcnt < 0 || iovcnt > IOV_MAX)
+    {
+        return -EINVAL;
+    }
+
+    ssize_t total = 0;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        if (iov[i].iov_len == 0)
+        {
+            continue;
+        }
+
+        ssize_t n = file->file_ops.write(file, iov[i].iov_base, iov[i].iov_len);
+        if (n < 0)
+        {
+            return total > 0 ? total : n;
+        }
+        total += n;
+
+        if ((size_t) n < iov[i].iov_len)
+        {
+            break;
+        }
+    }
+    return total;
+}
+
+int vfs_getdents(int fd, struct dirent *buf, unsigned int count)
+{
+    struct task *current = sched_current();
+    if (current == NULL)
+    {
+        return -1;
+    }
+
+    struct file *file = files_find_by_fd(&current->files, fd);
+    if (file == NULL || file->file_ops.getdents == NULL)
+    {
+        return -1;
+    }
+
+    return file->file_ops.getdents(file, buf, count);
+}
+
+int vfs_fstat(struct task *task, int fd, struct stat *stat)
 {
     if (task == NULL || stat == NULL)
     {
@@ -598,6 +882,9 @@ int vfs_fstat(struct task *task, int fd, struct stat *stat)
     }
 
     k_memset(stat, 0, sizeof(*stat));
+    stat->st_ino = file->inode->ino;
+    stat->st_mode = file->inode->mode;
+    stat->st_nlink = 1;
 
     if (file->file_ops.fstat == NULL)
     {
@@ -607,50 +894,312 @@ int vfs_fstat(struct task *task, int fd, struct stat *stat)
     return file->file_ops.fstat(file, stat);
 }
 
-int vfs_chdir(const char *path)
+int vfs_fsync(struct task *task, int fd)
 {
-    if (path == NULL)
+    struct file *file = files_find_by_fd(&task->files, fd);
+    if (file == NULL)
     {
-        return -EINVAL;
+        return -EBADF;
     }
 
-    struct task *current = sched_current();
-    if (current == NULL)
+    if (file->file_ops.fsync != NULL)
+    {
+        return file->file_ops.fsync(file);
+    }
+
+    /* Files without a cache in front of a device have nothing to write */
+    return vfs_file_seekable(file) ? 0 : -EINVAL;
+}
+
+void vfs_sync(void)
+{
+    pcache_sync();
+}
+
+int vfs_ftruncate(struct task *task, int fd, off_t length)
+{
+    if (task == NULL)
     {
         return -ESRCH;
     }
 
-    char resolved[MAX_FILENAME_LEN];
+    struct file *file = files_find_by_fd(&task->files, fd);
+    if (file == NULL)
+    {
+        return -EBADF;
+    }
 
-    vfs_resolve_path(current->cwd, path, resolved, sizeof(resolved));
+    /* Only through a file open for writing, whatever the filesystem allows */
+    if ((file->flags & 3) == O_RDONLY)
+    {
+        return -EINVAL;
+    }
 
-    int fd = vfs_open(current, resolved, 0, 0);
-    if (fd < 0)
+    if (file->file_ops.truncate == NULL)
+    {
+        return -EINVAL;
+    }
+
+    if (length < 0)
     {
-        return fd;
+        return -EINVAL;
     }
 
-    struct dirent test_dirent;
-    int result = vfs_getdents(fd, &test_dirent, sizeof(test_dirent));
-    vfs_close(current, fd);
+    return file->file_ops.truncate(file, length);
+}
+
+int vfs_unlink(struct task *task, const char *pathname)
+{
+    if (task == NULL || pathname == NULL)
+    {
+        return -EINVAL;
+    }
 
-    if (result == -ENOTDIR)
+    struct dentry *dentry;
+    int res = vfs_walk(task->cwd, pathname, &dentry);
+    if (res < 0)
     {
-        return -ENOTDIR;
+        return res;
     }
 
-    if (result < 0)
+    if (dentry->inode == NULL)
+    {
+        res = -ENOENT;
+    }
+    else if (dentry->flags & DENTRY_PINNED)
+    {
+        res = -EBUSY;
+    }
+    else if (inode_is_dir(dentry->inode))
     {
-        return result;
+        res = -EISDIR;
+    }
+    else
+    {
+        struct inode *dir = dentry->parent->inode;
+        res = dir->fs->unlink != NULL ? dir->fs->unlink(dir, dentry) : -EROFS;
+        if (res == 0)
+        {
+            /* Open files keep the inode; the name is gone */
+            d_delete(dentry);
+        }
     }
 
-    // Copy the resolved path into task->cwd safely
-    k_strncpy(current->cwd, resolved, sizeof(current->cwd));
-    current->cwd[sizeof(current->cwd) - 1] = '\0';
+    dput(dentry);
+    return res;
+}
 
+int vfs_mkdir(struct task *task, const char *pathname, int mode)
+{
+    if (task == NULL || pathname == NULL)
+    {
+        return -EINVAL;
+    }
+
+    struct dentry *dentry;
+    int res = vfs_walk(task->cwd, pathname, &dentry);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    if (dentry->inode != NULL)
+    {
+        res = -EEXIST;
+    }
+    else
+    {
+        struct inode *dir = dentry->parent->inode;
+        res = dir->fs->mkdir != NULL ? dir->fs->mkdir(dir, dentry, mode) : -EROFS;
+    }
+
+    dput(dentry);
+    return res;
+}
+
+int vfs_rmdir(struct task *task, const char *pathname)
+{
+    if (task == NULL || pathname == NULL)
+    {
+        return -EINVAL;
+    }
+
+    struct dentry *dentry;
+    int res = vfs_walk(task->cwd, pathname, &dentry);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    if (dentry->inode == NULL)
+    {
+        res = -ENOENT;
+    }
+    else if (!inode_is_dir(dentry->inode))
+    {
+        res = -ENOTDIR;
+    }
+    else if ((dentry->flags & DENTRY_PINNED) || dentry->parent == NULL)
+    {
+        res = -EBUSY;
+    }
+    else
+    {
+        struct inode *dir = dentry->parent->inode;
+        res = dir->fs->rmdir != NULL ? dir->fs->rmdir(dir, dentry) : -EROFS;
+        if (res == 0)
+        {
+            /* Dentries below it can't be reached anymore either */
+            d_delete(dentry);
+            d_drop(dentry);
+        }
+    }
+
+    dput(dentry);
+    return res;
+}
+
+/* True when dentry is ancestor or lies below it */
+static bool vfs_is_subdir(const struct dentry *dentry, const struct dentry *ancestor)
+{
+    for (const struct dentry *d = dentry; d; d = d->parent)
+    {
+        if (d == ancestor)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int vfs_rename_check(const struct dentry *old_dentry, const struct dentry *new_dentry)
+{
+    if (old_dentry->inode == NULL)
+    {
+        return -ENOENT;
+    }
+    if ((old_dentry->flags & DENTRY_PINNED) || (new_dentry->flags & DENTRY_PINNED) ||
+        old_dentry->parent == NULL || new_dentry->parent == NULL)
+    {
+        return -EBUSY;
+    }
+
+    struct inode *old_dir = old_dentry->parent->inode;
+    struct inode *new_dir = new_dentry->parent->inode;
+    if (old_dir->fs != new_dir->fs)
+    {
+        return -EXDEV;
+    }
+    if (old_dir->fs->rename == NULL)
+    {
+        return -EROFS;
+    }
+
+    bool is_dir = inode_is_dir(old_dentry->inode);
+    if (is_dir && vfs_is_subdir(new_dentry, old_dentry) && new_dentry != old_dentry)
+    {
+        return -EINVAL;
+    }
+
+    if (new_dentry->inode != NULL)
+    {
+        if (is_dir && !inode_is_dir(new_dentry->inode))
+        {
+            return -ENOTDIR;
+        }
+        if (!is_dir && inode_is_dir(new_dentry->inode))
+        {
+            return -EISDIR;
+        }
+    }
     return 0;
 }
 
+int vfs_rename(struct task *task, const char *oldpath, const char *newpath)
+{
+    if (task == NULL || oldpath == NULL || newpath == NULL)
+    {
+        return -EINVAL;
+    }
+
+    struct dentry *old_dentry;
+    int res = vfs_walk(task->cwd, oldpath, &old_dentry);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    struct dentry *new_dentry;
+    res = vfs_walk(task->cwd, newpath, &new_dentry);
+    if (res < 0)
+    {
+        dput(old_dentry);
+        return res;
+    }
+
+    res = vfs_rename_check(old_dentry, new_dentry);
+    if (res == 0 && old_dentry != new_dentry)
+    {
+        struct inode *old_dir = old_dentry->parent->inode;
+        struct inode *new_dir = new_dentry->parent->inode;
+        res = old_dir->fs->rename(old_dir, old_dentry, new_dir, new_dentry);
+        if (res == 0)
+        {
+            /* Both names changed; let the next lookups ask the filesystem */
+            d_drop(old_dentry);
+            d_drop(new_dentry);
+        }
+    }
+
+    dput(new_dentry);
+    dput(old_dentry);
+    return res;
+}
+
+int vfs_chdir(const char *path)
+{
+    if (path == NULL)
+    {
+        return -EINVAL;
+    }
+
+    struct task *current = sched_current();
+    if (current == NULL)
+    {
+        return -ESRCH;
+    }
+
+    struct dentry *dentry;
+    int res = vfs_walk(current->cwd, path, &dentry);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    if (dentry->inode == NULL)
+    {
+        res = -ENOENT;
+    }
+    else if (!inode_is_dir(dentry->inode))
+    {
+        res = -ENOTDIR;
+    }
+    else
+    {
+        // The dentry path is the normalized form of path
+        char cwd[sizeof(current->cwd)];
+        res = d_path(dentry, cwd, sizeof(cwd));
+        if (res >= 0)
+        {
+            k_strcpy(current->cwd, cwd);
+            res = 0;
+        }
+    }
+
+    dput(dentry);
+    return res;
+}
+
 char *vfs_getcwd(char *buf, size_t size)
 {
     if (buf == NULL || size == 0)
@@ -42,6 +42,7 @@
 #define ENOSYS          38  /* Function not implemented */
 #define ENOTEMPTY       39  /* Directory not empty */
 #define ELOOP           40  /* Too many symbolic links encountered */
+#define EOVERFLOW       75  /* Value too large for defined data type */
 
 /* Commonly used aliases */
 #define EWOULDBLOCK     EAGAIN  /* Operation would block */
@@ -13,7 +13,22 @@
 #define O_WRONLY   0x1
 #define O_RDWR     0x2
 #define O_CREAT    0x40
+#define O_EXCL     0x80
 #define O_TRUNC    0x200
+#define O_NONBLOCK 0x800
+#define O_DIRECT   0x4000
+#define O_CLOEXEC  0x80000
+
+// fcntl() commands
+#define F_DUPFD         0
+#define F_GETFD         1
+#define F_SETFD         2
+#define F_GETFL         3
+#define F_SETFL         4
+#define F_DUPFD_CLOEXEC 1030
+
+// fd flags
+#define FD_CLOEXEC 1
 
 
 ssize_t write(int fd, const void *buf, size_t count);
@@ -24,5 +39,7 @@ int open(const char *pathname, int flags, int mode);
 
 int close(int fd);
 
+int fcntl(int fd, int cmd, ...);
+
 
 #endif //FCNTL_H
@@ -0,0 +1,29 @@
+#ifndef KERNEL_ATA_H
+#define KERNEL_ATA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Drives on the primary ATA channel */
+#define ATA_DRIVE_MASTER  0
+#define ATA_DRIVE_SLAVE   1
+#define ATA_DRIVE_CNT     2
+
+#define ATA_SECTOR_SIZE   512
+
+/* Probe the drives on the primary channel and register them as block devices */
+void ata_init(void);
+
+/* Capacity of a drive in sectors; 0 when there is no (ATA) drive */
+uint32_t ata_sector_count(uint32_t drive);
+
+/*
+ * Transfer page_cnt 4 KiB pages between memory and the consecutive sectors
+ * starting at lba. The pages don't have to be contiguous in memory; each
+ * run of up to 128 KiB is a single disk command. Returns 0 or -1.
+ */
+int ata_read_pages(uint32_t drive, uint32_t lba, void *const *pages, uint32_t page_cnt);
+
+int ata_write_pages(uint32_t drive, uint32_t lba, void *const *pages, uint32_t page_cnt);
+
+#endif /* KERNEL_ATA_H */
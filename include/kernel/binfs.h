@@ -0,0 +1,48 @@
+#ifndef KERNEL_BINFS_H
+#define KERNEL_BINFS_H
+
+#include <stdint.h>
+
+/*
+ * Layout of the packed binary image that tools/mkbinfs.c builds and
+ * fs/bin_fs.c serves. All fields are little endian.
+ *
+ *   struct binfs_super
+ *   struct binfs_entry   entries[file_cnt]     sorted on name
+ *   uint32_t             block_off[block_cnt + 1]
+ *   compressed blocks
+ *
+ * Files are cut into BINFS_BLOCK_SIZE blocks, numbered across the whole
+ * image, and every block is compressed on its own (LZ4 block format) so it
+ * can be decompressed without its neighbours. Block i occupies
+ * [block_off[i], block_off[i + 1]) of the image. A block that doesn't
+ * shrink is stored as is, which shows as a stored length equal to its
+ * uncompressed length.
+ */
+
+#define BINFS_MAGIC         0x53464e42u     /* "BNFS" */
+#define BINFS_VERSION       1u
+#define BINFS_BLOCK_SIZE    4096u
+#define BINFS_NAME_MAX      32u
+
+struct binfs_super
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t file_cnt;
+    uint32_t block_cnt;
+    /* Sum of the uncompressed file sizes */
+    uint32_t raw_size;
+};
+
+struct binfs_entry
+{
+    /* Full path, e.g. "/bin/ls" */
+    char name[BINFS_NAME_MAX];
+    /* Offset of the last path component in name */
+    uint32_t base_off;
+    uint32_t size;
+    uint32_t first_block;
+};
+
+#endif /* KERNEL_BINFS_H */
@@ -0,0 +1,107 @@
+#ifndef KERNEL_BLK_H
+#define KERNEL_BLK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Block devices. I/O is submitted one 4 KiB block at a time as a bio and
+ * collected in a per device request queue that is kept sorted on block
+ * number. A bio that continues a queued request of the same direction is
+ * merged into it, so a run of neighbouring blocks becomes a single disk
+ * command.
+ *
+ * Between blk_plug and blk_unplug the queue only collects; the unplug
+ * dispatches it in one ascending sweep. Without a plug every bio is
+ * dispatched right away. A driver either transfers each request before
+ * returning, or starts as many as it has room for and then waits for
+ * them all; either way each bio has its status once the dispatch returns.
+ *
+ * Every device also shows up as /dev/<name>.
+ */
+
+#define BLK_SIZE            4096u
+#define BLK_SECTOR_SIZE     512u
+#define BLK_SECTORS         (BLK_SIZE / BLK_SECTOR_SIZE)
+
+#define BLK_MAX_DEVS        4
+#define BLK_NAME_MAX        8
+
+/* Blocks in one request, and so in one driver call, at most */
+#define BLK_MAX_SEGS        32
+
+struct blk_dev;
+struct pcache_mapping;
+
+struct blk_ops
+{
+    /*
+     * Transfer cnt pages between memory and the consecutive blocks from
+     * block on. Returns 0 or -1.
+     */
+    int (*transfer)(struct blk_dev *dev, uint32_t block, void *const *pages, uint32_t cnt, bool write);
+
+    /*
+     * Optional, used instead of transfer: start the transfer and return
+     * without waiting for it; -1 when the device has no room for it now.
+     * The driver reports the result with blk_complete(dev, tag, ...).
+     */
+    int (*start)(struct blk_dev *dev, uint32_t block, void *const *pages, uint32_t cnt, bool write, void *tag);
+
+    /* Wait until every started transfer has been completed */
+    void (*wait)(struct blk_dev *dev);
+};
+
+struct bio
+{
+    uint32_t block;
+    /* Physmap address (mm_pa_to_kva) of the page, so DMA can find it */
+    void *page;
+    bool write;
+    /* 0 or -EIO once dispatched */
+    int status;
+    /* Next bio of the same request */
+    struct bio *next;
+};
+
+struct blk_stat
+{
+    char name[BLK_NAME_MAX];
+    uint32_t blocks;
+    uint64_t reads;         /* blocks read */
+    uint64_t writes;        /* blocks written */
+    uint64_t merges;        /* bios merged into a queued request */
+    uint64_t requests;      /* driver calls */
+    uint64_t errors;        /* failed driver calls */
+    uint32_t max_inflight;  /* most requests started at once */
+};
+
+/* Add a device of block_cnt blocks and register /dev/<name> for it */
+struct blk_dev *blk_register(const char *name, uint32_t block_cnt, const struct blk_ops *ops, void *driver_data);
+
+void *blk_driver_data(const struct blk_dev *dev);
+
+/* The device called name, e.g. "vdb"; NULL if there is none */
+struct blk_dev *blk_find(const char *name);
+
+/* Page cache of the whole device, the one its /dev node reads through */
+struct pcache_mapping *blk_mapping(struct blk_dev *dev);
+
+/* A transfer the driver started has finished; status is 0 or -1 */
+void blk_complete(struct blk_dev *dev, void *tag, int status);
+
+/* Queue bio; dispatched at once unless the device is plugged */
+void blk_submit(struct blk_dev *dev, struct bio *bio);
+
+void blk_plug(struct blk_dev *dev);
+
+/* Drop a plug; the last one dispatches the queue */
+void blk_unplug(struct blk_dev *dev);
+
+/* Read or write cnt consecutive blocks with one plug; 0 or -EIO */
+int blk_rw_pages(struct blk_dev *dev, uint32_t block, void *const *pages, uint32_t cnt, bool write);
+
+/* Stats of device idx; false past the last device */
+bool blk_stat(uint32_t idx, struct blk_stat *stat);
+
+#endif /* KERNEL_BLK_H */
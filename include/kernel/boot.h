@@ -0,0 +1,27 @@
+#ifndef KERNEL_BOOT_H
+#define KERNEL_BOOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * What the boot loader handed over. A Multiboot loader (qemu -kernel,
+ * GRUB) passes an info structure that can list modules; the first module
+ * is the initrd, the packed /bin image. The disk loader passes nothing.
+ */
+
+/* Remember the loader's registers; called by kmain before anything else */
+void boot_init(uint32_t magic, uint32_t info_pa);
+
+/*
+ * Physical range of the initrd, read from the boot info through the
+ * physmap. Called by mm_init before the frame allocator takes over the
+ * memory, so the info may be overwritten afterwards. False without one.
+ */
+bool boot_initrd_range(uintptr_t *start_pa, uintptr_t *end_pa);
+
+/* Kernel address and size of the initrd, or NULL */
+const void *boot_initrd(size_t *size);
+
+#endif /* KERNEL_BOOT_H */
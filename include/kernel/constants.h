@@ -29,27 +29,59 @@
 
 #define KERNEL_VA_SIZE      MB(4)
 
-// todo:
-#define KERNEL_STACK_SIZE   KB(16)
 #define KERNEL_STACK_TOP_VA    (KERNEL_VA_BASE + KERNEL_VA_SIZE - KB(4))
 
 /*
- * The base virtual address of the process
+ * Task kernel stacks live right above the kernel window, one slot per task
+ * with an unmapped guard page below the stack.
+ */
+#define KERNEL_STACK_SIZE   KB(16)
+#define KERNEL_STACK_GUARD  KB(4)
+#define KERNEL_STACK_AREA_VA (KERNEL_VA_BASE + KERNEL_VA_SIZE)
+
+#define CACHE_LINE_SIZE     64
+
+/*
+ * All physical memory (up to KERNEL_PHYSMAP_SIZE) is mapped here so the kernel
+ * can access any frame directly.
+ */
+#define KERNEL_PHYSMAP_VA   0xC0000000UL
+#define KERNEL_PHYSMAP_SIZE MB(512)
+
+/*
+ * User address space layout (all of it is committed on use):
+ *
+ *   PROCESS_VA_BASE     ELF image (text, data, bss), followed by the brk heap
+ *                       which may grow up to RLIMIT_DATA bytes
+ *   PROCESS_MMAP_BASE   mmap area, up to PROCESS_MMAP_TOP
+ *   guard gap           PROCESS_STACK_GUARD bytes that are never mapped
+ *   stack               RLIMIT_STACK bytes growing down from PROCESS_STACK_TOP
  *
  * Processes always have a different virtual address than the kernel
  */
 #define PROCESS_VA_BASE     MB(4)
 
-#define PROCESS_PA_START    KERNEL_PA_BASE + KERNEL_VA_SIZE
+#define RLIMIT_DATA         MB(256)
+
+#define PROCESS_STACK_TOP   (KERNEL_VA_BASE - KB(64))
+#define RLIMIT_STACK        MB(8)
+#define PROCESS_STACK_GUARD MB(1)
 
 /*
- * Each process gets a fixed 1 MiB region
+ * Code runs in ring 0, so a fault can't be taken on the active stack (there
+ * is no stack switch). The top of the stack is committed at exec and every
+ * syscall keeps PROCESS_STACK_MARGIN bytes below the user stack pointer
+ * committed.
  */
-#define PROCESS_VA_SIZE     MB(1)
+#define PROCESS_STACK_COMMIT KB(64)
+#define PROCESS_STACK_MARGIN KB(32)
 
-#define PROCESS_HEAP_SIZE   KB(512)
+#define PROCESS_MMAP_BASE   GB(1)
+#define PROCESS_MMAP_TOP    (PROCESS_STACK_TOP - RLIMIT_STACK - PROCESS_STACK_GUARD)
 
-#define PROCESS_STACK_TOP   (PROCESS_VA_BASE + PROCESS_VA_SIZE - KB(4))
+/* Bytes of argv + envp strings execve carries over to the new image */
+#define EXEC_ARG_MAX        KB(16)
+#define EXEC_ARGV_MAX       256
 
 /* -------------------------------------------------- */
 /* Process / scheduler limits                         */
@@ -0,0 +1,120 @@
+#ifndef KERNEL_DCACHE_H
+#define KERNEL_DCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sys/types.h"
+#include "stat.h"
+#include "kernel/dlist.h"
+
+/*
+ * Inodes and the dentry cache.
+ *
+ * An inode is a file or directory of a filesystem; a dentry binds a name in
+ * a parent directory to an inode. Path lookup walks the dentries one
+ * component at a time through a hash table on (parent, name), so a path
+ * that was looked up before resolves without calling into the filesystem.
+ * A dentry without an inode is a negative entry: the name is known not to
+ * exist.
+ *
+ * A mount point is the dentry of the mounted filesystem's root directory,
+ * hashed under its name in the parent directory. Mount points and the root
+ * are pinned; other dentries nobody references are evicted least recently
+ * used first when the cache is full.
+ */
+
+/* Longest path component, including the terminating 0 */
+#define DNAME_MAX       32
+
+struct fs;
+
+struct inode
+{
+    uint32_t ino;
+    mode_t mode;
+    uint32_t refs;
+    struct fs *fs;
+    /* Filesystem data, e.g. the embedded binary or the device */
+    void *private;
+    struct inode *next_free;
+};
+
+struct dentry
+{
+    struct dentry *hash_next;
+    /* Unused dentries, least recently used first */
+    dlist_node_t lru;
+    struct dentry *parent;
+    /* NULL for a negative entry */
+    struct inode *inode;
+    uint32_t hash;
+    uint32_t refs;
+    uint8_t flags;
+    uint8_t name_len;
+    char name[DNAME_MAX];
+};
+
+#define DENTRY_HASHED   0x01
+#define DENTRY_PINNED   0x02
+
+void dcache_init(void);
+
+/* Returns a new inode with one reference or NULL */
+struct inode *inode_alloc(struct fs *fs, uint32_t ino, mode_t mode, void *private);
+
+void inode_get(struct inode *inode);
+
+void inode_put(struct inode *inode);
+
+static inline bool inode_is_dir(const struct inode *inode)
+{
+    return (inode->mode & S_IFMT) == S_IFDIR;
+}
+
+/* The dentry of "/"; NULL before the root filesystem is mounted */
+struct dentry *d_root(void);
+
+/* Make root, which takes over the reference, the pinned dentry of "/" */
+int d_set_root(struct inode *root);
+
+/*
+ * Look up name in the directory dir: from the cache, or else from the
+ * filesystem, after which the result is cached. On success *out is a
+ * referenced dentry, negative when the name doesn't exist. Returns 0,
+ * -ENAMETOOLONG or -ENOMEM.
+ */
+int d_lookup(struct dentry *dir, const char *name, size_t len, struct dentry **out);
+
+/* Pin root, which takes over the reference, under name in dir */
+int d_mount(struct dentry *dir, const char *name, struct inode *root);
+
+struct dentry *dget(struct dentry *dentry);
+
+void dput(struct dentry *dentry);
+
+/* Bind inode, which takes over the reference, to a negative dentry */
+void d_instantiate(struct dentry *dentry, struct inode *inode);
+
+/* The name was removed: turn dentry into a negative entry */
+void d_delete(struct dentry *dentry);
+
+/* Unhash dentry so the next lookup asks the filesystem; freed once unused */
+void d_drop(struct dentry *dentry);
+
+/* Absolute path of dentry in buf; returns its length, or -ENAMETOOLONG */
+int d_path(const struct dentry *dentry, char *buf, size_t size);
+
+struct dcache_stat
+{
+    uint32_t dentries;
+    uint32_t negative;
+    uint32_t inodes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+void dcache_stat(struct dcache_stat *stat);
+
+#endif /* KERNEL_DCACHE_H */
@@ -7,6 +7,9 @@
 
 struct dev_ops
 {
+    /* S_IFBLK for a block device; 0 is a character device */
+    mode_t type;
+
     int (*open)(struct file *file);
 
     int (*close)(struct file *file);
@@ -14,6 +17,17 @@ struct dev_ops
     ssize_t (*read)(struct file *file, void *buf, size_t count);
 
     ssize_t (*write)(struct file *file, const void *buf, size_t count);
+
+    uint32_t (*poll)(struct file *file, struct poll_table *pt);
+
+    /* Optional: positioned I/O and stat, for devices with a size */
+    ssize_t (*pread)(struct file *file, void *buf, size_t count, off_t offset);
+
+    ssize_t (*pwrite)(struct file *file, const void *buf, size_t count, off_t offset);
+
+    int (*fstat)(struct file *file, struct stat *stat);
+
+    int (*fsync)(struct file *file);
 };
 
 int dev_register(const char *name, struct dev_ops *ops, void *driver_data);
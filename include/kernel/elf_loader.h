@@ -47,6 +47,11 @@ typedef struct
 
 #define PT_LOAD 1
 
+/* p_flags */
+#define PF_X 0x1
+#define PF_W 0x2
+#define PF_R 0x4
+
 /*
  * elf_info contract:
  * - All values are virtual addresses.
@@ -67,26 +72,47 @@ struct elf_info
  * ELF Loader
  * ------------------------------------------------------------ */
 
+struct mm;
+
+struct embedded_bin;
+
 /*
- * Load ELF image into memory
+ * Map the PT_LOAD segments of the ELF binary bin into mm
  * Returns 0 on success, <0 on error.
  */
-int elf_load(const void *image, struct elf_info *elf_info);
+int elf_load(const struct embedded_bin *bin, struct mm *mm, struct elf_info *elf_info);
 
 /* ------------------------------------------------------------
- * Embedded bin table
+ * Embedded binaries (the packed image served under /bin)
  * ------------------------------------------------------------ */
 
 struct embedded_bin
 {
+    /* Full path, e.g. "/bin/ls" */
     const char *name;
-    const unsigned char *start;
-    const unsigned char *end;
+    /* Last path component, e.g. "ls" */
+    const char *base;
+    size_t size;
+    /* First block in the image */
+    uint32_t first_block;
 };
 
-extern const struct embedded_bin embedded_bins[];
-extern const size_t embedded_bin_count;
+/* Index the embedded image */
+void bin_fs_init(void);
 
+/* Binary search on the full path; NULL if there is no such binary */
 const struct embedded_bin *find_bin(const char *name);
 
+/* Read from a binary, decompressing as needed; returns bytes read or -errno */
+ssize_t bin_pread(const struct embedded_bin *bin, void *buf, size_t count, size_t pos);
+
+struct bin_cache_stat
+{
+    uint32_t pages;     /* frames holding decompressed blocks */
+    uint64_t hits;
+    uint64_t misses;
+};
+
+void bin_cache_stat(struct bin_cache_stat *stat);
+
 #endif /* ELF_LOADER_H */
@@ -0,0 +1,25 @@
+#ifndef KERNEL_EVENTPOLL_H
+#define KERNEL_EVENTPOLL_H
+
+#include "sys/epoll.h"
+#include "kernel/files.h"
+
+/*
+ * epoll: an epoll fd holds an interest list of (file, fd) items. Every
+ * item keeps a callback entry on the wait queues of its file that puts it
+ * on the ready list, so epoll_wait only looks at the items that saw a
+ * wakeup since the last call instead of polling every fd.
+ */
+
+struct task;
+
+int eventpoll_create(struct task *task, int flags);
+
+int eventpoll_ctl(struct task *task, int epfd, int op, int fd, struct epoll_event *event);
+
+int eventpoll_wait(struct task *task, int epfd, struct epoll_event *events, int maxevents, int timeout);
+
+/* The last reference to file is gone: drop it from every interest list */
+void eventpoll_release(struct file *file);
+
+#endif /* KERNEL_EVENTPOLL_H */
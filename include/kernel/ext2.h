@@ -0,0 +1,139 @@
+#ifndef KERNEL_EXT2_H
+#define KERNEL_EXT2_H
+
+#include <stdint.h>
+
+/*
+ * On disk layout of ext2, as fs/ext2_fs.c reads and writes it. All
+ * fields are little endian.
+ *
+ *   boot block (1 KiB) | superblock (1 KiB) | ...
+ *   group 0: [superblock copy] [group descriptors] block bitmap
+ *            inode bitmap, inode table, data blocks
+ *   group 1: ...
+ *
+ * Only 4 KiB blocks are supported (mkfs.ext2 -b 4096), so a block is
+ * exactly one page and one block device block.
+ */
+
+#define EXT2_SUPER_OFFSET       1024u
+#define EXT2_MAGIC              0xEF53u
+#define EXT2_ROOT_INO           2u
+
+#define EXT2_NDIR_BLOCKS        12
+#define EXT2_IND_BLOCK          12
+#define EXT2_DIND_BLOCK         13
+#define EXT2_TIND_BLOCK         14
+#define EXT2_N_BLOCKS           15
+
+/* Revision 0 has fixed inode sizes and first inode */
+#define EXT2_GOOD_OLD_REV       0
+#define EXT2_GOOD_OLD_INODE_SIZE 128u
+#define EXT2_GOOD_OLD_FIRST_INO 11u
+
+#define EXT2_VALID_FS           0x0001
+#define EXT2_ERROR_FS           0x0002
+
+/* Incompatible features: refuse to mount without support */
+#define EXT2_FEATURE_INCOMPAT_FILETYPE      0x0002
+/* Read-only compatible features: writing needs support */
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER 0x0001
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE   0x0002
+
+/* i_flags: hashed directory index, which a plain entry scan ignores */
+#define EXT2_INDEX_FL           0x00001000u
+
+/* Directory entry file types */
+#define EXT2_FT_UNKNOWN         0
+#define EXT2_FT_REG_FILE        1
+#define EXT2_FT_DIR             2
+
+struct ext2_super_block
+{
+    uint32_t s_inodes_count;
+    uint32_t s_blocks_count;
+    uint32_t s_r_blocks_count;
+    uint32_t s_free_blocks_count;
+    uint32_t s_free_inodes_count;
+    uint32_t s_first_data_block;
+    uint32_t s_log_block_size;      /* block size is 1024 << this */
+    uint32_t s_log_frag_size;
+    uint32_t s_blocks_per_group;
+    uint32_t s_frags_per_group;
+    uint32_t s_inodes_per_group;
+    uint32_t s_mtime;
+    uint32_t s_wtime;
+    uint16_t s_mnt_count;
+    uint16_t s_max_mnt_count;
+    uint16_t s_magic;
+    uint16_t s_state;
+    uint16_t s_errors;
+    uint16_t s_minor_rev_level;
+    uint32_t s_lastcheck;
+    uint32_t s_checkinterval;
+    uint32_t s_creator_os;
+    uint32_t s_rev_level;
+    uint16_t s_def_resuid;
+    uint16_t s_def_resgid;
+    /* Revision 1 */
+    uint32_t s_first_ino;
+    uint16_t s_inode_size;
+    uint16_t s_block_group_nr;
+    uint32_t s_feature_compat;
+    uint32_t s_feature_incompat;
+    uint32_t s_feature_ro_compat;
+    uint8_t s_uuid[16];
+    char s_volume_name[16];
+} __attribute__((packed));
+
+struct ext2_group_desc
+{
+    uint32_t bg_block_bitmap;
+    uint32_t bg_inode_bitmap;
+    uint32_t bg_inode_table;
+    uint16_t bg_free_blocks_count;
+    uint16_t bg_free_inodes_count;
+    uint16_t bg_used_dirs_count;
+    uint16_t bg_pad;
+    uint32_t bg_reserved[3];
+};
+
+/* The first 128 bytes of an inode; revision 1 inodes can be larger. Naturally aligned, so not packed */
+struct ext2_inode
+{
+    uint16_t i_mode;
+    uint16_t i_uid;
+    uint32_t i_size;
+    uint32_t i_atime;
+    uint32_t i_ctime;
+    uint32_t i_mtime;
+    uint32_t i_dtime;
+    uint16_t i_gid;
+    uint16_t i_links_count;
+    uint32_t i_blocks;              /* 512 byte sectors, indirect blocks included */
+    uint32_t i_flags;
+    uint32_t i_osd1;
+    uint32_t i_block[EXT2_N_BLOCKS];
+    uint32_t i_generation;
+    uint32_t i_file_acl;
+    uint32_t i_size_high;           /* i_dir_acl in revision 0 */
+    uint32_t i_faddr;
+    uint8_t i_osd2[12];
+};
+
+_Static_assert(sizeof(struct ext2_group_desc) == 32, "ext2_group_desc is 32 bytes on disk");
+_Static_assert(sizeof(struct ext2_inode) == 128, "ext2_inode is 128 bytes on disk");
+
+/* Entries are 4 byte aligned and rec_len reaches the next one */
+struct ext2_dir_entry
+{
+    uint32_t inode;                 /* 0 for an unused entry */
+    uint16_t rec_len;
+    uint8_t name_len;
+    uint8_t file_type;
+    char name[];
+} __attribute__((packed));
+
+#define EXT2_DIR_REC_LEN(name_len)  ((8u + (name_len) + 3u) & ~3u)
+
+#endif /* KERNEL_EXT2_H */
@@ -8,6 +8,7 @@
 #include "tty.h"
 #include "sys/types.h"
 #include "stat.h"
+#include "dcache.h"
 
 #define FD_STDIN   0
 #define FD_STDOUT  1
@@ -17,11 +18,33 @@
 #define O_WRONLY   0x1
 #define O_RDWR     0x2
 #define O_CREAT    0x40
+#define O_EXCL     0x80
 #define O_TRUNC    0x200
+#define O_NONBLOCK 0x800
+#define O_DIRECT   0x4000
+#define O_CLOEXEC  0x80000
+
+/* lseek whence */
+#define SEEK_SET   0
+#define SEEK_CUR   1
+#define SEEK_END   2
+
+/* fcntl commands */
+#define F_DUPFD         0
+#define F_GETFD         1
+#define F_SETFD         2
+#define F_GETFL         3
+#define F_SETFL         4
+#define F_DUPFD_CLOEXEC 1030
+
+/* fd flags (F_GETFD/F_SETFD) */
+#define FD_CLOEXEC 1
 
 struct files_slot
 {
     struct file *file;
+    /* FD_CLOEXEC; belongs to the fd, not to the shared file */
+    int flags;
 };
 
 struct files
@@ -29,6 +52,9 @@ struct files
     struct files_slot slots[RLIMIT_NOFILE];
 };
 
+struct poll_table;
+struct epitem;
+
 struct file_ops{
 
     int (*open)(struct file *file);
@@ -42,34 +68,86 @@ struct file_ops{
     int (*getdents)(struct file *file, struct dirent *buf, unsigned int count);
 
     int (*fstat)(struct file *file, struct stat *stat);
+
+    int (*truncate)(struct file *file, off_t length);
+
+    /*
+     * Optional; the vfs falls back to generic versions built on the ops
+     * above (see vfs_lseek, vfs_pread, vfs_pwrite).
+     */
+    off_t (*llseek)(struct file *file, off_t offset, int whence);
+
+    ssize_t (*pread)(struct file *file, void *buf, size_t count, off_t offset);
+
+    ssize_t (*pwrite)(struct file *file, const void *buf, size_t count, off_t offset);
+
+    /* Ready POLL* events; registers on the wait queues that change them */
+    uint32_t (*poll)(struct file *file, struct poll_table *pt);
+
+    /* Optional: write cached data to the device; 0 or -errno */
+    int (*fsync)(struct file *file);
 };
 
-// todo: files are currently not yet shared when doing a fork (since there is no fork)
+// An open file description. fork, dup and dup2 make more fds refer to the
+// same file, which then share its position and flags.
 struct file
 {
     uint32_t idx;
-    char pathname[MAX_FILENAME_LEN];
+    struct dentry *dentry;
+    struct inode *inode;
     int flags;
     int mode;
-    // ref-count because when a process is forked, there will be multiple
-    // process that have a fd to the same file instance.
-    uint8_t ref_count;
+    // number of fds, in any process, referring to this file
+    uint32_t refs;
     uint64_t pos;
-    int fd;
     void *driver_data;
     struct file_ops file_ops;
+    // epoll items watching this file, chained through file_next
+    struct epitem *ep_items;
 };
 
 struct fs
 {
+    /* Look up dentry->name in dir: d_instantiate it, or leave it negative */
+    int (*lookup)(struct inode *dir, struct dentry *dentry);
+
+    /* Optional: false when a cached dentry no longer matches the filesystem */
+    bool (*revalidate)(struct dentry *dentry);
+
+    /* Optional: create dentry->name in dir (O_CREAT) */
+    int (*create)(struct inode *dir, struct dentry *dentry, int mode);
+
     int (*open)(struct file *file);
 
+    int (*unlink)(struct inode *dir, struct dentry *dentry);
+
+    /* Optional: create the directory dentry->name in dir */
+    int (*mkdir)(struct inode *dir, struct dentry *dentry, int mode);
+
+    /* Optional: remove the directory dentry, or fail with -ENOTEMPTY */
+    int (*rmdir)(struct inode *dir, struct dentry *dentry);
+
+    /*
+     * Optional: move old_dentry to the name of new_dentry, replacing what
+     * is there. Both dirs are of this filesystem.
+     */
+    int (*rename)(struct inode *old_dir, struct dentry *old_dentry,
+                  struct inode *new_dir, struct dentry *new_dentry);
+
+    /* Optional: the last reference to inode is gone */
+    void (*evict)(struct inode *inode);
 };
 
 void files_init(struct files *files);
 
 int files_alloc_fd(struct files *files, struct file *file);
 
+/* Lowest free fd >= min_fd for file, or -1 */
+int files_alloc_fd_from(struct files *files, struct file *file, int min_fd);
+
+/* Copy the fd table of a forking task; every file gains a reference */
+void files_dup(struct files *dst, const struct files *src);
+
 struct file *files_free_fd(struct files *files, int fd);
 
 struct file *files_find_by_fd(const struct files *files, int fd);
@@ -13,4 +13,22 @@ int fs_add_entry(
         uint8_t d_type,
         const char *name);
 
+/*
+ * Helper for getdents on a directory whose entries have fixed positions,
+ * e.g. "." at 0, ".." at 1 and table slot i at 2 + i. file->pos is the
+ * position to resume from, so entries before it went out in earlier
+ * calls and a small buffer just takes more calls. Offer entries in
+ * increasing position. Returns false once buf is full; the entry is then
+ * left for the next call.
+ */
+bool fs_dir_emit(
+        struct file *file,
+        struct dirent *buf_entries,
+        unsigned int max_entries,
+        unsigned int *idx,
+        uint32_t pos,
+        uint32_t ino,
+        uint8_t d_type,
+        const char *name);
+
 #endif // FS_UTIL_H
\ No newline at end of file
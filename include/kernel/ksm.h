@@ -0,0 +1,20 @@
+#ifndef KERNEL_KSM_H
+#define KERNEL_KSM_H
+
+#include <stdint.h>
+
+/* Merge identical user pages; called from the idle task, paces itself */
+void ksm_scan(void);
+
+struct ksm_stat
+{
+    uint32_t pages_shared;      /* shared frames in use */
+    uint32_t pages_sharing;     /* extra mappings of them, i.e. frames saved */
+    uint32_t pages_unshared;    /* candidates without a twin (this sweep) */
+    uint64_t pages_scanned;
+    uint64_t full_scans;
+};
+
+void ksm_stat(struct ksm_stat *stat);
+
+#endif /* KERNEL_KSM_H */
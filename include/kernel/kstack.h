@@ -0,0 +1,25 @@
+#ifndef KERNEL_KSTACK_H
+#define KERNEL_KSTACK_H
+
+#include <stdint.h>
+
+/* Reserve the kernel stack area; must run before the first fork */
+void kstack_init(void);
+
+/* Back the stack of task slot slot with frames; returns its lowest address or 0 */
+uintptr_t kstack_alloc(uint32_t slot);
+
+void kstack_free(uintptr_t base);
+
+/* Deepest use of the stack at base so far, in bytes */
+uint32_t kstack_used(uintptr_t base);
+
+struct kstack_stat
+{
+    uint32_t stacks;        /* stacks in use */
+    uint32_t max_used;      /* deepest use of any stack since boot, in bytes */
+};
+
+void kstack_stat(struct kstack_stat *stat);
+
+#endif /* KERNEL_KSTACK_H */
@@ -0,0 +1,14 @@
+#ifndef KERNEL_LZ4_H
+#define KERNEL_LZ4_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Decompress one LZ4 block (the raw block format, no frame header).
+ * Returns the number of bytes written to dst or -1 when src is malformed
+ * or doesn't fit in dst_cap bytes.
+ */
+int lz4_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_cap);
+
+#endif /* KERNEL_LZ4_H */
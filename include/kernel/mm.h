@@ -3,14 +3,20 @@
 
 #include <stdint.h>
 #include "sys/types.h"
+#include "sys/mman.h"
 #include <stdbool.h>
 
 struct mm_impl;
+struct shm_object;
 
 /* VMA types */
 #define VMA_TYPE_KERNEL  0
 #define VMA_TYPE_VGA     1
-#define VMA_TYPE_PROCESS 2
+#define VMA_TYPE_IMAGE   2  /* ELF segment */
+#define VMA_TYPE_ANON    3  /* demand-paged anonymous memory (mmap) */
+#define VMA_TYPE_HEAP    4  /* brk heap */
+#define VMA_TYPE_STACK   5  /* user stack */
+#define VMA_TYPE_SHARED  6  /* MAP_SHARED, backed by a shm object */
 
 /* Virtual memory area - a mapped region */
 struct vma {
@@ -19,19 +25,37 @@ struct vma {
     size_t length;
     uint32_t flags;
     uint32_t type;
-    struct vma *next;
+    /* VMA_TYPE_SHARED: the object and the page of it mapped at base_va */
+    struct shm_object *shm;
+    uint32_t pgoff;
 };
 
 /* VMA flags */
-#define VMA_READ  0x1
+#define VMA_READ  0x1  /* same values as PROT_* */
 #define VMA_WRITE 0x2
 #define VMA_EXEC  0x4
 #define VMA_USER  0x8
+/* MAP_SHARED: the object may be written, so mprotect may add VMA_WRITE */
+#define VMA_MAYWRITE 0x10
+
+/* Maximum number of VMAs a single address space can hold */
+#define MM_MAX_VMAS 32
 
 /* Memory management structure */
 struct mm {
-    void *impl;        /* Page table root (architecture-specific) */
-    struct vma *vmas;  /* List of mapped regions */
+    void *impl;                       /* Page table root (architecture-specific) */
+    struct vma *vmas[MM_MAX_VMAS];    /* Mapped regions, sorted by base_va */
+    uint32_t vma_cnt;
+};
+
+/* Argument block for SYS_mmap (Linux i386 old_mmap layout) */
+struct mmap_args {
+    uint32_t addr;
+    uint32_t len;
+    uint32_t prot;
+    uint32_t flags;
+    uint32_t fd;
+    uint32_t offset;
 };
 
 /* ------------------------------------------------------------
@@ -44,6 +68,128 @@ void mm_init(void);
 /* Get kernel mm */
 struct mm *mm_kernel(void);
 
+/*
+ * Create the page tables for a kernel range, so pages mapped there later on
+ * show up in every address space. Must run before the first fork.
+ */
+void mm_kernel_reserve(uintptr_t va, size_t size);
+
+/* ------------------------------------------------------------
+ * Physical frames
+ * ------------------------------------------------------------ */
+
+/* Hand the physical range [start_pa, end_pa) to the frame allocator */
+void mm_frames_init(uintptr_t start_pa, uintptr_t end_pa);
+
+/* Allocate a 4 KiB frame; returns 0 when out of memory */
+uintptr_t mm_frame_alloc(void);
+
+/* Allocate a zero-filled 4 KiB frame; returns 0 when out of memory */
+uintptr_t mm_frame_alloc_zeroed(void);
+
+/* Drop a reference to a frame; it is freed when the last one is gone */
+void mm_frame_free(uintptr_t pa);
+
+/* Take an extra reference to an allocated frame */
+void mm_frame_get(uintptr_t pa);
+
+uint32_t mm_frame_refs(uintptr_t pa);
+
+/* Frames that can still be allocated (including the zero pool) */
+uint32_t mm_frames_free(void);
+
+/* Zero one more frame into the pre-zeroed pool; false when full or out of memory */
+bool mm_zero_pool_fill_one(void);
+
+/* ------------------------------------------------------------
+ * Statistics
+ * ------------------------------------------------------------ */
+
+struct mm_stat
+{
+    uint32_t total_pages;       /* RAM reachable through the physmap */
+    uint32_t free_pages;        /* frames the frame allocator can still hand out */
+    uint32_t page_table_pages;  /* page directories and page tables */
+    uint32_t vmas_used;
+    uint32_t vmas_total;
+
+    uint64_t zero_pool_hits;    /* zeroed allocations served from the pool */
+    uint64_t zero_pool_misses;  /* zeroed allocations that had to clear a frame */
+    uint32_t zero_pool_pages;   /* frames currently in the pool */
+};
+
+void mm_stat(struct mm_stat *stat);
+
+/* Per-subsystem parts of mm_stat */
+void mm_frames_stat(struct mm_stat *stat);
+
+void mm_vma_stat(struct mm_stat *stat);
+
+void mm_paging_stat(struct mm_stat *stat);
+
+/* Page state as returned by mm_page_state */
+#define MM_PAGE_PRESENT   0x1   /* backed by a frame */
+#define MM_PAGE_ACCESSED  0x2
+#define MM_PAGE_DIRTY     0x4
+#define MM_PAGE_SWAPPED   0x8   /* contents live in a swap slot */
+#define MM_PAGE_COW       0x10  /* frame is shared copy-on-write */
+
+uint32_t mm_page_state(const struct mm *mm, uintptr_t va);
+
+/* Resident set of one VMA, in pages */
+struct vma_usage
+{
+    uint32_t size;
+    uint32_t rss;
+    uint32_t dirty;
+    uint32_t referenced;
+    uint32_t swap;
+    uint32_t shared;        /* frames mapped elsewhere too */
+    uint32_t shared_dirty;
+};
+
+void mm_vma_usage(const struct mm *mm, const struct vma *vma, struct vma_usage *usage);
+
+/* ------------------------------------------------------------
+ * Sweeps
+ *
+ * Background scanners (reclaim, page merging) walk the pages of all task
+ * address spaces with a cursor. Only image, anon and heap pages are
+ * visited: the stack must stay present and writable because exceptions
+ * push their frame on the user stack (everything runs in ring 0).
+ * ------------------------------------------------------------ */
+
+struct mm_sweep
+{
+    uint32_t task_idx;
+    uintptr_t va;
+    /* Completed passes over all task slots */
+    uint32_t rounds;
+};
+
+/* Move the cursor to the next page; false when no task has such pages */
+bool mm_sweep_next(struct mm_sweep *sweep, struct mm **out_mm, struct vma **out_vma, uintptr_t *out_va);
+
+/* Kernel virtual address through which a physical address can be accessed */
+void *mm_pa_to_kva(uintptr_t pa);
+
+/* Physical address behind a physmap address (the inverse of mm_pa_to_kva) */
+uintptr_t mm_kva_to_pa(const void *kva);
+
+/* ------------------------------------------------------------
+ * VMA index
+ * ------------------------------------------------------------ */
+
+struct vma *mm_vma_alloc(void);
+
+void mm_vma_free(struct vma *vma);
+
+/* Insert a VMA into the sorted index; returns 0 or -1 when full/overlapping */
+int mm_vma_insert(struct mm *mm, struct vma *vma);
+
+/* Find the VMA containing va (O(log n)) */
+struct vma *mm_find_vma(struct mm *mm, uintptr_t va);
+
 /* ------------------------------------------------------------
  * MM Operations
  * ------------------------------------------------------------ */
@@ -63,10 +209,89 @@ void mm_activate(struct mm *mm);
 /* Translate virtual to physical address */
 bool mm_va_to_pa(const struct mm *mm, uintptr_t va, uintptr_t *out_pa);
 
-void mm_copy_vma(struct mm *dest_mm, struct vma *dest_vma,
-                 const struct mm *src_mm, const struct vma *src_vma,
-                 size_t length);
+/* Find the mm whose page tables are currently loaded */
+struct mm *mm_active(void);
+
+/* Free the page tables of the user part of the address space (must be empty) */
+void mm_free_user_page_tables(struct mm *mm);
+
+/* ------------------------------------------------------------
+ * Page-level mapping (architecture-specific)
+ * ------------------------------------------------------------ */
+
+/* Map one page with the protection described by VMA flags */
+bool mm_map_page(struct mm *mm, uintptr_t va, uintptr_t pa, uint32_t flags);
+
+/* Map a shared frame read-only; a write fault gives the mapping its own copy */
+bool mm_map_page_cow(struct mm *mm, uintptr_t va, uintptr_t pa, uint32_t flags);
+
+/* Unmap one page (or drop its swap entry); returns the frame it referenced or 0 */
+uintptr_t mm_unmap_page(struct mm *mm, uintptr_t va);
+
+/* Look up the frame behind va, also when the page is PROT_NONE */
+bool mm_get_page(const struct mm *mm, uintptr_t va, uintptr_t *out_pa);
+
+/* Change the protection of one page (no-op when nothing is mapped) */
+void mm_protect_page(struct mm *mm, uintptr_t va, uint32_t flags);
+
+/* Clear the accessed bit of a page; returns whether it was set */
+bool mm_clear_accessed(struct mm *mm, uintptr_t va);
+
+/* Replace the frame behind va by a swap entry for slot; returns the frame or 0 */
+uintptr_t mm_swap_out_page(struct mm *mm, uintptr_t va, uint32_t slot);
+
+/* Swap slot behind va; false when the page isn't swapped out */
+bool mm_get_swap_slot(const struct mm *mm, uintptr_t va, uint32_t *out_slot);
+
+/* Zero a 4 KiB page (kernel VA) */
+void mm_clear_page(void *page);
+
+/* Zero a 4 KiB page bypassing the cache (for pages that aren't used soon) */
+void mm_clear_page_nt(void *page);
+
+/* ------------------------------------------------------------
+ * User memory
+ *
+ * Image, heap, stack and mmap regions are private memory backed by
+ * frames from the frame allocator and committed on first use.
+ * MAP_SHARED regions map the frames of a shm object instead; every
+ * mapping of such a frame holds a reference to it.
+ * ------------------------------------------------------------ */
+
+void *mm_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+
+int mm_munmap(void *addr, size_t len);
+
+int mm_mprotect(void *addr, size_t len, int prot);
+
+/* Resolve a page fault on va; returns false when it is a real access violation */
+bool mm_handle_fault(struct mm *mm, uintptr_t va, bool write);
+
+/* Copy all private user memory of src into dst and share its shared memory (fork) */
+int mm_dup_user(struct mm *dst, struct mm *src);
+
+/* Drop all user memory (exit/exec) */
+void mm_release_user(struct mm *mm);
+
+/*
+ * Map an ELF segment of memsz bytes at va. The pages of the first filesz
+ * bytes are committed zeroed for the caller to fill; the rest stays lazy.
+ */
+int mm_map_image(struct mm *mm, uintptr_t va, size_t memsz, size_t filesz, uint32_t flags);
+
+/* Create the stack VMA and commit its top PROCESS_STACK_COMMIT bytes */
+int mm_setup_stack(struct mm *mm);
+
+/* Commit the stack pages down to PROCESS_STACK_MARGIN below sp */
+void mm_stack_reserve(struct mm *mm, uintptr_t sp);
+
+/* Create an empty heap VMA starting at start_brk (page aligned) */
+int mm_setup_heap(struct mm *mm, uintptr_t start_brk);
+
+/* Move the end of the heap VMA to end (rounded up to a page) */
+int mm_heap_resize(struct mm *mm, uintptr_t end);
 
-int mm_brk(void *addr);
+/* Linux brk semantics: returns the new break, or the current one on failure */
+uintptr_t mm_brk(void *addr);
 
-#endif /* VM_H */
\ No newline at end of file
+#endif /* VM_H */
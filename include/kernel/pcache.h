@@ -0,0 +1,106 @@
+#ifndef KERNEL_PCACHE_H
+#define KERNEL_PCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sys/types.h"
+#include "kernel/radix.h"
+
+/*
+ * Page cache for block backed files. Every cached page belongs to a
+ * mapping (a file, or a whole block device) and is found by its page
+ * index in the mapping's radix tree. Reads are served from cached pages;
+ * misses are read from the device in batches under one plug, so
+ * neighbouring blocks become one disk command.
+ *
+ * A mapping that is read sequentially gets a read-ahead window that
+ * doubles on every step up to PCACHE_RA_MAX pages. The first page of
+ * each window is marked; hitting the mark reads the next window, so the
+ * reader finds its pages cached instead of waiting for each miss.
+ *
+ * Writes only dirty cached pages. They go to the device on fsync, sync,
+ * when the cache evicts them, or when too many pages are dirty.
+ */
+
+#define PCACHE_PAGE_SIZE    4096u
+
+/* Pages one read-ahead window holds at most */
+#define PCACHE_RA_MAX       32
+
+/* Block of a page that has none on the device; reads as zeros */
+#define PCACHE_HOLE         UINT32_MAX
+
+struct blk_dev;
+struct pcache_mapping;
+
+struct pcache_ops
+{
+    /*
+     * Device block of page index of mapping, or PCACHE_HOLE. With create
+     * a hole gets a block allocated. Returns 0 or -errno.
+     */
+    int (*bmap)(struct pcache_mapping *mapping, uint32_t index, bool create, uint32_t *block);
+};
+
+struct pcache_mapping
+{
+    struct blk_dev *dev;
+    const struct pcache_ops *ops;
+    /* Owner's data, e.g. the filesystem's inode */
+    void *private;
+    /* Bytes in the file; reads stop here, writes past it grow it */
+    uint64_t size;
+    /* Page index to its cached page */
+    struct radix_tree pages;
+    uint32_t nr_pages;
+    uint32_t nr_dirty;
+    /* Last read-ahead window */
+    uint32_t ra_start;
+    uint32_t ra_size;
+    /* Page a sequential reader reads next */
+    uint32_t ra_next;
+    /* First writeback error since the last pcache_writeback, as -errno */
+    int error;
+};
+
+struct pcache_stat
+{
+    uint32_t pages;
+    uint32_t dirty;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t readahead;     /* pages read before they were asked for */
+    uint64_t writeback;     /* dirty pages written */
+    uint64_t evictions;
+};
+
+void pcache_init(void);
+
+void pcache_mapping_init(struct pcache_mapping *mapping, struct blk_dev *dev,
+                         const struct pcache_ops *ops, void *private, uint64_t size);
+
+ssize_t pcache_read(struct pcache_mapping *mapping, void *buf, size_t count, off_t offset);
+
+ssize_t pcache_write(struct pcache_mapping *mapping, const void *buf, size_t count, off_t offset);
+
+/* Write the dirty pages of mapping; 0 or the first error since the last call */
+int pcache_writeback(struct pcache_mapping *mapping);
+
+/* Drop the pages past size, dirty or not, and make size the file size */
+void pcache_truncate(struct pcache_mapping *mapping, uint64_t size);
+
+/* Drop page index if it is cached, dirty or not, e.g. when its block was freed */
+void pcache_discard(struct pcache_mapping *mapping, uint32_t index);
+
+/* Write back and drop every page, e.g. when the file goes away */
+void pcache_release(struct pcache_mapping *mapping);
+
+/* Write back and drop least recently used pages until nr_pages frames were freed; returns frames freed */
+uint32_t pcache_shrink(uint32_t nr_pages);
+
+/* Write back every dirty page */
+void pcache_sync(void);
+
+void pcache_stat(struct pcache_stat *stat);
+
+#endif /* KERNEL_PCACHE_H */
@@ -0,0 +1,53 @@
+#ifndef KERNEL_PCI_H
+#define KERNEL_PCI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PCI_MAX_DEVICES     32
+
+/* Configuration space registers */
+#define PCI_COMMAND         0x04
+#define PCI_BAR0            0x10
+#define PCI_INTERRUPT_LINE  0x3C
+
+#define PCI_COMMAND_IO      0x0001
+#define PCI_COMMAND_MEMORY  0x0002
+#define PCI_COMMAND_MASTER  0x0004
+
+/* An I/O BAR has bit 0 set; the rest is the port base */
+#define PCI_BAR_IO          0x1
+#define PCI_BAR_IO_MASK     (~0x3u)
+
+/* No interrupt line assigned */
+#define PCI_IRQ_NONE        0xFF
+
+struct pci_dev
+{
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t func;
+    uint16_t vendor;
+    uint16_t device;
+    uint8_t class;
+    uint8_t subclass;
+    uint8_t irq;
+    uint32_t bar[6];
+};
+
+/* Scan every bus for devices */
+void pci_init(void);
+
+/* The index-th device with vendor and a device id in [device_lo, device_hi]; NULL if there is none */
+struct pci_dev *pci_find(uint16_t vendor, uint16_t device_lo, uint16_t device_hi, uint32_t index);
+
+uint32_t pci_read32(const struct pci_dev *dev, uint8_t offset);
+
+uint16_t pci_read16(const struct pci_dev *dev, uint8_t offset);
+
+void pci_write16(const struct pci_dev *dev, uint8_t offset, uint16_t value);
+
+/* Turn on I/O and memory decoding and bus mastering (DMA) */
+void pci_enable(const struct pci_dev *dev);
+
+#endif /* KERNEL_PCI_H */
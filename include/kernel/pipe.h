@@ -0,0 +1,19 @@
+#ifndef KERNEL_PIPE_H
+#define KERNEL_PIPE_H
+
+#include "kernel/files.h"
+
+/*
+ * Pipes: a page sized ring buffer between a read end and a write end.
+ * Writes of up to PIPE_BUF bytes are atomic: they are never interleaved
+ * with other writes.
+ */
+
+#define PIPE_BUF    4096
+
+extern struct fs pipe_fs;
+
+/* A new pipe behind an anonymous inode with one reference; NULL if out of pipes */
+struct inode *pipe_inode_alloc(void);
+
+#endif /* KERNEL_PIPE_H */
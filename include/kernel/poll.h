@@ -0,0 +1,37 @@
+#ifndef KERNEL_POLL_H
+#define KERNEL_POLL_H
+
+#include <stdint.h>
+/* The userspace header, not this one */
+#include "../poll.h"
+#include "kernel/wait.h"
+
+struct file;
+struct task;
+
+/*
+ * Readiness. A file's poll op returns the POLL* events that are ready now
+ * and, when given a poll table, calls poll_wait for every wait queue that
+ * is woken up when that changes. What registering means is up to the
+ * table: poll() sleeps on the queues, epoll keeps an entry on them that
+ * marks the watched fd ready.
+ */
+struct poll_table
+{
+    void (*queue_proc)(struct wait_queue *queue, struct poll_table *pt);
+};
+
+static inline void poll_wait(struct wait_queue *queue, struct poll_table *pt)
+{
+    if (pt != NULL && queue != NULL)
+    {
+        pt->queue_proc(queue, pt);
+    }
+}
+
+/* The ready events of file; files without a poll op are always ready */
+uint32_t vfs_file_poll(struct file *file, struct poll_table *pt);
+
+int vfs_poll(struct task *task, struct pollfd *fds, nfds_t nfds, int timeout);
+
+#endif /* KERNEL_POLL_H */
@@ -0,0 +1,38 @@
+#ifndef KERNEL_RADIX_H
+#define KERNEL_RADIX_H
+
+#include <stdint.h>
+
+/*
+ * Radix tree from a 32 bit index to a non zero value, e.g. a file's page
+ * index to its frame. Every node is one frame of RADIX_SLOTS slots, and
+ * the tree is only as high as the largest index needs: a file of up to
+ * 4 MiB of pages is a single node.
+ */
+
+#define RADIX_SHIFT     10
+#define RADIX_SLOTS     (1u << RADIX_SHIFT)
+#define RADIX_MASK      (RADIX_SLOTS - 1)
+
+struct radix_tree
+{
+    /* Physical address of the top node; 0 when empty */
+    uintptr_t root_pa;
+    /* Levels of nodes; 0 when empty */
+    uint32_t height;
+    /* Frames used by nodes */
+    uint32_t nodes;
+};
+
+void radix_init(struct radix_tree *tree);
+
+/* Value at index, or 0 */
+uintptr_t radix_lookup(const struct radix_tree *tree, uint32_t index);
+
+/* Slot of index, allocating nodes on the way; NULL if out of memory */
+uintptr_t *radix_slot(struct radix_tree *tree, uint32_t index);
+
+/* Remove every value at index >= from, handing each to release */
+void radix_trim(struct radix_tree *tree, uint32_t from, void (*release)(uintptr_t value));
+
+#endif /* KERNEL_RADIX_H */
@@ -39,42 +39,43 @@ struct trampoline{
 
 struct task
 {
+    /*
+     * Hot: everything sched_schedule, wakeup and syscall entry touch, kept
+     * within the first cache line. cpu_ctx must stay first, the context
+     * switch code addresses it at offset 0.
+     */
     struct cpu_ctx cpu_ctx;
-
+    enum sched_state state;
     pid_t pid;
     struct task *next;
+    struct mm *mm;
+    // The number of context switches.
+    uint64_t ctxt;
+    uint64_t sys_call_cnt;
+    /* Lowest address of the kernel stack (see kstack.h) */
+    uintptr_t kstack;
+
+    /* Cold */
     struct task *parent;
 
     struct task *children;      /* Head of my children list */
     struct task *next_sibling;  /* Next child in parent's list */
 
-
     int exit_status;
 
-    char cwd[MAX_FILENAME_LEN];
-
-    struct mm *mm;
-
-    char name[MAX_FILENAME_LEN];
-
-    struct files files;
+    uintptr_t brk;
+    uintptr_t brk_limit;
 
     struct tty *ctty;
 
-    enum sched_state state;
-
-    // The number of context switches.
-    uint64_t ctxt;
-
-    uintptr_t brk;
-    uintptr_t brk_limit;
+    struct signal signal;
 
-    uint8_t kstack[KERNEL_STACK_SIZE];
+    struct files files;
 
-    uint64_t sys_call_cnt;
+    char cwd[MAX_FILENAME_LEN];
 
-    struct signal signal;
-};
+    char name[MAX_FILENAME_LEN];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
 
 /* Task table - must be defined before struct scheduler */
 struct task_slot
@@ -145,6 +146,9 @@ int sched_execve(const char *pathname, char *const argv[], char *const envp[]);
 
 void sched_schedule(void);
 
+/* Background work done by the idle task before it gives up the CPU */
+void sched_idle(void);
+
 void sched_enqueue(struct task *task);
 
 pid_t sched_getpid(void);
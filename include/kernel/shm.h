@@ -0,0 +1,37 @@
+#ifndef KERNEL_SHM_H
+#define KERNEL_SHM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "kernel/files.h"
+
+/*
+ * Shared memory objects. Named objects live under /dev/shm (shm_open);
+ * anonymous ones back MAP_SHARED | MAP_ANONYMOUS mappings. Every open
+ * file, every VMA and the inode of a named object hold a reference to it.
+ */
+struct shm_object;
+
+/* Largest object: the page index of an object is a single frame */
+#define SHM_MAX_PAGES 1024u
+
+/* Object behind an open /dev/shm file; NULL for any other file */
+struct shm_object *shm_file_object(struct file *file);
+
+/* Create an unnamed object of size bytes with one reference */
+struct shm_object *shm_anon_create(size_t size);
+
+void shm_object_get(struct shm_object *obj);
+
+/* Drop a reference; the object is destroyed with the last one once unlinked */
+void shm_object_put(struct shm_object *obj);
+
+/* Frame backing page pgoff, allocated zeroed on first use; 0 past the end or when out of memory */
+uintptr_t shm_object_page(struct shm_object *obj, uint32_t pgoff);
+
+size_t shm_object_size(const struct shm_object *obj);
+
+/* Empty for anonymous objects */
+const char *shm_object_name(const struct shm_object *obj);
+
+#endif /* KERNEL_SHM_H */
@@ -0,0 +1,43 @@
+#ifndef KERNEL_SWAP_H
+#define KERNEL_SWAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "kernel/mm.h"
+
+/* Use the second drive on the primary ATA channel as swap area */
+void swap_init(void);
+
+/* Reclaim pages when free memory dropped below the low watermark (fault path) */
+void swap_reclaim_direct(void);
+
+/* Reclaim pages up to the high watermark; called from the idle task */
+void swap_reclaim_background(void);
+
+/* Allocate a frame, reclaiming pages when memory runs out; 0 when that fails too */
+uintptr_t swap_frame_alloc(bool zeroed);
+
+/* Bring in the swapped page at va (plus neighbours written with it) */
+bool swap_in(struct mm *mm, const struct vma *vma, uintptr_t va, uint32_t slot);
+
+/* Read a slot into a page without releasing it (fork) */
+int swap_read_slot(uint32_t slot, void *page);
+
+void swap_slot_free(uint32_t slot);
+
+struct swap_stat
+{
+    uint32_t total_slots;
+    uint32_t free_slots;
+
+    uint64_t pswpin;            /* pages read from swap */
+    uint64_t pswpout;           /* pages written to swap */
+    uint64_t pgscan_kswapd;     /* pages scanned by background reclaim */
+    uint64_t pgscan_direct;     /* pages scanned by reclaim on the fault path */
+    uint64_t pgsteal_kswapd;    /* pages reclaimed by background reclaim */
+    uint64_t pgsteal_direct;    /* pages reclaimed on the fault path */
+};
+
+void swap_stat(struct swap_stat *stat);
+
+#endif /* KERNEL_SWAP_H */
@@ -14,19 +14,44 @@
 #define SYS_open            5
 #define SYS_close           6
 #define SYS_waitpid         7
+#define SYS_unlink          10
 #define SYS_execve          11
 #define SYS_chdir           12
+#define SYS_lseek           19
 #define SYS_getpid          20
 #define SYS_nice            34
+#define SYS_sync            36
 #define SYS_kill            37
+#define SYS_rename          38
+#define SYS_mkdir           39
+#define SYS_rmdir           40
+#define SYS_dup             41
+#define SYS_pipe            42
 #define SYS_brk             45
+#define SYS_fcntl           55
+#define SYS_dup2            63
+#define SYS_mmap            90
+#define SYS_munmap          91
+#define SYS_ftruncate       93
 #define SYS_stat            106
 #define SYS_lstat           107
 #define SYS_fstat           108
+#define SYS_fsync           118
+#define SYS_mprotect        125
 #define SYS_getdents        141
+#define SYS_readv           145
+#define SYS_writev          146
 #define SYS_sched_yield     158
+#define SYS_poll            168
+#define SYS_pread64         180
+#define SYS_pwrite64        181
 #define SYS_getcwd          183
+#define SYS_epoll_create    254
+#define SYS_epoll_ctl       255
+#define SYS_epoll_wait      256
 #define SYS_clock_gettime   265
+#define SYS_epoll_create1   329
+#define SYS_pipe2           331
 
 // Custom syscalls (no Linux equivalent)
 #define SYS_setctty   500 // Linux uses ioctl(fd, TIOCSCTTY, 0)
@@ -7,6 +7,7 @@
 #include "files.h"
 #include "sched.h"
 #include "stat.h"
+#include "sys/uio.h"
 
 /* Opaque VFS structure - internals hidden */
 struct vfs;
@@ -22,6 +23,9 @@ extern struct fs proc_fs;
 extern struct fs bin_fs;
 extern struct fs dev_fs;
 extern struct fs sys_fs;
+extern struct fs shm_fs;
+extern struct fs tmp_fs;
+extern struct fs ext2_fs;
 
 /* ------------------------------------------------------------------
  * Mounting API
@@ -30,7 +34,9 @@ extern struct fs sys_fs;
 /* Mount a filesystem at a path */
 int vfs_mount(const char *path, struct fs *fs);
 
-void vfs_get_root_mounts(struct dirent *buf, unsigned int max_entries, unsigned int *idx);
+/* getdents of "/": the mount points directly below it, mount slot i at position base + i */
+void vfs_get_root_mounts(struct file *file, struct dirent *buf, unsigned int max_entries, unsigned int *idx,
+                         uint32_t base);
 
 
 /* ------------------------------------------------------------------
@@ -41,24 +47,70 @@ ssize_t vfs_write(int fd, const char *buf, size_t count);
 
 ssize_t vfs_read(int fd, void *buf, size_t count);
 
+off_t vfs_lseek(struct task *task, int fd, off_t offset, int whence);
+
+/* Read or write at offset without moving the file position */
+ssize_t vfs_pread(struct task *task, int fd, void *buf, size_t count, off_t offset);
+
+ssize_t vfs_pwrite(struct task *task, int fd, const void *buf, size_t count, off_t offset);
+
+ssize_t vfs_readv(struct task *task, int fd, const struct iovec *iov, int iovcnt);
+
+ssize_t vfs_writev(struct task *task, int fd, const struct iovec *iov, int iovcnt);
+
 int vfs_getdents(int fd, struct dirent *buf, unsigned int count);
 
 int vfs_chdir(const char *path);
 
 char *vfs_getcwd(char *buf, size_t size);
 
-void vfs_resolve_path(
-        const char *cwd,
-        const char *pathname,
-        char *resolved,
-        size_t resolved_size);
-
 void vfs_init(struct vfs *vfs);
 
 int vfs_open(struct task *task, const char *pathname, int flags, int mode);
 
 int vfs_close(struct task *task, int fd);
 
+/* Open an inode that has no name, like a pipe; takes its own inode reference */
+int vfs_open_anon(struct task *task, struct inode *inode, int flags);
+
+/* Open a new pipe: fds[0] is the read end, fds[1] the write end */
+int vfs_pipe(struct task *task, int fds[2], int flags);
+
+/* New fd, the lowest free one, for the file behind oldfd */
+int vfs_dup(struct task *task, int oldfd);
+
+/* Make newfd refer to the file behind oldfd, closing newfd first */
+int vfs_dup2(struct task *task, int oldfd, int newfd);
+
+/* F_DUPFD, F_DUPFD_CLOEXEC, F_GETFD, F_SETFD and F_GETFL */
+int vfs_fcntl(struct task *task, int fd, int cmd, int arg);
+
+/* Close the fds marked FD_CLOEXEC (execve) */
+void vfs_close_on_exec(struct task *task);
+
 int vfs_fstat(struct task *task, int fd, struct stat *stat);
 
+int vfs_ftruncate(struct task *task, int fd, off_t length);
+
+/* Write the cached data of fd to its device */
+int vfs_fsync(struct task *task, int fd);
+
+/* Write every dirty cached page to its device */
+void vfs_sync(void);
+
+int vfs_unlink(struct task *task, const char *pathname);
+
+int vfs_mkdir(struct task *task, const char *pathname, int mode);
+
+int vfs_rmdir(struct task *task, const char *pathname);
+
+/* Move oldpath to newpath, replacing newpath; both on one filesystem */
+int vfs_rename(struct task *task, const char *oldpath, const char *newpath);
+
+/* Set up the empty tmpfs; before it is mounted */
+void tmp_fs_init(void);
+
+/* Read the ext2 filesystem on block device name (e.g. "vdb"); 0 if it can be mounted */
+int ext2_fs_init(const char *device);
+
 #endif //VFS_H
\ No newline at end of file
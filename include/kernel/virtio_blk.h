@@ -0,0 +1,7 @@
+#ifndef KERNEL_VIRTIO_BLK_H
+#define KERNEL_VIRTIO_BLK_H
+
+/* Register every legacy virtio-blk PCI device, as /dev/vda, /dev/vdb, ... */
+void virtio_blk_init(void);
+
+#endif /* KERNEL_VIRTIO_BLK_H */
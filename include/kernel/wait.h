@@ -8,7 +8,15 @@ struct task;
 
 
 struct wait_queue;
+struct wait_queue_entry;
 
+typedef void (*wait_func_t)(struct wait_queue_entry *entry);
+
+/*
+ * An entry either wakes up a task, after which wakeup takes it off the
+ * queue, or calls func and stays queued until it is removed. The second
+ * kind lets poll and epoll watch many queues at once.
+ */
 struct wait_queue_entry
 {
     struct task *task;
@@ -17,6 +25,9 @@ struct wait_queue_entry
     struct wait_queue_entry *next;
 
     struct wait_queue *queue;
+
+    wait_func_t func;
+    void *private;
 };
 
 struct wait_queue
@@ -35,6 +46,8 @@ void wait_queue_init(struct wait_queue *queue);
 
 void wait_queue_entry_init(struct wait_queue_entry *entry, struct task *task);
 
+void wait_queue_entry_init_func(struct wait_queue_entry *entry, wait_func_t func, void *private);
+
 void wait_queue_add(struct wait_queue *queue, struct wait_queue_entry *entry);
 
 void wait_queue_remove(struct wait_queue_entry *entry);
@@ -0,0 +1,37 @@
+#ifndef KERNEL_ZYGOTE_H
+#define KERNEL_ZYGOTE_H
+
+#include <stdint.h>
+#include "kernel/mm.h"
+#include "kernel/elf_loader.h"
+
+/*
+ * Process templates. The first exec of a binary loads the ELF image as
+ * usual and keeps the loaded pages as a template; later execs map those
+ * frames copy-on-write instead of copying the image again.
+ */
+
+/*
+ * Map the image of bin into the empty address space mm from its template.
+ * Returns 0, -ENOENT when there is no template or -ENOMEM.
+ */
+int zygote_clone(const struct embedded_bin *bin, struct mm *mm, struct elf_info *elf_info);
+
+/* Keep the image elf_load just mapped into mm as the template of bin */
+void zygote_capture(const struct embedded_bin *bin, struct mm *mm, const struct elf_info *elf_info);
+
+/* Drop least recently used templates until nr_pages frames were freed; returns frames freed */
+uint32_t zygote_shrink(uint32_t nr_pages);
+
+struct zygote_stat
+{
+    uint32_t templates;
+    uint32_t pages;         /* frames held by templates */
+    uint64_t hits;          /* execs served from a template */
+    uint64_t misses;        /* execs that loaded the ELF image */
+    uint64_t evictions;
+};
+
+void zygote_stat(struct zygote_stat *stat);
+
+#endif /* KERNEL_ZYGOTE_H */
@@ -0,0 +1,23 @@
+#ifndef MALLOC_H
+#define MALLOC_H
+
+#include "stdlib.h"
+
+// Allocator statistics (glibc layout; unused fields are 0)
+struct mallinfo
+{
+    int arena;      // bytes obtained for small chunks (brk/mmap arenas)
+    int ordblks;    // free small chunks
+    int smblks;
+    int hblks;      // large allocations (own mapping)
+    int hblkhd;     // bytes in large allocations
+    int usmblks;
+    int fsmblks;
+    int uordblks;   // bytes in small chunks in use
+    int fordblks;   // bytes in free small chunks
+    int keepcost;   // arena bytes not yet carved into chunks
+};
+
+struct mallinfo mallinfo(void);
+
+#endif //MALLOC_H
@@ -0,0 +1,28 @@
+#ifndef POLL_H
+#define POLL_H
+
+#include <stdint.h>
+
+/* poll() events */
+#define POLLIN      0x001
+#define POLLPRI     0x002
+#define POLLOUT     0x004
+#define POLLERR     0x008
+#define POLLHUP     0x010
+#define POLLNVAL    0x020
+#define POLLRDNORM  0x040
+#define POLLWRNORM  0x100
+
+typedef unsigned int nfds_t;
+
+struct pollfd
+{
+    int fd;
+    short events;
+    short revents;
+};
+
+/* timeout in ms; -1 waits forever, 0 doesn't wait */
+int poll(struct pollfd *fds, nfds_t nfds, int timeout);
+
+#endif /* POLL_H */
@@ -7,6 +7,9 @@
 #define S_IFMT   0170000   /* type bit mask */
 #define S_IFREG  0100000   /* regular file   */
 #define S_IFDIR  0040000   /* directory      */
+#define S_IFBLK  0060000   /* block device   */
+#define S_IFCHR  0020000   /* character device */
+#define S_IFIFO  0010000   /* pipe           */
 
 struct stat {
     dev_t     st_dev;
@@ -33,4 +36,6 @@ int fstat(int fd, struct stat *buf);
 
 int lstat(const char *pathname, struct stat *buf);
 
+int mkdir(const char *pathname, mode_t mode);
+
 #endif /* _SYS_STAT_H */
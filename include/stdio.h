@@ -7,4 +7,6 @@ int printf(const char *fmt, ...);
 
 int snprintf(char *str, size_t size, const char *fmt, ...);
 
+int rename(const char *oldpath, const char *newpath);
+
 #endif /* STDIO_H */
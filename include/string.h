@@ -19,4 +19,6 @@ int strncmp(const char *s1, const char *s2, size_t n);
 
 void *memcpy(void *dest, const void *src, size_t n);
 
+void *memset(void *dest, int c, size_t n);
+
 #endif //STRING_H
@@ -0,0 +1,34 @@
+#ifndef SYS_MMAN_H
+#define SYS_MMAN_H
+
+#include "sys/types.h"
+
+// Protection bits
+#define PROT_NONE      0x0
+#define PROT_READ      0x1
+#define PROT_WRITE     0x2
+#define PROT_EXEC      0x4
+
+// mmap() flags (minimal subset)
+#define MAP_SHARED     0x01
+#define MAP_PRIVATE    0x02
+#define MAP_FIXED      0x10
+#define MAP_ANONYMOUS  0x20
+#define MAP_ANON       MAP_ANONYMOUS
+
+#define MAP_FAILED     ((void *) -1)
+
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+
+int munmap(void *addr, size_t length);
+
+int mprotect(void *addr, size_t length, int prot);
+
+/* Open a shared memory object; name is "/name" and lives under /dev/shm */
+int shm_open(const char *name, int oflag, int mode);
+
+int shm_unlink(const char *name);
+
+
+#endif //SYS_MMAN_H
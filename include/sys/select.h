@@ -0,0 +1,30 @@
+#ifndef SYS_SELECT_H
+#define SYS_SELECT_H
+
+#include <stdint.h>
+
+#define FD_SETSIZE  32
+
+typedef struct
+{
+    uint32_t fds_bits[FD_SETSIZE / 32];
+} fd_set;
+
+#define FD_ZERO(set)        ((set)->fds_bits[0] = 0)
+#define FD_SET(fd, set)     ((set)->fds_bits[(fd) / 32] |= (1u << ((fd) % 32)))
+#define FD_CLR(fd, set)     ((set)->fds_bits[(fd) / 32] &= ~(1u << ((fd) % 32)))
+#define FD_ISSET(fd, set)   (((set)->fds_bits[(fd) / 32] & (1u << ((fd) % 32))) != 0)
+
+struct timeval
+{
+    long tv_sec;
+    long tv_usec;
+};
+
+/*
+ * Built on poll(); timeout NULL waits forever. The sets are rewritten to
+ * the fds that are ready.
+ */
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout);
+
+#endif /* SYS_SELECT_H */
@@ -0,0 +1,19 @@
+#ifndef SYS_UIO_H
+#define SYS_UIO_H
+
+#include "sys/types.h"
+
+/* Most buffers one readv or writev takes */
+#define IOV_MAX     1024
+
+struct iovec
+{
+    void *iov_base;
+    size_t iov_len;
+};
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt);
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt);
+
+#endif /* SYS_UIO_H */
@@ -6,6 +6,10 @@
 
 #define WNOHANG 0x01
 
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+
 extern char **environ;
 
 char *getenv(const char *name);
@@ -38,6 +42,30 @@ int brk(void *addr);
 
 int chdir(const char *path);
 
+int unlink(const char *pathname);
+
+int rmdir(const char *pathname);
+
+off_t lseek(int fd, off_t offset, int whence);
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset);
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset);
+
+int dup(int oldfd);
+
+int dup2(int oldfd, int newfd);
+
+int pipe(int fds[2]);
+
+int pipe2(int fds[2], int flags);
+
+int ftruncate(int fd, off_t length);
+
+int fsync(int fd);
+
+void sync(void);
+
 char *getcwd(char *buf, size_t size);
 
 void delay(uint32_t count);
@@ -0,0 +1,593 @@
+// blk.c
+//
+// Block device layer (see include/kernel/blk.h): request queues and the
+// /dev nodes of block devices.
+//
+// The /dev nodes read and write through the page cache, with the whole
+// device as one mapping. O_DIRECT bypasses the cache and transfers
+// through bounce frames instead.
+//
+// The queue is a singly linked list sorted on the first block of each
+// request. Dispatching it front to back is one sweep across the disk, and
+// a bio only has to look at the requests around its place in the list to
+// find one it can be merged into.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "errno.h"
+#include "kernel/blk.h"
+#include "kernel/dev.h"
+#include "kernel/mm.h"
+#include "kernel/pcache.h"
+#include "kernel/kutils.h"
+#include "kernel/console.h"
+
+/* Requests a device can have queued; a full queue is dispatched */
+#define BLK_QUEUE_DEPTH     64
+
+/* Blocks blk_rw_pages submits under one plug */
+#define BLK_BATCH           128
+
+/* Frames the read and write calls of the /dev nodes go through */
+#define BLK_BOUNCE_PAGES    BLK_BATCH
+
+struct blk_request
+{
+    bool active;
+    bool write;
+    uint32_t block;
+    uint32_t cnt;
+    struct bio *head;
+    struct bio *tail;
+    struct blk_request *next;
+};
+
+struct blk_dev
+{
+    char name[BLK_NAME_MAX];
+    uint32_t block_cnt;
+    const struct blk_ops *ops;
+    void *driver_data;
+    uint32_t plugged;
+    /* Requests started and not yet completed */
+    uint32_t inflight;
+    struct blk_request *queue;
+    struct blk_request requests[BLK_QUEUE_DEPTH];
+    struct blk_stat stat;
+    /* Cached pages of the /dev node; page index is block number */
+    struct pcache_mapping mapping;
+};
+
+static struct
+{
+    struct blk_dev devs[BLK_MAX_DEVS];
+    uint32_t dev_cnt;
+    /*
+     * A user buffer can fault, and the fault can need the disk for a
+     * swap-in, so the disk never transfers into user memory directly.
+     */
+    void *bounce[BLK_BOUNCE_PAGES];
+} blk;
+
+/* ------------------------------------------------------------
+ * Request queue
+ * ------------------------------------------------------------ */
+
+static void blk_request_done(struct blk_dev *dev, struct blk_request *req, int status)
+{
+    if (status < 0)
+    {
+        dev->stat.errors++;
+    }
+    for (struct bio *bio = req->head; bio; bio = bio->next)
+    {
+        bio->status = status < 0 ? -EIO : 0;
+    }
+    req->active = false;
+}
+
+void blk_complete(struct blk_dev *dev, void *tag, int status)
+{
+    dev->inflight--;
+    blk_request_done(dev, tag, status);
+}
+
+/* Start req on a driver that takes many at once, making room if needed */
+static void blk_start(struct blk_dev *dev, struct blk_request *req, void *const *pages)
+{
+    while (dev->ops->start(dev, req->block, pages, req->cnt, req->write, req) < 0)
+    {
+        if (dev->inflight == 0)
+        {
+            blk_request_done(dev, req, -1);
+            return;
+        }
+        dev->ops->wait(dev);
+    }
+
+    dev->inflight++;
+    if (dev->inflight > dev->stat.max_inflight)
+    {
+        dev->stat.max_inflight = dev->inflight;
+    }
+}
+
+static void blk_dispatch(struct blk_dev *dev)
+{
+    struct blk_request *req = dev->queue;
+    dev->queue = NULL;
+
+    while (req)
+    {
+        /* Done requests can be reused, so read next first */
+        struct blk_request *next = req->next;
+
+        void *pages[BLK_MAX_SEGS];
+        uint32_t i = 0;
+        for (struct bio *bio = req->head; bio; bio = bio->next)
+        {
+            pages[i++] = bio->page;
+        }
+
+        dev->stat.requests++;
+        if (dev->ops->start)
+        {
+            blk_start(dev, req, pages);
+        }
+        else
+        {
+            blk_request_done(dev, req, dev->ops->transfer(dev, req->block, pages, req->cnt, req->write));
+        }
+        req = next;
+    }
+
+    if (dev->inflight > 0)
+    {
+        dev->ops->wait(dev);
+    }
+}
+
+static struct blk_request *blk_request_alloc(struct blk_dev *dev)
+{
+    for (uint32_t i = 0; i < BLK_QUEUE_DEPTH; i++)
+    {
+        if (!dev->requests[i].active)
+        {
+            return &dev->requests[i];
+        }
+    }
+    return NULL;
+}
+
+static bool blk_overlaps(const struct blk_request *req, uint32_t block)
+{
+    return block >= req->block && block < req->block + req->cnt;
+}
+
+/* Append bio to req, then take in the next request if it now continues req */
+static void blk_back_merge(struct blk_dev *dev, struct blk_request *req, struct bio *bio)
+{
+    req->tail->next = bio;
+    req->tail = bio;
+    req->cnt++;
+    dev->stat.merges++;
+
+    struct blk_request *next = req->next;
+    if (next && next->write == req->write && next->block == req->block + req->cnt &&
+        req->cnt + next->cnt <= BLK_MAX_SEGS)
+    {
+        req->tail->next = next->head;
+        req->tail = next->tail;
+        req->cnt += next->cnt;
+        req->next = next->next;
+        next->active = false;
+    }
+}
+
+/* Merge bio into the queue; false if it needs a request of its own */
+static bool blk_merge(struct blk_dev *dev, struct bio *bio)
+{
+    for (struct blk_request *req = dev->queue; req && req->block <= bio->block + 1; req = req->next)
+    {
+        if (req->write != bio->write || req->cnt == BLK_MAX_SEGS)
+        {
+            continue;
+        }
+
+        if (req->block + req->cnt == bio->block)
+        {
+            blk_back_merge(dev, req, bio);
+            return true;
+        }
+
+        if (bio->block + 1 == req->block)
+        {
+            bio->next = req->head;
+            req->head = bio;
+            req->block--;
+            req->cnt++;
+            dev->stat.merges++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void blk_submit(struct blk_dev *dev, struct bio *bio)
+{
+    bio->next = NULL;
+    bio->status = 0;
+    if (bio->write)
+    {
+        dev->stat.writes++;
+    }
+    else
+    {
+        dev->stat.reads++;
+    }
+
+    /* Sorting must not reorder I/O to the same block */
+    for (struct blk_request *req = dev->queue; req; req = req->next)
+    {
+        if (blk_overlaps(req, bio->block))
+        {
+            blk_dispatch(dev);
+            break;
+        }
+    }
+
+    if (!blk_merge(dev, bio))
+    {
+        struct blk_request *req = blk_request_alloc(dev);
+        if (!req)
+        {
+            blk_dispatch(dev);
+            req = blk_request_alloc(dev);
+        }
+
+        req->active = true;
+        req->write = bio->write;
+        req->block = bio->block;
+        req->cnt = 1;
+        req->head = bio;
+        req->tail = bio;
+
+        struct blk_request **link = &dev->queue;
+        while (*link && (*link)->block <= bio->block)
+        {
+            link = &(*link)->next;
+        }
+        req->next = *link;
+        *link = req;
+    }
+
+    if (dev->plugged == 0)
+    {
+        blk_dispatch(dev);
+    }
+}
+
+void blk_plug(struct blk_dev *dev)
+{
+    dev->plugged++;
+}
+
+void blk_unplug(struct blk_dev *dev)
+{
+    if (dev->plugged == 0)
+    {
+        panic("blk_unplug: not plugged");
+    }
+
+    dev->plugged--;
+    if (dev->plugged == 0)
+    {
+        blk_dispatch(dev);
+    }
+}
+
+int blk_rw_pages(struct blk_dev *dev, uint32_t block, void *const *pages, uint32_t cnt, bool write)
+{
+    struct bio bios[BLK_BATCH];
+    uint32_t done = 0;
+
+    while (done < cnt)
+    {
+        uint32_t batch = cnt - done < BLK_BATCH ? cnt - done : BLK_BATCH;
+
+        blk_plug(dev);
+        for (uint32_t i = 0; i < batch; i++)
+        {
+            bios[i].block = block + done + i;
+            bios[i].page = pages[done + i];
+            bios[i].write = write;
+            blk_submit(dev, &bios[i]);
+        }
+        blk_unplug(dev);
+
+        for (uint32_t i = 0; i < batch; i++)
+        {
+            if (bios[i].status < 0)
+            {
+                return -EIO;
+            }
+        }
+        done += batch;
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------
+ * /dev nodes
+ * ------------------------------------------------------------ */
+
+/* Copy len bytes between buf and the bounce pages, from offset off in the first */
+static void blk_bounce_copy(void *buf, size_t off, size_t len, bool to_bounce)
+{
+    uint8_t *p = buf;
+    while (len > 0)
+    {
+        uint8_t *page = blk.bounce[off / BLK_SIZE];
+        size_t in_page = off % BLK_SIZE;
+        size_t chunk = BLK_SIZE - in_page < len ? BLK_SIZE - in_page : len;
+
+        if (to_bounce)
+        {
+            k_memcpy(page + in_page, p, chunk);
+        }
+        else
+        {
+            k_memcpy(p, page + in_page, chunk);
+        }
+        p += chunk;
+        off += chunk;
+        len -= chunk;
+    }
+}
+
+static ssize_t blk_rw(struct blk_dev *dev, void *buf, size_t count, off_t offset, bool write)
+{
+    uint64_t size = (uint64_t) dev->block_cnt * BLK_SIZE;
+    if ((uint64_t) offset >= size)
+    {
+        return write && count > 0 ? -ENOSPC : 0;
+    }
+    if (count > size - (uint64_t) offset)
+    {
+        count = (size_t) (size - (uint64_t) offset);
+    }
+
+    uint8_t *p = buf;
+    size_t done = 0;
+    while (done < count)
+    {
+        size_t pos = (size_t) offset + done;
+        uint32_t block = (uint32_t) (pos / BLK_SIZE);
+        size_t in_block = pos % BLK_SIZE;
+        size_t chunk = BLK_BOUNCE_PAGES * BLK_SIZE - in_block;
+        if (chunk > count - done)
+        {
+            chunk = count - done;
+        }
+        uint32_t cnt = (uint32_t) ((in_block + chunk + BLK_SIZE - 1) / BLK_SIZE);
+
+        int res = 0;
+        if (write)
+        {
+            /* A partial block keeps the bytes around the written ones */
+            if (in_block != 0)
+            {
+                res = blk_rw_pages(dev, block, &blk.bounce[0], 1, false);
+            }
+            if (res == 0 && (in_block + chunk) % BLK_SIZE != 0 && (cnt > 1 || in_block == 0))
+            {
+                res = blk_rw_pages(dev, block + cnt - 1, &blk.bounce[cnt - 1], 1, false);
+            }
+            if (res == 0)
+            {
+                blk_bounce_copy(p + done, in_block, chunk, true);
+                res = blk_rw_pages(dev, block, blk.bounce, cnt, true);
+            }
+        }
+        else
+        {
+            res = blk_rw_pages(dev, block, blk.bounce, cnt, false);
+            if (res == 0)
+            {
+                blk_bounce_copy(p + done, in_block, chunk, false);
+            }
+        }
+
+        if (res < 0)
+        {
+            return done > 0 ? (ssize_t) done : res;
+        }
+        done += chunk;
+    }
+
+    return (ssize_t) done;
+}
+
+static int blk_bmap(struct pcache_mapping *mapping, uint32_t index, bool create, uint32_t *block)
+{
+    (void) mapping;
+    (void) create;
+    *block = index;
+    return 0;
+}
+
+static const struct pcache_ops blk_pcache_ops = {
+        .bmap = blk_bmap,
+};
+
+/* O_DIRECT I/O must not miss data still in the cache, nor leave stale pages behind */
+static void blk_direct(struct blk_dev *dev)
+{
+    if (dev->mapping.nr_pages > 0)
+    {
+        pcache_release(&dev->mapping);
+    }
+}
+
+static ssize_t blk_dev_pread(struct file *file, void *buf, size_t count, off_t offset)
+{
+    struct blk_dev *dev = file->driver_data;
+    if (file->flags & O_DIRECT)
+    {
+        blk_direct(dev);
+        return blk_rw(dev, buf, count, offset, false);
+    }
+    return pcache_read(&dev->mapping, buf, count, offset);
+}
+
+static ssize_t blk_dev_pwrite(struct file *file, const void *buf, size_t count, off_t offset)
+{
+    struct blk_dev *dev = file->driver_data;
+    if (file->flags & O_DIRECT)
+    {
+        blk_direct(dev);
+        return blk_rw(dev, (void *) buf, count, offset, true);
+    }
+
+    /* The cache would grow the mapping; a device has a fixed size */
+    if ((uint64_t) offset >= dev->mapping.size)
+    {
+        return count > 0 ? -ENOSPC : 0;
+    }
+    if (count > dev->mapping.size - (uint64_t) offset)
+    {
+        count = (size_t) (dev->mapping.size - (uint64_t) offset);
+    }
+    return pcache_write(&dev->mapping, buf, count, offset);
+}
+
+static ssize_t blk_dev_read(struct file *file, void *buf, size_t count)
+{
+    ssize_t n = blk_dev_pread(file, buf, count, (off_t) file->pos);
+    if (n > 0)
+    {
+        file->pos += (uint64_t) n;
+    }
+    return n;
+}
+
+static ssize_t blk_dev_write(struct file *file, const void *buf, size_t count)
+{
+    ssize_t n = blk_dev_pwrite(file, buf, count, (off_t) file->pos);
+    if (n > 0)
+    {
+        file->pos += (uint64_t) n;
+    }
+    return n;
+}
+
+static int blk_dev_fsync(struct file *file)
+{
+    struct blk_dev *dev = file->driver_data;
+    return pcache_writeback(&dev->mapping);
+}
+
+/* Like Linux, the last close of a block device writes it back */
+static int blk_dev_close(struct file *file)
+{
+    return blk_dev_fsync(file);
+}
+
+static int blk_dev_fstat(struct file *file, struct stat *stat)
+{
+    const struct blk_dev *dev = file->driver_data;
+    stat->st_mode = S_IFBLK | 0660;
+    stat->st_nlink = 1;
+    stat->st_size = (off_t) ((uint64_t) dev->block_cnt * BLK_SIZE);
+    stat->st_blksize = BLK_SIZE;
+    stat->st_blocks = (blkcnt_t) dev->block_cnt * BLK_SECTORS;
+    return 0;
+}
+
+static struct dev_ops blk_dev_ops = {
+        .type   = S_IFBLK,
+        .close  = blk_dev_close,
+        .read   = blk_dev_read,
+        .write  = blk_dev_write,
+        .pread  = blk_dev_pread,
+        .pwrite = blk_dev_pwrite,
+        .fstat  = blk_dev_fstat,
+        .fsync  = blk_dev_fsync,
+};
+
+/* ------------------------------------------------------------
+ * Devices
+ * ------------------------------------------------------------ */
+
+struct blk_dev *blk_register(const char *name, uint32_t block_cnt, const struct blk_ops *ops, void *driver_data)
+{
+    if (blk.dev_cnt == BLK_MAX_DEVS || block_cnt == 0)
+    {
+        return NULL;
+    }
+
+    if (!blk.bounce[0])
+    {
+        for (uint32_t i = 0; i < BLK_BOUNCE_PAGES; i++)
+        {
+            uintptr_t pa = mm_frame_alloc();
+            if (!pa)
+            {
+                panic("blk_register: no bounce frames");
+            }
+            blk.bounce[i] = mm_pa_to_kva(pa);
+        }
+    }
+
+    struct blk_dev *dev = &blk.devs[blk.dev_cnt];
+    k_memset(dev, 0, sizeof(*dev));
+    k_strncpy(dev->name, name, sizeof(dev->name) - 1);
+    dev->block_cnt = block_cnt;
+    dev->ops = ops;
+    dev->driver_data = driver_data;
+    k_strcpy(dev->stat.name, dev->name);
+    dev->stat.blocks = block_cnt;
+    pcache_mapping_init(&dev->mapping, dev, &blk_pcache_ops, NULL, (uint64_t) block_cnt * BLK_SIZE);
+
+    if (dev_register(dev->name, &blk_dev_ops, dev) < 0)
+    {
+        return NULL;
+    }
+
+    blk.dev_cnt++;
+    kprintf("blk: %s, %u KiB\n", dev->name, block_cnt * (BLK_SIZE / 1024));
+    return dev;
+}
+
+void *blk_driver_data(const struct blk_dev *dev)
+{
+    return dev->driver_data;
+}
+
+struct blk_dev *blk_find(const char *name)
+{
+    for (uint32_t i = 0; i < blk.dev_cnt; i++)
+    {
+        if (k_strcmp(blk.devs[i].name, name) == 0)
+        {
+            return &blk.devs[i];
+        }
+    }
+    return NULL;
+}
+
+struct pcache_mapping *blk_mapping(struct blk_dev *dev)
+{
+    return &dev->mapping;
+}
+
+bool blk_stat(uint32_t idx, struct blk_stat *stat)
+{
+    if (idx >= blk.dev_cnt)
+    {
+        return false;
+    }
+
+    *stat = blk.devs[idx].stat;
+    return true;
+}
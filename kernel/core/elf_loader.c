@@ -1,6 +1,9 @@
 #include "kernel/kutils.h"
 #include "kernel/console.h"
 #include "kernel/elf_loader.h"
+#include "kernel/mm.h"
+
+#define PAGE_SIZE 4096u
 
 bool is_elf(const Elf32_Ehdr *elf_header)
 {
@@ -10,45 +13,94 @@ bool is_elf(const Elf32_Ehdr *elf_header)
            elf_header->e_ident[3] == 'F';
 }
 
-int elf_load(const void *image, struct elf_info *elf_info)
+/* Largest number of program headers we read */
+#define ELF_MAX_PHDRS 16
+
+/* Copy the file backed part of a segment mm_map_image just committed */
+static int elf_fill_segment(const struct embedded_bin *bin, struct mm *mm, const Elf32_Phdr *phdr)
 {
-    const Elf32_Ehdr *ehdr = (const Elf32_Ehdr *) image;
+    uintptr_t va = phdr->p_vaddr;
+    uintptr_t file_end = va + phdr->p_filesz;
+    while (va < file_end)
+    {
+        uintptr_t page_va = va & ~(uintptr_t) (PAGE_SIZE - 1);
+        size_t chunk = page_va + PAGE_SIZE - va;
+        if (chunk > file_end - va)
+        {
+            chunk = file_end - va;
+        }
+
+        uintptr_t pa;
+        if (!mm_get_page(mm, page_va, &pa))
+        {
+            return -1;
+        }
+
+        uint8_t *dst = (uint8_t *) mm_pa_to_kva(pa) + (va - page_va);
+        size_t pos = phdr->p_offset + (va - phdr->p_vaddr);
+        if (bin_pread(bin, dst, chunk, pos) != (ssize_t) chunk)
+        {
+            return -1;
+        }
+        va += chunk;
+    }
+    return 0;
+}
+
+int elf_load(const struct embedded_bin *bin, struct mm *mm, struct elf_info *elf_info)
+{
+    Elf32_Ehdr ehdr;
+    if (bin_pread(bin, &ehdr, sizeof(ehdr), 0) != (ssize_t) sizeof(ehdr))
+    {
+        return -1;
+    }
 
     // A sanity check to ensure we are loading an actual program and not garbage.
-    if (!is_elf(ehdr))
+    if (!is_elf(&ehdr))
     {
         return -1;
     }
 
     // it needs to be an executable.
-    if (ehdr->e_type != ET_EXEC)
+    if (ehdr.e_type != ET_EXEC)
     {
         return -1;
     }
 
-    const Elf32_Phdr *phdr = (const Elf32_Phdr *) ((uintptr_t) image + ehdr->e_phoff);
+    if (ehdr.e_phnum > ELF_MAX_PHDRS || ehdr.e_phentsize != sizeof(Elf32_Phdr))
+    {
+        return -1;
+    }
+
+    Elf32_Phdr phdrs[ELF_MAX_PHDRS];
+    size_t phdrs_size = ehdr.e_phnum * sizeof(Elf32_Phdr);
+    if (bin_pread(bin, phdrs, phdrs_size, ehdr.e_phoff) != (ssize_t) phdrs_size)
+    {
+        return -1;
+    }
 
     uint32_t max_end = 0;
     uint32_t size = 0;
 
-    for (int i = 0; i < ehdr->e_phnum; i++, phdr++)
+    for (int i = 0; i < ehdr.e_phnum; i++)
     {
-        if (phdr->p_type != PT_LOAD)
+        const Elf32_Phdr *phdr = &phdrs[i];
+        // bin.ld always emits the data segment, binaries without data get an empty one.
+        if (phdr->p_type != PT_LOAD || phdr->p_memsz == 0)
         {
             continue;
         }
 
-        uint32_t dest_va = phdr->p_vaddr;
-        const void *src = (const void *) ((uintptr_t) image + phdr->p_offset);
+        // Segments get their own VMA; the .bss part is zero and committed on use.
+        uint32_t flags = 0;
+        if (phdr->p_flags & PF_R) flags |= VMA_READ;
+        if (phdr->p_flags & PF_W) flags |= VMA_WRITE;
+        if (phdr->p_flags & PF_X) flags |= VMA_EXEC;
 
-        k_memcpy((void *) dest_va, src, phdr->p_filesz);
-        if (phdr->p_memsz > phdr->p_filesz)
+        if (mm_map_image(mm, phdr->p_vaddr, phdr->p_memsz, phdr->p_filesz, flags) < 0 ||
+            elf_fill_segment(bin, mm, phdr) < 0)
         {
-            // this is for .bss section which doesn't take size on disk, but we do need to
-            // allocate size for it in memory and we also need to zero it.
-            void *dst = (void *) (dest_va + phdr->p_filesz);
-            uint32_t len = phdr->p_memsz - phdr->p_filesz;
-            k_memset(dst, 0, len);
+            return -1;
         }
 
         uint32_t end = phdr->p_vaddr + phdr->p_memsz;
@@ -63,7 +115,7 @@ int elf_load(const void *image, struct elf_info *elf_info)
     if (elf_info)
     {
         elf_info->base_va = 0;
-        elf_info->entry_va = ehdr->e_entry;
+        elf_info->entry_va = ehdr.e_entry;
         elf_info->max_offset = max_end;
         elf_info->size = size;
         elf_info->environ_off = 0;
@@ -72,4 +124,3 @@ int elf_load(const void *image, struct elf_info *elf_info)
 
     return 0;
 }
-
@@ -0,0 +1,184 @@
+// frame_alloc.c
+//
+// Physical frame allocator for memory that is not statically owned by the
+// kernel image or a task slot. Frames are handed out from a bump pointer
+// first; freed frames go on an intrusive free list whose link lives in the
+// first word of the free frame itself (accessed through the physmap).
+//
+// Every frame has a 16-bit reference count so it can be mapped by several
+// address spaces (copy-on-write sharing); the counts live in an array carved
+// from the start of the managed range. mm_frame_free drops a reference and
+// only releases the frame when the last one is gone.
+//
+// Frames that must be zero are taken from a pool of pre-zeroed frames first.
+// The idle task refills that pool with non-temporal stores so the zeroing
+// doesn't happen on the fault/exec critical path nor pollutes the cache.
+
+#include <stdint.h>
+#include "kernel/mm.h"
+#include "kernel/kutils.h"
+
+#define FRAME_SIZE 4096u
+
+/* Pre-zeroed frames kept in reserve (1 MiB) */
+#define ZERO_POOL_SIZE 256u
+
+struct frame_allocator
+{
+    /* Per-frame reference counts, indexed from map_pa */
+    uint16_t *refs;
+    uintptr_t map_pa;
+    uintptr_t start_pa;
+    uintptr_t end_pa;
+    /* Never-used frames are carved from here */
+    uintptr_t bump_pa;
+    /* Singly linked list of freed frames (0 terminated) */
+    uintptr_t free_head;
+    uint32_t free_cnt;
+};
+
+struct zero_pool
+{
+    uintptr_t frames[ZERO_POOL_SIZE];
+    uint32_t cnt;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+static struct frame_allocator frames;
+static struct zero_pool zero_pool;
+
+static inline uint16_t *frame_refs(uintptr_t pa)
+{
+    return &frames.refs[(pa - frames.map_pa) / FRAME_SIZE];
+}
+
+void mm_frames_init(uintptr_t start_pa, uintptr_t end_pa)
+{
+    frames.map_pa = align_up(start_pa, FRAME_SIZE);
+    frames.end_pa = end_pa & ~(FRAME_SIZE - 1);
+
+    uint32_t frame_cnt = (frames.end_pa - frames.map_pa) / FRAME_SIZE;
+    size_t map_size = align_up(frame_cnt * sizeof(uint16_t), FRAME_SIZE);
+    frames.refs = mm_pa_to_kva(frames.map_pa);
+    k_memset(frames.refs, 0, map_size);
+
+    frames.start_pa = frames.map_pa + map_size;
+    frames.bump_pa = frames.start_pa;
+    frames.free_head = 0;
+    frames.free_cnt = 0;
+}
+
+uintptr_t mm_frame_alloc(void)
+{
+    if (frames.free_head != 0)
+    {
+        uintptr_t pa = frames.free_head;
+        frames.free_head = *(uintptr_t *) mm_pa_to_kva(pa);
+        frames.free_cnt--;
+        *frame_refs(pa) = 1;
+        return pa;
+    }
+
+    if (frames.bump_pa < frames.end_pa)
+    {
+        uintptr_t pa = frames.bump_pa;
+        frames.bump_pa += FRAME_SIZE;
+        *frame_refs(pa) = 1;
+        return pa;
+    }
+
+    /* Out of dirty frames; the zeroed reserve still counts as free memory (refs stay 1) */
+    if (zero_pool.cnt > 0)
+    {
+        return zero_pool.frames[--zero_pool.cnt];
+    }
+
+    return 0;
+}
+
+uintptr_t mm_frame_alloc_zeroed(void)
+{
+    if (zero_pool.cnt > 0)
+    {
+        zero_pool.hits++;
+        return zero_pool.frames[--zero_pool.cnt];
+    }
+
+    zero_pool.misses++;
+    uintptr_t pa = mm_frame_alloc();
+    if (pa != 0)
+    {
+        mm_clear_page(mm_pa_to_kva(pa));
+    }
+    return pa;
+}
+
+bool mm_zero_pool_fill_one(void)
+{
+    if (zero_pool.cnt == ZERO_POOL_SIZE)
+    {
+        return false;
+    }
+
+    uintptr_t pa = mm_frame_alloc();
+    if (pa == 0)
+    {
+        return false;
+    }
+
+    mm_clear_page_nt(mm_pa_to_kva(pa));
+    zero_pool.frames[zero_pool.cnt++] = pa;
+    return true;
+}
+
+uint32_t mm_frames_free(void)
+{
+    return frames.free_cnt + (frames.end_pa - frames.bump_pa) / FRAME_SIZE + zero_pool.cnt;
+}
+
+void mm_frames_stat(struct mm_stat *stat)
+{
+    stat->free_pages = mm_frames_free();
+    stat->zero_pool_hits = zero_pool.hits;
+    stat->zero_pool_misses = zero_pool.misses;
+    stat->zero_pool_pages = zero_pool.cnt;
+}
+
+static void frame_check(uintptr_t pa, char *msg)
+{
+    if (pa < frames.start_pa || pa >= frames.end_pa || (pa & (FRAME_SIZE - 1)) != 0 ||
+        *frame_refs(pa) == 0)
+    {
+        panic(msg);
+    }
+}
+
+void mm_frame_get(uintptr_t pa)
+{
+    frame_check(pa, "mm_frame_get: invalid frame");
+    if (*frame_refs(pa) == UINT16_MAX)
+    {
+        panic("mm_frame_get: reference count overflow");
+    }
+    (*frame_refs(pa))++;
+}
+
+uint32_t mm_frame_refs(uintptr_t pa)
+{
+    frame_check(pa, "mm_frame_refs: invalid frame");
+    return *frame_refs(pa);
+}
+
+void mm_frame_free(uintptr_t pa)
+{
+    frame_check(pa, "mm_frame_free: invalid frame");
+    if (--(*frame_refs(pa)) > 0)
+    {
+        return;
+    }
+
+    *(uintptr_t *) mm_pa_to_kva(pa) = frames.free_head;
+    frames.free_head = pa;
+    frames.free_cnt++;
+}
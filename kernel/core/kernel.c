@@ -13,6 +13,13 @@
 #include "kernel/clock.h"
 #include "kernel/mm.h"
 #include "kernel/dev.h"
+#include "kernel/pcache.h"
+#include "kernel/ata.h"
+#include "kernel/pci.h"
+#include "kernel/virtio_blk.h"
+#include "kernel/swap.h"
+#include "kernel/elf_loader.h"
+#include "kernel/boot.h"
 
 extern uint8_t __bss_start;
 extern uint8_t __bss_end;
@@ -27,9 +34,9 @@ static void bss_zero(void)
     }
 }
 
-/* Kernel entry point */
+/* Kernel entry point; boot_magic and boot_info_pa are what the boot loader left in eax and ebx */
 __attribute__((noreturn, section(".start")))
-void kmain(void)
+void kmain(uint32_t boot_magic, uint32_t boot_info_pa)
 {
     // *(volatile uint16_t*)0xB8000 = 0x1F4B;  // 'K'
 
@@ -38,6 +45,7 @@ void kmain(void)
 //    k_cpu_ctx->esp = KERNEL_STACK_TOP_VA;
 
     bss_zero();
+    boot_init(boot_magic, boot_info_pa);
 
     console_init(&kconsole);
 
@@ -51,6 +59,15 @@ void kmain(void)
     mm_init();
 
     dev_init();
+    pcache_init();
+
+    kprintf("Init ATA.\n");
+    ata_init();
+    swap_init();
+
+    kprintf("Init PCI.\n");
+    pci_init();
+    virtio_blk_init();
 
     kprintf("Init VFS.\n");
     vfs_init(&vfs);
@@ -58,7 +75,15 @@ void kmain(void)
     vfs_mount("/sys", &sys_fs);
     vfs_mount("/proc", &proc_fs);
     vfs_mount("/dev", &dev_fs);
+    vfs_mount("/dev/shm", &shm_fs);
+    bin_fs_init();
     vfs_mount("/bin", &bin_fs);
+    tmp_fs_init();
+    vfs_mount("/tmp", &tmp_fs);
+    if (ext2_fs_init("vdb") == 0)
+    {
+        vfs_mount("/mnt", &ext2_fs);
+    }
 
 
     kprintf("Init TTYs.\n");
@@ -0,0 +1,334 @@
+// ksm.c
+//
+// Same-page merging. Init starts a shell per tty and each shell is a private
+// copy of the same image, so many user pages have identical contents. A
+// scanner running from the idle task hashes candidate pages and merges
+// identical ones into a single frame that is mapped copy-on-write.
+//
+// Candidates are pages of read-only VMAs and writable pages that were never
+// written (PTE dirty bit clear), e.g. data pages nobody touched since exec.
+//
+// Like Linux KSM there are two tables, both hashed on the page contents:
+//
+//   stable    frames that are already shared. The table holds a reference of
+//             its own, so a frame can't be freed and reused behind its back,
+//             and the contents never change since every mapping is
+//             read-only. Frames nobody else maps any more are dropped at the
+//             end of a sweep.
+//   unstable  candidates seen during the current sweep. An entry can go stale
+//             at any moment, so it is revalidated and compared byte for byte
+//             before a merge. The table is emptied at the end of a sweep.
+//
+// The scanner only runs when nothing is runnable, looks at a bounded number
+// of pages per pass and sleeps KSM_SLEEP_MS between passes.
+
+#include <stdint.h>
+#include "kernel/ksm.h"
+#include "kernel/mm.h"
+#include "kernel/sched.h"
+#include "kernel/clock.h"
+#include "kernel/kutils.h"
+
+#define PAGE_SIZE           4096u
+
+#define KSM_NODES_MAX       2048u
+#define KSM_BUCKETS         512u    /* power of 2 */
+#define KSM_PAGES_PER_PASS  64u
+#define KSM_SLEEP_MS        20u
+
+struct ksm_node
+{
+    struct ksm_node *next;
+    uint32_t hash;
+    /* Stable: the shared frame */
+    uintptr_t pa;
+    /* Unstable: where the candidate was seen */
+    struct mm *mm;
+    uintptr_t va;
+};
+
+struct ksm_table
+{
+    struct ksm_node *buckets[KSM_BUCKETS];
+    uint32_t cnt;
+};
+
+struct ksm
+{
+    struct ksm_node nodes[KSM_NODES_MAX];
+    struct ksm_node *free_nodes;
+    bool initialized;
+
+    struct ksm_table stable;
+    struct ksm_table unstable;
+
+    struct mm_sweep sweep;
+    uint64_t last_pass_ms;
+
+    uint64_t pages_scanned;
+};
+
+static struct ksm ksm;
+
+/* ------------------------------------------------------------
+ * Tables
+ * ------------------------------------------------------------ */
+
+static void ksm_init(void)
+{
+    ksm.free_nodes = NULL;
+    for (uint32_t i = 0; i < KSM_NODES_MAX; i++)
+    {
+        ksm.nodes[i].next = ksm.free_nodes;
+        ksm.free_nodes = &ksm.nodes[i];
+    }
+    ksm.initialized = true;
+}
+
+static struct ksm_node *node_alloc(void)
+{
+    struct ksm_node *node = ksm.free_nodes;
+    if (node)
+    {
+        ksm.free_nodes = node->next;
+        k_memset(node, 0, sizeof(*node));
+    }
+    return node;
+}
+
+static void node_free(struct ksm_node *node)
+{
+    node->next = ksm.free_nodes;
+    ksm.free_nodes = node;
+}
+
+static void table_insert(struct ksm_table *table, struct ksm_node *node)
+{
+    struct ksm_node **bucket = &table->buckets[node->hash & (KSM_BUCKETS - 1)];
+    node->next = *bucket;
+    *bucket = node;
+    table->cnt++;
+}
+
+/* ------------------------------------------------------------
+ * Merging
+ * ------------------------------------------------------------ */
+
+/* FNV-1a over 32-bit words */
+static uint32_t page_hash(const void *page)
+{
+    const uint32_t *words = page;
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++)
+    {
+        hash = (hash ^ words[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static bool is_candidate(struct mm *mm, const struct vma *vma, uintptr_t va, uintptr_t *out_pa)
+{
+    /* Same set of VMAs as mm_sweep_next visits; matters for stale unstable entries */
+    if (vma->type != VMA_TYPE_IMAGE && vma->type != VMA_TYPE_ANON && vma->type != VMA_TYPE_HEAP)
+    {
+        return false;
+    }
+
+    uint32_t state = mm_page_state(mm, va);
+    if (!(state & MM_PAGE_PRESENT) || (state & MM_PAGE_COW))
+    {
+        return false;
+    }
+    if ((vma->flags & VMA_WRITE) && (state & MM_PAGE_DIRTY))
+    {
+        return false;
+    }
+    return mm_get_page(mm, va, out_pa);
+}
+
+/* Replace the private frame pa behind va by the shared frame */
+static void merge_page(struct mm *mm, const struct vma *vma, uintptr_t va, uintptr_t pa, uintptr_t shared_pa)
+{
+    mm_frame_get(shared_pa);
+    if (!mm_map_page_cow(mm, va, shared_pa, vma->flags))
+    {
+        mm_frame_free(shared_pa);
+        return;
+    }
+    mm_frame_free(pa);
+}
+
+/* Find a valid unstable twin of page; it is unlinked from the table */
+static struct ksm_node *unstable_take_twin(uint32_t hash, const void *page, uintptr_t pa,
+                                           struct vma **out_vma, uintptr_t *out_pa)
+{
+    struct ksm_node **link = &ksm.unstable.buckets[hash & (KSM_BUCKETS - 1)];
+    for (; *link; link = &(*link)->next)
+    {
+        struct ksm_node *node = *link;
+        if (node->hash != hash)
+        {
+            continue;
+        }
+
+        struct vma *vma = mm_find_vma(node->mm, node->va);
+        uintptr_t other_pa;
+        if (!vma || !is_candidate(node->mm, vma, node->va, &other_pa) || other_pa == pa ||
+            k_memcmp(page, mm_pa_to_kva(other_pa), PAGE_SIZE) != 0)
+        {
+            continue;
+        }
+
+        *link = node->next;
+        ksm.unstable.cnt--;
+        *out_vma = vma;
+        *out_pa = other_pa;
+        return node;
+    }
+    return NULL;
+}
+
+static void scan_page(struct mm *mm, const struct vma *vma, uintptr_t va)
+{
+    uintptr_t pa;
+    if (!is_candidate(mm, vma, va, &pa))
+    {
+        return;
+    }
+
+    const void *page = mm_pa_to_kva(pa);
+    uint32_t hash = page_hash(page);
+    ksm.pages_scanned++;
+
+    /* Already shared by others? */
+    for (struct ksm_node *node = ksm.stable.buckets[hash & (KSM_BUCKETS - 1)]; node; node = node->next)
+    {
+        if (node->hash == hash && k_memcmp(page, mm_pa_to_kva(node->pa), PAGE_SIZE) == 0)
+        {
+            merge_page(mm, vma, va, pa, node->pa);
+            return;
+        }
+    }
+
+    /* Seen a twin during this sweep? Its frame becomes the shared one */
+    struct vma *other_vma;
+    uintptr_t other_pa;
+    struct ksm_node *node = unstable_take_twin(hash, page, pa, &other_vma, &other_pa);
+    if (node)
+    {
+        mm_frame_get(other_pa);
+        mm_map_page_cow(node->mm, node->va, other_pa, other_vma->flags);
+        node->pa = other_pa;
+        node->mm = NULL;
+        node->va = 0;
+        table_insert(&ksm.stable, node);
+
+        merge_page(mm, vma, va, pa, other_pa);
+        return;
+    }
+
+    node = node_alloc();
+    if (node)
+    {
+        node->hash = hash;
+        node->mm = mm;
+        node->va = va;
+        table_insert(&ksm.unstable, node);
+    }
+}
+
+/* A sweep completed: forget the candidates, drop frames nobody shares any more */
+static void end_round(void)
+{
+    for (uint32_t b = 0; b < KSM_BUCKETS; b++)
+    {
+        struct ksm_node *node = ksm.unstable.buckets[b];
+        while (node)
+        {
+            struct ksm_node *next = node->next;
+            node_free(node);
+            node = next;
+        }
+        ksm.unstable.buckets[b] = NULL;
+
+        struct ksm_node **link = &ksm.stable.buckets[b];
+        while (*link)
+        {
+            node = *link;
+            if (mm_frame_refs(node->pa) > 1)
+            {
+                link = &node->next;
+                continue;
+            }
+
+            *link = node->next;
+            ksm.stable.cnt--;
+            mm_frame_free(node->pa);
+            node_free(node);
+        }
+    }
+    ksm.unstable.cnt = 0;
+}
+
+/* ------------------------------------------------------------
+ * Public API
+ * ------------------------------------------------------------ */
+
+void ksm_scan(void)
+{
+    if (!ksm.initialized)
+    {
+        ksm_init();
+    }
+
+    struct timespec ts;
+    kclock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now_ms = (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+    if (now_ms - ksm.last_pass_ms < KSM_SLEEP_MS)
+    {
+        return;
+    }
+    ksm.last_pass_ms = now_ms;
+
+    /* Stop as soon as a task became runnable */
+    for (uint32_t i = 0; i < KSM_PAGES_PER_PASS && sched.run_queue.len == 0; i++)
+    {
+        uint32_t rounds = ksm.sweep.rounds;
+        struct mm *mm;
+        struct vma *vma;
+        uintptr_t va;
+        if (!mm_sweep_next(&ksm.sweep, &mm, &vma, &va))
+        {
+            break;
+        }
+
+        if (ksm.sweep.rounds != rounds)
+        {
+            end_round();
+        }
+        scan_page(mm, vma, va);
+    }
+}
+
+void ksm_stat(struct ksm_stat *stat)
+{
+    k_memset(stat, 0, sizeof(*stat));
+
+    for (uint32_t b = 0; b < KSM_BUCKETS; b++)
+    {
+        for (struct ksm_node *node = ksm.stable.buckets[b]; node; node = node->next)
+        {
+            /* One reference is the table's own */
+            uint32_t mappings = mm_frame_refs(node->pa) - 1;
+            if (mappings > 0)
+            {
+                stat->pages_shared++;
+                stat->pages_sharing += mappings - 1;
+            }
+        }
+    }
+
+    stat->pages_unshared = ksm.unstable.cnt;
+    stat->pages_scanned = ksm.pages_scanned;
+    stat->full_scans = ksm.sweep.rounds;
+}
@@ -0,0 +1,136 @@
+// kstack.c
+//
+// Task kernel stacks. Every task slot owns a fixed range in the kernel stack
+// area: an unmapped guard page followed by KERNEL_STACK_SIZE bytes that are
+// backed by frames while the slot is in use. An overflow runs into the guard
+// page instead of silently overwriting whatever lies below the stack.
+//
+// A new stack is filled with a pattern. The lowest word that no longer holds
+// it shows how deep the stack was ever used, which is what KERNEL_STACK_SIZE
+// should be sized after.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "kernel/kstack.h"
+#include "kernel/mm.h"
+#include "kernel/constants.h"
+#include "kernel/kutils.h"
+
+#define PAGE_SIZE           4096u
+#define KSTACK_SLOT_SIZE    (KERNEL_STACK_GUARD + KERNEL_STACK_SIZE)
+#define KSTACK_PATTERN      0x57ac57acu
+
+struct kstacks
+{
+    bool in_use[MAX_PROCESS_CNT];
+    uint32_t cnt;
+    /* Deepest use of a stack that was freed */
+    uint32_t max_used;
+};
+
+static struct kstacks kstacks;
+
+static inline uintptr_t slot_base(uint32_t slot)
+{
+    return KERNEL_STACK_AREA_VA + slot * KSTACK_SLOT_SIZE + KERNEL_STACK_GUARD;
+}
+
+static void unmap_stack(uintptr_t base, uintptr_t end)
+{
+    for (uintptr_t va = base; va < end; va += PAGE_SIZE)
+    {
+        uintptr_t pa = mm_unmap_page(mm_kernel(), va);
+        if (pa)
+        {
+            mm_frame_free(pa);
+        }
+    }
+}
+
+void kstack_init(void)
+{
+    mm_kernel_reserve(KERNEL_STACK_AREA_VA, MAX_PROCESS_CNT * KSTACK_SLOT_SIZE);
+}
+
+uintptr_t kstack_alloc(uint32_t slot)
+{
+    if (slot >= MAX_PROCESS_CNT || kstacks.in_use[slot])
+    {
+        panic("kstack_alloc: invalid slot");
+    }
+
+    uintptr_t base = slot_base(slot);
+    for (uintptr_t va = base; va < base + KERNEL_STACK_SIZE; va += PAGE_SIZE)
+    {
+        /* Stacks can't be faulted in, so every page is backed up front */
+        uintptr_t pa = mm_frame_alloc();
+        if (!pa || !mm_map_page(mm_kernel(), va, pa, VMA_READ | VMA_WRITE))
+        {
+            if (pa)
+            {
+                mm_frame_free(pa);
+            }
+            unmap_stack(base, va);
+            return 0;
+        }
+    }
+
+    uint32_t *words = (uint32_t *) base;
+    for (uint32_t i = 0; i < KERNEL_STACK_SIZE / sizeof(uint32_t); i++)
+    {
+        words[i] = KSTACK_PATTERN;
+    }
+
+    kstacks.in_use[slot] = true;
+    kstacks.cnt++;
+    return base;
+}
+
+uint32_t kstack_used(uintptr_t base)
+{
+    const uint32_t *words = (const uint32_t *) base;
+    uint32_t untouched = 0;
+    while (untouched < KERNEL_STACK_SIZE / sizeof(uint32_t) && words[untouched] == KSTACK_PATTERN)
+    {
+        untouched++;
+    }
+    return KERNEL_STACK_SIZE - untouched * (uint32_t) sizeof(uint32_t);
+}
+
+void kstack_free(uintptr_t base)
+{
+    uint32_t slot = (uint32_t) ((base - KERNEL_STACK_AREA_VA) / KSTACK_SLOT_SIZE);
+    if (base < KERNEL_STACK_AREA_VA || slot >= MAX_PROCESS_CNT || base != slot_base(slot) ||
+        !kstacks.in_use[slot])
+    {
+        panic("kstack_free: invalid stack");
+    }
+
+    uint32_t used = kstack_used(base);
+    if (used > kstacks.max_used)
+    {
+        kstacks.max_used = used;
+    }
+
+    unmap_stack(base, base + KERNEL_STACK_SIZE);
+    kstacks.in_use[slot] = false;
+    kstacks.cnt--;
+}
+
+void kstack_stat(struct kstack_stat *stat)
+{
+    stat->stacks = kstacks.cnt;
+    stat->max_used = kstacks.max_used;
+
+    for (uint32_t slot = 0; slot < MAX_PROCESS_CNT; slot++)
+    {
+        if (kstacks.in_use[slot])
+        {
+            uint32_t used = kstack_used(slot_base(slot));
+            if (used > stat->max_used)
+            {
+                stat->max_used = used;
+            }
+        }
+    }
+}
@@ -42,6 +42,20 @@ void *k_memmove(void *dest, const void *src, size_t n)
     return dest;
 }
 
+int k_memcmp(const void *a, const void *b, size_t n)
+{
+    const unsigned char *p = a;
+    const unsigned char *q = b;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (p[i] != q[i])
+        {
+            return p[i] - q[i];
+        }
+    }
+    return 0;
+}
+
 void *k_memset(void *dest, int value, size_t n)
 {
     unsigned char *d = dest;
@@ -0,0 +1,97 @@
+// lz4.c
+//
+// LZ4 block decoder. A block is a series of sequences:
+//
+//   token      high nibble: literal length, low nibble: match length - 4;
+//              a nibble of 15 continues in bytes of 255 plus a final byte
+//   literals
+//   offset     16 bit little endian distance back into the output
+//   match
+//
+// The last sequence of a block has literals only. Every length and offset
+// is checked, so a corrupt block fails instead of writing out of bounds.
+
+#include <stdbool.h>
+#include "kernel/lz4.h"
+#include "kernel/kutils.h"
+
+#define LZ4_MIN_MATCH 4
+
+/* Extend a length nibble of 15 with the bytes that follow; false when src runs out */
+static bool read_length(const uint8_t **src, const uint8_t *src_end, size_t *len)
+{
+    uint8_t b;
+    do
+    {
+        if (*src >= src_end)
+        {
+            return false;
+        }
+        b = *(*src)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+int lz4_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_cap)
+{
+    const uint8_t *src_end = src + src_len;
+    uint8_t *out = dst;
+    uint8_t *out_end = dst + dst_cap;
+
+    while (src < src_end)
+    {
+        uint8_t token = *src++;
+
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && !read_length(&src, src_end, &lit_len))
+        {
+            return -1;
+        }
+        if (lit_len > (size_t) (src_end - src) || lit_len > (size_t) (out_end - out))
+        {
+            return -1;
+        }
+        k_memcpy(out, src, lit_len);
+        src += lit_len;
+        out += lit_len;
+
+        /* The last sequence ends after its literals */
+        if (src == src_end)
+        {
+            break;
+        }
+
+        if (src_end - src < 2)
+        {
+            return -1;
+        }
+        size_t offset = (size_t) src[0] | ((size_t) src[1] << 8);
+        src += 2;
+        if (offset == 0 || offset > (size_t) (out - dst))
+        {
+            return -1;
+        }
+
+        size_t match_len = token & 0xf;
+        if (match_len == 15 && !read_length(&src, src_end, &match_len))
+        {
+            return -1;
+        }
+        match_len += LZ4_MIN_MATCH;
+        if (match_len > (size_t) (out_end - out))
+        {
+            return -1;
+        }
+
+        /* Byte by byte: the match may overlap the bytes it produces */
+        const uint8_t *match = out - offset;
+        for (size_t i = 0; i < match_len; i++)
+        {
+            out[i] = match[i];
+        }
+        out += match_len;
+    }
+
+    return (int) (out - dst);
+}
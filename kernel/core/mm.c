@@ -1,22 +1,1142 @@
 #include <stdint.h>
+#include "errno.h"
 #include "kernel/mm.h"
 #include "kernel/sched.h"
+#include "kernel/swap.h"
+#include "kernel/shm.h"
+#include "kernel/kutils.h"
 
-int mm_brk(void *addr)
+#define PAGE_SIZE          4096u
+#define PAGE_ALIGN_DOWN(x) ((x) & ~(PAGE_SIZE - 1))
+#define PAGE_ALIGN_UP(x)   (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+/* VMA pool sizing (power of 2) */
+#define MAX_VMAS_TOTAL (MAX_PROCESS_CNT * MM_MAX_VMAS)
+#define VMA_RING_MASK  (MAX_VMAS_TOTAL - 1)
+
+/* ------------------------------------------------------------
+ * VMA pool
+ * ------------------------------------------------------------ */
+
+struct vma_pool
+{
+    uint32_t free_ring[MAX_VMAS_TOTAL];
+    uint32_t free_head;
+    uint32_t free_tail;
+    bool initialized;
+    struct vma vmas[MAX_VMAS_TOTAL];
+};
+
+static struct vma_pool vma_pool;
+
+static void vma_pool_init(void)
+{
+    vma_pool.free_head = 0;
+    vma_pool.free_tail = MAX_VMAS_TOTAL;
+    for (uint32_t i = 0; i < MAX_VMAS_TOTAL; i++)
+    {
+        vma_pool.free_ring[i] = i;
+    }
+    vma_pool.initialized = true;
+}
+
+struct vma *mm_vma_alloc(void)
+{
+    if (!vma_pool.initialized)
+    {
+        vma_pool_init();
+    }
+
+    if (vma_pool.free_head == vma_pool.free_tail)
+    {
+        return NULL;
+    }
+
+    uint32_t idx = vma_pool.free_ring[vma_pool.free_head & VMA_RING_MASK];
+    vma_pool.free_head++;
+
+    struct vma *vma = &vma_pool.vmas[idx];
+    k_memset(vma, 0, sizeof(*vma));
+    return vma;
+}
+
+void mm_vma_free(struct vma *vma)
+{
+    if (vma_pool.free_tail - vma_pool.free_head == MAX_VMAS_TOTAL)
+    {
+        panic("mm_vma_free: too many frees");
+    }
+
+    uint32_t idx = (uint32_t) (vma - vma_pool.vmas);
+    vma_pool.free_ring[vma_pool.free_tail & VMA_RING_MASK] = idx;
+    vma_pool.free_tail++;
+}
+
+void mm_vma_stat(struct mm_stat *stat)
+{
+    stat->vmas_total = MAX_VMAS_TOTAL;
+    stat->vmas_used = vma_pool.initialized
+                      ? MAX_VMAS_TOTAL - (vma_pool.free_tail - vma_pool.free_head)
+                      : 0;
+}
+
+/* ------------------------------------------------------------
+ * VMA index
+ *
+ * Every mm keeps its VMAs in an array sorted by base_va, so lookups
+ * are a binary search and gap search is a single ordered walk.
+ * ------------------------------------------------------------ */
+
+static inline uintptr_t vma_end(const struct vma *vma)
+{
+    return vma->base_va + vma->length;
+}
+
+/* Index of the first VMA that ends above va (vma_cnt if none) */
+static uint32_t vma_lower_bound(const struct mm *mm, uintptr_t va)
+{
+    uint32_t lo = 0;
+    uint32_t hi = mm->vma_cnt;
+
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (vma_end(mm->vmas[mid]) <= va)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static void vma_index_insert_at(struct mm *mm, uint32_t idx, struct vma *vma)
+{
+    for (uint32_t i = mm->vma_cnt; i > idx; i--)
+    {
+        mm->vmas[i] = mm->vmas[i - 1];
+    }
+    mm->vmas[idx] = vma;
+    mm->vma_cnt++;
+}
+
+static void vma_index_remove_at(struct mm *mm, uint32_t idx)
+{
+    for (uint32_t i = idx; i + 1 < mm->vma_cnt; i++)
+    {
+        mm->vmas[i] = mm->vmas[i + 1];
+    }
+    mm->vma_cnt--;
+}
+
+int mm_vma_insert(struct mm *mm, struct vma *vma)
+{
+    if (mm->vma_cnt >= MM_MAX_VMAS)
+    {
+        return -1;
+    }
+
+    uint32_t idx = vma_lower_bound(mm, vma->base_va);
+    if (idx < mm->vma_cnt && mm->vmas[idx]->base_va < vma_end(vma))
+    {
+        /* overlaps an existing region */
+        return -1;
+    }
+
+    vma_index_insert_at(mm, idx, vma);
+    return 0;
+}
+
+struct vma *mm_find_vma(struct mm *mm, uintptr_t va)
+{
+    uint32_t idx = vma_lower_bound(mm, va);
+    if (idx < mm->vma_cnt && mm->vmas[idx]->base_va <= va)
+    {
+        return mm->vmas[idx];
+    }
+    return NULL;
+}
+
+struct vma *mm_find_vma_by_type(struct mm *mm, uint32_t type)
+{
+    for (uint32_t i = 0; i < mm->vma_cnt; i++)
+    {
+        if (mm->vmas[i]->type == type)
+        {
+            return mm->vmas[i];
+        }
+    }
+    return NULL;
+}
+
+/* Private user memory: backed by owned frames, committed on use */
+static inline bool vma_is_private(const struct vma *vma)
+{
+    return vma->type == VMA_TYPE_IMAGE ||
+           vma->type == VMA_TYPE_ANON ||
+           vma->type == VMA_TYPE_HEAP ||
+           vma->type == VMA_TYPE_STACK;
+}
+
+/* Shared user memory: frames of a shm object, mapped by reference */
+static inline bool vma_is_shared(const struct vma *vma)
+{
+    return vma->type == VMA_TYPE_SHARED;
+}
+
+/* Created by mmap, so munmap and mprotect may change it */
+static inline bool vma_is_mmap(const struct vma *vma)
+{
+    return vma->type == VMA_TYPE_ANON || vma->type == VMA_TYPE_SHARED;
+}
+
+/* Free a VMA that was taken out of the index */
+static void vma_release(struct vma *vma)
+{
+    if (vma_is_shared(vma))
+    {
+        shm_object_put(vma->shm);
+    }
+    mm_vma_free(vma);
+}
+
+static bool vma_can_merge(const struct vma *a, const struct vma *b)
+{
+    return a->type == VMA_TYPE_ANON &&
+           b->type == VMA_TYPE_ANON &&
+           a->flags == b->flags &&
+           vma_end(a) == b->base_va;
+}
+
+/* Merge the VMA at idx with compatible neighbours; returns its new index */
+static uint32_t vma_merge(struct mm *mm, uint32_t idx)
+{
+    if (idx + 1 < mm->vma_cnt && vma_can_merge(mm->vmas[idx], mm->vmas[idx + 1]))
+    {
+        struct vma *next = mm->vmas[idx + 1];
+        mm->vmas[idx]->length += next->length;
+        vma_index_remove_at(mm, idx + 1);
+        mm_vma_free(next);
+    }
+
+    if (idx > 0 && vma_can_merge(mm->vmas[idx - 1], mm->vmas[idx]))
+    {
+        struct vma *cur = mm->vmas[idx];
+        mm->vmas[idx - 1]->length += cur->length;
+        vma_index_remove_at(mm, idx);
+        mm_vma_free(cur);
+        idx--;
+    }
+
+    return idx;
+}
+
+/* Split the VMA at idx so that a VMA boundary exists at va */
+static int vma_split(struct mm *mm, uint32_t idx, uintptr_t va)
+{
+    struct vma *vma = mm->vmas[idx];
+    if (va <= vma->base_va || va >= vma_end(vma))
+    {
+        return 0;
+    }
+
+    if (mm->vma_cnt >= MM_MAX_VMAS)
+    {
+        return -ENOMEM;
+    }
+
+    struct vma *tail = mm_vma_alloc();
+    if (!tail)
+    {
+        return -ENOMEM;
+    }
+
+    *tail = *vma;
+    tail->base_va = va;
+    tail->length = vma_end(vma) - va;
+    vma->length = va - vma->base_va;
+
+    if (vma_is_shared(tail))
+    {
+        tail->pgoff += (uint32_t) ((va - vma->base_va) / PAGE_SIZE);
+        shm_object_get(tail->shm);
+    }
+
+    vma_index_insert_at(mm, idx + 1, tail);
+    return 0;
+}
+
+/* Make sure no VMA straddles start or end */
+static int vma_split_range(struct mm *mm, uintptr_t start, uintptr_t end)
+{
+    uint32_t idx = vma_lower_bound(mm, start);
+    if (idx < mm->vma_cnt)
+    {
+        int res = vma_split(mm, idx, start);
+        if (res < 0)
+        {
+            return res;
+        }
+    }
+
+    idx = vma_lower_bound(mm, end);
+    if (idx < mm->vma_cnt)
+    {
+        return vma_split(mm, idx, end);
+    }
+
+    return 0;
+}
+
+/* Lowest address in [PROCESS_MMAP_BASE, PROCESS_MMAP_TOP) with len free bytes */
+static uintptr_t vma_find_gap(const struct mm *mm, size_t len)
+{
+    uintptr_t candidate = PROCESS_MMAP_BASE;
+
+    for (uint32_t i = vma_lower_bound(mm, candidate); i < mm->vma_cnt; i++)
+    {
+        const struct vma *vma = mm->vmas[i];
+        if (vma->base_va >= candidate + len)
+        {
+            break;
+        }
+        candidate = vma_end(vma);
+    }
+
+    if (candidate + len > PROCESS_MMAP_TOP || candidate + len < candidate)
+    {
+        return 0;
+    }
+
+    return candidate;
+}
+
+static bool vma_range_is_free(const struct mm *mm, uintptr_t start, uintptr_t end)
+{
+    uint32_t idx = vma_lower_bound(mm, start);
+    return idx >= mm->vma_cnt || mm->vmas[idx]->base_va >= end;
+}
+
+/* True when [start, end) only overlaps VMAs created by mmap */
+static bool vma_range_is_mmap(const struct mm *mm, uintptr_t start, uintptr_t end)
+{
+    for (uint32_t i = vma_lower_bound(mm, start); i < mm->vma_cnt; i++)
+    {
+        const struct vma *vma = mm->vmas[i];
+        if (vma->base_va >= end)
+        {
+            break;
+        }
+        if (!vma_is_mmap(vma))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* ------------------------------------------------------------
+ * User memory
+ * ------------------------------------------------------------ */
+
+static void mm_unmap_pages(struct mm *mm, uintptr_t start, uintptr_t end)
+{
+    for (uintptr_t va = start; va < end; va += PAGE_SIZE)
+    {
+        uint32_t slot;
+        if (mm_get_swap_slot(mm, va, &slot))
+        {
+            swap_slot_free(slot);
+        }
+
+        uintptr_t pa = mm_unmap_page(mm, va);
+        if (pa)
+        {
+            mm_frame_free(pa);
+        }
+    }
+}
+
+static int mm_unmap_range(struct mm *mm, uintptr_t start, uintptr_t end)
+{
+    int res = vma_split_range(mm, start, end);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    uint32_t idx = vma_lower_bound(mm, start);
+    while (idx < mm->vma_cnt && mm->vmas[idx]->base_va < end)
+    {
+        struct vma *vma = mm->vmas[idx];
+        mm_unmap_pages(mm, vma->base_va, vma_end(vma));
+        vma_index_remove_at(mm, idx);
+        vma_release(vma);
+    }
+
+    return 0;
+}
+
+void *mm_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset)
+{
+    struct task *current = sched_current();
+    if (!current)
+    {
+        return (void *) -ESRCH;
+    }
+
+    if (len == 0)
+    {
+        return (void *) -EINVAL;
+    }
+
+    if (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC))
+    {
+        return (void *) -EINVAL;
+    }
+
+    /* Exactly one of MAP_SHARED and MAP_PRIVATE */
+    if (!(flags & MAP_SHARED) == !(flags & MAP_PRIVATE))
+    {
+        return (void *) -EINVAL;
+    }
+
+    /* Shared memory objects are the only files that can be mapped */
+    struct shm_object *shm = NULL;
+    bool may_write = true;
+    if (!(flags & MAP_ANONYMOUS))
+    {
+        struct file *file = files_find_by_fd(&current->files, fd);
+        if (!file)
+        {
+            return (void *) -EBADF;
+        }
+
+        shm = shm_file_object(file);
+        if (!shm)
+        {
+            return (void *) -ENODEV;
+        }
+
+        if (!(flags & MAP_SHARED) || offset < 0 || (offset & (PAGE_SIZE - 1)) != 0)
+        {
+            return (void *) -EINVAL;
+        }
+
+        /* A writable shared mapping writes the object, so the fd must be open for writing */
+        may_write = (file->flags & 3) != O_RDONLY;
+        if ((prot & PROT_WRITE) && !may_write)
+        {
+            return (void *) -EACCES;
+        }
+    }
+
+    struct mm *mm = current->mm;
+    size_t length = PAGE_ALIGN_UP(len);
+    uintptr_t hint = (uintptr_t) addr;
+    uintptr_t start = 0;
+
+    if (length < len)
+    {
+        return (void *) -ENOMEM;
+    }
+
+    if (flags & MAP_FIXED)
+    {
+        if ((hint & (PAGE_SIZE - 1)) != 0 ||
+            hint + length > PROCESS_MMAP_TOP ||
+            hint + length < hint)
+        {
+            return (void *) -EINVAL;
+        }
+
+        if (!vma_range_is_mmap(mm, hint, hint + length))
+        {
+            return (void *) -EINVAL;
+        }
+
+        int res = mm_unmap_range(mm, hint, hint + length);
+        if (res < 0)
+        {
+            return (void *) res;
+        }
+        start = hint;
+    }
+    else
+    {
+        /* A hint outside the mmap area would land near NULL, in the brk range or the stack guard gap */
+        hint &= ~(PAGE_SIZE - 1);
+        if (hint >= PROCESS_MMAP_BASE && hint + length <= PROCESS_MMAP_TOP && hint + length > hint &&
+            vma_range_is_free(mm, hint, hint + length))
+        {
+            start = hint;
+        }
+        else
+        {
+            start = vma_find_gap(mm, length);
+            if (start == 0)
+            {
+                return (void *) -ENOMEM;
+            }
+        }
+    }
+
+    if (mm->vma_cnt >= MM_MAX_VMAS)
+    {
+        return (void *) -ENOMEM;
+    }
+
+    struct vma *vma = mm_vma_alloc();
+    if (!vma)
+    {
+        return (void *) -ENOMEM;
+    }
+
+    vma->base_va = start;
+    vma->base_pa = 0;
+    vma->length = length;
+    vma->flags = (uint32_t) prot | VMA_USER;
+    vma->type = VMA_TYPE_ANON;
+
+    if (flags & MAP_SHARED)
+    {
+        /* Shared anonymous memory is an unnamed object that lives as long as its mappings */
+        uint32_t pgoff = 0;
+        if (shm)
+        {
+            shm_object_get(shm);
+            pgoff = (uint32_t) (offset / PAGE_SIZE);
+        }
+        else if (!(shm = shm_anon_create(length)))
+        {
+            mm_vma_free(vma);
+            return (void *) -ENOMEM;
+        }
+
+        /* An anonymous object is exactly length bytes, so its mapping starts at page 0 whatever offset says */
+        vma->type = VMA_TYPE_SHARED;
+        vma->shm = shm;
+        vma->pgoff = pgoff;
+        if (may_write)
+        {
+            vma->flags |= VMA_MAYWRITE;
+        }
+    }
+
+    /* Pages are populated lazily by mm_handle_fault */
+    if (mm_vma_insert(mm, vma) < 0)
+    {
+        vma_release(vma);
+        return (void *) -ENOMEM;
+    }
+    vma_merge(mm, vma_lower_bound(mm, start));
+
+    return (void *) start;
+}
+
+int mm_munmap(void *addr, size_t len)
+{
+    struct task *current = sched_current();
+    if (!current)
+    {
+        return -ESRCH;
+    }
+
+    uintptr_t start = (uintptr_t) addr;
+    uintptr_t end = start + PAGE_ALIGN_UP(len);
+
+    if ((start & (PAGE_SIZE - 1)) != 0 || len == 0 || end > KERNEL_VA_BASE || end < start)
+    {
+        return -EINVAL;
+    }
+
+    if (!vma_range_is_mmap(current->mm, start, end))
+    {
+        return -EINVAL;
+    }
+
+    return mm_unmap_range(current->mm, start, end);
+}
+
+int mm_mprotect(void *addr, size_t len, int prot)
+{
+    struct task *current = sched_current();
+    if (!current)
+    {
+        return -ESRCH;
+    }
+
+    uintptr_t start = (uintptr_t) addr;
+    uintptr_t end = start + PAGE_ALIGN_UP(len);
+
+    if ((start & (PAGE_SIZE - 1)) != 0 || end > KERNEL_VA_BASE || end < start)
+    {
+        return -EINVAL;
+    }
+
+    if (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC))
+    {
+        return -EINVAL;
+    }
+
+    if (start == end)
+    {
+        return 0;
+    }
+
+    struct mm *mm = current->mm;
+
+    /* The whole range must be backed by mmap VMAs without holes */
+    uintptr_t cursor = start;
+    for (uint32_t i = vma_lower_bound(mm, start); i < mm->vma_cnt && cursor < end; i++)
+    {
+        const struct vma *vma = mm->vmas[i];
+        if (vma->base_va > cursor || !vma_is_mmap(vma))
+        {
+            break;
+        }
+        /* Write access to a shared object was decided by the fd at mmap time */
+        if ((prot & PROT_WRITE) && vma->type == VMA_TYPE_SHARED && !(vma->flags & VMA_MAYWRITE))
+        {
+            return -EACCES;
+        }
+        cursor = vma_end(vma);
+    }
+
+    if (cursor < end)
+    {
+        return -ENOMEM;
+    }
+
+    int res = vma_split_range(mm, start, end);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    uint32_t flags = (uint32_t) prot | VMA_USER;
+    uint32_t idx = vma_lower_bound(mm, start);
+    while (idx < mm->vma_cnt && mm->vmas[idx]->base_va < end)
+    {
+        struct vma *vma = mm->vmas[idx];
+        vma->flags = flags | (vma->flags & VMA_MAYWRITE);
+
+        for (uintptr_t va = vma->base_va; va < vma_end(vma); va += PAGE_SIZE)
+        {
+            mm_protect_page(mm, va, vma->flags);
+        }
+
+        idx = vma_merge(mm, idx) + 1;
+    }
+
+    return 0;
+}
+
+static bool mm_populate_page(struct mm *mm, const struct vma *vma, uintptr_t page_va)
+{
+    uintptr_t pa = swap_frame_alloc(true);
+    if (!pa)
+    {
+        return false;
+    }
+
+    if (!mm_map_page(mm, page_va, pa, vma->flags))
+    {
+        mm_frame_free(pa);
+        return false;
+    }
+
+    return true;
+}
+
+/* Map the frame of the shm object behind page_va; fails past the end of the object */
+static bool mm_populate_shared(struct mm *mm, const struct vma *vma, uintptr_t page_va)
+{
+    uint32_t pgoff = vma->pgoff + (uint32_t) ((page_va - vma->base_va) / PAGE_SIZE);
+    uintptr_t pa = shm_object_page(vma->shm, pgoff);
+    if (!pa)
+    {
+        return false;
+    }
+
+    mm_frame_get(pa);
+    if (!mm_map_page(mm, page_va, pa, vma->flags))
+    {
+        mm_frame_free(pa);
+        return false;
+    }
+
+    return true;
+}
+
+/* Give the mapping its own copy of a copy-on-write frame */
+static bool mm_break_cow(struct mm *mm, const struct vma *vma, uintptr_t page_va, uintptr_t pa)
+{
+    if (mm_frame_refs(pa) == 1)
+    {
+        /* Everybody else let go; take the frame over */
+        return mm_map_page(mm, page_va, pa, vma->flags);
+    }
+
+    uintptr_t copy = swap_frame_alloc(false);
+    if (!copy)
+    {
+        return false;
+    }
+
+    /* Reclaim may have swapped the page out; the retried access sorts that out */
+    uintptr_t cur_pa;
+    if (!mm_get_page(mm, page_va, &cur_pa) || cur_pa != pa)
+    {
+        mm_frame_free(copy);
+        return true;
+    }
+
+    k_memcpy(mm_pa_to_kva(copy), mm_pa_to_kva(pa), PAGE_SIZE);
+    if (!mm_map_page(mm, page_va, copy, vma->flags))
+    {
+        mm_frame_free(copy);
+        return false;
+    }
+
+    mm_frame_free(pa);
+    return true;
+}
+
+bool mm_handle_fault(struct mm *mm, uintptr_t va, bool write)
+{
+    if (!mm || va >= KERNEL_VA_BASE)
+    {
+        return false;
+    }
+
+    struct vma *vma = mm_find_vma(mm, va);
+    if (!vma || !(vma_is_private(vma) || vma_is_shared(vma)))
+    {
+        return false;
+    }
+
+    /* As in pte_set_prot: anything but PROT_NONE is readable on x86 */
+    if (!(vma->flags & (VMA_READ | VMA_WRITE | VMA_EXEC)) || (write && !(vma->flags & VMA_WRITE)))
+    {
+        return false;
+    }
+
+    swap_reclaim_direct();
+
+    uintptr_t page_va = PAGE_ALIGN_DOWN(va);
+    if (vma_is_shared(vma))
+    {
+        /* Shared pages are never swapped or copied; a present one means a violation */
+        uintptr_t pa;
+        return !mm_get_page(mm, page_va, &pa) && mm_populate_shared(mm, vma, page_va);
+    }
+
+    uint32_t slot;
+    if (mm_get_swap_slot(mm, page_va, &slot))
+    {
+        return swap_in(mm, vma, page_va, slot);
+    }
+
+    uintptr_t pa;
+    if (mm_get_page(mm, page_va, &pa))
+    {
+        if (write && (mm_page_state(mm, page_va) & MM_PAGE_COW))
+        {
+            return mm_break_cow(mm, vma, page_va, pa);
+        }
+
+        /* Already populated, so this is a genuine protection violation */
+        return false;
+    }
+
+    return mm_populate_page(mm, vma, page_va);
+}
+
+int mm_dup_user(struct mm *dst, struct mm *src)
+{
+    for (uint32_t i = 0; i < src->vma_cnt; i++)
+    {
+        const struct vma *src_vma = src->vmas[i];
+        if (!vma_is_private(src_vma) && !vma_is_shared(src_vma))
+        {
+            continue;
+        }
+
+        struct vma *vma = mm_vma_alloc();
+        if (!vma)
+        {
+            return -ENOMEM;
+        }
+
+        *vma = *src_vma;
+        if (mm_vma_insert(dst, vma) < 0)
+        {
+            mm_vma_free(vma);
+            return -ENOMEM;
+        }
+
+        if (vma_is_shared(vma))
+        {
+            /* Parent and child map the same frames */
+            shm_object_get(vma->shm);
+            for (uintptr_t va = vma->base_va; va < vma_end(vma); va += PAGE_SIZE)
+            {
+                uintptr_t pa;
+                if (!mm_get_page(src, va, &pa))
+                {
+                    continue;
+                }
+
+                mm_frame_get(pa);
+                if (!mm_map_page(dst, va, pa, vma->flags))
+                {
+                    mm_frame_free(pa);
+                    return -ENOMEM;
+                }
+            }
+            continue;
+        }
+
+        for (uintptr_t va = vma->base_va; va < vma_end(vma); va += PAGE_SIZE)
+        {
+            if (!(mm_page_state(src, va) & (MM_PAGE_PRESENT | MM_PAGE_SWAPPED)))
+            {
+                continue;
+            }
+
+            /* May reclaim, so the source page is looked up afterwards */
+            uintptr_t dst_pa = swap_frame_alloc(false);
+            if (!dst_pa)
+            {
+                return -ENOMEM;
+            }
+
+            uintptr_t src_pa;
+            uint32_t slot;
+            if (mm_get_page(src, va, &src_pa))
+            {
+                k_memcpy(mm_pa_to_kva(dst_pa), mm_pa_to_kva(src_pa), PAGE_SIZE);
+            }
+            else if (!mm_get_swap_slot(src, va, &slot) ||
+                     swap_read_slot(slot, mm_pa_to_kva(dst_pa)) < 0)
+            {
+                mm_frame_free(dst_pa);
+                return -ENOMEM;
+            }
+
+            if (!mm_map_page(dst, va, dst_pa, vma->flags))
+            {
+                mm_frame_free(dst_pa);
+                return -ENOMEM;
+            }
+        }
+    }
+
+    return 0;
+}
+
+void mm_release_user(struct mm *mm)
+{
+    uint32_t idx = 0;
+    while (idx < mm->vma_cnt)
+    {
+        struct vma *vma = mm->vmas[idx];
+        if (!vma_is_private(vma) && !vma_is_shared(vma))
+        {
+            idx++;
+            continue;
+        }
+
+        mm_unmap_pages(mm, vma->base_va, vma_end(vma));
+        vma_index_remove_at(mm, idx);
+        vma_release(vma);
+    }
+
+    mm_free_user_page_tables(mm);
+}
+
+int mm_map_image(struct mm *mm, uintptr_t va, size_t memsz, size_t filesz, uint32_t flags)
+{
+    uintptr_t start = PAGE_ALIGN_DOWN(va);
+    uintptr_t end = PAGE_ALIGN_UP(va + memsz);
+
+    if (memsz == 0 || filesz > memsz || va < PROCESS_VA_BASE || end > PROCESS_MMAP_BASE)
+    {
+        return -ENOEXEC;
+    }
+
+    struct vma *vma = mm_vma_alloc();
+    if (!vma)
+    {
+        return -ENOMEM;
+    }
+
+    vma->base_va = start;
+    vma->length = end - start;
+    vma->flags = flags | VMA_USER;
+    vma->type = VMA_TYPE_IMAGE;
+    if (mm_vma_insert(mm, vma) < 0)
+    {
+        mm_vma_free(vma);
+        return -ENOEXEC;
+    }
+
+    /* Commit zeroed frames for the file backed part; bss pages stay lazy */
+    uintptr_t file_end = va + filesz;
+    for (uintptr_t page_va = start; page_va < PAGE_ALIGN_UP(file_end); page_va += PAGE_SIZE)
+    {
+        if (!mm_populate_page(mm, vma, page_va))
+        {
+            return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+int mm_setup_stack(struct mm *mm)
+{
+    struct vma *vma = mm_vma_alloc();
+    if (!vma)
+    {
+        return -ENOMEM;
+    }
+
+    vma->base_va = PROCESS_STACK_TOP - RLIMIT_STACK;
+    vma->length = RLIMIT_STACK;
+    vma->flags = VMA_READ | VMA_WRITE | VMA_USER;
+    vma->type = VMA_TYPE_STACK;
+    if (mm_vma_insert(mm, vma) < 0)
+    {
+        mm_vma_free(vma);
+        return -ENOMEM;
+    }
+
+    for (uintptr_t va = PROCESS_STACK_TOP - PROCESS_STACK_COMMIT; va < PROCESS_STACK_TOP; va += PAGE_SIZE)
+    {
+        if (!mm_populate_page(mm, vma, va))
+        {
+            return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+void mm_stack_reserve(struct mm *mm, uintptr_t sp)
+{
+    struct vma *vma = mm_find_vma_by_type(mm, VMA_TYPE_STACK);
+    if (!vma || sp <= vma->base_va || sp > vma_end(vma))
+    {
+        return;
+    }
+
+    uintptr_t low = PAGE_ALIGN_DOWN(sp - PROCESS_STACK_MARGIN);
+    if (low < vma->base_va || low > sp)
+    {
+        low = vma->base_va;
+    }
+
+    /* Pages are committed top down, so the lowest one tells if work is needed */
+    uintptr_t pa;
+    for (uintptr_t va = low; va < sp && !mm_get_page(mm, va, &pa); va += PAGE_SIZE)
+    {
+        if (!mm_populate_page(mm, vma, va))
+        {
+            return;
+        }
+    }
+}
+
+int mm_setup_heap(struct mm *mm, uintptr_t start_brk)
+{
+    struct vma *vma = mm_vma_alloc();
+    if (!vma)
+    {
+        return -ENOMEM;
+    }
+
+    vma->base_va = PAGE_ALIGN_UP(start_brk);
+    vma->length = 0;
+    vma->flags = VMA_READ | VMA_WRITE | VMA_USER;
+    vma->type = VMA_TYPE_HEAP;
+    if (mm_vma_insert(mm, vma) < 0)
+    {
+        mm_vma_free(vma);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+int mm_heap_resize(struct mm *mm, uintptr_t end)
+{
+    struct vma *heap = mm_find_vma_by_type(mm, VMA_TYPE_HEAP);
+    if (!heap || end < heap->base_va)
+    {
+        return -EINVAL;
+    }
+
+    uintptr_t old_end = vma_end(heap);
+    uintptr_t new_end = PAGE_ALIGN_UP(end);
+
+    if (new_end < end || new_end > heap->base_va + RLIMIT_DATA)
+    {
+        return -ENOMEM;
+    }
+
+    if (new_end > old_end)
+    {
+        /* The heap may not run into an mmap region */
+        if (!vma_range_is_free(mm, old_end, new_end))
+        {
+            return -ENOMEM;
+        }
+    }
+    else
+    {
+        mm_unmap_pages(mm, new_end, old_end);
+    }
+
+    heap->length = new_end - heap->base_va;
+    return 0;
+}
+
+uintptr_t mm_brk(void *addr)
 {
     struct task *task = sched_current();
     if (!task)
     {
-        return -1;
+        return 0;
     }
 
     uintptr_t new_brk = (uintptr_t) addr;
 
-    if (new_brk > task->brk_limit)
+    if (new_brk == 0 || new_brk > task->brk_limit)
     {
-        return -1;
+        return task->brk;
+    }
+
+    if (mm_heap_resize(task->mm, new_brk) < 0)
+    {
+        return task->brk;
     }
 
     task->brk = new_brk;
-    return 0;
-}
\ No newline at end of file
+    return new_brk;
+}
+
+/* ------------------------------------------------------------
+ * Statistics
+ * ------------------------------------------------------------ */
+
+void mm_stat(struct mm_stat *stat)
+{
+    k_memset(stat, 0, sizeof(*stat));
+    mm_frames_stat(stat);
+    mm_vma_stat(stat);
+    mm_paging_stat(stat);
+}
+
+void mm_vma_usage(const struct mm *mm, const struct vma *vma, struct vma_usage *usage)
+{
+    k_memset(usage, 0, sizeof(*usage));
+    usage->size = vma->length / PAGE_SIZE;
+
+    if (!vma_is_private(vma) && !vma_is_shared(vma))
+    {
+        return;
+    }
+
+    for (uintptr_t va = vma->base_va; va < vma_end(vma); va += PAGE_SIZE)
+    {
+        uint32_t state = mm_page_state(mm, va);
+        if (state & MM_PAGE_SWAPPED)
+        {
+            usage->swap++;
+            continue;
+        }
+        if (!(state & MM_PAGE_PRESENT))
+        {
+            continue;
+        }
+
+        /* A shm frame is also referenced by its object */
+        uintptr_t pa;
+        bool shared = (state & MM_PAGE_COW) ||
+                      (vma_is_shared(vma) && mm_get_page(mm, va, &pa) && mm_frame_refs(pa) > 2);
+
+        usage->rss++;
+        if (shared)
+        {
+            usage->shared++;
+        }
+        if (state & MM_PAGE_DIRTY)
+        {
+            usage->dirty++;
+            if (shared)
+            {
+                usage->shared_dirty++;
+            }
+        }
+        if (state & MM_PAGE_ACCESSED)
+        {
+            usage->referenced++;
+        }
+    }
+}
+
+/* ------------------------------------------------------------
+ * Sweeps
+ * ------------------------------------------------------------ */
+
+static inline bool vma_is_sweepable(const struct vma *vma)
+{
+    return vma_is_private(vma) && vma->type != VMA_TYPE_STACK;
+}
+
+/* First sweepable VMA that ends above va */
+static struct vma *sweep_next_vma(const struct mm *mm, uintptr_t va)
+{
+    for (uint32_t i = vma_lower_bound(mm, va); i < mm->vma_cnt; i++)
+    {
+        struct vma *vma = mm->vmas[i];
+        if (vma_is_sweepable(vma))
+        {
+            return vma;
+        }
+    }
+    return NULL;
+}
+
+bool mm_sweep_next(struct mm_sweep *sweep, struct mm **out_mm, struct vma **out_vma, uintptr_t *out_va)
+{
+    for (uint32_t n = 0; n <= MAX_PROCESS_CNT; n++)
+    {
+        struct mm *mm = sched.task_table.slots[sweep->task_idx].task.mm;
+        struct vma *vma = mm ? sweep_next_vma(mm, sweep->va) : NULL;
+        if (vma)
+        {
+            uintptr_t va = sweep->va > vma->base_va ? sweep->va : vma->base_va;
+            *out_mm = mm;
+            *out_vma = vma;
+            *out_va = va;
+            sweep->va = va + PAGE_SIZE;
+            return true;
+        }
+
+        sweep->task_idx++;
+        sweep->va = 0;
+        if (sweep->task_idx == MAX_PROCESS_CNT)
+        {
+            sweep->task_idx = 0;
+            sweep->rounds++;
+        }
+    }
+    return false;
+}
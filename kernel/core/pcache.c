@@ -0,0 +1,659 @@
+// pcache.c
+//
+// Page cache (see include/kernel/pcache.h).
+//
+// Pages come from a fixed pool of descriptors, each owning one frame
+// while it is in use. Cached pages sit on one LRU list across all
+// mappings; when the pool or the frames run out the least recently used
+// page is written back if dirty and reused. Pages being read are only
+// inserted into their mapping once the read is done, so a page that can
+// be found always holds the file's data.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "errno.h"
+#include "kernel/pcache.h"
+#include "kernel/blk.h"
+#include "kernel/dlist.h"
+#include "kernel/mm.h"
+#include "kernel/kutils.h"
+
+/* Pages the cache holds at most (4 MiB) */
+#define PCACHE_PAGES        1024
+
+/* Dirty pages past which a writer writes its own back */
+#define PCACHE_DIRTY_MAX    (PCACHE_PAGES / 4)
+
+/* Size of the first read-ahead window of a sequential reader */
+#define PCACHE_RA_INIT      4
+
+/* Dirty pages written back under one plug */
+#define PCACHE_WB_BATCH     BLK_MAX_SEGS
+
+/* No page of the window gets the read-ahead mark */
+#define PCACHE_NO_MARK      UINT32_MAX
+
+/* Page was written and the device has not seen it yet */
+#define PCACHE_DIRTY        0x1
+/* Reaching this page starts the next read-ahead window */
+#define PCACHE_READAHEAD    0x2
+/* Being copied from or to; a fault on the user buffer can reclaim */
+#define PCACHE_LOCKED       0x4
+
+struct pcache_page
+{
+    /* NULL while the page is free */
+    struct pcache_mapping *mapping;
+    uint32_t index;
+    uint32_t block;
+    uintptr_t pa;
+    uint32_t flags;
+    /* Cached pages, most recently used first */
+    dlist_node_t lru;
+    struct pcache_page *next_free;
+};
+
+static struct
+{
+    struct pcache_page pages[PCACHE_PAGES];
+    struct pcache_page *free;
+    dlist_t lru;
+    struct pcache_stat stat;
+} pcache;
+
+void pcache_init(void)
+{
+    dlist_init(&pcache.lru);
+    pcache.free = NULL;
+    for (uint32_t i = PCACHE_PAGES; i-- > 0;)
+    {
+        struct pcache_page *page = &pcache.pages[i];
+        page->mapping = NULL;
+        dlist_node_init(&page->lru);
+        page->next_free = pcache.free;
+        pcache.free = page;
+    }
+}
+
+void pcache_mapping_init(struct pcache_mapping *mapping, struct blk_dev *dev,
+                         const struct pcache_ops *ops, void *private, uint64_t size)
+{
+    k_memset(mapping, 0, sizeof(*mapping));
+    mapping->dev = dev;
+    mapping->ops = ops;
+    mapping->private = private;
+    mapping->size = size;
+    radix_init(&mapping->pages);
+}
+
+/* ------------------------------------------------------------
+ * Pages
+ * ------------------------------------------------------------ */
+
+static void *pcache_kva(const struct pcache_page *page)
+{
+    return mm_pa_to_kva(page->pa);
+}
+
+static struct pcache_page *pcache_lookup(const struct pcache_mapping *mapping, uint32_t index)
+{
+    return (struct pcache_page *) radix_lookup(&mapping->pages, index);
+}
+
+static void pcache_touch(struct pcache_page *page)
+{
+    dlist_remove(&page->lru);
+    dlist_push_front(&pcache.lru, &page->lru);
+}
+
+static void pcache_set_dirty(struct pcache_page *page)
+{
+    if (!(page->flags & PCACHE_DIRTY))
+    {
+        page->flags |= PCACHE_DIRTY;
+        page->mapping->nr_dirty++;
+        pcache.stat.dirty++;
+    }
+}
+
+static void pcache_clear_dirty(struct pcache_page *page)
+{
+    if (page->flags & PCACHE_DIRTY)
+    {
+        page->flags &= ~PCACHE_DIRTY;
+        page->mapping->nr_dirty--;
+        pcache.stat.dirty--;
+    }
+}
+
+/* Give a page, already out of its mapping's tree, back to the pool; dirty data is lost */
+static void pcache_page_drop(uintptr_t value)
+{
+    struct pcache_page *page = (struct pcache_page *) value;
+
+    pcache_clear_dirty(page);
+    page->mapping->nr_pages--;
+    pcache.stat.pages--;
+    dlist_remove(&page->lru);
+    page->mapping = NULL;
+
+    mm_frame_free(page->pa);
+    page->next_free = pcache.free;
+    pcache.free = page;
+}
+
+/* A page that never made it into a mapping */
+static void pcache_page_free(struct pcache_page *page)
+{
+    mm_frame_free(page->pa);
+    page->mapping = NULL;
+    page->next_free = pcache.free;
+    pcache.free = page;
+}
+
+/* Write back and drop the least recently used page; false if there is none */
+static bool pcache_evict(void)
+{
+    dlist_node_t *node = pcache.lru.head.prev;
+    while (node != &pcache.lru.head && (dlist_entry(node, struct pcache_page, lru)->flags & PCACHE_LOCKED))
+    {
+        node = node->prev;
+    }
+    if (node == &pcache.lru.head)
+    {
+        return false;
+    }
+
+    struct pcache_page *page = dlist_entry(node, struct pcache_page, lru);
+    struct pcache_mapping *mapping = page->mapping;
+
+    if (page->flags & PCACHE_DIRTY)
+    {
+        void *kva = pcache_kva(page);
+        if (blk_rw_pages(mapping->dev, page->block, &kva, 1, true) < 0 && mapping->error == 0)
+        {
+            mapping->error = -EIO;
+        }
+        pcache.stat.writeback++;
+    }
+
+    *radix_slot(&mapping->pages, page->index) = 0;
+    pcache_page_drop((uintptr_t) page);
+    pcache.stat.evictions++;
+    return true;
+}
+
+/* A free page with a frame, evicting when the pool or memory is used up */
+static struct pcache_page *pcache_page_alloc(void)
+{
+    while (true)
+    {
+        if (pcache.free)
+        {
+            uintptr_t pa = mm_frame_alloc();
+            if (pa)
+            {
+                struct pcache_page *page = pcache.free;
+                pcache.free = page->next_free;
+                page->pa = pa;
+                page->flags = 0;
+                return page;
+            }
+        }
+
+        if (!pcache_evict())
+        {
+            return NULL;
+        }
+    }
+}
+
+static bool pcache_insert(struct pcache_mapping *mapping, struct pcache_page *page)
+{
+    uintptr_t *slot = radix_slot(&mapping->pages, page->index);
+    if (!slot)
+    {
+        pcache_page_free(page);
+        return false;
+    }
+
+    *slot = (uintptr_t) page;
+    page->mapping = mapping;
+    dlist_push_front(&pcache.lru, &page->lru);
+    mapping->nr_pages++;
+    pcache.stat.pages++;
+    return true;
+}
+
+/* ------------------------------------------------------------
+ * Reading
+ * ------------------------------------------------------------ */
+
+static uint32_t pcache_page_cnt(const struct pcache_mapping *mapping)
+{
+    return (uint32_t) ((mapping->size + PCACHE_PAGE_SIZE - 1) / PCACHE_PAGE_SIZE);
+}
+
+/*
+ * Read the pages of [start, start + cnt) that aren't cached, all under
+ * one plug. The first req of them were asked for, the rest are
+ * read-ahead. Page marker gets the read-ahead mark.
+ */
+static int pcache_fill(struct pcache_mapping *mapping, uint32_t start, uint32_t cnt, uint32_t req, uint32_t marker)
+{
+    uint32_t end = pcache_page_cnt(mapping);
+    if (start >= end)
+    {
+        return 0;
+    }
+    if (cnt > end - start)
+    {
+        cnt = end - start;
+    }
+
+    struct pcache_page *pages[PCACHE_RA_MAX];
+    struct bio bios[PCACHE_RA_MAX];
+    uint32_t n = 0;
+    int res = 0;
+
+    for (uint32_t i = 0; i < cnt; i++)
+    {
+        uint32_t index = start + i;
+        struct pcache_page *page = pcache_lookup(mapping, index);
+        if (page)
+        {
+            if (index == marker)
+            {
+                page->flags |= PCACHE_READAHEAD;
+            }
+            continue;
+        }
+
+        uint32_t block;
+        res = mapping->ops->bmap(mapping, index, false, &block);
+        if (res < 0)
+        {
+            break;
+        }
+
+        page = pcache_page_alloc();
+        if (!page)
+        {
+            res = -ENOMEM;
+            break;
+        }
+        page->index = index;
+        page->block = block;
+        if (index == marker)
+        {
+            page->flags |= PCACHE_READAHEAD;
+        }
+        if (block == PCACHE_HOLE)
+        {
+            k_memset(pcache_kva(page), 0, PCACHE_PAGE_SIZE);
+        }
+        pages[n++] = page;
+    }
+
+    blk_plug(mapping->dev);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        bios[i].status = 0;
+        if (pages[i]->block != PCACHE_HOLE)
+        {
+            bios[i].block = pages[i]->block;
+            bios[i].page = pcache_kva(pages[i]);
+            bios[i].write = false;
+            blk_submit(mapping->dev, &bios[i]);
+        }
+    }
+    blk_unplug(mapping->dev);
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (bios[i].status < 0)
+        {
+            pcache_page_free(pages[i]);
+            res = -EIO;
+            continue;
+        }
+
+        if (pages[i]->index >= start + req)
+        {
+            pcache.stat.readahead++;
+        }
+        if (!pcache_insert(mapping, pages[i]) && res == 0)
+        {
+            res = -ENOMEM;
+        }
+    }
+    return res;
+}
+
+/*
+ * index missed and req pages from it on are wanted. A sequential reader
+ * gets a window twice the last one, capped at PCACHE_RA_MAX, and a mark
+ * on the first page it didn't ask for; anyone else only the pages asked.
+ */
+static int pcache_readahead(struct pcache_mapping *mapping, uint32_t index, uint32_t req)
+{
+    if (req > PCACHE_RA_MAX)
+    {
+        req = PCACHE_RA_MAX;
+    }
+
+    if (index != mapping->ra_next && index != mapping->ra_start + mapping->ra_size)
+    {
+        mapping->ra_size = 0;
+        return pcache_fill(mapping, index, req, req, PCACHE_NO_MARK);
+    }
+
+    uint32_t size = mapping->ra_size ? mapping->ra_size * 2 : PCACHE_RA_INIT;
+    if (size < req)
+    {
+        size = req;
+    }
+    if (size > PCACHE_RA_MAX)
+    {
+        size = PCACHE_RA_MAX;
+    }
+
+    mapping->ra_start = index;
+    mapping->ra_size = size;
+    return pcache_fill(mapping, index, size, req, size > req ? index + req : PCACHE_NO_MARK);
+}
+
+/* The reader reached a mark: read the next window, marked on its first page */
+static void pcache_readahead_async(struct pcache_mapping *mapping)
+{
+    uint32_t start = mapping->ra_start + mapping->ra_size;
+    uint32_t size = mapping->ra_size * 2;
+    if (size == 0)
+    {
+        size = PCACHE_RA_INIT;
+    }
+    if (size > PCACHE_RA_MAX)
+    {
+        size = PCACHE_RA_MAX;
+    }
+
+    mapping->ra_start = start;
+    mapping->ra_size = size;
+    pcache_fill(mapping, start, size, 0, start);
+}
+
+ssize_t pcache_read(struct pcache_mapping *mapping, void *buf, size_t count, off_t offset)
+{
+    if (offset < 0)
+    {
+        return -EINVAL;
+    }
+    if ((uint64_t) offset >= mapping->size)
+    {
+        return 0;
+    }
+    if (count > mapping->size - (uint64_t) offset)
+    {
+        count = (size_t) (mapping->size - (uint64_t) offset);
+    }
+
+    uint8_t *p = buf;
+    size_t done = 0;
+    uint32_t last = (uint32_t) (((uint64_t) offset + count - 1) / PCACHE_PAGE_SIZE);
+
+    while (done < count)
+    {
+        uint64_t pos = (uint64_t) offset + done;
+        uint32_t index = (uint32_t) (pos / PCACHE_PAGE_SIZE);
+        size_t in_page = (size_t) (pos % PCACHE_PAGE_SIZE);
+        size_t chunk = PCACHE_PAGE_SIZE - in_page < count - done ? PCACHE_PAGE_SIZE - in_page : count - done;
+
+        struct pcache_page *page = pcache_lookup(mapping, index);
+        if (page)
+        {
+            pcache.stat.hits++;
+        }
+        else
+        {
+            pcache.stat.misses++;
+            int res = pcache_readahead(mapping, index, last - index + 1);
+            page = pcache_lookup(mapping, index);
+            if (!page)
+            {
+                return done > 0 ? (ssize_t) done : (res < 0 ? res : -EIO);
+            }
+        }
+
+        bool mark = page->flags & PCACHE_READAHEAD;
+        page->flags &= ~PCACHE_READAHEAD;
+        pcache_touch(page);
+        page->flags |= PCACHE_LOCKED;
+        k_memcpy(p + done, (uint8_t *) pcache_kva(page) + in_page, chunk);
+        page->flags &= ~PCACHE_LOCKED;
+        done += chunk;
+        mapping->ra_next = index + 1;
+
+        if (mark)
+        {
+            pcache_readahead_async(mapping);
+        }
+    }
+
+    return (ssize_t) done;
+}
+
+/* ------------------------------------------------------------
+ * Writing
+ * ------------------------------------------------------------ */
+
+/* Write the dirty pages of mapping, PCACHE_WB_BATCH under one plug */
+static void pcache_flush(struct pcache_mapping *mapping)
+{
+    while (mapping->nr_dirty > 0)
+    {
+        struct pcache_page *pages[PCACHE_WB_BATCH];
+        struct bio bios[PCACHE_WB_BATCH];
+        uint32_t n = 0;
+
+        for (uint32_t i = 0; i < PCACHE_PAGES && n < PCACHE_WB_BATCH; i++)
+        {
+            struct pcache_page *page = &pcache.pages[i];
+            if (page->mapping == mapping && (page->flags & PCACHE_DIRTY))
+            {
+                pages[n++] = page;
+            }
+        }
+        if (n == 0)
+        {
+            panic("pcache_flush: dirty count out of sync");
+        }
+
+        blk_plug(mapping->dev);
+        for (uint32_t i = 0; i < n; i++)
+        {
+            bios[i].block = pages[i]->block;
+            bios[i].page = pcache_kva(pages[i]);
+            bios[i].write = true;
+            blk_submit(mapping->dev, &bios[i]);
+        }
+        blk_unplug(mapping->dev);
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+            /* A failed page isn't retried; its error goes to the next fsync */
+            if (bios[i].status < 0 && mapping->error == 0)
+            {
+                mapping->error = -EIO;
+            }
+            pcache_clear_dirty(pages[i]);
+            pcache.stat.writeback++;
+        }
+    }
+}
+
+/*
+ * Page index for a write of [in_page, in_page + len). It is only read
+ * from the device when bytes of the file around the written ones are on it.
+ */
+static struct pcache_page *pcache_grab(struct pcache_mapping *mapping, uint32_t index, size_t in_page, size_t len,
+                                       int *res)
+{
+    struct pcache_page *page = pcache_lookup(mapping, index);
+    if (page)
+    {
+        return page;
+    }
+
+    uint64_t page_pos = (uint64_t) index * PCACHE_PAGE_SIZE;
+    bool head_valid = in_page > 0 && page_pos < mapping->size;
+    bool tail_valid = in_page + len < PCACHE_PAGE_SIZE && page_pos + in_page + len < mapping->size;
+
+    if (head_valid || tail_valid)
+    {
+        *res = pcache_fill(mapping, index, 1, 1, PCACHE_NO_MARK);
+        return pcache_lookup(mapping, index);
+    }
+
+    page = pcache_page_alloc();
+    if (!page)
+    {
+        *res = -ENOMEM;
+        return NULL;
+    }
+    page->index = index;
+    page->block = PCACHE_HOLE;
+    k_memset(pcache_kva(page), 0, PCACHE_PAGE_SIZE);
+    if (!pcache_insert(mapping, page))
+    {
+        *res = -ENOMEM;
+        return NULL;
+    }
+    return page;
+}
+
+ssize_t pcache_write(struct pcache_mapping *mapping, const void *buf, size_t count, off_t offset)
+{
+    if (offset < 0)
+    {
+        return -EINVAL;
+    }
+
+    const uint8_t *p = buf;
+    size_t done = 0;
+
+    while (done < count)
+    {
+        uint64_t pos = (uint64_t) offset + done;
+        uint32_t index = (uint32_t) (pos / PCACHE_PAGE_SIZE);
+        size_t in_page = (size_t) (pos % PCACHE_PAGE_SIZE);
+        size_t chunk = PCACHE_PAGE_SIZE - in_page < count - done ? PCACHE_PAGE_SIZE - in_page : count - done;
+
+        /* Before the page is taken: allocating a block can read metadata through the cache */
+        uint32_t block;
+        int res = mapping->ops->bmap(mapping, index, true, &block);
+        struct pcache_page *page = NULL;
+        if (res == 0)
+        {
+            res = -EIO;
+            page = pcache_grab(mapping, index, in_page, chunk, &res);
+        }
+        if (!page)
+        {
+            return done > 0 ? (ssize_t) done : res;
+        }
+
+        page->block = block;
+        pcache_touch(page);
+        page->flags |= PCACHE_LOCKED;
+        k_memcpy((uint8_t *) pcache_kva(page) + in_page, p + done, chunk);
+        page->flags &= ~PCACHE_LOCKED;
+        pcache_set_dirty(page);
+        done += chunk;
+
+        if (pos + chunk > mapping->size)
+        {
+            mapping->size = pos + chunk;
+        }
+    }
+
+    if (pcache.stat.dirty > PCACHE_DIRTY_MAX)
+    {
+        pcache_flush(mapping);
+    }
+    return (ssize_t) done;
+}
+
+int pcache_writeback(struct pcache_mapping *mapping)
+{
+    pcache_flush(mapping);
+
+    int error = mapping->error;
+    mapping->error = 0;
+    return error;
+}
+
+void pcache_truncate(struct pcache_mapping *mapping, uint64_t size)
+{
+    uint32_t from = (uint32_t) ((size + PCACHE_PAGE_SIZE - 1) / PCACHE_PAGE_SIZE);
+    radix_trim(&mapping->pages, from, pcache_page_drop);
+
+    /* The rest of the last page must read as zeros when the file grows again */
+    size_t in_page = (size_t) (size % PCACHE_PAGE_SIZE);
+    struct pcache_page *page = in_page ? pcache_lookup(mapping, (uint32_t) (size / PCACHE_PAGE_SIZE)) : NULL;
+    if (page)
+    {
+        k_memset((uint8_t *) pcache_kva(page) + in_page, 0, PCACHE_PAGE_SIZE - in_page);
+        if (page->block != PCACHE_HOLE)
+        {
+            pcache_set_dirty(page);
+        }
+    }
+
+    mapping->size = size;
+}
+
+void pcache_discard(struct pcache_mapping *mapping, uint32_t index)
+{
+    struct pcache_page *page = pcache_lookup(mapping, index);
+    if (page && !(page->flags & PCACHE_LOCKED))
+    {
+        *radix_slot(&mapping->pages, index) = 0;
+        pcache_page_drop((uintptr_t) page);
+    }
+}
+
+void pcache_release(struct pcache_mapping *mapping)
+{
+    pcache_flush(mapping);
+    radix_trim(&mapping->pages, 0, pcache_page_drop);
+    mapping->ra_start = 0;
+    mapping->ra_size = 0;
+    mapping->ra_next = 0;
+}
+
+uint32_t pcache_shrink(uint32_t nr_pages)
+{
+    uint32_t freed = 0;
+    while (freed < nr_pages && pcache_evict())
+    {
+        freed++;
+    }
+    return freed;
+}
+
+void pcache_sync(void)
+{
+    for (uint32_t i = 0; i < PCACHE_PAGES; i++)
+    {
+        struct pcache_page *page = &pcache.pages[i];
+        if (page->mapping && (page->flags & PCACHE_DIRTY))
+        {
+            pcache_flush(page->mapping);
+        }
+    }
+}
+
+void pcache_stat(struct pcache_stat *stat)
+{
+    *stat = pcache.stat;
+}
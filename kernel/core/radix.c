@@ -0,0 +1,143 @@
+// radix.c
+//
+// Radix tree (see include/kernel/radix.h). Nodes are zeroed frames
+// addressed through the physmap; a slot holds the physical address of the
+// node below, or the value itself in the bottom level.
+
+#include "kernel/radix.h"
+#include "kernel/mm.h"
+
+void radix_init(struct radix_tree *tree)
+{
+    tree->root_pa = 0;
+    tree->height = 0;
+    tree->nodes = 0;
+}
+
+/* Indexes a tree of the given height covers */
+static uint64_t radix_capacity(uint32_t height)
+{
+    return height * RADIX_SHIFT >= 32 ? (1ULL << 32) : 1ULL << (height * RADIX_SHIFT);
+}
+
+static uint32_t radix_index(uint32_t index, uint32_t level)
+{
+    return (index >> ((level - 1) * RADIX_SHIFT)) & RADIX_MASK;
+}
+
+uintptr_t radix_lookup(const struct radix_tree *tree, uint32_t index)
+{
+    if (tree->height == 0 || index >= radix_capacity(tree->height))
+    {
+        return 0;
+    }
+
+    uintptr_t pa = tree->root_pa;
+    for (uint32_t level = tree->height; level > 0; level--)
+    {
+        const uintptr_t *slots = mm_pa_to_kva(pa);
+        pa = slots[radix_index(index, level)];
+        if (pa == 0)
+        {
+            return 0;
+        }
+    }
+    return pa;
+}
+
+static uintptr_t radix_node_alloc(struct radix_tree *tree)
+{
+    uintptr_t pa = mm_frame_alloc_zeroed();
+    if (pa)
+    {
+        tree->nodes++;
+    }
+    return pa;
+}
+
+uintptr_t *radix_slot(struct radix_tree *tree, uint32_t index)
+{
+    /* Grow at the top: the old root becomes slot 0 of the new one */
+    while (tree->height == 0 || index >= radix_capacity(tree->height))
+    {
+        uintptr_t pa = radix_node_alloc(tree);
+        if (!pa)
+        {
+            return NULL;
+        }
+        if (tree->root_pa)
+        {
+            ((uintptr_t *) mm_pa_to_kva(pa))[0] = tree->root_pa;
+        }
+        tree->root_pa = pa;
+        tree->height++;
+    }
+
+    uintptr_t *slots = mm_pa_to_kva(tree->root_pa);
+    for (uint32_t level = tree->height; level > 1; level--)
+    {
+        uintptr_t *slot = &slots[radix_index(index, level)];
+        if (*slot == 0)
+        {
+            *slot = radix_node_alloc(tree);
+            if (*slot == 0)
+            {
+                return NULL;
+            }
+        }
+        slots = mm_pa_to_kva(*slot);
+    }
+    return &slots[radix_index(index, 1)];
+}
+
+/*
+ * Trim the subtree at pa, which covers the indexes from base on. Returns
+ * true when the whole subtree went, node included.
+ */
+static bool radix_trim_node(struct radix_tree *tree, uintptr_t pa, uint32_t level, uint64_t base,
+                            uint32_t from, void (*release)(uintptr_t value))
+{
+    uintptr_t *slots = mm_pa_to_kva(pa);
+    uint64_t span = radix_capacity(level - 1);
+
+    for (uint32_t i = 0; i < RADIX_SLOTS; i++)
+    {
+        uint64_t start = base + i * span;
+        if (slots[i] == 0 || start + span <= from)
+        {
+            continue;
+        }
+
+        if (level == 1)
+        {
+            release(slots[i]);
+            slots[i] = 0;
+        }
+        else if (radix_trim_node(tree, slots[i], level - 1, start, from, release))
+        {
+            slots[i] = 0;
+        }
+    }
+
+    if (base >= from)
+    {
+        mm_frame_free(pa);
+        tree->nodes--;
+        return true;
+    }
+    return false;
+}
+
+void radix_trim(struct radix_tree *tree, uint32_t from, void (*release)(uintptr_t value))
+{
+    if (tree->height == 0)
+    {
+        return;
+    }
+
+    if (radix_trim_node(tree, tree->root_pa, tree->height, 0, from, release))
+    {
+        tree->root_pa = 0;
+        tree->height = 0;
+    }
+}
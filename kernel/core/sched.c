@@ -1,16 +1,25 @@
 // sched.c
+#include <stddef.h>
 #include "errno.h"
 #include "kernel/sched.h"
 #include "kernel/console.h"
 #include "kernel/irq.h"
 #include "kernel/kutils.h"
 #include "kernel/elf_loader.h"
+#include "kernel/swap.h"
+#include "kernel/ksm.h"
 #include "kernel/constants.h"
 #include "kernel/vfs.h"
+#include "kernel/kstack.h"
+#include "kernel/zygote.h"
 
 struct scheduler sched;
 
+_Static_assert(offsetof(struct task, kstack) + sizeof(uintptr_t) <= CACHE_LINE_SIZE,
+               "hot task fields must fit in one cache line");
+
 void task_init_cwd(struct task *task);
+void task_init_stdio(struct task *task);
 
 /* ---------------- Run queue ---------------- */
 
@@ -90,6 +99,9 @@ void sched_exit(int status)
         }
     }
 
+    /* Return user memory to the frame allocator */
+    mm_release_user(current->mm);
+
     current->exit_status = status;
     current->state = TASK_ZOMBIE;
     wakeup(&current->signal.wait_exit);
@@ -172,7 +184,7 @@ static void task_init_args(struct task *task, char **argv, struct trampoline *tr
  * Copies envp[] into the process heap starting at task->brk and
  * sets the ELF 'environ' symbol if present.
  * ------------------------------------------------------------ */
-static void task_init_env(struct task *task, char **envp, uint32_t environ_off, struct trampoline *trampoline)
+static void task_init_env(struct task *task, char **envp, uintptr_t environ_va, struct trampoline *trampoline)
 {
     int envc = 0;
     while (envp && envp[envc] != NULL)
@@ -197,10 +209,8 @@ static void task_init_env(struct task *task, char **envp, uint32_t environ_off,
     heap_envp[envc] = NULL;
 
     /* Initialize program's global 'environ' if present */
-    if (environ_off != 0)
+    if (environ_va != 0)
     {
-        struct vma *vma = mm_find_vma_by_type(task->mm, VMA_TYPE_PROCESS);
-        uintptr_t environ_va = vma->base_va + (uintptr_t) environ_off;
         char ***environ_ptr = (char ***) environ_va;
         *environ_ptr = heap_envp;
     }
@@ -216,6 +226,83 @@ void signal_init(struct signal *signal)
     wait_queue_init(&signal->wait_child);
 }
 
+/* Bytes task_init_args/task_init_env need on the heap for v */
+static size_t strv_heap_size(char **v)
+{
+    size_t size = sizeof(char *);
+    for (int i = 0; v && v[i] != NULL; i++)
+    {
+        size += sizeof(char *) + k_strlen(v[i]) + 1;
+    }
+    return size;
+}
+
+/* ------------------------------------------------------------
+ * task_load_image
+ *
+ * Map a program into the empty user address space of task: the ELF
+ * segments at PROCESS_VA_BASE, the brk heap right after them and the
+ * stack below PROCESS_STACK_TOP. argv/envp must be kernel memory and
+ * the task's mm must be active. Returns 0 or -errno.
+ * ------------------------------------------------------------ */
+static int task_load_image(struct task *task, const struct embedded_bin *bin, char **argv, char **envp)
+{
+    /* Map the image from the binary's template; the first exec builds one */
+    struct elf_info elf_info;
+    int res = zygote_clone(bin, task->mm, &elf_info);
+    if (res == -ENOENT)
+    {
+        if (elf_load(bin, task->mm, &elf_info) < 0)
+        {
+            return -ENOEXEC;
+        }
+        zygote_capture(bin, task->mm, &elf_info);
+    }
+    else if (res < 0)
+    {
+        return res;
+    }
+
+    if (mm_setup_stack(task->mm) < 0)
+    {
+        return -ENOMEM;
+    }
+
+    /* The heap starts at the first page after the image */
+    task->brk = (uintptr_t) align_up(elf_info.max_offset, 4096);
+    task->brk_limit = task->brk + RLIMIT_DATA;
+
+    if (mm_setup_heap(task->mm, task->brk) < 0 ||
+        mm_heap_resize(task->mm, task->brk + strv_heap_size(argv) + strv_heap_size(envp)) < 0)
+    {
+        return -E2BIG;
+    }
+
+    task->cpu_ctx.u_sp = PROCESS_STACK_TOP;
+
+    uintptr_t environ_va = 0;
+    if (elf_info.environ_off != 0)
+    {
+        environ_va = elf_info.base_va + (uintptr_t) elf_info.environ_off;
+    }
+
+    /* Setup the trampoline; argv/envp are copied to the bottom of the heap */
+    struct trampoline trampoline = {.main_addr = elf_info.entry_va};
+    task_init_args(task, argv, &trampoline);
+    task_init_env(task, envp, environ_va, &trampoline);
+    ctx_setup_trampoline(&task->cpu_ctx, &trampoline);
+
+    /* Initialize curbrk if present */
+    if (elf_info.curbrk_off != 0)
+    {
+        uintptr_t curbrk_va = elf_info.base_va + (uintptr_t) elf_info.curbrk_off;
+        char **curbrk_ptr = (char **) curbrk_va;
+        *curbrk_ptr = (char *) task->brk;
+    }
+
+    return 0;
+}
+
 /* ------------------------------------------------------------
  * task_kernel_exec
  *
@@ -245,13 +332,10 @@ struct task *task_kernel_exec(const char *filename, int tty_id, char **argv, cha
 
     /* Initialize the stack */
     task->cpu_ctx.k_sp = (unsigned long) (task->kstack + KERNEL_STACK_SIZE);
-    task->cpu_ctx.u_sp = PROCESS_STACK_TOP;
 
     /* Activate task's address space to set it up */
     mm_activate(task->mm);
 
-    uintptr_t base_va = mm_find_vma_by_type(task->mm, VMA_TYPE_PROCESS)->base_va;
-
     k_strcpy(task->name, filename);
 
     task->ctxt = 0;
@@ -267,49 +351,38 @@ struct task *task_kernel_exec(const char *filename, int tty_id, char **argv, cha
     task_init_tty(task, tty_id);
     task_init_cwd(task);
 
-    /* Load ELF */
-    const void *image = bin->start;
-    struct elf_info elf_info;
-    if (elf_load(image, &elf_info) < 0)
+    if (task_load_image(task, bin, argv, envp) < 0)
     {
         kprintf("task_kernel_exec: Failed to load the binary %s\n", filename);
+        mm_release_user(task->mm);
         task_table_free(&sched.task_table, task);
         mm_activate(mm_kernel());
         return NULL;
     }
 
-    uint32_t main_addr = elf_info.entry_va;
-    uint32_t environ_off = elf_info.environ_off;
+    /* Switch back to kernel address space */
+    mm_activate(mm_kernel());
 
-    uintptr_t program_end = (uintptr_t) elf_info.max_offset;
-    task->brk = (uintptr_t) align_up(program_end, 16);
-    task->brk_limit = task->brk + PROCESS_HEAP_SIZE;
+    return task;
+}
 
-    if ((uintptr_t) task->brk > task->brk_limit)
-    {
-        kprintf("task_kernel_exec: not enough space %s\n", filename);
-        task_table_free(&sched.task_table, task);
-        mm_activate(mm_kernel());
-        return NULL;
-    }
+/*
+ * Called by the trampoline before a program starts: open /dev/stdin,
+ * /dev/stdout and /dev/stderr on fds 0-2, but only where the task didn't
+ * inherit them through fork and execve.
+ */
+void task_init_stdio(struct task *task)
+{
+    static const char *const paths[] = {"/dev/stdin", "/dev/stdout", "/dev/stderr"};
+    static const int flags[] = {O_RDONLY, O_WRONLY, O_WRONLY};
 
-    if (elf_info.curbrk_off != 0)
+    for (int fd = FD_STDIN; fd <= FD_STDERR; fd++)
     {
-        uintptr_t curbrk_va = base_va + (uintptr_t) elf_info.curbrk_off;
-        char **curbrk_ptr = (char **) curbrk_va;
-        *curbrk_ptr = (char *) task->brk;
+        if (task->files.slots[fd].file == NULL)
+        {
+            vfs_open(task, paths[fd], flags[fd], 0);
+        }
     }
-
-    /* Setup the trampoline */
-    struct trampoline trampoline = {.main_addr = main_addr};
-    task_init_args(task, argv, &trampoline);
-    task_init_env(task, envp, environ_off, &trampoline);
-    ctx_setup_trampoline(&task->cpu_ctx, &trampoline);
-
-    /* Switch back to kernel address space */
-    mm_activate(mm_kernel());
-
-    return task;
 }
 
 void task_init_cwd(struct task *task)
@@ -363,6 +436,14 @@ pid_t sched_fork(void)
         return -ENOMEM;
     }
 
+    /* Copy the user address space first; this is the only step that can fail */
+    if (mm_dup_user(child->mm, parent->mm) < 0)
+    {
+        mm_release_user(child->mm);
+        task_table_free(&sched.task_table, child);
+        return -ENOMEM;
+    }
+
     /* Copy basic info */
     k_strcpy(child->name, parent->name);
 
@@ -384,16 +465,8 @@ pid_t sched_fork(void)
     child->brk = parent->brk;
     child->brk_limit = parent->brk_limit;
 
-    /* TODO: Fix file descriptor sharing/reference counting
-    for (int fd = 0; fd < RLIMIT_NOFILE; fd++)
-    {
-        child->files.slots[fd] = parent->files.slots[fd];
-        if (child->files.slots[fd].file)
-        {
-            child->files.slots[fd].file->ref_count++;
-        }
-    }
-    */
+    /* The child shares the parent's open files */
+    files_dup(&child->files, &parent->files);
 
     /* Copy cwd and TTY */
     k_strcpy(child->cwd, parent->cwd);
@@ -407,19 +480,52 @@ pid_t sched_fork(void)
 
     child->exit_status = 0;
 
-    /* Copy user address space */
-    struct vma *parent_vma = mm_find_vma_by_type(parent->mm, VMA_TYPE_PROCESS);
-    struct vma *child_vma = mm_find_vma_by_type(child->mm, VMA_TYPE_PROCESS);
-    if (parent_vma && child_vma)
-    {
-        mm_copy_vma(child->mm, child_vma, parent->mm, parent_vma, parent_vma->length);
-    }
-
     child->state = TASK_QUEUED;
     sched_enqueue(child);
     return child->pid;
 }
 
+/* Kernel copy of the execve arguments (execve does not yield while using it) */
+static struct
+{
+    char *argv[EXEC_ARGV_MAX + 1];
+    char *envp[EXEC_ARGV_MAX + 1];
+    char strings[EXEC_ARG_MAX];
+} exec_args;
+
+static int exec_copy_strv(char *const src[], char **dst, char **cursor, const char *end)
+{
+    int n = 0;
+    while (src && src[n] != NULL)
+    {
+        size_t len = k_strlen(src[n]) + 1;
+        if (n >= EXEC_ARGV_MAX || len > (size_t) (end - *cursor))
+        {
+            return -E2BIG;
+        }
+
+        k_memcpy(*cursor, src[n], len);
+        dst[n] = *cursor;
+        *cursor += len;
+        n++;
+    }
+    dst[n] = NULL;
+    return 0;
+}
+
+static int exec_save_args(char *const argv[], char *const envp[])
+{
+    char *cursor = exec_args.strings;
+    const char *end = exec_args.strings + EXEC_ARG_MAX;
+
+    int res = exec_copy_strv(argv, exec_args.argv, &cursor, end);
+    if (res < 0)
+    {
+        return res;
+    }
+    return exec_copy_strv(envp, exec_args.envp, &cursor, end);
+}
+
 /* ------------------------------------------------------------
  * sched_execve
  *
@@ -443,71 +549,25 @@ int sched_execve(const char *pathname, char *const argv[], char *const envp[])
         return -ENOENT;
     }
 
-    /* TODO: Implement close-on-exec (O_CLOEXEC)
-    for (int fd = 0; fd < RLIMIT_NOFILE; fd++)
-    {
-        struct file *file = current->files.slots[fd].file;
-        if (file && (current->files.slots[fd].flags & FD_CLOEXEC))
-        {
-            vfs_close(current, fd);
-        }
-    }
-    */
-
-    /* Get process VMA */
-    struct vma *vma = mm_find_vma_by_type(current->mm, VMA_TYPE_PROCESS);
-    if (!vma)
+    /* argv/envp live in the address space that is about to be replaced */
+    int res = exec_save_args(argv, envp);
+    if (res < 0)
     {
-        return -ENOMEM;
+        return res;
     }
 
-    /* Zero out user memory */
-    uintptr_t base_va = vma->base_va;
-
-    // also the user stack we don't want null btw; because it would fuck up the call stack
-//    k_memset((void *)base_va, 0, vma->length);
+    vfs_close_on_exec(current);
 
     k_strcpy(current->name, pathname);
 
-    /* Load ELF */
-    const void *image = bin->start;
-    struct elf_info elf_info;
-    if (elf_load(image, &elf_info) < 0)
-    {
-        /* Failed to load - process is now broken, must exit */
-        sched_exit(-1);
-    }
+    mm_release_user(current->mm);
 
-    uint32_t main_addr = elf_info.entry_va;
-    uint32_t environ_off = elf_info.environ_off;
-
-    /* Reset heap */
-    uintptr_t program_end = (uintptr_t) elf_info.max_offset;
-    current->brk = (uintptr_t) align_up(program_end, 16);
-    current->brk_limit = current->brk + PROCESS_HEAP_SIZE;
-
-    if (current->brk > current->brk_limit)
+    if (task_load_image(current, bin, exec_args.argv, exec_args.envp) < 0)
     {
+        /* Failed to load - process is now broken, must exit */
         sched_exit(-1);
     }
 
-    /* Initialize curbrk if present */
-    if (elf_info.curbrk_off != 0)
-    {
-        uintptr_t curbrk_va = base_va + (uintptr_t) elf_info.curbrk_off;
-        char **curbrk_ptr = (char **) curbrk_va;
-        *curbrk_ptr = (char *) current->brk;
-    }
-
-    /* Reset user stack pointer */
-    current->cpu_ctx.u_sp = PROCESS_STACK_TOP;
-
-    /* Setup the trampoline */
-    struct trampoline trampoline = {.main_addr = main_addr};
-    task_init_args(current, (char **) argv, &trampoline);
-    task_init_env(current, (char **) envp, environ_off, &trampoline);
-    ctx_setup_trampoline(&current->cpu_ctx, &trampoline);
-
     /* Reset signal state */
     current->signal.pending = 0;
     return 0;
@@ -597,6 +657,24 @@ void sched_schedule(void)
     ctx_switch(prev_cpu_ctx, next_cpu_ctx, next->mm);
 }
 
+/* Frames the idle task zeroes per pass at most */
+#define IDLE_ZERO_BATCH 16
+
+void sched_idle(void)
+{
+    swap_reclaim_background();
+    ksm_scan();
+
+    /* Stop as soon as a task became runnable (e.g. woken by an interrupt) */
+    for (int i = 0; i < IDLE_ZERO_BATCH && sched.run_queue.len == 0; i++)
+    {
+        if (!mm_zero_pool_fill_one())
+        {
+            break;
+        }
+    }
+}
+
 void sched_stat(struct sched_stat *stat)
 {
     if (stat == NULL)
@@ -613,6 +691,8 @@ void sched_init(void)
     sched.ctxt = 0;
     run_queue_init(&sched.run_queue);
 
+    /* Before task_table_init forks the kernel address space for every slot */
+    kstack_init();
     task_table_init(&sched.task_table);
 
     char *argv[] = {"/sbin/swapper", NULL};
@@ -0,0 +1,376 @@
+// swap.c
+//
+// Page reclaim and swap. The swap area is the whole second drive on the
+// primary ATA channel, divided into page-sized slots tracked by a bitmap.
+//
+// Reclaim is a clock over the private pages of all address spaces (an
+// mm_sweep over every task slot in turn). A page whose accessed bit is
+// set gets the bit cleared and a second chance; a page that wasn't touched
+// since the previous sweep becomes a victim. Victims are collected into
+// batches that are written to a run of consecutive slots with one disk
+// command. Because the hand walks pages in address order, neighbouring pages
+// tend to end up in neighbouring slots, so swap-in reads the faulting slot
+// together with the slots of the pages that follow it in one command.
+
+#include <stdint.h>
+#include "kernel/swap.h"
+#include "kernel/zygote.h"
+#include "kernel/pcache.h"
+#include "kernel/ata.h"
+#include "kernel/sched.h"
+#include "kernel/console.h"
+#include "kernel/kutils.h"
+
+#define PAGE_SIZE           4096u
+
+#define SWAP_DRIVE          ATA_DRIVE_SLAVE
+#define SECTORS_PER_SLOT    (PAGE_SIZE / ATA_SECTOR_SIZE)
+
+/* 256 MiB of swap at most */
+#define SWAP_MAX_SLOTS      65536u
+
+/* Pages written with one disk command */
+#define SWAP_BATCH          16u
+
+/* Pages read with one disk command on a swap-in */
+#define SWAP_CLUSTER        8u
+
+/* Free frame watermarks: reclaim on faults below LOW, in the background below HIGH */
+#define SWAP_FREE_LOW       512u
+#define SWAP_FREE_HIGH      1024u
+
+/* Pages the clock hand visits per reclaim pass at most */
+#define SWAP_SCAN_MAX       4096u
+
+struct swap_area
+{
+    uint32_t slot_cnt;
+    uint32_t free_cnt;
+    /* Next-fit search starts here */
+    uint32_t hint;
+    uint32_t bitmap[SWAP_MAX_SLOTS / 32];
+};
+
+struct swap_victim
+{
+    struct mm *mm;
+    uintptr_t va;
+};
+
+static struct swap_area swap;
+static struct mm_sweep clock;
+static struct swap_stat stats;
+
+/* ------------------------------------------------------------
+ * Slot bitmap
+ * ------------------------------------------------------------ */
+
+static inline bool slot_used(uint32_t slot)
+{
+    return (swap.bitmap[slot / 32] & (1u << (slot % 32))) != 0;
+}
+
+/* Allocate up to want consecutive slots; returns the first and the count in out_cnt */
+static uint32_t slots_alloc(uint32_t want, uint32_t *out_cnt)
+{
+    *out_cnt = 0;
+    if (swap.free_cnt == 0)
+    {
+        return 0;
+    }
+
+    uint32_t slot = swap.hint;
+    for (uint32_t n = 0; n < swap.slot_cnt; n++, slot = (slot + 1) % swap.slot_cnt)
+    {
+        if (slot_used(slot))
+        {
+            continue;
+        }
+
+        uint32_t cnt = 0;
+        while (cnt < want && slot + cnt < swap.slot_cnt && !slot_used(slot + cnt))
+        {
+            swap.bitmap[(slot + cnt) / 32] |= 1u << ((slot + cnt) % 32);
+            cnt++;
+        }
+
+        swap.free_cnt -= cnt;
+        swap.hint = (slot + cnt) % swap.slot_cnt;
+        *out_cnt = cnt;
+        return slot;
+    }
+
+    return 0;
+}
+
+void swap_slot_free(uint32_t slot)
+{
+    if (slot >= swap.slot_cnt || !slot_used(slot))
+    {
+        panic("swap_slot_free: invalid slot");
+    }
+
+    swap.bitmap[slot / 32] &= ~(1u << (slot % 32));
+    swap.free_cnt++;
+}
+
+/* ------------------------------------------------------------
+ * Swap I/O
+ * ------------------------------------------------------------ */
+
+/* Write victims to swap; returns the number of pages that were swapped out */
+static uint32_t swap_out(const struct swap_victim *victims, uint32_t cnt)
+{
+    uint32_t done = 0;
+    while (done < cnt)
+    {
+        uint32_t run;
+        uint32_t slot = slots_alloc(cnt - done, &run);
+        if (run == 0)
+        {
+            break;
+        }
+
+        void *pages[SWAP_BATCH];
+        for (uint32_t i = 0; i < run; i++)
+        {
+            uintptr_t pa;
+            mm_get_page(victims[done + i].mm, victims[done + i].va, &pa);
+            pages[i] = mm_pa_to_kva(pa);
+        }
+
+        if (ata_write_pages(SWAP_DRIVE, slot * SECTORS_PER_SLOT, pages, run) < 0)
+        {
+            for (uint32_t i = 0; i < run; i++)
+            {
+                swap_slot_free(slot + i);
+            }
+            break;
+        }
+
+        for (uint32_t i = 0; i < run; i++)
+        {
+            const struct swap_victim *victim = &victims[done + i];
+            mm_frame_free(mm_swap_out_page(victim->mm, victim->va, slot + i));
+        }
+
+        done += run;
+        stats.pswpout += run;
+    }
+
+    return done;
+}
+
+int swap_read_slot(uint32_t slot, void *page)
+{
+    if (ata_read_pages(SWAP_DRIVE, slot * SECTORS_PER_SLOT, &page, 1) < 0)
+    {
+        return -1;
+    }
+
+    stats.pswpin++;
+    return 0;
+}
+
+bool swap_in(struct mm *mm, const struct vma *vma, uintptr_t va, uint32_t slot)
+{
+    uintptr_t frames[SWAP_CLUSTER];
+    void *pages[SWAP_CLUSTER];
+
+    frames[0] = swap_frame_alloc(false);
+    if (!frames[0])
+    {
+        return false;
+    }
+    pages[0] = mm_pa_to_kva(frames[0]);
+
+    /* Read the slots of the following pages along if they were written together */
+    uintptr_t end = vma->base_va + vma->length;
+    uint32_t cnt = 1;
+    uint32_t next;
+    while (cnt < SWAP_CLUSTER &&
+           va + cnt * PAGE_SIZE < end &&
+           mm_get_swap_slot(mm, va + cnt * PAGE_SIZE, &next) &&
+           next == slot + cnt)
+    {
+        frames[cnt] = mm_frame_alloc();
+        if (!frames[cnt])
+        {
+            break;
+        }
+        pages[cnt] = mm_pa_to_kva(frames[cnt]);
+        cnt++;
+    }
+
+    if (ata_read_pages(SWAP_DRIVE, slot * SECTORS_PER_SLOT, pages, cnt) < 0)
+    {
+        for (uint32_t i = 0; i < cnt; i++)
+        {
+            mm_frame_free(frames[i]);
+        }
+        return false;
+    }
+
+    uint32_t mapped = 0;
+    for (; mapped < cnt; mapped++)
+    {
+        if (!mm_map_page(mm, va + mapped * PAGE_SIZE, frames[mapped], vma->flags))
+        {
+            break;
+        }
+        swap_slot_free(slot + mapped);
+    }
+
+    for (uint32_t i = mapped; i < cnt; i++)
+    {
+        mm_frame_free(frames[i]);
+    }
+
+    stats.pswpin += mapped;
+    return mapped > 0;
+}
+
+/* ------------------------------------------------------------
+ * Reclaim
+ * ------------------------------------------------------------ */
+
+static uint32_t reclaim(uint32_t nr_pages, bool direct)
+{
+    /* Process templates and file pages are only caches; drop them before paging anybody out */
+    uint32_t dropped = zygote_shrink(nr_pages);
+    if (dropped < nr_pages)
+    {
+        dropped += pcache_shrink(nr_pages - dropped);
+    }
+    if (dropped >= nr_pages || swap.free_cnt == 0)
+    {
+        return dropped;
+    }
+    nr_pages -= dropped;
+
+    struct swap_victim victims[SWAP_BATCH];
+    uint32_t victim_cnt = 0;
+    uint32_t reclaimed = 0;
+    uint32_t scanned = 0;
+    bool stalled = false;
+
+    while (!stalled && reclaimed + victim_cnt < nr_pages && scanned < SWAP_SCAN_MAX)
+    {
+        struct mm *mm;
+        struct vma *vma;
+        uintptr_t va;
+        if (!mm_sweep_next(&clock, &mm, &vma, &va))
+        {
+            break;
+        }
+        scanned++;
+
+        uint32_t state = mm_page_state(mm, va);
+        if (!(state & MM_PAGE_PRESENT))
+        {
+            continue;
+        }
+
+        /*
+         * A frame others map too (KSM merged, zygote shared) stays in memory
+         * when one mapping swaps out, and swap-in would undo the sharing
+         */
+        uintptr_t pa;
+        if ((state & MM_PAGE_COW) || !mm_get_page(mm, va, &pa) || mm_frame_refs(pa) > 1)
+        {
+            continue;
+        }
+
+        /* Referenced since the last sweep: second chance */
+        if (mm_clear_accessed(mm, va))
+        {
+            continue;
+        }
+
+        victims[victim_cnt].mm = mm;
+        victims[victim_cnt].va = va;
+        victim_cnt++;
+
+        if (victim_cnt == SWAP_BATCH)
+        {
+            uint32_t out = swap_out(victims, victim_cnt);
+            stalled = out < victim_cnt;
+            reclaimed += out;
+            victim_cnt = 0;
+        }
+    }
+
+    if (victim_cnt > 0)
+    {
+        reclaimed += swap_out(victims, victim_cnt);
+    }
+
+    if (direct)
+    {
+        stats.pgscan_direct += scanned;
+        stats.pgsteal_direct += reclaimed;
+    }
+    else
+    {
+        stats.pgscan_kswapd += scanned;
+        stats.pgsteal_kswapd += reclaimed;
+    }
+    return dropped + reclaimed;
+}
+
+void swap_reclaim_direct(void)
+{
+    if (mm_frames_free() < SWAP_FREE_LOW)
+    {
+        reclaim(SWAP_BATCH, true);
+    }
+}
+
+void swap_reclaim_background(void)
+{
+    if (mm_frames_free() < SWAP_FREE_HIGH)
+    {
+        reclaim(SWAP_BATCH, false);
+    }
+}
+
+uintptr_t swap_frame_alloc(bool zeroed)
+{
+    uintptr_t pa = zeroed ? mm_frame_alloc_zeroed() : mm_frame_alloc();
+    if (!pa && reclaim(SWAP_BATCH, true) > 0)
+    {
+        pa = zeroed ? mm_frame_alloc_zeroed() : mm_frame_alloc();
+    }
+    return pa;
+}
+
+/* ------------------------------------------------------------
+ * Init / stats
+ * ------------------------------------------------------------ */
+
+void swap_init(void)
+{
+    uint32_t slots = ata_sector_count(SWAP_DRIVE) / SECTORS_PER_SLOT;
+    if (slots > SWAP_MAX_SLOTS)
+    {
+        slots = SWAP_MAX_SLOTS;
+    }
+
+    swap.slot_cnt = slots;
+    swap.free_cnt = slots;
+    swap.hint = 0;
+
+    if (slots == 0)
+    {
+        kprintf("Swap: no swap drive.\n");
+        return;
+    }
+    kprintf("Swap: %u KB.\n", slots * (PAGE_SIZE / 1024));
+}
+
+void swap_stat(struct swap_stat *stat)
+{
+    *stat = stats;
+    stat->total_slots = swap.slot_cnt;
+    stat->free_slots = swap.free_cnt;
+}
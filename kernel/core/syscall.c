@@ -8,6 +8,8 @@
 #include "dirent.h"
 #include "kernel/elf_loader.h"
 #include "kernel/vfs.h"
+#include "kernel/poll.h"
+#include "kernel/eventpoll.h"
 #include "kernel/mm.h"
 #include "kernel/clock.h"
 
@@ -32,6 +34,9 @@ uint32_t sys_enter_dispatch_c(uint32_t nr, uint32_t a1, uint32_t a2, uint32_t a3
 
     current->sys_call_cnt++;
 
+    /* Faults can't be taken on the user stack, so keep room committed below it */
+    mm_stack_reserve(current->mm, current->cpu_ctx.u_sp);
+
     switch (nr)
     {
         case SYS_write:
@@ -44,6 +49,52 @@ uint32_t sys_enter_dispatch_c(uint32_t nr, uint32_t a1, uint32_t a2, uint32_t a3
             result = (uint32_t) vfs_read((int) a1, (void *) a2, (size_t) a3);
             break;
 
+        case SYS_lseek:
+            result = (uint32_t) vfs_lseek(current, (int) a1, (off_t) a2, (int) a3);
+            break;
+
+        case SYS_pread64:
+            sched_schedule();
+            result = (uint32_t) vfs_pread(current, (int) a1, (void *) a2, (size_t) a3, (off_t) a4);
+            break;
+
+        case SYS_pwrite64:
+            sched_schedule();
+            result = (uint32_t) vfs_pwrite(current, (int) a1, (const void *) a2, (size_t) a3, (off_t) a4);
+            break;
+
+        case SYS_readv:
+            sched_schedule();
+            result = (uint32_t) vfs_readv(current, (int) a1, (const struct iovec *) a2, (int) a3);
+            break;
+
+        case SYS_writev:
+            sched_schedule();
+            result = (uint32_t) vfs_writev(current, (int) a1, (const struct iovec *) a2, (int) a3);
+            break;
+
+        case SYS_poll:
+            sched_schedule();
+            result = (uint32_t) vfs_poll(current, (struct pollfd *) a1, (nfds_t) a2, (int) a3);
+            break;
+
+        case SYS_epoll_create:
+            result = (int) a1 <= 0 ? (uint32_t) -EINVAL : (uint32_t) eventpoll_create(current, 0);
+            break;
+
+        case SYS_epoll_create1:
+            result = (uint32_t) eventpoll_create(current, (int) a1);
+            break;
+
+        case SYS_epoll_ctl:
+            result = (uint32_t) eventpoll_ctl(current, (int) a1, (int) a2, (int) a3, (struct epoll_event *) a4);
+            break;
+
+        case SYS_epoll_wait:
+            sched_schedule();
+            result = (uint32_t) eventpoll_wait(current, (int) a1, (struct epoll_event *) a2, (int) a3, (int) a4);
+            break;
+
         case SYS_open:
             sched_schedule();
             result = (uint32_t) vfs_open(current, (const char *) a1, (int) a2, (int) a3);
@@ -54,6 +105,62 @@ uint32_t sys_enter_dispatch_c(uint32_t nr, uint32_t a1, uint32_t a2, uint32_t a3
             result = (uint32_t) vfs_close(current, (int) a1);
             break;
 
+        case SYS_pipe:
+            result = (uint32_t) vfs_pipe(current, (int *) a1, 0);
+            break;
+
+        case SYS_pipe2:
+            result = (uint32_t) vfs_pipe(current, (int *) a1, (int) a2);
+            break;
+
+        case SYS_dup:
+            result = (uint32_t) vfs_dup(current, (int) a1);
+            break;
+
+        case SYS_dup2:
+            result = (uint32_t) vfs_dup2(current, (int) a1, (int) a2);
+            break;
+
+        case SYS_fcntl:
+            result = (uint32_t) vfs_fcntl(current, (int) a1, (int) a2, (int) a3);
+            break;
+
+        case SYS_unlink:
+            sched_schedule();
+            result = (uint32_t) vfs_unlink(current, (const char *) a1);
+            break;
+
+        case SYS_rename:
+            sched_schedule();
+            result = (uint32_t) vfs_rename(current, (const char *) a1, (const char *) a2);
+            break;
+
+        case SYS_mkdir:
+            sched_schedule();
+            result = (uint32_t) vfs_mkdir(current, (const char *) a1, (int) a2);
+            break;
+
+        case SYS_rmdir:
+            sched_schedule();
+            result = (uint32_t) vfs_rmdir(current, (const char *) a1);
+            break;
+
+        case SYS_fsync:
+            sched_schedule();
+            result = (uint32_t) vfs_fsync(current, (int) a1);
+            break;
+
+        case SYS_sync:
+            sched_schedule();
+            vfs_sync();
+            result = 0;
+            break;
+
+        case SYS_ftruncate:
+            sched_schedule();
+            result = (uint32_t) vfs_ftruncate(current, (int) a1, (off_t) a2);
+            break;
+
         case SYS_getdents:
             sched_schedule();
             result = (uint32_t) vfs_getdents((int) a1, (struct dirent *) a2, (unsigned int) a3);
@@ -99,6 +206,10 @@ uint32_t sys_enter_dispatch_c(uint32_t nr, uint32_t a1, uint32_t a2, uint32_t a3
             break;
 
         case SYS_sched_yield:
+            if (current == sched.swapper)
+            {
+                sched_idle();
+            }
             sched_schedule();
             result = 0;
             break;
@@ -112,6 +223,26 @@ uint32_t sys_enter_dispatch_c(uint32_t nr, uint32_t a1, uint32_t a2, uint32_t a3
             result = (uint32_t) mm_brk((void *) a1);
             break;
 
+        case SYS_mmap:
+        {
+            /* Six arguments don't fit in registers; a1 points to the argument block */
+            const struct mmap_args *args = (const struct mmap_args *) a1;
+            sched_schedule();
+            result = (uint32_t) mm_mmap((void *) args->addr, (size_t) args->len, (int) args->prot,
+                                        (int) args->flags, (int) args->fd, (off_t) args->offset);
+            break;
+        }
+
+        case SYS_munmap:
+            sched_schedule();
+            result = (uint32_t) mm_munmap((void *) a1, (size_t) a2);
+            break;
+
+        case SYS_mprotect:
+            sched_schedule();
+            result = (uint32_t) mm_mprotect((void *) a1, (size_t) a2, (int) a3);
+            break;
+
         case SYS_chdir:
             sched_schedule();
             result = (uint32_t) vfs_chdir((const char *) a1);
@@ -4,6 +4,7 @@
 #include "kernel/kutils.h"
 #include "kernel/vfs.h"
 #include "kernel/mm.h"
+#include "kernel/kstack.h"
 
 #define PID_MASK (MAX_PROCESS_CNT -1)
 
@@ -17,7 +18,6 @@ void task_table_init(struct task_table *task_table)
     task_table->free_head = 0;
     task_table->free_tail = MAX_PROCESS_CNT;
 
-    uint32_t next_free_pa = PROCESS_PA_START;
     for (int task_idx = 0; task_idx < MAX_PROCESS_CNT; task_idx++)
     {
         struct task_slot *slot = &task_table->slots[task_idx];
@@ -30,19 +30,11 @@ void task_table_init(struct task_table *task_table)
         task->state = TASK_POOLED;
         task->pid = PID_NONE;
 
-        struct mm *mm = mm_fork_kernel();
-        mm_add_vma(mm,
-                   VMA_TYPE_PROCESS,
-                   PROCESS_VA_BASE,
-                   PROCESS_VA_SIZE,
-                   VMA_READ | VMA_WRITE | VMA_EXEC | VMA_USER,
-                   next_free_pa);
-        task->mm = mm;
+        /* User memory is mapped on exec and committed on use */
+        task->mm = mm_fork_kernel();
 
         task_table->free_ring[task_idx] = task_idx;
         files_init(&task->files);
-
-        next_free_pa += PROCESS_VA_SIZE;
     }
 }
 
@@ -78,6 +70,12 @@ struct task *task_table_alloc(struct task_table *task_table)
     struct task_slot *slot = &task_table->slots[slot_idx];
     struct task *task = &slot->task;
 
+    task->kstack = kstack_alloc(slot_idx);
+    if (!task->kstack)
+    {
+        return NULL;
+    }
+
     task->pid = slot->generation * MAX_PROCESS_CNT + slot_idx;
     // we need to take care of the wrap around of the slot->generation
     slot->generation = (slot->generation + 1) & MAX_GENERATION;
@@ -108,6 +106,9 @@ void task_table_free(struct task_table *task_table, struct task *task)
         panic("task_table_free: task pointer/slot mismatch");
     }
 
+    kstack_free(task->kstack);
+    task->kstack = 0;
+
     task_table->free_ring[free_ring_idx] = slot_idx;
     task_table->free_tail++;
     task->pid = PID_NONE;
@@ -1,3 +1,4 @@
+#include "errno.h"
 #include "kernel/tty.h"
 #include "kernel/keyboard.h"
 #include "kernel/console.h"
@@ -5,6 +6,7 @@
 #include "kernel/wait.h"
 #include "kernel/kutils.h"
 #include "kernel/dev.h"
+#include "kernel/poll.h"
 
 #define TTY_INPUT_BUF_MASK  (TTY_INPUT_BUF_SIZE  - 1u)
 #define TTY_OUTPUT_BUF_MASK (TTY_OUTPUT_BUF_SIZE - 1u)
@@ -116,6 +118,11 @@ static ssize_t tty_read(struct file *file, void *buf, size_t count)
         return -1;
     }
 
+    if (!tty_input_available(tty) && (file->flags & O_NONBLOCK))
+    {
+        return -EAGAIN;
+    }
+
     wait_event(&tty->in_wait_queue, tty_input_available, tty, WAIT_INTERRUPTIBLE);
 
     size_t available = tty->in_head - tty->in_tail;
@@ -184,11 +191,31 @@ static ssize_t tty_write(struct file *file, const void *buf, size_t count)
     return (ssize_t)written;
 }
 
+/* Output never blocks, input is ready once a key is buffered */
+static uint32_t tty_poll(struct file *file, struct poll_table *pt)
+{
+    struct tty *tty = (struct tty *)file->driver_data;
+    if (tty == NULL)
+    {
+        return POLLERR;
+    }
+
+    poll_wait(&tty->in_wait_queue, pt);
+
+    uint32_t mask = POLLOUT | POLLWRNORM;
+    if (tty_input_available(tty))
+    {
+        mask |= POLLIN | POLLRDNORM;
+    }
+    return mask;
+}
+
 struct dev_ops tty_dev_ops = {
         .open = tty_open,
         .close = tty_close,
         .read = tty_read,
         .write = tty_write,
+        .poll = tty_poll,
 };
 
 /* ------------------------------------------------------------------
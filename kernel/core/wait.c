@@ -23,6 +23,20 @@ void wait_queue_entry_init(struct wait_queue_entry *entry, struct task *task)
     entry->prev = NULL;
     entry->next = NULL;
     entry->queue = NULL;
+    entry->func = NULL;
+    entry->private = NULL;
+}
+
+void wait_queue_entry_init_func(struct wait_queue_entry *entry, wait_func_t func, void *private)
+{
+    if (entry == NULL)
+    {
+        return;
+    }
+
+    wait_queue_entry_init(entry, NULL);
+    entry->func = func;
+    entry->private = private;
 }
 
 void wait_queue_add(struct wait_queue *queue, struct wait_queue_entry *entry)
@@ -99,20 +113,22 @@ void wakeup(struct wait_queue *queue)
 
     struct wait_queue_entry *entry = queue->head;
 
-    /* detach whole list first */
-    queue->head = NULL;
-    queue->tail = NULL;
-
-
     while (entry != NULL)
     {
         struct wait_queue_entry *next = entry->next;
+
+        /* Callback entries stay queued */
+        if (entry->func != NULL)
+        {
+            entry->func(entry);
+            entry = next;
+            continue;
+        }
+
         struct task *task = entry->task;
 
         /* fully detach entry */
-        entry->prev = NULL;
-        entry->next = NULL;
-        entry->queue = NULL;
+        wait_queue_remove(entry);
 
         if (task != NULL &&
             (task->state == TASK_INTERRUPTIBLE || task->state == TASK_UNINTERRUPTIBLE))
@@ -0,0 +1,282 @@
+// zygote.c
+//
+// Process templates. Exec used to copy every file backed page of the ELF
+// image into fresh frames. Now the first exec of a binary loads it as usual
+// and the loaded frames are kept as the template of that binary: the
+// template takes a reference to each of them and the task that loaded them
+// gets them remapped copy-on-write. Every later exec of the binary maps the
+// same frames copy-on-write, so text is shared and a data page is only
+// copied once a process writes to it.
+//
+// Only the ELF image is kept. The stack, the heap and the argv/envp block
+// on it differ per exec and are set up fresh every time.
+//
+// Templates are a cache: reclaim drops the least recently used ones first.
+// Frames still mapped by a process stay alive through that mapping.
+
+#include <stdint.h>
+#include "errno.h"
+#include "kernel/zygote.h"
+#include "kernel/kutils.h"
+
+#define PAGE_SIZE               4096u
+#define PAGE_CNT(size)          (((size) + PAGE_SIZE - 1) / PAGE_SIZE)
+
+#define ZYGOTE_MAX_TEMPLATES    8
+#define ZYGOTE_MAX_SEGMENTS     4
+/* The page index of a template is a single frame */
+#define ZYGOTE_MAX_PAGES        (PAGE_SIZE / sizeof(uintptr_t))
+
+struct zygote_segment
+{
+    uintptr_t va;
+    size_t length;
+    uint32_t flags;
+    /* Index of the first page in the page index */
+    uint32_t first_page;
+};
+
+struct zygote
+{
+    const struct embedded_bin *bin;
+    struct elf_info elf_info;
+    struct zygote_segment segments[ZYGOTE_MAX_SEGMENTS];
+    uint32_t segment_cnt;
+    uint32_t page_cnt;
+    /* Frames that are actually held (bss pages have none) */
+    uint32_t resident;
+    /* Page index: a frame per page of the segments, 0 = not loaded */
+    uintptr_t index_pa;
+    uintptr_t *pages;
+    uint64_t last_used;
+};
+
+static struct
+{
+    struct zygote templates[ZYGOTE_MAX_TEMPLATES];
+    uint64_t clock;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} zygotes;
+
+/* ------------------------------------------------------------
+ * Templates
+ * ------------------------------------------------------------ */
+
+static struct zygote *zygote_find(const struct embedded_bin *bin)
+{
+    for (uint32_t i = 0; i < ZYGOTE_MAX_TEMPLATES; i++)
+    {
+        if (zygotes.templates[i].bin == bin)
+        {
+            return &zygotes.templates[i];
+        }
+    }
+    return NULL;
+}
+
+static struct zygote *zygote_lru(void)
+{
+    struct zygote *lru = NULL;
+    for (uint32_t i = 0; i < ZYGOTE_MAX_TEMPLATES; i++)
+    {
+        struct zygote *z = &zygotes.templates[i];
+        if (z->bin && (!lru || z->last_used < lru->last_used))
+        {
+            lru = z;
+        }
+    }
+    return lru;
+}
+
+/* Drop a template; returns the number of frames that were actually freed */
+static uint32_t zygote_evict(struct zygote *z)
+{
+    uint32_t freed = 0;
+    for (uint32_t i = 0; i < z->page_cnt; i++)
+    {
+        uintptr_t pa = z->pages[i];
+        if (pa)
+        {
+            freed += mm_frame_refs(pa) == 1;
+            mm_frame_free(pa);
+        }
+    }
+
+    mm_frame_free(z->index_pa);
+    freed++;
+
+    k_memset(z, 0, sizeof(*z));
+    zygotes.evictions++;
+    return freed;
+}
+
+/* ------------------------------------------------------------
+ * Public API
+ * ------------------------------------------------------------ */
+
+int zygote_clone(const struct embedded_bin *bin, struct mm *mm, struct elf_info *elf_info)
+{
+    struct zygote *z = zygote_find(bin);
+    if (!z)
+    {
+        zygotes.misses++;
+        return -ENOENT;
+    }
+
+    z->last_used = ++zygotes.clock;
+    zygotes.hits++;
+
+    for (uint32_t s = 0; s < z->segment_cnt; s++)
+    {
+        const struct zygote_segment *seg = &z->segments[s];
+
+        struct vma *vma = mm_vma_alloc();
+        if (!vma)
+        {
+            return -ENOMEM;
+        }
+
+        vma->base_va = seg->va;
+        vma->length = seg->length;
+        vma->flags = seg->flags;
+        vma->type = VMA_TYPE_IMAGE;
+        if (mm_vma_insert(mm, vma) < 0)
+        {
+            mm_vma_free(vma);
+            return -ENOMEM;
+        }
+
+        for (uint32_t i = 0; i < PAGE_CNT(seg->length); i++)
+        {
+            uintptr_t pa = z->pages[seg->first_page + i];
+            if (!pa)
+            {
+                continue;
+            }
+
+            mm_frame_get(pa);
+            if (!mm_map_page_cow(mm, seg->va + i * PAGE_SIZE, pa, seg->flags))
+            {
+                mm_frame_free(pa);
+                return -ENOMEM;
+            }
+        }
+    }
+
+    *elf_info = z->elf_info;
+    return 0;
+}
+
+void zygote_capture(const struct embedded_bin *bin, struct mm *mm, const struct elf_info *elf_info)
+{
+    /* The image VMAs are the only ones so far; all loaded pages must still be resident */
+    uint32_t segment_cnt = 0;
+    uint32_t page_cnt = 0;
+    for (uint32_t v = 0; v < mm->vma_cnt; v++)
+    {
+        const struct vma *vma = mm->vmas[v];
+        if (vma->type != VMA_TYPE_IMAGE)
+        {
+            continue;
+        }
+
+        segment_cnt++;
+        page_cnt += PAGE_CNT(vma->length);
+        if (segment_cnt > ZYGOTE_MAX_SEGMENTS || page_cnt > ZYGOTE_MAX_PAGES)
+        {
+            return;
+        }
+
+        for (uintptr_t va = vma->base_va; va < vma->base_va + vma->length; va += PAGE_SIZE)
+        {
+            if (mm_page_state(mm, va) & MM_PAGE_SWAPPED)
+            {
+                return;
+            }
+        }
+    }
+
+    struct zygote *z = zygote_find(NULL);
+    if (!z)
+    {
+        z = zygote_lru();
+        zygote_evict(z);
+    }
+
+    uintptr_t index_pa = mm_frame_alloc_zeroed();
+    if (!index_pa)
+    {
+        return;
+    }
+
+    z->bin = bin;
+    z->elf_info = *elf_info;
+    z->index_pa = index_pa;
+    z->pages = mm_pa_to_kva(index_pa);
+    z->last_used = ++zygotes.clock;
+
+    for (uint32_t v = 0; v < mm->vma_cnt; v++)
+    {
+        const struct vma *vma = mm->vmas[v];
+        if (vma->type != VMA_TYPE_IMAGE)
+        {
+            continue;
+        }
+
+        struct zygote_segment *seg = &z->segments[z->segment_cnt++];
+        seg->va = vma->base_va;
+        seg->length = vma->length;
+        seg->flags = vma->flags;
+        seg->first_page = z->page_cnt;
+
+        for (uintptr_t va = vma->base_va; va < vma->base_va + vma->length; va += PAGE_SIZE)
+        {
+            uintptr_t pa;
+            if (mm_get_page(mm, va, &pa))
+            {
+                /* The page table exists already, so remapping can't fail */
+                mm_frame_get(pa);
+                mm_map_page_cow(mm, va, pa, vma->flags);
+                z->pages[z->page_cnt] = pa;
+                z->resident++;
+            }
+            z->page_cnt++;
+        }
+    }
+}
+
+uint32_t zygote_shrink(uint32_t nr_pages)
+{
+    uint32_t freed = 0;
+    while (freed < nr_pages)
+    {
+        struct zygote *z = zygote_lru();
+        if (!z)
+        {
+            break;
+        }
+        freed += zygote_evict(z);
+    }
+    return freed;
+}
+
+void zygote_stat(struct zygote_stat *stat)
+{
+    k_memset(stat, 0, sizeof(*stat));
+
+    for (uint32_t i = 0; i < ZYGOTE_MAX_TEMPLATES; i++)
+    {
+        const struct zygote *z = &zygotes.templates[i];
+        if (z->bin)
+        {
+            stat->templates++;
+            stat->pages += z->resident + 1;
+        }
+    }
+
+    stat->hits = zygotes.hits;
+    stat->misses = zygotes.misses;
+    stat->evictions = zygotes.evictions;
+}
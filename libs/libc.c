@@ -1,6 +1,7 @@
 #include <stdint.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include "string.h"
 #include "kernel/syscall.h"
 #include "fcntl.h"
@@ -8,6 +9,13 @@
 #include "unistd.h"
 #include "syscall_arch.h"
 #include "stat.h"
+#include "sys/mman.h"
+#include "sys/uio.h"
+#include "sys/select.h"
+#include "sys/epoll.h"
+#include "poll.h"
+#include "stdlib.h"
+#include "malloc.h"
 
 void delay(uint32_t count)
 {
@@ -121,6 +129,18 @@ void *memcpy(void *dest, const void *src, size_t n)
     return dest;
 }
 
+void *memset(void *dest, int c, size_t n)
+{
+    unsigned char *d = (unsigned char *) dest;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        d[i] = (unsigned char) c;
+    }
+
+    return dest;
+}
+
 int atoi(const char *str)
 {
     int result = 0;
@@ -758,11 +778,157 @@ int open(const char *pathname, int flags, int mode)
                           (uint32_t)mode);
 }
 
+off_t lseek(int fd, off_t offset, int whence)
+{
+    return (off_t)__syscall3(SYS_lseek, (uint32_t)fd, (uint32_t)offset, (uint32_t)whence);
+}
+
+/* off_t is 32 bits, so the high word of the 64 bit offset is left out */
+ssize_t pread(int fd, void *buf, size_t count, off_t offset)
+{
+    return (ssize_t)__syscall4(SYS_pread64, (uint32_t)fd, (uint32_t)buf, (uint32_t)count, (uint32_t)offset);
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+    return (ssize_t)__syscall4(SYS_pwrite64, (uint32_t)fd, (uint32_t)buf, (uint32_t)count, (uint32_t)offset);
+}
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt)
+{
+    return (ssize_t)__syscall3(SYS_readv, (uint32_t)fd, (uint32_t)iov, (uint32_t)iovcnt);
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    return (ssize_t)__syscall3(SYS_writev, (uint32_t)fd, (uint32_t)iov, (uint32_t)iovcnt);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    return (int)__syscall3(SYS_poll, (uint32_t)fds, (uint32_t)nfds, (uint32_t)timeout);
+}
+
+/* select() on top of poll(): one pollfd per fd in any of the sets */
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout)
+{
+    if (nfds < 0 || nfds > FD_SETSIZE)
+    {
+        return -1;
+    }
+
+    struct pollfd fds[FD_SETSIZE];
+    nfds_t count = 0;
+    for (int fd = 0; fd < nfds; fd++)
+    {
+        short events = 0;
+        if (readfds && FD_ISSET(fd, readfds))
+            events |= POLLIN;
+        if (writefds && FD_ISSET(fd, writefds))
+            events |= POLLOUT;
+        if (exceptfds && FD_ISSET(fd, exceptfds))
+            events |= POLLPRI;
+        if (events)
+        {
+            fds[count].fd = fd;
+            fds[count].events = events;
+            count++;
+        }
+    }
+
+    int ms = timeout ? (int)(timeout->tv_sec * 1000 + timeout->tv_usec / 1000) : -1;
+    int res = poll(fds, count, ms);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    if (readfds)
+        FD_ZERO(readfds);
+    if (writefds)
+        FD_ZERO(writefds);
+    if (exceptfds)
+        FD_ZERO(exceptfds);
+
+    /* select counts every set bit, poll every fd */
+    int ready = 0;
+    for (nfds_t i = 0; i < count; i++)
+    {
+        short revents = fds[i].revents;
+        if (readfds && (revents & (POLLIN | POLLHUP | POLLERR)) && (fds[i].events & POLLIN))
+        {
+            FD_SET(fds[i].fd, readfds);
+            ready++;
+        }
+        if (writefds && (revents & (POLLOUT | POLLERR)) && (fds[i].events & POLLOUT))
+        {
+            FD_SET(fds[i].fd, writefds);
+            ready++;
+        }
+        if (exceptfds && (revents & POLLPRI))
+        {
+            FD_SET(fds[i].fd, exceptfds);
+            ready++;
+        }
+    }
+    return ready;
+}
+
+int epoll_create(int size)
+{
+    return (int)__syscall1(SYS_epoll_create, (uint32_t)size);
+}
+
+int epoll_create1(int flags)
+{
+    return (int)__syscall1(SYS_epoll_create1, (uint32_t)flags);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+    return (int)__syscall4(SYS_epoll_ctl, (uint32_t)epfd, (uint32_t)op, (uint32_t)fd, (uint32_t)event);
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+    return (int)__syscall4(SYS_epoll_wait, (uint32_t)epfd, (uint32_t)events, (uint32_t)maxevents, (uint32_t)timeout);
+}
+
 int close(int fd)
 {
     return (int)__syscall1(SYS_close, (uint32_t)fd);
 }
 
+int dup(int oldfd)
+{
+    return (int)__syscall1(SYS_dup, (uint32_t)oldfd);
+}
+
+int dup2(int oldfd, int newfd)
+{
+    return (int)__syscall2(SYS_dup2, (uint32_t)oldfd, (uint32_t)newfd);
+}
+
+int pipe(int fds[2])
+{
+    return (int)__syscall1(SYS_pipe, (uint32_t)fds);
+}
+
+int pipe2(int fds[2], int flags)
+{
+    return (int)__syscall2(SYS_pipe2, (uint32_t)fds, (uint32_t)flags);
+}
+
+int fcntl(int fd, int cmd, ...)
+{
+    va_list ap;
+    va_start(ap, cmd);
+    int arg = va_arg(ap, int);
+    va_end(ap);
+
+    return (int)__syscall3(SYS_fcntl, (uint32_t)fd, (uint32_t)cmd, (uint32_t)arg);
+}
+
 int getdents(int fd, struct dirent *buf, unsigned int count)
 {
     return (int)__syscall3(SYS_getdents,
@@ -804,6 +970,43 @@ int chdir(const char *path)
     return (int)__syscall1(SYS_chdir, (uint32_t)path);
 }
 
+int unlink(const char *pathname)
+{
+    return (int)__syscall1(SYS_unlink, (uint32_t)pathname);
+}
+
+int mkdir(const char *pathname, mode_t mode)
+{
+    return (int)__syscall2(SYS_mkdir, (uint32_t)pathname, (uint32_t)mode);
+}
+
+int rmdir(const char *pathname)
+{
+    return (int)__syscall1(SYS_rmdir, (uint32_t)pathname);
+}
+
+int rename(const char *oldpath, const char *newpath)
+{
+    return (int)__syscall2(SYS_rename, (uint32_t)oldpath, (uint32_t)newpath);
+}
+
+int ftruncate(int fd, off_t length)
+{
+    return (int)__syscall2(SYS_ftruncate,
+                          (uint32_t)fd,
+                          (uint32_t)length);
+}
+
+int fsync(int fd)
+{
+    return (int)__syscall1(SYS_fsync, (uint32_t)fd);
+}
+
+void sync(void)
+{
+    (void)__syscall0(SYS_sync);
+}
+
 char *getcwd(char *buf, size_t size)
 {
     return (char *)__syscall2(SYS_getcwd,
@@ -815,27 +1018,382 @@ void *__curbrk = 0;
 
 int brk(void *addr)
 {
-    return (int)__syscall1(SYS_brk, (uint32_t)addr);
+    /* The kernel returns the new break, or the current one on failure */
+    void *res = (void *)__syscall1(SYS_brk, (uint32_t)addr);
+    __curbrk = res;
+    return res == addr ? 0 : -1;
 }
 
 void *sbrk(intptr_t increment)
 {
+    if (__curbrk == 0)
+        __curbrk = (void *)__syscall1(SYS_brk, 0);
+
     void *old_brk = __curbrk;
 
     if (increment != 0)
     {
-        void *new_brk = (char *)old_brk + increment;
-        int rc = (int)__syscall1(SYS_brk, (uint32_t)new_brk);
-
-        if (rc == 0)
-            __curbrk = new_brk;
-        else
+        if (brk((char *)old_brk + increment) != 0)
             return (void *)-1;
     }
 
     return old_brk;
 }
 
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+    /* old_mmap convention: the six arguments are passed as one block */
+    uint32_t args[6] = {
+        (uint32_t)addr, (uint32_t)length, (uint32_t)prot,
+        (uint32_t)flags, (uint32_t)fd, (uint32_t)offset
+    };
+
+    long rc = __syscall1(SYS_mmap, (uint32_t)args);
+    if ((unsigned long)rc >= (unsigned long)-4095)
+        return MAP_FAILED;
+    return (void *)rc;
+}
+
+int munmap(void *addr, size_t length)
+{
+    return (int)__syscall2(SYS_munmap,
+                          (uint32_t)addr,
+                          (uint32_t)length);
+}
+
+int mprotect(void *addr, size_t length, int prot)
+{
+    return (int)__syscall3(SYS_mprotect,
+                          (uint32_t)addr,
+                          (uint32_t)length,
+                          (uint32_t)prot);
+}
+
+#define SHM_DIR "/dev/shm"
+
+/* "/name" -> "/dev/shm/name"; -1 when it doesn't fit */
+static int shm_path(const char *name, char *path, size_t size)
+{
+    if (*name == '/')
+    {
+        name++;
+    }
+
+    if (*name == '\0' || strchr(name, '/') != NULL ||
+        sizeof(SHM_DIR) + 1 + strlen(name) > size)
+    {
+        return -1;
+    }
+
+    strcpy(path, SHM_DIR "/");
+    strcat(path, name);
+    return 0;
+}
+
+int shm_open(const char *name, int oflag, int mode)
+{
+    char path[64];
+    if (shm_path(name, path, sizeof(path)) < 0)
+    {
+        return -1;
+    }
+    return open(path, oflag, mode);
+}
+
+int shm_unlink(const char *name)
+{
+    char path[64];
+    if (shm_path(name, path, sizeof(path)) < 0)
+    {
+        return -1;
+    }
+    return unlink(path);
+}
+
+/* ------------------------------------------------------------
+ * malloc
+ *
+ * Small requests are served from power-of-two size classes (16..4096 bytes
+ * including an 8 byte chunk header). Each class bump-allocates chunks from
+ * its current slab and recycles freed chunks through a LIFO free list.
+ * Slabs are carved from arenas taken from the brk heap, falling back to
+ * mmap once the heap is exhausted. Large requests get their own mapping.
+ * ------------------------------------------------------------ */
+
+#define MALLOC_MIN_SHIFT    4
+#define MALLOC_CLASS_CNT    9                           /* 16 .. 4096 */
+#define MALLOC_MAX_CHUNK    (1u << (MALLOC_MIN_SHIFT + MALLOC_CLASS_CNT - 1))
+#define MALLOC_SLAB_SIZE    16384u
+#define MALLOC_ARENA_SIZE   65536u
+#define MALLOC_PAGE_SIZE    4096u
+
+#define CHUNK_MAGIC_SMALL   0xA110C8EDu
+#define CHUNK_MAGIC_LARGE   0xB16A110Cu
+
+struct chunk_hdr
+{
+    uint32_t magic;
+    uint32_t size;      /* class index (small) or mapping length (large) */
+};
+
+struct free_chunk
+{
+    struct chunk_hdr hdr;
+    struct free_chunk *next;
+};
+
+struct size_class
+{
+    struct free_chunk *free_list;
+    char *bump;
+    char *bump_end;
+    uint32_t in_use;
+    uint32_t free_cnt;
+};
+
+struct malloc_state
+{
+    struct size_class classes[MALLOC_CLASS_CNT];
+    char *arena;
+    char *arena_end;
+    size_t arena_bytes;
+    size_t large_bytes;
+    uint32_t large_cnt;
+};
+
+static struct malloc_state malloc_state;
+
+static inline uint32_t chunk_size(uint32_t class_idx)
+{
+    return 1u << (MALLOC_MIN_SHIFT + class_idx);
+}
+
+static uint32_t size_to_class(size_t size)
+{
+    size_t needed = size + sizeof(struct chunk_hdr);
+    uint32_t class_idx = 0;
+
+    while (chunk_size(class_idx) < needed)
+    {
+        class_idx++;
+    }
+
+    return class_idx;
+}
+
+static bool malloc_arena_refill(void)
+{
+    /* Keep arenas page aligned so slabs never straddle a page needlessly */
+    uintptr_t cur = (uintptr_t) sbrk(0);
+    uintptr_t pad = (MALLOC_PAGE_SIZE - (cur & (MALLOC_PAGE_SIZE - 1))) & (MALLOC_PAGE_SIZE - 1);
+
+    char *arena = sbrk((intptr_t) (pad + MALLOC_ARENA_SIZE));
+    if (arena != (char *) -1)
+    {
+        arena += pad;
+    }
+    else
+    {
+        arena = mmap(NULL, MALLOC_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (arena == MAP_FAILED)
+        {
+            return false;
+        }
+    }
+
+    malloc_state.arena = arena;
+    malloc_state.arena_end = arena + MALLOC_ARENA_SIZE;
+    malloc_state.arena_bytes += MALLOC_ARENA_SIZE;
+    return true;
+}
+
+static bool malloc_slab_refill(struct size_class *sc)
+{
+    if ((size_t) (malloc_state.arena_end - malloc_state.arena) < MALLOC_SLAB_SIZE)
+    {
+        if (!malloc_arena_refill())
+        {
+            return false;
+        }
+    }
+
+    sc->bump = malloc_state.arena;
+    sc->bump_end = malloc_state.arena + MALLOC_SLAB_SIZE;
+    malloc_state.arena += MALLOC_SLAB_SIZE;
+    return true;
+}
+
+static void *malloc_large(size_t size)
+{
+    size_t length = (size + sizeof(struct chunk_hdr) + MALLOC_PAGE_SIZE - 1) & ~(MALLOC_PAGE_SIZE - 1);
+    if (length < size)
+    {
+        return NULL;
+    }
+
+    struct chunk_hdr *hdr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (hdr == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    hdr->magic = CHUNK_MAGIC_LARGE;
+    hdr->size = (uint32_t) length;
+    malloc_state.large_bytes += length;
+    malloc_state.large_cnt++;
+    return hdr + 1;
+}
+
+void *malloc(size_t size)
+{
+    if (size > MALLOC_MAX_CHUNK - sizeof(struct chunk_hdr))
+    {
+        return malloc_large(size);
+    }
+
+    uint32_t class_idx = size_to_class(size);
+    struct size_class *sc = &malloc_state.classes[class_idx];
+    struct chunk_hdr *hdr;
+
+    if (sc->free_list)
+    {
+        struct free_chunk *chunk = sc->free_list;
+        sc->free_list = chunk->next;
+        sc->free_cnt--;
+        hdr = &chunk->hdr;
+    }
+    else
+    {
+        if (sc->bump == sc->bump_end && !malloc_slab_refill(sc))
+        {
+            return NULL;
+        }
+        hdr = (struct chunk_hdr *) sc->bump;
+        sc->bump += chunk_size(class_idx);
+    }
+
+    hdr->magic = CHUNK_MAGIC_SMALL;
+    hdr->size = class_idx;
+    sc->in_use++;
+    return hdr + 1;
+}
+
+void free(void *ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+
+    struct chunk_hdr *hdr = (struct chunk_hdr *) ptr - 1;
+
+    if (hdr->magic == CHUNK_MAGIC_SMALL && hdr->size < MALLOC_CLASS_CNT)
+    {
+        struct size_class *sc = &malloc_state.classes[hdr->size];
+        struct free_chunk *chunk = (struct free_chunk *) hdr;
+
+        /* Clear the magic so a double free is caught */
+        chunk->hdr.magic = 0;
+        chunk->next = sc->free_list;
+        sc->free_list = chunk;
+        sc->free_cnt++;
+        sc->in_use--;
+    }
+    else if (hdr->magic == CHUNK_MAGIC_LARGE)
+    {
+        malloc_state.large_bytes -= hdr->size;
+        malloc_state.large_cnt--;
+        munmap(hdr, hdr->size);
+    }
+    else
+    {
+        printf("free(): invalid pointer %p\n", ptr);
+        exit(134);
+    }
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    size_t total = nmemb * size;
+    if (size != 0 && total / size != nmemb)
+    {
+        return NULL;
+    }
+
+    void *ptr = malloc(total);
+    if (!ptr)
+    {
+        return NULL;
+    }
+
+    /* Fresh mappings are already zero; recycled chunks are not */
+    struct chunk_hdr *hdr = (struct chunk_hdr *) ptr - 1;
+    if (hdr->magic != CHUNK_MAGIC_LARGE)
+    {
+        memset(ptr, 0, total);
+    }
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (!ptr)
+    {
+        return malloc(size);
+    }
+
+    if (size == 0)
+    {
+        free(ptr);
+        return NULL;
+    }
+
+    struct chunk_hdr *hdr = (struct chunk_hdr *) ptr - 1;
+    size_t capacity = hdr->magic == CHUNK_MAGIC_LARGE
+                      ? hdr->size - sizeof(struct chunk_hdr)
+                      : chunk_size(hdr->size) - sizeof(struct chunk_hdr);
+
+    if (size <= capacity)
+    {
+        return ptr;
+    }
+
+    void *new_ptr = malloc(size);
+    if (!new_ptr)
+    {
+        return NULL;
+    }
+
+    memcpy(new_ptr, ptr, capacity);
+    free(ptr);
+    return new_ptr;
+}
+
+struct mallinfo mallinfo(void)
+{
+    struct mallinfo mi;
+    memset(&mi, 0, sizeof(mi));
+
+    size_t used = 0;
+    size_t free_bytes = 0;
+    for (uint32_t i = 0; i < MALLOC_CLASS_CNT; i++)
+    {
+        const struct size_class *sc = &malloc_state.classes[i];
+        used += (size_t) sc->in_use * chunk_size(i);
+        free_bytes += (size_t) sc->free_cnt * chunk_size(i);
+        mi.ordblks += (int) sc->free_cnt;
+    }
+
+    mi.arena = (int) malloc_state.arena_bytes;
+    mi.hblks = (int) malloc_state.large_cnt;
+    mi.hblkhd = (int) malloc_state.large_bytes;
+    mi.uordblks = (int) used;
+    mi.fordblks = (int) free_bytes;
+    /* Arena space not yet handed to any slab or chunk */
+    mi.keepcost = (int) (malloc_state.arena_bytes - used - free_bytes);
+    return mi;
+}
+
 int clock_gettime(clockid_t clk_id, struct timespec *tp)
 {
     return (int)__syscall2(SYS_clock_gettime,
@@ -0,0 +1,6 @@
+# Write the size of kernel.bin as a NASM define, so the boot loader reads
+# just the sectors the kernel occupies.
+#
+# usage: cmake -DKERNEL_BIN=<kernel.bin> -DOUT=<file.inc> -P kernel_size.cmake
+file(SIZE ${KERNEL_BIN} size)
+file(WRITE ${OUT} "%define KERNEL_BIN_SIZE ${size}\n")
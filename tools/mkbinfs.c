@@ -0,0 +1,261 @@
+// mkbinfs.c
+//
+// Host tool: pack the user binaries into the compressed image that the
+// kernel serves under /bin (see include/kernel/binfs.h for the layout).
+//
+// usage: mkbinfs <image> <path>=<file>...
+//
+// e.g. mkbinfs binfs.img /bin/sh=sh.elf /sbin/init=init.elf
+//
+// Blocks are compressed with a greedy single-probe LZ4 compressor: not the
+// best ratio, but a small, dependency free encoder is all the build needs.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "../include/kernel/binfs.h"
+
+#define HASH_BITS       12
+#define HASH_SIZE       (1u << HASH_BITS)
+
+/* LZ4 block format limits */
+#define MIN_MATCH       4
+#define LAST_LITERALS   5   /* the last 5 bytes are always literals */
+#define MFLIMIT         12  /* the last match starts at least 12 bytes before the end */
+
+/* Worst case size of a compressed block */
+#define BLOCK_BOUND     (BINFS_BLOCK_SIZE + BINFS_BLOCK_SIZE / 255 + 16)
+
+struct input
+{
+    const char *path;
+    const char *file;
+    uint8_t *data;
+    uint32_t size;
+};
+
+/* ------------------------------------------------------------
+ * LZ4 block compression
+ * ------------------------------------------------------------ */
+
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash32(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static uint8_t *put_length(uint8_t *out, size_t len)
+{
+    while (len >= 255)
+    {
+        *out++ = 255;
+        len -= 255;
+    }
+    *out++ = (uint8_t) len;
+    return out;
+}
+
+static uint8_t *put_sequence(uint8_t *out, const uint8_t *literals, size_t lit_len,
+                             size_t offset, size_t match_len)
+{
+    uint8_t *token = out++;
+    *token = (uint8_t) ((lit_len < 15 ? lit_len : 15) << 4);
+    if (lit_len >= 15)
+    {
+        out = put_length(out, lit_len - 15);
+    }
+    memcpy(out, literals, lit_len);
+    out += lit_len;
+
+    /* The last sequence has no match */
+    if (match_len == 0)
+    {
+        return out;
+    }
+
+    *out++ = (uint8_t) offset;
+    *out++ = (uint8_t) (offset >> 8);
+
+    size_t ml = match_len - MIN_MATCH;
+    *token |= (uint8_t) (ml < 15 ? ml : 15);
+    if (ml >= 15)
+    {
+        out = put_length(out, ml - 15);
+    }
+    return out;
+}
+
+static size_t lz4_compress(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    int32_t table[HASH_SIZE];
+    for (size_t i = 0; i < HASH_SIZE; i++)
+    {
+        table[i] = -1;
+    }
+
+    uint8_t *out = dst;
+    size_t anchor = 0;
+    size_t pos = 0;
+
+    while (len >= MFLIMIT && pos <= len - MFLIMIT)
+    {
+        uint32_t seq = read32(src + pos);
+        uint32_t h = hash32(seq);
+        int32_t cand = table[h];
+        table[h] = (int32_t) pos;
+
+        if (cand < 0 || read32(src + cand) != seq)
+        {
+            pos++;
+            continue;
+        }
+
+        size_t match_len = MIN_MATCH;
+        while (pos + match_len < len - LAST_LITERALS && src[cand + match_len] == src[pos + match_len])
+        {
+            match_len++;
+        }
+
+        out = put_sequence(out, src + anchor, pos - anchor, pos - (size_t) cand, match_len);
+        pos += match_len;
+        anchor = pos;
+    }
+
+    out = put_sequence(out, src + anchor, len - anchor, 0, 0);
+    return (size_t) (out - dst);
+}
+
+/* ------------------------------------------------------------
+ * Image
+ * ------------------------------------------------------------ */
+
+static void die(const char *msg, const char *arg)
+{
+    fprintf(stderr, "mkbinfs: %s%s\n", msg, arg ? arg : "");
+    exit(1);
+}
+
+static void read_input(struct input *in)
+{
+    FILE *f = fopen(in->file, "rb");
+    if (!f)
+    {
+        die("can't open ", in->file);
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    in->size = (uint32_t) size;
+    in->data = malloc(size > 0 ? (size_t) size : 1);
+    if (!in->data || fread(in->data, 1, (size_t) size, f) != (size_t) size)
+    {
+        die("can't read ", in->file);
+    }
+    fclose(f);
+}
+
+static int input_cmp(const void *a, const void *b)
+{
+    return strcmp(((const struct input *) a)->path, ((const struct input *) b)->path);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        die("usage: mkbinfs <image> <path>=<file>...", NULL);
+    }
+
+    uint32_t file_cnt = (uint32_t) (argc - 2);
+    struct input *inputs = calloc(file_cnt, sizeof(*inputs));
+    for (uint32_t i = 0; i < file_cnt; i++)
+    {
+        char *arg = argv[i + 2];
+        char *eq = strchr(arg, '=');
+        if (!eq)
+        {
+            die("expected <path>=<file>: ", arg);
+        }
+        *eq = '\0';
+        inputs[i].path = arg;
+        inputs[i].file = eq + 1;
+        if (strlen(arg) >= BINFS_NAME_MAX || strrchr(arg, '/') == NULL)
+        {
+            die("bad path: ", arg);
+        }
+        read_input(&inputs[i]);
+    }
+
+    /* The kernel binary searches the entries */
+    qsort(inputs, file_cnt, sizeof(*inputs), input_cmp);
+
+    struct binfs_super super = {.magic = BINFS_MAGIC, .version = BINFS_VERSION, .file_cnt = file_cnt};
+    struct binfs_entry *entries = calloc(file_cnt, sizeof(*entries));
+    for (uint32_t i = 0; i < file_cnt; i++)
+    {
+        if (i > 0 && strcmp(inputs[i - 1].path, inputs[i].path) == 0)
+        {
+            die("duplicate path: ", inputs[i].path);
+        }
+
+        strcpy(entries[i].name, inputs[i].path);
+        entries[i].base_off = (uint32_t) (strrchr(inputs[i].path, '/') + 1 - inputs[i].path);
+        entries[i].size = inputs[i].size;
+        entries[i].first_block = super.block_cnt;
+        super.block_cnt += (inputs[i].size + BINFS_BLOCK_SIZE - 1) / BINFS_BLOCK_SIZE;
+        super.raw_size += inputs[i].size;
+    }
+
+    uint32_t *block_off = calloc(super.block_cnt + 1, sizeof(uint32_t));
+    uint8_t *data = malloc((size_t) super.block_cnt * BLOCK_BOUND + 1);
+    uint32_t header_size = (uint32_t) (sizeof(super) + file_cnt * sizeof(*entries) +
+                                       (super.block_cnt + 1) * sizeof(uint32_t));
+
+    uint32_t data_size = 0;
+    uint32_t block = 0;
+    for (uint32_t i = 0; i < file_cnt; i++)
+    {
+        for (uint32_t off = 0; off < inputs[i].size; off += BINFS_BLOCK_SIZE, block++)
+        {
+            const uint8_t *raw = inputs[i].data + off;
+            size_t raw_len = inputs[i].size - off < BINFS_BLOCK_SIZE ? inputs[i].size - off : BINFS_BLOCK_SIZE;
+
+            block_off[block] = header_size + data_size;
+            size_t len = lz4_compress(raw, raw_len, data + data_size);
+            if (len >= raw_len)
+            {
+                /* Didn't shrink: store it as is */
+                memcpy(data + data_size, raw, raw_len);
+                len = raw_len;
+            }
+            data_size += (uint32_t) len;
+        }
+    }
+    block_off[block] = header_size + data_size;
+
+    FILE *out = fopen(argv[1], "wb");
+    if (!out)
+    {
+        die("can't create ", argv[1]);
+    }
+    fwrite(&super, sizeof(super), 1, out);
+    fwrite(entries, sizeof(*entries), file_cnt, out);
+    fwrite(block_off, sizeof(uint32_t), super.block_cnt + 1, out);
+    fwrite(data, 1, data_size, out);
+    if (fclose(out) != 0)
+    {
+        die("can't write ", argv[1]);
+    }
+
+    printf("mkbinfs: %u files, %u bytes packed into %u bytes\n",
+           file_cnt, super.raw_size, header_size + data_size);
+    return 0;
+}